@@ -75,6 +75,11 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+#if configUSE_TICKLESS_IDLE == 1
+	/* Sleep bound from the data acquisition timers of the platform. */
+	#include "low_power_idle.h"
+#endif
+
 #ifndef __VFP_FP__
 	#error This port can only be used when the project options are configured to enable hardware floating point support.
 #endif
@@ -185,6 +190,14 @@ static void vPortEnableVFP( void ) __attribute__ (( naked ));
  */
 static void prvTaskExitError( void );
 
+/*
+ * Sleep with the SysTick left running, until the next interrupt (low power
+ * functionality only).
+ */
+#if configUSE_TICKLESS_IDLE == 1
+	static void prvSleepUntilInterrupt( void );
+#endif /* configUSE_TICKLESS_IDLE */
+
 /*-----------------------------------------------------------*/
 
 /*
@@ -512,9 +525,35 @@ void xPortSysTickHandler( void )
 
 #if configUSE_TICKLESS_IDLE == 1
 
+	static void prvSleepUntilInterrupt( void )
+	{
+	uint32_t ulSleepStart, ulSleepEnd;
+	TickType_t xModifiableIdleTime = 1;
+
+		/* Called from vPortSuppressTicksAndSleep() with interrupts disabled
+		and the SysTick running: an interrupt ends the sleep, and its handler
+		runs once interrupts are enabled again, a few instructions later. */
+		ulSleepStart = LowPowerIdleNow();
+		configPRE_SLEEP_PROCESSING( &xModifiableIdleTime );
+		if( xModifiableIdleTime > 0 )
+		{
+			__asm volatile( "dsb" );
+			__asm volatile( "wfi" );
+			__asm volatile( "isb" );
+		}
+		configPOST_SLEEP_PROCESSING( &xModifiableIdleTime );
+		ulSleepEnd = LowPowerIdleNow();
+
+		__asm volatile( "cpsie i" );
+
+		LowPowerIdleSlept( ulSleepStart, ulSleepEnd );
+	}
+	/*-----------------------------------------------------------*/
+
 	__attribute__((weak)) void vPortSuppressTicksAndSleep( TickType_t xExpectedIdleTime )
 	{
 	uint32_t ulReloadValue, ulCompleteTickPeriods, ulCompletedSysTickDecrements, ulSysTickCTRL;
+	uint32_t ulCountsToDeadline, ulCountsToTick, ulSleepStart, ulSleepEnd;
 	TickType_t xModifiableIdleTime;
 
 		/* Make sure the SysTick reload value does not overflow the counter. */
@@ -523,21 +562,6 @@ void xPortSysTickHandler( void )
 			xExpectedIdleTime = xMaximumPossibleSuppressedTicks;
 		}
 
-		/* Stop the SysTick momentarily.  The time the SysTick is stopped for
-		is accounted for as best it can be, but using the tickless mode will
-		inevitably result in some tiny drift of the time maintained by the
-		kernel with respect to calendar time. */
-		portNVIC_SYSTICK_CTRL_REG &= ~portNVIC_SYSTICK_ENABLE_BIT;
-
-		/* Calculate the reload value required to wait xExpectedIdleTime
-		tick periods.  -1 is used because this code will execute part way
-		through one of the tick periods. */
-		ulReloadValue = portNVIC_SYSTICK_CURRENT_VALUE_REG + ( ulTimerCountsForOneTick * ( xExpectedIdleTime - 1UL ) );
-		if( ulReloadValue > ulStoppedTimerCompensation )
-		{
-			ulReloadValue -= ulStoppedTimerCompensation;
-		}
-
 		/* Enter a critical section but don't use the taskENTER_CRITICAL()
 		method as that will mask interrupts that should exit sleep mode. */
 		__asm volatile( "cpsid i" );
@@ -548,117 +572,163 @@ void xPortSysTickHandler( void )
 		to be unsuspended then abandon the low power entry. */
 		if( eTaskConfirmSleepModeStatus() == eAbortSleep )
 		{
-			/* Restart from whatever is left in the count register to complete
-			this tick period. */
-			portNVIC_SYSTICK_LOAD_REG = portNVIC_SYSTICK_CURRENT_VALUE_REG;
-
-			/* Restart SysTick. */
-			portNVIC_SYSTICK_CTRL_REG |= portNVIC_SYSTICK_ENABLE_BIT;
-
-			/* Reset the reload register to the value required for normal tick
-			periods. */
-			portNVIC_SYSTICK_LOAD_REG = ulTimerCountsForOneTick - 1UL;
-
 			/* Re-enable interrupts - see comments above the cpsid instruction()
 			above. */
 			__asm volatile( "cpsie i" );
+			return;
 		}
-		else
-		{
-			/* Set the new reload value. */
-			portNVIC_SYSTICK_LOAD_REG = ulReloadValue;
 
-			/* Clear the SysTick count flag and set the count value back to
-			zero. */
-			portNVIC_SYSTICK_CURRENT_VALUE_REG = 0UL;
-
-			/* Restart SysTick. */
-			portNVIC_SYSTICK_CTRL_REG |= portNVIC_SYSTICK_ENABLE_BIT;
-
-			/* Sleep until something happens.  configPRE_SLEEP_PROCESSING() can
-			set its parameter to 0 to indicate that its implementation contains
-			its own wait for interrupt or wait for event instruction, and so wfi
-			should not be executed again.  However, the original expected idle
-			time variable must remain unmodified, so a copy is taken. */
-			xModifiableIdleTime = xExpectedIdleTime;
-			configPRE_SLEEP_PROCESSING( &xModifiableIdleTime );
-			if( xModifiableIdleTime > 0 )
-			{
-				__asm volatile( "dsb" );
-				__asm volatile( "wfi" );
-				__asm volatile( "isb" );
-			}
-			configPOST_SLEEP_PROCESSING( &xExpectedIdleTime );
+		/* The kernel does not know about the data acquisition tick.  Its
+		interrupt must find the idle task awake, with the scheduler running,
+		or the task it releases waits for the tick count to be stepped.  So
+		the sleep ends on a tick boundary a guard time before it at the latest.
+		When no boundary is that early the core only waits for the next
+		interrupt with the SysTick running, provided that SysTick comes before
+		the guard, and otherwise does not sleep at all.  Both are read with
+		interrupts disabled, the SysTick once stopped, so no interrupt between
+		them can move the deadline; the few instructions in between are
+		within the guard. */
+		ulCountsToDeadline = LowPowerIdleCountsToDeadline( configSYSTICK_CLOCK_HZ );
 
-			/* Stop SysTick.  Again, the time the SysTick is stopped for is
-			accounted for as best it can be, but using the tickless mode will
-			inevitably result in some tiny drift of the time maintained by the
-			kernel with respect to calendar time. */
-			ulSysTickCTRL = portNVIC_SYSTICK_CTRL_REG;
-			portNVIC_SYSTICK_CTRL_REG = ( ulSysTickCTRL & ~portNVIC_SYSTICK_ENABLE_BIT );
+		/* Stop the SysTick momentarily.  The time the SysTick is stopped for
+		is accounted for as best it can be, but using the tickless mode will
+		inevitably result in some tiny drift of the time maintained by the
+		kernel with respect to calendar time. */
+		portNVIC_SYSTICK_CTRL_REG &= ~portNVIC_SYSTICK_ENABLE_BIT;
+		ulCountsToTick = portNVIC_SYSTICK_CURRENT_VALUE_REG;
 
-			/* Re-enable interrupts - see comments above the cpsid instruction()
-			above. */
-			__asm volatile( "cpsie i" );
+		if( ( ulCountsToDeadline <= ulCountsToTick ) ||
+			( ( ulCountsToDeadline - ulCountsToTick ) < ulTimerCountsForOneTick ) )
+		{
+			/* Restart from whatever is left in the count register to complete
+			this tick period. */
+			portNVIC_SYSTICK_LOAD_REG = ulCountsToTick;
+			portNVIC_SYSTICK_CTRL_REG |= portNVIC_SYSTICK_ENABLE_BIT;
+			portNVIC_SYSTICK_LOAD_REG = ulTimerCountsForOneTick - 1UL;
 
-			if( ( ulSysTickCTRL & portNVIC_SYSTICK_COUNT_FLAG_BIT ) != 0 )
+			if( ulCountsToDeadline <= ulCountsToTick )
 			{
-				uint32_t ulCalculatedLoadValue;
-
-				/* The tick interrupt has already executed, and the SysTick
-				count reloaded with ulReloadValue.  Reset the
-				portNVIC_SYSTICK_LOAD_REG with whatever remains of this tick
-				period. */
-				ulCalculatedLoadValue = ( ulTimerCountsForOneTick - 1UL ) - ( ulReloadValue - portNVIC_SYSTICK_CURRENT_VALUE_REG );
-
-				/* Don't allow a tiny value, or values that have somehow
-				underflowed because the post sleep hook did something
-				that took too long. */
-				if( ( ulCalculatedLoadValue < ulStoppedTimerCompensation ) || ( ulCalculatedLoadValue > ulTimerCountsForOneTick ) )
-				{
-					ulCalculatedLoadValue = ( ulTimerCountsForOneTick - 1UL );
-				}
-
-				portNVIC_SYSTICK_LOAD_REG = ulCalculatedLoadValue;
-
-				/* The tick interrupt handler will already have pended the tick
-				processing in the kernel.  As the pending tick will be
-				processed as soon as this function exits, the tick value
-				maintained by the tick is stepped forward by one less than the
-				time spent waiting. */
-				ulCompleteTickPeriods = xExpectedIdleTime - 1UL;
+				__asm volatile( "cpsie i" );
+				LowPowerIdleSkipped();
 			}
 			else
 			{
-				/* Something other than the tick interrupt ended the sleep.
-				Work out how long the sleep lasted rounded to complete tick
-				periods (not the ulReload value which accounted for part
-				ticks). */
-				ulCompletedSysTickDecrements = ( xExpectedIdleTime * ulTimerCountsForOneTick ) - portNVIC_SYSTICK_CURRENT_VALUE_REG;
-
-				/* How many complete tick periods passed while the processor
-				was waiting? */
-				ulCompleteTickPeriods = ulCompletedSysTickDecrements / ulTimerCountsForOneTick;
-
-				/* The reload value is set to whatever fraction of a single tick
-				period remains. */
-				portNVIC_SYSTICK_LOAD_REG = ( ( ulCompleteTickPeriods + 1UL ) * ulTimerCountsForOneTick ) - ulCompletedSysTickDecrements;
+				prvSleepUntilInterrupt();
 			}
+			return;
+		}
+		if( xExpectedIdleTime > ( ( ulCountsToDeadline - ulCountsToTick ) / ulTimerCountsForOneTick ) + 1UL )
+		{
+			xExpectedIdleTime = ( ( ulCountsToDeadline - ulCountsToTick ) / ulTimerCountsForOneTick ) + 1UL;
+		}
 
-			/* Restart SysTick so it runs from portNVIC_SYSTICK_LOAD_REG
-			again, then set portNVIC_SYSTICK_LOAD_REG back to its standard
-			value.  The critical section is used to ensure the tick interrupt
-			can only execute once in the case that the reload register is near
-			zero. */
-			portNVIC_SYSTICK_CURRENT_VALUE_REG = 0UL;
-			portENTER_CRITICAL();
+		/* Calculate the reload value required to wait xExpectedIdleTime
+		tick periods.  -1 is used because this code will execute part way
+		through one of the tick periods. */
+		ulReloadValue = ulCountsToTick + ( ulTimerCountsForOneTick * ( xExpectedIdleTime - 1UL ) );
+		if( ulReloadValue > ulStoppedTimerCompensation )
+		{
+			ulReloadValue -= ulStoppedTimerCompensation;
+		}
+
+		/* Set the new reload value. */
+		portNVIC_SYSTICK_LOAD_REG = ulReloadValue;
+
+		/* Clear the SysTick count flag and set the count value back to
+		zero. */
+		portNVIC_SYSTICK_CURRENT_VALUE_REG = 0UL;
+
+		/* Restart SysTick. */
+		portNVIC_SYSTICK_CTRL_REG |= portNVIC_SYSTICK_ENABLE_BIT;
+
+		/* Sleep until something happens.  configPRE_SLEEP_PROCESSING() can
+		set its parameter to 0 to indicate that its implementation contains
+		its own wait for interrupt or wait for event instruction, and so wfi
+		should not be executed again.  However, the original expected idle
+		time variable must remain unmodified, so a copy is taken. */
+		xModifiableIdleTime = xExpectedIdleTime;
+		ulSleepStart = LowPowerIdleNow();
+		configPRE_SLEEP_PROCESSING( &xModifiableIdleTime );
+		if( xModifiableIdleTime > 0 )
+		{
+			__asm volatile( "dsb" );
+			__asm volatile( "wfi" );
+			__asm volatile( "isb" );
+		}
+		configPOST_SLEEP_PROCESSING( &xExpectedIdleTime );
+		ulSleepEnd = LowPowerIdleNow();
+
+		/* Stop SysTick.  Again, the time the SysTick is stopped for is
+		accounted for as best it can be, but using the tickless mode will
+		inevitably result in some tiny drift of the time maintained by the
+		kernel with respect to calendar time. */
+		ulSysTickCTRL = portNVIC_SYSTICK_CTRL_REG;
+		portNVIC_SYSTICK_CTRL_REG = ( ulSysTickCTRL & ~portNVIC_SYSTICK_ENABLE_BIT );
+
+		/* Re-enable interrupts - see comments above the cpsid instruction()
+		above. */
+		__asm volatile( "cpsie i" );
+
+		if( ( ulSysTickCTRL & portNVIC_SYSTICK_COUNT_FLAG_BIT ) != 0 )
+		{
+			uint32_t ulCalculatedLoadValue;
+
+			/* The tick interrupt has already executed, and the SysTick
+			count reloaded with ulReloadValue.  Reset the
+			portNVIC_SYSTICK_LOAD_REG with whatever remains of this tick
+			period. */
+			ulCalculatedLoadValue = ( ulTimerCountsForOneTick - 1UL ) - ( ulReloadValue - portNVIC_SYSTICK_CURRENT_VALUE_REG );
+
+			/* Don't allow a tiny value, or values that have somehow
+			underflowed because the post sleep hook did something
+			that took too long. */
+			if( ( ulCalculatedLoadValue < ulStoppedTimerCompensation ) || ( ulCalculatedLoadValue > ulTimerCountsForOneTick ) )
 			{
-				portNVIC_SYSTICK_CTRL_REG |= portNVIC_SYSTICK_ENABLE_BIT;
-				vTaskStepTick( ulCompleteTickPeriods );
-				portNVIC_SYSTICK_LOAD_REG = ulTimerCountsForOneTick - 1UL;
+				ulCalculatedLoadValue = ( ulTimerCountsForOneTick - 1UL );
 			}
-			portEXIT_CRITICAL();
+
+			portNVIC_SYSTICK_LOAD_REG = ulCalculatedLoadValue;
+
+			/* The tick interrupt handler will already have pended the tick
+			processing in the kernel.  As the pending tick will be
+			processed as soon as this function exits, the tick value
+			maintained by the tick is stepped forward by one less than the
+			time spent waiting. */
+			ulCompleteTickPeriods = xExpectedIdleTime - 1UL;
+		}
+		else
+		{
+			/* Something other than the tick interrupt ended the sleep.
+			Work out how long the sleep lasted rounded to complete tick
+			periods (not the ulReload value which accounted for part
+			ticks). */
+			ulCompletedSysTickDecrements = ( xExpectedIdleTime * ulTimerCountsForOneTick ) - portNVIC_SYSTICK_CURRENT_VALUE_REG;
+
+			/* How many complete tick periods passed while the processor
+			was waiting? */
+			ulCompleteTickPeriods = ulCompletedSysTickDecrements / ulTimerCountsForOneTick;
+
+			/* The reload value is set to whatever fraction of a single tick
+			period remains. */
+			portNVIC_SYSTICK_LOAD_REG = ( ( ulCompleteTickPeriods + 1UL ) * ulTimerCountsForOneTick ) - ulCompletedSysTickDecrements;
+		}
+
+		/* Restart SysTick so it runs from portNVIC_SYSTICK_LOAD_REG
+		again, then set portNVIC_SYSTICK_LOAD_REG back to its standard
+		value.  The critical section is used to ensure the tick interrupt
+		can only execute once in the case that the reload register is near
+		zero. */
+		portNVIC_SYSTICK_CURRENT_VALUE_REG = 0UL;
+		portENTER_CRITICAL();
+		{
+			portNVIC_SYSTICK_CTRL_REG |= portNVIC_SYSTICK_ENABLE_BIT;
+			vTaskStepTick( ulCompleteTickPeriods );
+			portNVIC_SYSTICK_LOAD_REG = ulTimerCountsForOneTick - 1UL;
 		}
+		portEXIT_CRITICAL();
+
+		/* Once the SysTick runs again. */
+		LowPowerIdleSlept( ulSleepStart, ulSleepEnd );
 	}
 
 #endif /* #if configUSE_TICKLESS_IDLE */
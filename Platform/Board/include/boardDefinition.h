@@ -334,6 +334,10 @@ limitations under the License.
 #define MAG_DATA_READY_EXTI_PORT_SOURCE      EXTI_PortSourceGPIOB
 #define MAG_DATA_READY_EXTI_PIN_SOURCE       EXTI_PinSource5
 #define MAG_DATA_READY_EXTI_IRQn             EXTI9_5_IRQn
+// input capture of the data ready edge, see sensor_tstamp.c
+#define MAG_DATA_READY_PIN_SOURCE            GPIO_PinSource5
+#define MAG_DATA_READY_GPIO_AF               GPIO_AF_TIM3
+#define MAG_DATA_READY_TIM_CHANNEL           TIM_Channel_2
 
 /// I2C3 port is A8 (SCL)
 ///              C9 (SDA), accelerometer
@@ -392,6 +396,12 @@ limitations under the License.
 #define ACCEL_DATA_READY_EXTI_PORT_SOURCE      EXTI_PortSourceGPIOC
 #define ACCEL_DATA_READY_EXTI_PIN_SOURCE       EXTI_PinSource8
 #define ACCEL_DATA_READY_EXTI_IRQn             EXTI9_5_IRQn
+// input capture of the data ready edge, see sensor_tstamp.c
+#define ACCEL_DATA_READY_PIN_SOURCE            GPIO_PinSource8
+#define ACCEL_DATA_READY_GPIO_AF               GPIO_AF_TIM3
+#define ACCEL_DATA_READY_TIM_CHANNEL           TIM_Channel_3
+#define DATA_READY_CAPTURE_TIM                 TIM3      // same clock as TIM5
+#define DATA_READY_CAPTURE_TIM_CLK             RCC_APB1Periph_TIM3
 
 /// SPI1 port is: A7 (SPI1_MOSI)
 ///               A6 (SPI1_MISO)
@@ -50,6 +50,12 @@ extern void         uart_BIT(int uartType);
 extern void         uart_Pause();
 extern int          uart_bufferTx(int channel, uint8_t *data, int len);
 extern void         uart_flashTxBuffer(int channel);
+extern BOOL         uart_txReserve(int channel, int len);
+extern void         uart_txPutAt(int channel, int offset, uint8_t byte);
+extern void         uart_txCommit(int channel, int len);
+extern BOOL         uart_checkBaudRate(int channel, int baudrate);
+extern int          uart_setBaudRate(int channel, int baudrate);
+extern BOOL         uart_txIdle(int channel);
 
 #ifdef __cplusplus
 }
@@ -36,6 +36,7 @@
 #include "osapi.h"
 #include "GlobalConstants.h"
 #include "platformAPI.h"
+#include "sensor_tstamp.h"
 /** @addtogroup STM32F2xx_StdPeriph_Examples
   * @{
   */
@@ -233,9 +234,12 @@ void DebugMon_Handler(void)
 
 void EXTI1_IRQHandler(void)
 {
+	uint32_t isrEnter = TIM5->CNT;
+
 	OSEnterISR();
 	
 //	setAccelI2CBusy(BUSY);
+	SensorTstampDataReady(SENSOR_GROUP_ACCEL, isrEnter);
 	AccelerometerDataReadyIRQ();
 
 	//Clear the pending bit, write register directly
@@ -250,14 +254,18 @@ void EXTI1_IRQHandler(void)
 // Handle the magnetometer and accelerometer interrupts by checking the individual interrupt status
 void EXTI9_5_IRQHandler(void)
 {
+    uint32_t isrEnter = TIM5->CNT;  // data ready time when not captured
+
     OSEnterISR();
 
     if( EXTI_GetITStatus( ACCEL_DATA_READY_EXTI_LINE ) == SET ) {
+        SensorTstampDataReady(SENSOR_GROUP_ACCEL, isrEnter);
         AccelerometerDataReadyIRQ();
         EXTI->PR = ACCEL_DATA_READY_EXTI_LINE;  // EXTI_ClearITPendingBit(ACCEL_DATA_READY_EXTI_LINE);
     }
 
     if( EXTI_GetITStatus( MAG_DATA_READY_EXTI_LINE ) == SET ) {
+        SensorTstampDataReady(SENSOR_GROUP_MAG, isrEnter);
         MagnetomterDataReadyIRQ();
         EXTI->PR = MAG_DATA_READY_EXTI_LINE;   // EXTI_ClearITPendingBit(MAG_DATA_READY_EXTI_LINE);
     }
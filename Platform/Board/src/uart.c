@@ -37,6 +37,7 @@ limitations under the License.
 #include "BITStatus.h"
 #include "osresources.h"
 #include "platformAPI.h"
+#include "latency_probe.h"
 
 
 //extern port_struct gPort[], gPort0, gPort1, gPort2;
@@ -237,6 +238,157 @@ void uart_buf_init(port_struct   *port,
 }  /*end of COM_buf_init*/
 
 
+/// largest accepted difference between requested and generated baud rate
+#define UART_MAX_BAUD_ERROR_PERMILLE    20      // 2 %
+
+/** ****************************************************************************
+ * @name _uart_baudError
+ * @brief baud rate error the BRR register would give, computed the same way
+ *        USART_Init() programs it (including its 4 / 3 bit fraction rounding)
+ * @param [in] pclk - USART kernel clock [Hz]
+ * @param [in] baudrate - requested baud rate
+ * @param [in] over8 - TRUE for 8x oversampling, FALSE for 16x
+ * @retval error in 1/1000 of the requested rate, -1 if out of BRR range
+ ******************************************************************************/
+static int _uart_baudError(uint32_t pclk, uint32_t baudrate, BOOL over8)
+{
+    uint32_t div100;        // USARTDIV * 100
+    uint32_t mantissa;
+    uint32_t fraction;
+    uint32_t actual;
+
+    if (baudrate == 0) {
+        return -1;
+    }
+
+    div100   = over8 ? (25 * pclk) / (2 * baudrate) : (25 * pclk) / (4 * baudrate);
+    mantissa = div100 / 100;
+    if (mantissa == 0 || mantissa > 0xFFF) {
+        return -1;
+    }
+
+    if (over8) {
+        fraction = ((((div100 - 100 * mantissa) * 8) + 50) / 100) & 0x07;
+        actual   = pclk / (8 * mantissa + fraction);
+    } else {
+        fraction = ((((div100 - 100 * mantissa) * 16) + 50) / 100) & 0x0F;
+        actual   = pclk / (16 * mantissa + fraction);
+    }
+
+    return (int)(((actual > baudrate ? actual - baudrate : baudrate - actual) * 1000) / baudrate);
+}
+
+/** ****************************************************************************
+ * @name _uart_selectOversampling
+ * @brief pick the USART oversampling for a baud rate. 16x tolerates more
+ *        clock mismatch and noise, so it is used whenever it is in range;
+ *        8x doubles the reachable rate (PCLK / 8) for the Mbaud settings.
+ *        The kernel clock comes from RCC, i.e. SystemCoreClock and the APB
+ *        prescalers: USART1/6 run from PCLK2, the others from PCLK1.
+ * @param [in] uart - USART
+ * @param [in] baudrate - requested baud rate
+ * @param [out] over8 - TRUE if 8x oversampling is needed
+ * @retval TRUE if the generated rate is within UART_MAX_BAUD_ERROR_PERMILLE
+ ******************************************************************************/
+static BOOL _uart_selectOversampling(USART_TypeDef *uart, uint32_t baudrate, BOOL *over8)
+{
+    RCC_ClocksTypeDef clocks;
+    uint32_t pclk;
+    int      err16, err8;
+
+    RCC_GetClocksFreq(&clocks);
+    pclk = (uart == USART1 || uart == USART6) ? clocks.PCLK2_Frequency : clocks.PCLK1_Frequency;
+
+    err16 = _uart_baudError(pclk, baudrate, FALSE);
+    err8  = _uart_baudError(pclk, baudrate, TRUE);
+
+    if (err16 >= 0 && err16 <= UART_MAX_BAUD_ERROR_PERMILLE) {
+        *over8 = FALSE;
+        return TRUE;
+    }
+    *over8 = (BOOL)(err8 >= 0 && (err16 < 0 || err8 < err16));
+
+    return (BOOL)(err8 >= 0 && err8 <= UART_MAX_BAUD_ERROR_PERMILLE);
+}
+
+/** ****************************************************************************
+ * @name _uart_configure
+ * @brief oversampling, baud rate and frame format, 8N1 no flow control.
+ *        OVER8 has to be set before USART_Init() computes BRR.
+ * @retval TRUE if the baud rate error is acceptable
+ ******************************************************************************/
+static BOOL _uart_configure(USART_TypeDef *uart, int baudrate)
+{
+    USART_InitTypeDef USART_InitStructure;
+    BOOL over8;
+    BOOL valid;
+
+    valid = _uart_selectOversampling(uart, (uint32_t)baudrate, &over8);
+    USART_OverSampling8Cmd(uart, over8 ? ENABLE : DISABLE);
+
+    USART_InitStructure.USART_BaudRate            = baudrate;
+    USART_InitStructure.USART_WordLength          = USART_WordLength_8b;
+    USART_InitStructure.USART_StopBits            = USART_StopBits_1;
+    USART_InitStructure.USART_Parity              = USART_Parity_No;
+    USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
+    USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
+    USART_Init(uart, &USART_InitStructure);
+
+    return valid;
+}
+
+/** ****************************************************************************
+ * @name uart_checkBaudRate
+ * @brief TRUE if the channel can generate the baud rate within tolerance
+ ******************************************************************************/
+BOOL uart_checkBaudRate(int channel, int baudrate)
+{
+    BOOL over8;
+
+    if(channel < 0 || channel >= NUM_UART_PORTS){
+        return TRUE;    // no uart behind it, nothing to check
+    }
+    return _uart_selectOversampling(gUartConfig[channel].uart, (uint32_t)baudrate, &over8);
+}
+
+/** ****************************************************************************
+ * @name uart_setBaudRate
+ * @brief change the baud rate of a running channel, buffers and DMA are kept.
+ *        The caller makes sure the transmitter is idle (uart_txIdle()).
+ * @retval 0 - OK, -1 - baud rate error out of tolerance (rate still applied)
+ ******************************************************************************/
+int uart_setBaudRate(int channel, int baudrate)
+{
+    USART_TypeDef *uart;
+    BOOL          valid;
+
+    if(channel < 0 || channel >= NUM_UART_PORTS){
+        return -1;
+    }
+    uart = gUartConfig[channel].uart;
+
+    USART_Cmd(uart, DISABLE);
+    valid = _uart_configure(uart, baudrate);
+    USART_Cmd(uart, ENABLE);
+
+    return valid ? 0 : -1;
+}
+
+/** ****************************************************************************
+ * @name uart_txIdle
+ * @brief TRUE when the tx ring is empty and the last stop bit has gone out
+ ******************************************************************************/
+BOOL uart_txIdle(int channel)
+{
+    if(channel < 0 || channel >= NUM_UART_PORTS){
+        return TRUE;
+    }
+    return (BOOL)(!gPort[channel].txBusy &&
+                  gPort[channel].xmit_buf.bytes_in_buffer == 0 &&
+                  USART_GetFlagStatus(gUartConfig[channel].uart, USART_FLAG_TC) == SET);
+}
+
+
 /** ****************************************************************************
  * @name uart_init
  * @brief initializes all channels of the UART peripheral
@@ -244,7 +396,7 @@ void uart_buf_init(port_struct   *port,
  * @param [in] uartChannel - 0- USER_UART, port 1 - GPS UART, 2 - DEBUG UART
  * @param [in] *port_hw - uart_hw data structure containing fifo trigger levels
  *						and the baudrate for this port
- * @retval CN/A
+ * @retval 0 - OK, -1 - bad channel or baud rate error out of tolerance
  ******************************************************************************/
 int uart_init(int channel, int baudrate)
 {
@@ -254,9 +406,9 @@ int uart_init(int channel, int baudrate)
     const struct sUartConfig *uartConfig = &(gUartConfig[channel]);
     
     GPIO_InitTypeDef  GPIO_InitStructure;
-    USART_InitTypeDef USART_InitStructure;
     NVIC_InitTypeDef  NVIC_InitStructure;
     DMA_InitTypeDef   DMA_InitStructure;
+    BOOL              baudValid;
 
     if(channel >= NUM_UART_PORTS || channel < 0){
         return -1;
@@ -294,17 +446,11 @@ int uart_init(int channel, int baudrate)
     GPIO_PinAFConfig(uartConfig->rx.port, uartConfig->rx.source, uartConfig->rx.altFun);
 
     /** USARTx configured as follow:
-    - BaudRate = from port_hw
+    - BaudRate = from port_hw, 16x or 8x oversampling
     - Word Length = 8 Bits, one stop bit, o parity, no flow control
     - Receive and transmit enabled
     */
-    USART_InitStructure.USART_BaudRate            = baudrate;
-    USART_InitStructure.USART_WordLength          = USART_WordLength_8b;
-    USART_InitStructure.USART_StopBits            = USART_StopBits_1;
-    USART_InitStructure.USART_Parity              = USART_Parity_No;
-    USART_InitStructure.USART_HardwareFlowControl = USART_HardwareFlowControl_None;
-    USART_InitStructure.USART_Mode = USART_Mode_Rx | USART_Mode_Tx;
-    USART_Init(uartConfig->uart, &USART_InitStructure);
+    baudValid = _uart_configure(uartConfig->uart, baudrate);
     // initialize TX DMA stream 
     DMA_StructInit(&DMA_InitStructure);
     DMA_InitStructure.DMA_Channel            = uartConfig->dmaTxChannel;
@@ -338,7 +484,7 @@ int uart_init(int channel, int baudrate)
 	NVIC_InitStructure.NVIC_IRQChannelCmd                = ENABLE;
 	NVIC_Init( &NVIC_InitStructure );
 
-    return 0;
+    return baudValid ? 0 : -1;
 
 } /* end function uart_init */
 
@@ -402,6 +548,40 @@ void uart_flashTxBuffer(int channel)
 } /* end function uart_write */
 
 
+/** ****************************************************************************
+ * @name uart_txReserve / uart_txPutAt / uart_txCommit
+ * @brief zero-copy transmit: a packet encoder checks that len bytes fit in the
+ *        tx ring, writes them in place and commits them in one step, instead
+ *        of building the packet in a separate buffer for uart_write().
+ *        Only the task that owns the channel may use these.
+ ******************************************************************************/
+BOOL uart_txReserve(int channel, int len)
+{
+    if(channel == UART_CHANNEL_NONE){
+        return FALSE;
+    }
+    return COM_buf_headroom(&gPort[channel].xmit_buf) >= (unsigned int)len;
+}
+
+void uart_txPutAt(int channel, int offset, uint8_t byte)
+{
+    COM_buf_put_at(&gPort[channel].xmit_buf, (unsigned int)offset, byte);
+}
+
+void uart_txCommit(int channel, int len)
+{
+    if(channel == UART_CHANNEL_NONE){
+        return;
+    }
+    OSDisableHookIfNotInIsr();
+    COM_buf_commit(&gPort[channel].xmit_buf, (unsigned int)len);
+    if(!gPort[channel].txBusy){
+        gPort[channel].txBusy = 1;
+        USART_ITConfig( gUartConfig[channel].uart, USART_IT_TXE, ENABLE);
+    }
+    OSEnableHookIfNotInIsr();
+}
+
 int uart_read(int channel, uint8_t *data, int len)
 {
     if(channel == UART_CHANNEL_NONE){
@@ -489,8 +669,14 @@ void uart_prepare_tx(unsigned int channel, port_struct  *port)
        bytesToTx = COM_buf_prepare_dma_tx_transaction (&port->xmit_buf, &data);
        uart_dma_transmit(uartConfig, data, bytesToTx);
        port->txBusy = 1;
+       if(channel == userSerialChan){
+           LATENCY_PROBE(LATENCY_UART_TX_START);
+       }
     }else {
        port->txBusy = 0;
+       if(channel == userSerialChan){
+           LATENCY_PROBE(LATENCY_UART_TX_DONE);
+       }
     }
 }
 
@@ -52,6 +52,12 @@ enum {
 #define USER_CAN_IDE                 1
 #define USER_CAN_RTR                 0
 
+#define CAN_EXT_ID_MASK              0x1FFFFFFF
+
+// acceptance filters, all banks are assigned to CAN1
+#define CAN_FILTER_BANKS             28
+#define CAN_FILTER_MAX_SUBSCRIPTIONS 48
+
 #define CAN_BAUD_RATE_RETRY          4          // retry times for baud rate auto detection
 #define CAN_DETECT_TIME              3000       // ms, listening period at each of channels
 
@@ -59,5 +65,8 @@ extern uint32_t canRxIntCounter, canStartDetectRxIntCounter;
 
 extern void _CAN_Configure(void (*callback1)(void), void(*callback2)(void));
 extern BOOL  CAN_Detect_Baudrate(_ECU_BAUD_RATE *rate);
+extern void  CAN_Tx_Request(void);
+extern uint8_t CAN_Filter_Banks_Used(void);
+extern BOOL  CAN_Filter_Software_Fallback(void);
 
 #endif
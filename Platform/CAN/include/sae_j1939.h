@@ -108,6 +108,7 @@ typedef struct {
 // J1939 PS definition
 #define SAE_J1939_GROUP_EXTENSION_ECU                197
 #define SAE_J1939_GROUP_EXTENSION_SOFTWARE_VERSION   218
+#define SAE_J1939_GROUP_EXTENSION_COMPONENT_ID       235	// 65259 Component Identification
 #define SAE_J1939_GROUP_EXTENSION_ALGORITHM_RESET    80
 #define SAE_J1939_GROUP_EXTENSION_SAVE_CONFIGURATION 81
 #define SAE_J1939_GROUP_EXTENSION_TEST_HARDWARE      82
@@ -123,6 +124,9 @@ typedef struct {
 #define SAE_J1939_GROUP_EXTENSION_CONE_ALARM         92
 #define SAE_J1939_GROUP_EXTENSION_ACCELERATION_PARAM 93
 #define SAE_J1939_GROUP_EXTENSION_MAG_ALIGN_CMD      94
+#define SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY      95
+#define SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY_CFG  96
+#define SAE_J1939_GROUP_EXTENSION_PGN_RATE           97
 #define SAE_J1939_GROUP_EXTENSION_BANK0              240
 #define SAE_J1939_GROUP_EXTENSION_BANK1              241
 #define SAE_J1939_GROUP_EXTENSION_ADDR               254
@@ -143,6 +147,7 @@ typedef struct {
 #define SAE_J1939_POSITION_PRIORITY                  6
 #define SAE_J1939_ATTITUDE_PRIORITY                  6
 #define SAE_J1939_RUPDATE_PRIORITY                   6
+#define SAE_J1939_TELEMETRY_PRIORITY                 7
 
 // J1939 message page number, currently uses 0
 #define SAE_J1939_DATA_PAGE                          0
@@ -183,6 +188,7 @@ typedef enum {
 
 #define ACEINNA_SAE_J1939_VERSION_PACKET_LEN            6
 #define ACEINNA_SAE_J1939_ECU_PACKET_LEN                8
+#define ACEINNA_SAE_J1939_COMPONENT_ID_MAX_LEN          64
 
 #define ACEINNA_SAE_J1939_ALGO_RST_LEN                  3
 #define ACEINNA_SAE_J1939_SAVE_CONFIG_LEN               3
@@ -257,6 +263,7 @@ enum {
   ACEINNA_SAE_J1939_PACKET_ATTITUDE         =           0x80,   // Attitude
   ACEINNA_SAE_J1939_PACKET_RAPID_POSITION_UPDATE    =           0x100   // Rapid position Update
 };
+#define ACEINNA_SAE_J1939_PACKET_TYPES          9       // bits above, one periodic PGN each
  
 
 // MTLT's connection status
@@ -307,9 +314,10 @@ typedef enum {
 struct sae_j1939_tx_desc {
   SAE_J1939_PACKET_TYPE       tx_pkt_type;          // tx packet type
   uint8_t                     tx_payload_len;       // tx payload length
-  DESC_STATE                  tx_pkt_ready;         // tx state
+  DESC_STATE                  tx_pkt_ready;         // tx state, PENDING while queued
   SAE_J1939_IDENTIFIER_FIELD  tx_identifier;        // idnetifier of tx packet
   CanTxMsg                    tx_buffer;            // tx buffer
+  uint32_t                    tx_queued_at;         // TIM5 count when queued
 
   struct sae_j1939_tx_desc *next;  
 };
@@ -319,17 +327,93 @@ struct sae_j1939_tx_desc {
 #define SAE_J1939_MAX_TX_DESC             32
 #define SAE_J1939_MAX_RX_DESC             32
 
+// rx ring depth, power of two; can be raised above SAE_J1939_MAX_RX_DESC
+// from the build flags for busy buses
+#ifndef SAE_J1939_RX_RING_DEPTH
+#define SAE_J1939_RX_RING_DEPTH           SAE_J1939_MAX_RX_DESC
+#endif
+
+#if (SAE_J1939_RX_RING_DEPTH & (SAE_J1939_RX_RING_DEPTH - 1)) || (SAE_J1939_RX_RING_DEPTH > 32768)
+#error "SAE_J1939_RX_RING_DEPTH must be a power of two not above 32768"
+#endif
+
+#define SAE_J1939_RX_FIFO_NUM             2        // CAN controller rx FIFOs
+
+#if (SAE_J1939_MAX_TX_DESC & (SAE_J1939_MAX_TX_DESC - 1)) || (SAE_J1939_MAX_TX_DESC > 256)
+#error "SAE_J1939_MAX_TX_DESC must be a power of two not above 256"
+#endif
+
+// tx queues, one per J1939 priority (0 highest)
+#define SAE_J1939_PRIORITY_LEVELS         8
+#define SAE_J1939_TX_LATENCY_BINS         12       // bin n counts latencies below 64us << n, last bin the rest
+
+// TIM5 runs free at 60 MHz, tx and telemetry timestamps
+#define SAE_J1939_TIMER_TICKS_PER_US      60
+
+// bits on the wire of an extended data frame including intermission, with
+// about half the worst case stuff bits
+#define SAE_J1939_FRAME_BITS(dlc)         (67 + 8 * (dlc) + (53 + 8 * (dlc)) / 8)
+
+// indexes into ecu_tx_desc; filled by the task, drained by the tx ISR
+typedef struct {
+  uint8_t                     slot[SAE_J1939_MAX_TX_DESC];
+  volatile uint8_t            head;
+  volatile uint8_t            tail;
+} SAE_J1939_TX_QUEUE;
+
+// queued to mailbox latency per priority
+typedef struct {
+  uint32_t                    sent[SAE_J1939_PRIORITY_LEVELS];
+  uint32_t                    max_latency_us[SAE_J1939_PRIORITY_LEVELS];
+  uint32_t                    latency_hist[SAE_J1939_PRIORITY_LEVELS][SAE_J1939_TX_LATENCY_BINS];
+  uint32_t                    bits;               // SAE_J1939_FRAME_BITS of the frames sent
+  uint32_t                    mailbox_full;       // refills stopped by three busy mailboxes
+  uint32_t                    no_desc;            // frames not built, descriptor pool empty
+} SAE_J1939_TX_STATS;
+
 
 // MTLT's receive desc
 struct sae_j1939_rx_desc {
   uint8_t                     rx_pkt_len;         // rx packet length
+  uint8_t                     rx_fifo;            // controller FIFO received on
   DESC_STATE                  rx_pkt_ready;       // rx state
   SAE_J1939_IDENTIFIER_FIELD  rx_identifier;      // indentifier of rx packet
   CanRxMsg                    rx_buffer;          // rx buffer
-  
-  struct sae_j1939_rx_desc * next;
 };
 
+// MTLT's receive ring, single producer (rx ISR) / single consumer (ecu_process).
+// head and tail run free and are masked on access, head - tail is the fill level
+typedef struct {
+  struct sae_j1939_rx_desc    desc[SAE_J1939_RX_RING_DEPTH];
+  volatile uint16_t           head;               // next slot to fill, ISR only
+  volatile uint16_t           tail;               // next slot to process, task only
+  uint16_t                    high_water;         // max fill level seen
+  uint32_t                    frames;             // frames published
+  uint32_t                    bits;               // SAE_J1939_FRAME_BITS of the frames published
+  uint32_t                    overrun[SAE_J1939_RX_FIFO_NUM];     // frames dropped, ring full
+  uint32_t                    hw_overrun[SAE_J1939_RX_FIFO_NUM];  // frames lost in the controller FIFO
+} SAE_J1939_RX_RING;
+
+// PGN dispatch table, open addressing, power of two
+#define SAE_J1939_PGN_TABLE_SIZE          64
+
+// j1939_register_pgn() flags
+#define SAE_J1939_PGN_ANY_DEST            0x01     // PDU1: accept frames for any destination address
+#define SAE_J1939_PGN_IGNORE              0x02     // drop silently, handler may be NULL
+
+typedef void (*j1939_pgn_handler_t)(struct sae_j1939_rx_desc *desc);
+
+typedef struct {
+  uint32_t                    pgn;
+  j1939_pgn_handler_t         handler;
+  uint8_t                     flags;
+  uint8_t                     used;               // SAE_J1939_PGN_SLOT_*
+} SAE_J1939_PGN_ENTRY;
+
+#define SAE_J1939_PGN_SLOT_FREE           0
+#define SAE_J1939_PGN_SLOT_USED           1
+#define SAE_J1939_PGN_SLOT_REMOVED        2        // keeps the probe sequences through it
+
 // software version packet type
 typedef struct {
   SAE_J1939_IDENTIFIER_FIELD  ver_pgn;            // software version PGN
@@ -532,6 +616,17 @@ typedef struct{
 
 #define SAE_J1939_MAX_TABLE_ENTRY         128
 
+// NAME hash of the address table, open addressing at most half full
+#define SAE_J1939_NAME_HASH_BITS          8
+#define SAE_J1939_NAME_HASH_SIZE          (1 << SAE_J1939_NAME_HASH_BITS)
+
+#if (SAE_J1939_MAX_TABLE_ENTRY % 32) || (SAE_J1939_MAX_TABLE_ENTRY > 254)
+#error "SAE_J1939_MAX_TABLE_ENTRY must be a multiple of 32 below 255"
+#endif
+#if (SAE_J1939_NAME_HASH_SIZE < 2 * SAE_J1939_MAX_TABLE_ENTRY)
+#error "SAE_J1939_NAME_HASH_SIZE must be at least twice SAE_J1939_MAX_TABLE_ENTRY"
+#endif
+
 // address table
 typedef struct {
   	SAE_J1939_NAME_FIELD ecu_name;             	  // ecu's name
@@ -591,6 +686,9 @@ typedef struct {
   uint8_t orientation_ps;                   // new ps value of orientation
   uint8_t user_behavior_ps;                 // new ps value of user behavior
   uint8_t mag_align_ps;                     // new ps value of mag align command
+  uint8_t telemetry_ps;                     // ps value of the CAN telemetry PGN
+  uint8_t telemetry_period;                 // CAN telemetry period, 100 ms units, 0xFF off
+  uint8_t pgn_rate[ACEINNA_SAE_J1939_PACKET_TYPES]; // per packet type divider of 100 Hz, 0 packet_rate
 } EcuConfigurationStruct;
 
 
@@ -604,8 +702,7 @@ typedef struct {
   ECU_ADDRESS_ENTRY           * addrTbl;      // address table
   
   struct sae_j1939_tx_desc    * curr_tx_desc;               // current tx desc
-  struct sae_j1939_rx_desc    * curr_process_desc;          // current desc processed by hardware
-  struct sae_j1939_rx_desc    * curr_rx_desc;               // current rx desc
+  SAE_J1939_RX_RING           * rx_ring;                    // rx ring
   
   void                        (* init_table)(void);         // initilize address table
   void                        (* update_table)(ECU_ADDRESS_ENTRY *entry);  // update adddress table
@@ -687,14 +784,18 @@ typedef struct{
 #define ACEINNA_ECU_ADDRESS_MAX              120
 
 extern ECU_INSTANCE gEcuInst;
+extern SAE_J1939_TX_STATS ecu_tx_stats;
+extern SAE_J1939_RX_RING ecu_rx_ring;
 extern EcuConfigurationStruct gEcuConfig;
 extern EcuConfigurationStruct *gEcuConfigPtr;
 
 extern void sae_j1939_initialize(uint16_t baudRate, uint8_t address);
+extern uint32_t sae_j1939_bitrate_kbps(void);
 
 extern void initialize_mapping_table();
 extern void update_mapping_table(ECU_ADDRESS_ENTRY *);
 extern uint8_t del_ecu_mapping_table(ECU_ADDRESS_ENTRY *);
+extern ECU_ADDRESS_ENTRY * find_ecu_by_address(uint8_t);
 
 extern void sae_j1939_get_identifier(SAE_J1939_IDENTIFIER_FIELD *);
 extern void sae_j1939_set_identifier(SAE_J1939_IDENTIFIER_FIELD *);
@@ -703,6 +804,9 @@ extern uint8_t is_valid_sae_j1939_identifier(SAE_J1939_IDENTIFIER_FIELD *);
 
 extern void ecu_process(void);
 extern void ecu_transmit(void); 
+extern void ecu_tx_enqueue(struct sae_j1939_tx_desc *desc);
+extern uint8_t ecu_tx_pending(uint8_t prio);
+extern uint8_t ecu_tx_refill(void);
 
 extern uint8_t find_tx_desc(struct sae_j1939_tx_desc **);
 extern ACEINNA_J1939_PACKET_TYPE is_valid_data_packet(SAE_J1939_IDENTIFIER_FIELD *);
@@ -719,11 +823,22 @@ extern void process_request_pg(struct sae_j1939_rx_desc *);
 extern void build_request_pkt(struct sae_j1939_tx_desc *);
 extern void process_address_claim(struct sae_j1939_rx_desc *desc);
 
+extern uint32_t j1939_pgn(SAE_J1939_IDENTIFIER_FIELD *ident);
+extern uint8_t  j1939_register_pgn(uint32_t pgn, j1939_pgn_handler_t handler, uint8_t flags);
+extern void     j1939_unregister_pgn(uint32_t pgn);
+extern SAE_J1939_PGN_ENTRY *j1939_lookup_pgn(uint32_t pgn);
+extern void     aceinna_j1939_register_pgns(void);
+extern void     aceinna_j1939_register_set_pgns(void);
+
 extern void    aceinna_j1939_transmit_isr(void);
 extern void    aceinna_j1939_receive_isr(void);
+extern struct sae_j1939_rx_desc *aceinna_j1939_rx_reserve(uint8_t fifo);
+extern BOOL    aceinna_j1939_filter_route(uint32_t baseID, uint32_t baseMask, uint8_t *fifo);
+extern void    aceinna_j1939_rx_hw_overrun(uint8_t fifo);
 extern uint8_t aceinna_j1939_send_status_packet(uint8_t built_in_type, void * bit_fields);
 extern uint8_t aceinna_j1939_send_software_version(void);
 extern uint8_t aceinna_j1939_send_ecu_id(void);
+extern uint8_t aceinna_j1939_send_component_id(uint8_t dest);
 extern uint8_t aceinna_j1939_send_slope_sensor(SLOPE_SENSOR_2 * data);
 extern uint8_t aceinna_j1939_send_acceleration(ACCELERATION_SENSOR * data);
 extern uint8_t aceinna_j1939_send_angular_rate(AUGULAR_RATE * data);
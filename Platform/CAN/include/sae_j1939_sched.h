@@ -0,0 +1,86 @@
+/** ***************************************************************************
+ * @file sae_j1939_sched.h periodic data PGN scheduler
+ * @brief  Copyright (c) 2018 All Rights Reserved.
+ *
+ * Each periodic packet type (ACEINNA_SAE_J1939_PACKET_* bit) runs at its own
+ * rate, gEcuConfig.pgn_rate or packet_rate, from a phase picked so the types
+ * spread over the CAN task ticks instead of all going out on the same one.
+ * Every tick admits no more frames than the bus and the tx queue can take,
+ * the rest wait for the next tick.
+ *
+ * j1939_sched_enqueue() hands the admitted types to the application's
+ * EnqueueScheduledDataPackets(). An application that only defines the older
+ * EnqeuePeriodicDataPackets() sends all its types on a 0/1 flag: for it the
+ * types are planned on one phase and admitted together, so the flag keeps
+ * coming every packet_rate, and pgn_rate is not offered. pgn_rate is set
+ * with j1939_sched_set_rate() or a SET command on
+ * SAE_J1939_GROUP_EXTENSION_PGN_RATE.
+ *
+ * THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+ * KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ *****************************************************************************/
+#ifndef SAE_J1939_SCHED_H
+#define SAE_J1939_SCHED_H
+#include <stdint.h>
+#include "sae_j1939.h"
+#include "dacq_rate.h"
+
+// CAN task acquisition tick
+#define SAE_J1939_SCHED_TICK_HZ             DACQ_ODR_HZ
+
+// gEcuConfig.pgn_rate, dividers of 100 Hz like packet_rate
+#define SAE_J1939_SCHED_RATE_DEFAULT        0       // follow packet_rate
+#define SAE_J1939_SCHED_RATE_MAX            100     // 1 Hz
+#define SAE_J1939_SCHED_RATE_OFF            0xFF
+
+// SET command payload, PF SAE_J1939_PDU_FORMAT_GLOBAL and PS
+// SAE_J1939_GROUP_EXTENSION_PGN_RATE
+typedef struct {
+  uint8_t         dest_address;
+  uint8_t         types[2];             // ACEINNA_SAE_J1939_PACKET_* bits, little endian
+  uint8_t         rate;                 // pgn_rate of each of them
+} SAE_J1939_PGN_RATE_PAYLOAD;
+
+// share of the bus per tick the periodic PGNs may take, in percent
+#ifndef SAE_J1939_SCHED_BUS_SHARE
+#define SAE_J1939_SCHED_BUS_SHARE           50
+#endif
+
+// tx descriptors kept for responses and transport protocol frames
+#define SAE_J1939_SCHED_DESC_RESERVE        8
+
+// a periodic packet type
+typedef struct {
+  uint16_t        type;                 // ACEINNA_SAE_J1939_PACKET_* bit
+  uint16_t        period;               // in ticks, 0 off
+  uint16_t        phase;                // first due tick within the period
+  uint16_t        countdown;            // ticks to the next due
+  uint16_t        late;                 // ticks it has been waiting for admission, 0 not due
+  uint32_t        sent;
+  uint32_t        deferred;             // ticks it waited for capacity
+  uint32_t        skipped;              // still waiting when due again
+} SAE_J1939_SCHED_SLOT;
+
+typedef struct {
+  SAE_J1939_SCHED_SLOT slot[ACEINNA_SAE_J1939_PACKET_TYPES];
+  uint8_t         peak;                 // most frames of one tick in the phase plan
+  uint8_t         budget;               // bus frames per tick for the periodic PGNs
+  uint8_t         max_admitted;         // most frames admitted in one tick
+} SAE_J1939_SCHED;
+
+extern SAE_J1939_SCHED ecu_sched;
+
+extern void     j1939_sched_init(void);
+extern uint16_t j1939_sched_tick(void);
+extern uint8_t  j1939_sched_set_rate(uint16_t types, uint8_t rate);
+
+extern void     j1939_sched_enqueue(int latency, uint16_t types);
+
+// application, whichever of the two it defines
+extern void     EnqueueScheduledDataPackets(int latency, uint16_t types) __attribute__((weak));
+extern void     EnqeuePeriodicDataPackets(int latency, int sendPeriodicPackets) __attribute__((weak));
+
+#endif
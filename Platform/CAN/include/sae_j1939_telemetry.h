@@ -0,0 +1,91 @@
+/** ***************************************************************************
+ * @file sae_j1939_telemetry.h CAN bus load and error telemetry
+ * @brief  Copyright (c) 2018 All Rights Reserved.
+ *
+ * Bus utilization estimated from the frames the stack handles, controller
+ * error counters, tx mailbox and rx ring pressure, and the period jitter of
+ * the outgoing data PGNs. Collected over windows of telemetry_period and
+ * published on a proprietary B PGN and the UCB "CT" packet. The PGN is off
+ * until a SET command on SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY_CFG gives
+ * it a period.
+ *
+ * THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+ * KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ *****************************************************************************/
+#ifndef SAE_J1939_TELEMETRY_H
+#define SAE_J1939_TELEMETRY_H
+#include <stdint.h>
+#include "sae_j1939.h"
+
+// data PGNs whose timing is tracked, can be raised from the build flags
+#ifndef SAE_J1939_TELEMETRY_MAX_PGNS
+#define SAE_J1939_TELEMETRY_MAX_PGNS        8
+#endif
+
+// gEcuConfig.telemetry_period, in 100 ms units
+#define SAE_J1939_TELEMETRY_PERIOD_UNIT_MS  100
+#define SAE_J1939_TELEMETRY_PERIOD_DEFAULT  10      // 1 s
+#define SAE_J1939_TELEMETRY_PERIOD_OFF      0xFF    // no PGN, windows of the default period for UCB
+
+// SET command payload, PF SAE_J1939_PDU_FORMAT_GLOBAL and PS
+// SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY_CFG
+typedef struct {
+  uint8_t         dest_address;
+  uint8_t         telemetry_ps;         // 0 keeps the current one
+  uint8_t         telemetry_period;     // 100 ms units, 0 keeps the current one, 0xFF off
+} SAE_J1939_TELEMETRY_CFG_PAYLOAD;
+
+// byte 0 of each frame of the telemetry PGN
+#define SAE_J1939_TELEMETRY_PAGE_BUS        0       // load, error counters and state
+#define SAE_J1939_TELEMETRY_PAGE_FRAMES     1       // rx losses, mailbox and descriptor pressure
+#define SAE_J1939_TELEMETRY_PAGE_PGN        2       // first of one page per tracked PGN
+
+// controller error state
+typedef enum {
+  J1939_BUS_ERROR_ACTIVE   =   0,
+  J1939_BUS_ERROR_WARNING  =   1,      // a counter reached 96
+  J1939_BUS_ERROR_PASSIVE  =   2,      // a counter above 127
+  J1939_BUS_OFF            =   3
+} J1939_BUS_STATE;
+
+// timing of one outgoing data PGN over a window
+typedef struct {
+  uint32_t        pgn;
+  uint16_t        sent;
+  uint32_t        queue_jitter_us;      // max - min interval between queueing, our scheduling
+  uint32_t        tx_jitter_us;         // max - min interval between mailbox loads, what the bus sees
+  uint32_t        max_wait_us;          // queued to mailbox
+} SAE_J1939_PGN_TIMING;
+
+// one window, counts are for the window only
+typedef struct {
+  uint32_t        window_ms;
+  uint16_t        load_permille;        // of the frames the stack sent and accepted
+  uint8_t         tec;                  // at the end of the window
+  uint8_t         rec;
+  uint8_t         tec_max;
+  uint8_t         rec_max;
+  uint8_t         state;                // J1939_BUS_STATE, worst seen
+  uint8_t         lec;                  // last error code, 0 none
+  uint16_t        bus_off;              // bus-off entries seen
+  uint32_t        rx_frames;
+  uint32_t        tx_frames;
+  uint32_t        rx_lost;              // rx ring full
+  uint32_t        rx_hw_lost;           // controller FIFO overruns
+  uint32_t        mailbox_full;
+  uint32_t        tx_no_desc;           // frames not built, descriptor pool empty
+  uint16_t        rx_high_water;        // since start
+  uint8_t         pgns;
+  SAE_J1939_PGN_TIMING pgn[SAE_J1939_TELEMETRY_MAX_PGNS];
+} SAE_J1939_TELEMETRY;
+
+extern void    j1939_telemetry_init(void);
+extern void    j1939_telemetry_process(void);
+extern void    j1939_telemetry_tx(struct sae_j1939_tx_desc *desc, uint32_t now);
+extern uint8_t j1939_telemetry_get(SAE_J1939_TELEMETRY *out);
+extern uint8_t j1939_telemetry_set_ps(uint8_t ps);
+
+#endif
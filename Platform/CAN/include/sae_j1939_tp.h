@@ -0,0 +1,107 @@
+/** ***************************************************************************
+ * @file sae_j1939_tp.h SAE J1939-21 transport protocol
+ * @brief  Copyright (c) 2018 All Rights Reserved.
+ *
+ * Multi-packet messages up to SAE_J1939_TP_MAX_SIZE bytes: BAM broadcast and
+ * connection mode (RTS/CTS) in both directions, driven from the CAN task.
+ *
+ * THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+ * KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ *****************************************************************************/
+#ifndef SAE_J1939_TP_H
+#define SAE_J1939_TP_H
+#include <stdint.h>
+#include "sae_j1939.h"
+#include "dacq_rate.h"
+
+// transport protocol PGNs
+#define SAE_J1939_PDU_FORMAT_TP_CM          236     // connection management
+#define SAE_J1939_PDU_FORMAT_TP_DT          235     // data transfer
+#define SAE_J1939_TP_PRIORITY               7
+
+// TP.CM control bytes
+#define SAE_J1939_TP_CM_RTS                 16
+#define SAE_J1939_TP_CM_CTS                 17
+#define SAE_J1939_TP_CM_EOM_ACK             19
+#define SAE_J1939_TP_CM_BAM                 32
+#define SAE_J1939_TP_CM_ABORT               255
+
+// abort reasons
+#define SAE_J1939_TP_ABORT_BUSY             1       // already in a session
+#define SAE_J1939_TP_ABORT_RESOURCES        2       // no buffer / too long
+#define SAE_J1939_TP_ABORT_TIMEOUT          3
+
+// sessions and reassembly buffers, can be raised from the build flags
+#ifndef SAE_J1939_TP_MAX_SESSIONS
+#define SAE_J1939_TP_MAX_SESSIONS           4
+#endif
+#ifndef SAE_J1939_TP_MAX_SIZE
+#define SAE_J1939_TP_MAX_SIZE               256     // protocol limit is 1785
+#endif
+
+#define SAE_J1939_TP_PACKET_LEN             7       // data bytes per TP.DT
+#define SAE_J1939_TP_CTS_PACKETS            8       // packets granted per CTS
+
+// pacing: j1939_tp_process() runs once per CAN task acquisition tick
+#define SAE_J1939_TP_TICK_US                DACQ_TICK_US
+#define SAE_J1939_TP_DT_PER_TICK            2       // connection mode frames per wakeup
+#define SAE_J1939_TP_BAM_INTERVAL_MS        50      // J1939-21: 50..200 ms
+
+// J1939-21 timeouts, ms
+#define SAE_J1939_TP_TR                     200
+#define SAE_J1939_TP_TH                     500
+#define SAE_J1939_TP_T1                     750
+#define SAE_J1939_TP_T2                     1250
+#define SAE_J1939_TP_T3                     1250
+#define SAE_J1939_TP_T4                     1050
+
+typedef enum {
+  J1939_TP_IDLE            =   0,
+  J1939_TP_RX_BAM          =   1,      // receiving broadcast
+  J1939_TP_RX_CMDT         =   2,      // receiving, CTS window open
+  J1939_TP_TX_BAM          =   3,      // broadcasting
+  J1939_TP_TX_WAIT_CTS     =   4,      // RTS or last window sent
+  J1939_TP_TX_CMDT         =   5,      // sending a CTS window
+  J1939_TP_TX_WAIT_ACK     =   6       // all data sent, waiting for EOM
+} J1939_TP_STATE;
+
+typedef struct {
+  J1939_TP_STATE  state;
+  uint8_t         peer;                 // other node, 0xFF for BAM
+  uint8_t         priority;
+  uint32_t        pgn;
+  uint16_t        size;
+  uint8_t         packets;              // total TP.DT packets
+  uint16_t        next;                 // next sequence number, 256 once all 255 are done
+  uint16_t        window_end;           // last sequence of the current CTS window
+  uint8_t         max_per_cts;          // limit from the peer's RTS, 0xFF none
+  int32_t         timer;                // us to timeout or to the next BAM packet
+  const uint8_t   *tx_data;             // caller's buffer, not copied
+  uint8_t         *rx_data;             // reassembly buffer of the session
+} SAE_J1939_TP_SESSION;
+
+// completed incoming message, data valid during the call only
+typedef void (*j1939_tp_rx_handler_t)(uint32_t pgn, uint8_t source, const uint8_t *data, uint16_t len);
+
+typedef struct {
+  uint32_t        rx_done;
+  uint32_t        tx_done;
+  uint32_t        aborts;               // sent or received
+  uint32_t        timeouts;
+  uint32_t        rejected;             // RTS/BAM we had no session or buffer for
+} SAE_J1939_TP_STATS;
+
+extern SAE_J1939_TP_STATS j1939TpStats;
+
+extern void    j1939_tp_init(void);
+extern void    j1939_tp_set_rx_handler(j1939_tp_rx_handler_t handler);
+extern uint8_t j1939_tp_send(uint32_t pgn, uint8_t priority, uint8_t dest, const uint8_t *data, uint16_t len);
+extern uint8_t j1939_tp_tx_pending(const uint8_t *data);
+extern uint8_t j1939_tp_tx_window_open(void);
+extern void    j1939_tp_process(void);
+extern void    j1939_tp_pump(void);
+
+#endif
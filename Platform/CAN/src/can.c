@@ -13,6 +13,7 @@
 #if defined(DBC_FILE) || defined(SAE_J1939)
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "sae_j1939.h"
 #include "GlobalConstants.h"
@@ -22,6 +23,7 @@
 #include "boardDefinition.h"
 #include "osapi.h"
 #include "UserConfiguration.h"
+#include "latency_probe.h"
 #include "canAPI.h"
 
 void (*gCANTxCompleteCallback)(void) = NULL;    // callback function pointer of CAN transmit 
@@ -31,7 +33,18 @@ int     gCANSleep = FALSE;                      // CAN interface sleep variable
 uint32_t canRxIntCounter = 0;                   // counter of CAN receiver
 uint32_t canStartDetectRxIntCounter = 0;        // counter of CAN receiver for auto detection
 CAN_FilterInitTypeDef FILTER_InitStructure;
-int filterNum = 1;
+
+// PGN subscriptions, programmed into the filter banks by _CAN_Activate_Filters()
+typedef struct {
+  uint32_t id;                                  // 29-bit identifier
+  uint32_t mask;                                // 29-bit mask, 1 = must match
+  uint8_t  fifo;                                // CAN_Filter_FIFO0/1
+} CAN_SUBSCRIPTION;
+
+static CAN_SUBSCRIPTION canSubscription[CAN_FILTER_MAX_SUBSCRIPTIONS];
+static int     canNumSubscriptions = 0;
+static uint8_t canFilterBanksUsed  = 0;
+static BOOL    canFilterSoftware   = FALSE;     // banks ran out, some masks were widened
 
 /** ***************************************************************************
  * @name get_can_sleep() check CAN interface sleep
@@ -239,7 +252,7 @@ uint8_t _CAN_Init(CAN_TypeDef* CANx, uint8_t mode, int baudRate)
 
 /** ***************************************************************************
  * @name_CAN_Init_Filter_Engine () CAN's filter initialization
- * @brief Performs the filter of CAN interface 
+ * @brief Performs the filter of CAN interface, clears the subscription table
  *
  * @param [in]
  *         
@@ -252,27 +265,184 @@ void _CAN_Init_Filter_Config_Structure(void)
   FILTER_InitStructure.CAN_FilterMode           = CAN_FilterMode_IdMask;
   FILTER_InitStructure.CAN_FilterScale          = CAN_FilterScale_32bit;
   FILTER_InitStructure.CAN_FilterActivation     = ENABLE;
+  
+  canNumSubscriptions = 0;
+  canFilterSoftware   = FALSE;
+}
+
+/** ***************************************************************************
+ * @name SubscribeCANMessage() add an identifier/mask pair to the hardware filters
+ * @brief Only frames matching a subscription reach the rx interrupt. Takes
+ *        effect with the next _CAN_Activate_Filters()
+ *
+ * @param [in] baseID, 29-bit identifier
+ *             baseMask, 29-bit mask, set bits must match baseID
+ *             fifo, CAN_Filter_FIFO0 for high rate data, CAN_Filter_FIFO1 for
+ *                   address claim and configuration traffic
+ * @retval TRUE or FALSE if the subscription table is full
+ ******************************************************************************/
+BOOL SubscribeCANMessage(uint32_t baseID, uint32_t baseMask, uint8_t fifo)
+{
+  CAN_SUBSCRIPTION *sub;
+  
+  if (canNumSubscriptions >= CAN_FILTER_MAX_SUBSCRIPTIONS) {
+    return FALSE;
+  }
+  
+  sub = &canSubscription[canNumSubscriptions++];
+  sub->mask = baseMask & CAN_EXT_ID_MASK;
+  sub->id   = baseID & sub->mask;
+  sub->fifo = (fifo == CAN_Filter_FIFO1) ? CAN_Filter_FIFO1 : CAN_Filter_FIFO0;
+  
+  return TRUE;
 }
 
 void ConfigureCANMessageFilter(uint32_t baseID, uint32_t baseMask)
 {
-    uint32_t mask;
-    uint32_t filtr;
-  // initialize filter ECU ID
-    filtr = (baseID   << 3 ) | (USER_CAN_IDE << 2) | (USER_CAN_RTR << 1);
-    mask  = (baseMask << 3 ) | (USER_CAN_IDE << 2) | (USER_CAN_RTR << 1);
-  FILTER_InitStructure.CAN_FilterIdHigh     =  filtr >> 16;
-  FILTER_InitStructure.CAN_FilterIdLow      =  filtr;
-  FILTER_InitStructure.CAN_FilterMaskIdHigh =  mask >> 16;
-  FILTER_InitStructure.CAN_FilterMaskIdLow  =  mask;
-    FILTER_InitStructure.CAN_FilterNumber     =  filterNum++;
+  uint8_t fifo = CAN_Filter_FIFO0;
+  
+#ifdef SAE_J1939
+  // route by PGN, frames the stack always ignores are not subscribed at all
+  if (!aceinna_j1939_filter_route(baseID, baseMask, &fifo)) {
+    return;
+  }
+#endif
+  
+  SubscribeCANMessage(baseID, baseMask, fifo);
+}
+
+/// 32-bit filter register layout: STID/EXID in [31:3], IDE [2], RTR [1]
+static void _CAN_Program_Bank(uint8_t bank, uint8_t fifo, uint8_t mode, uint32_t r1, uint32_t r2)
+{
+  FILTER_InitStructure.CAN_FilterNumber         = bank;
+  FILTER_InitStructure.CAN_FilterFIFOAssignment = fifo;
+  FILTER_InitStructure.CAN_FilterMode           = mode;
+  FILTER_InitStructure.CAN_FilterIdHigh         = r1 >> 16;
+  FILTER_InitStructure.CAN_FilterIdLow          = r1;
+  FILTER_InitStructure.CAN_FilterMaskIdHigh     = r2 >> 16;
+  FILTER_InitStructure.CAN_FilterMaskIdLow      = r2;
+  FILTER_InitStructure.CAN_FilterActivation     = ENABLE;
   CAN_FilterInit(&FILTER_InitStructure);
+}
 
+static uint32_t _CAN_Filter_Reg(uint32_t id)
+{
+  return (id << 3) | (USER_CAN_IDE << 2) | (USER_CAN_RTR << 1);
+}
+
+/** ***************************************************************************
+ * @name _CAN_Allocate_Fifo() program the banks for one FIFO
+ * @brief exact identifiers are paired into list mode banks, the rest take a
+ *        mask mode bank each. When the banks run out, the remaining entries
+ *        share the last bank with a mask widened to cover all of them and
+ *        are classified in software.
+ *
+ * @param [in] fifo, CAN_Filter_FIFO0/1
+ *             bank, first free bank
+ *             banks, number of banks this FIFO may use
+ * @retval next free bank
+ ******************************************************************************/
+static uint8_t _CAN_Allocate_Fifo(uint8_t fifo, uint8_t bank, uint8_t banks)
+{
+  CAN_SUBSCRIPTION *exact[CAN_FILTER_MAX_SUBSCRIPTIONS];
+  CAN_SUBSCRIPTION *masked[CAN_FILTER_MAX_SUBSCRIPTIONS];
+  int      numExact = 0, numMasked = 0, direct, i, j;
+  uint32_t id, mask;
+  
+  for (i = 0; i < canNumSubscriptions; i++) {
+    if (canSubscription[i].fifo != fifo) {
+      continue;
+    }
+    if (canSubscription[i].mask == CAN_EXT_ID_MASK) {
+      exact[numExact++] = &canSubscription[i];
+    } else {
+      masked[numMasked++] = &canSubscription[i];
+    }
+  }
+  
+  if (numExact + numMasked == 0 || banks == 0) {
+    return bank;
+  }
+  
+  // banks programmed one to one, the last one is kept for the widened mask
+  direct = numMasked + (numExact + 1) / 2;
+  if (direct > banks) {
+    direct = banks - 1;
+  }
+  
+  // masks first, they are usually the wide and busy ones
+  for (i = 0; i < numMasked && direct > 0; i++, direct--) {
+    _CAN_Program_Bank(bank++, fifo, CAN_FilterMode_IdMask,
+                      _CAN_Filter_Reg(masked[i]->id), _CAN_Filter_Reg(masked[i]->mask));
+  }
+  
+  for (j = 0; j < numExact && direct > 0; j += 2, direct--) {
+    CAN_SUBSCRIPTION *second = (j + 1 < numExact) ? exact[j + 1] : exact[j];
+    _CAN_Program_Bank(bank++, fifo, CAN_FilterMode_IdList,
+                      _CAN_Filter_Reg(exact[j]->id), _CAN_Filter_Reg(second->id));
+  }
+  
+  // out of banks - one widened mask over everything left
+  if (i < numMasked || j < numExact) {
+    id   = (i < numMasked) ? masked[i]->id : exact[j]->id;
+    mask = CAN_EXT_ID_MASK;
+    for (; i < numMasked; i++) {
+      mask &= masked[i]->mask & ~(masked[i]->id ^ id);
+    }
+    for (; j < numExact; j++) {
+      mask &= exact[j]->mask & ~(exact[j]->id ^ id);
+    }
+    _CAN_Program_Bank(bank++, fifo, CAN_FilterMode_IdMask,
+                      _CAN_Filter_Reg(id & mask), _CAN_Filter_Reg(mask));
+    canFilterSoftware = TRUE;
+  }
+  
+  return bank;
 }
 
+/** ***************************************************************************
+ * @name _CAN_Activate_Filters() program the subscription table into the banks
+ * @brief All CAN_FILTER_BANKS banks belong to CAN1. Configuration and address
+ *        claim (FIFO1) are allocated first so they never end up in a widened
+ *        bank; banks left unused are deactivated.
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
 void _CAN_Activate_Filters()
 {
-  CAN_SlaveStartBank(28);
+  uint8_t bank = 0;
+  uint8_t reserve = 0;
+  int     i;
+  
+  CAN_SlaveStartBank(CAN_FILTER_BANKS);
+  
+  for (i = 0; i < canNumSubscriptions; i++) {
+    if (canSubscription[i].fifo == CAN_Filter_FIFO0) {
+      reserve = 1;
+      break;
+    }
+  }
+  
+  bank = _CAN_Allocate_Fifo(CAN_Filter_FIFO1, bank, CAN_FILTER_BANKS - reserve);
+  bank = _CAN_Allocate_Fifo(CAN_Filter_FIFO0, bank, CAN_FILTER_BANKS - bank);
+  canFilterBanksUsed = bank;
+  
+  for (; bank < CAN_FILTER_BANKS; bank++) {
+    FILTER_InitStructure.CAN_FilterNumber     = bank;
+    FILTER_InitStructure.CAN_FilterActivation = DISABLE;
+    CAN_FilterInit(&FILTER_InitStructure);
+  }
+}
+
+uint8_t CAN_Filter_Banks_Used(void)
+{
+  return canFilterBanksUsed;
+}
+
+BOOL CAN_Filter_Software_Fallback(void)
+{
+  return canFilterSoftware;
 }
 
 
@@ -358,15 +528,74 @@ void CAN1_TX_IRQHandler(void)
   ItRslt = CAN_GetITStatus(CAN1, CAN_IT_TME);
   
   if(ItRslt == SET) {
-    gCANTxCompleteCallback();
     CAN_ClearITPendingBit(CAN1, CAN_IT_TME);
   }
   
+  // mailbox done or CAN_Tx_Request(), refill all free mailboxes
+  if (gCANTxCompleteCallback != NULL) {
+    gCANTxCompleteCallback();
+  }
+  
+  // after the refill all mailboxes are empty only if the queues are drained
+  if ((CAN1->TSR & (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)) !=
+      (CAN_TSR_TME0 | CAN_TSR_TME1 | CAN_TSR_TME2)) {
+    LATENCY_PROBE(LATENCY_CAN_TX_START);
+  } else {
+    LATENCY_PROBE(LATENCY_CAN_TX_DONE);
+  }
+  
   OSExitISR();
   
   return;
 }
 
+/** ***************************************************************************
+ * @name CAN_Tx_Request() run the CAN1 tx handler from task context
+ * @brief pends CAN1_TX_IRQn so frames queued while all mailboxes are idle
+ *        go out without waiting for a tx completion
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void CAN_Tx_Request(void)
+{
+  NVIC_SetPendingIRQ(CAN1_TX_IRQn);
+}
+
+#if defined(SAE_J1939) || defined(FL)
+/** ***************************************************************************
+ * @name _CAN_ReceiveFifo() drain one controller rx FIFO into the J1939 rx ring
+ * @brief frames that don't fit the ring are released unread and counted.
+ *        CAN_Receive() releases the FIFO output mailbox itself.
+ *
+ * @param [in] CANx, where x can be 1 or 2 to select the CAN peripheral.
+ *             fifo, CAN_FIFO0 or CAN_FIFO1
+ * @retval N/A
+ ******************************************************************************/
+static void _CAN_ReceiveFifo(CAN_TypeDef* CANx, uint8_t fifo)
+{
+  struct sae_j1939_rx_desc *desc;
+  uint8_t fifoPending = CAN_MessagePending(CANx, fifo);
+  uint32_t overrunFlag = (fifo == CAN_FIFO0) ? CAN_FLAG_FOV0 : CAN_FLAG_FOV1;
+  
+  while (fifoPending > 0) {
+    desc = aceinna_j1939_rx_reserve(fifo);
+    if (desc != NULL) {
+      CAN_Receive(CANx, fifo, &desc->rx_buffer);
+      gCANRxCompleteCallback();
+    } else {
+      CAN_FIFORelease(CANx, fifo);
+    }
+    fifoPending--;
+  }
+  
+  if (CAN_GetFlagStatus(CANx, overrunFlag) == SET) {
+    aceinna_j1939_rx_hw_overrun(fifo);
+    CAN_ClearFlag(CANx, overrunFlag);
+  }
+}
+#endif
+
 /** ***************************************************************************
  * @name CAN1_RX0_IRQHandler CAN1 receive buffer 0 IRQ handler
  * @brief Handle receiving interrupt of CAN1 buffer 0
@@ -378,20 +607,13 @@ void CAN1_RX0_IRQHandler(void)
 {
 #ifdef SAE_J1939
   ITStatus ItRslt;
-  uint8_t fifoPending;
     
 	OSEnterISR();
   
   canRxIntCounter++;
   ItRslt =  CAN_GetITStatus(CAN1, CAN_IT_FMP0);
   if (ItRslt == SET) {
-    fifoPending = CAN_MessagePending(CAN1, 0);
-    do {
-        CAN_Receive(CAN1, 0, &(gEcuInst.curr_rx_desc->rx_buffer));
-        gCANRxCompleteCallback();
-        CAN_FIFORelease(CAN1, 0);
-        fifoPending--;
-    } while (fifoPending > 0);
+    _CAN_ReceiveFifo(CAN1, CAN_FIFO0);
     
     CAN_ClearITPendingBit(CAN1, CAN_IT_FF0);
   }
@@ -413,19 +635,12 @@ void CAN1_RX1_IRQHandler(void)
 {
 #ifdef SAE_J1939
   ITStatus ItRslt;
-  uint8_t fifoPending;
   
 	OSEnterISR();
   
   ItRslt =  CAN_GetITStatus(CAN1, CAN_IT_FMP1);
   if (ItRslt == SET) {
-    fifoPending = CAN_MessagePending(CAN1, 1);
-    do {
-        CAN_Receive(CAN1, 1, &(gEcuInst.curr_rx_desc->rx_buffer));
-        CAN_FIFORelease(CAN1, 1);
-        gCANRxCompleteCallback();
-        fifoPending--;
-    } while (fifoPending > 0);
+    _CAN_ReceiveFifo(CAN1, CAN_FIFO1);
     
     CAN_ClearITPendingBit(CAN1, CAN_IT_FF1);
   }
@@ -473,19 +688,12 @@ void CAN2_RX0_IRQHandler(void)
 {
 #ifdef FL
   ITStatus ItRslt;
-  uint8_t fifoPending;
     
   OSDisableHook();
   
   ItRslt =  CAN_GetITStatus(CAN2, CAN_IT_FMP0);
   if (ItRslt == SET) {
-    fifoPending = CAN_MessagePending(CAN2, 0);
-    do {
-        CAN_Receive(CAN2, 0, &(gEcuInst.curr_rx_desc->rx_buffer));
-        CAN_FIFORelease(CAN2, 0);
-        gCANRxCompleteCallback();
-        fifoPending--;
-    } while (fifoPending > 0);
+    _CAN_ReceiveFifo(CAN2, CAN_FIFO0);
     
     CAN_ClearITPendingBit(CAN2, CAN_IT_FF0);
   }
@@ -508,19 +716,12 @@ void CAN2_RX1_IRQHandler(void)
 {
 #ifdef FL
   ITStatus ItRslt;
-  uint8_t fifoPending;
   
   OSDisableHook();
   
   ItRslt =  CAN_GetITStatus(CAN2, CAN_IT_FMP1);
   if (ItRslt == SET) {
-    fifoPending = CAN_MessagePending(CAN2, 1);
-    do {
-        CAN_Receive(CAN2, 1, &(gEcuInst.curr_rx_desc->rx_buffer));
-        CAN_FIFORelease(CAN2, 1);
-        gCANRxCompleteCallback();
-        fifoPending--;
-    } while (fifoPending > 0);
+    _CAN_ReceiveFifo(CAN2, CAN_FIFO1);
     
     CAN_ClearITPendingBit(CAN2, CAN_IT_FF1);
   }
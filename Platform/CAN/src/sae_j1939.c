@@ -19,6 +19,9 @@
 #include "osapi.h"
 #include "can.h"
 #include "sae_j1939.h"
+#include "sae_j1939_tp.h"
+#include "sae_j1939_telemetry.h"
+#include "sae_j1939_sched.h"
 
 //#define DEMO_PROTO 1
 
@@ -31,13 +34,130 @@ ECU_ADDRESS_ENTRY      *gAddrMapTblPtr = &addrMappingTable[0];
 EcuConfigurationStruct *gEcuConfigPtr  = &gEcuConfig;
 
 struct sae_j1939_tx_desc ecu_tx_desc[SAE_J1939_MAX_TX_DESC];
-struct sae_j1939_rx_desc ecu_rx_desc[SAE_J1939_MAX_RX_DESC];
+SAE_J1939_RX_RING        ecu_rx_ring;
 
 #define SAE_J1939_TX_THRESHOLD                     16
 #define SAE_J1939_MAX_IDLE_TIME                    1000000    //ms
 
-static ACEINNA_ECU_ADDR ecu_pool[ACEINNA_ECU_ADDRESS_MAX];
+// address pool 128..247, a set bit is a free address
+static uint32_t ecu_pool_free[(ACEINNA_ECU_ADDRESS_MAX + 31) / 32];
 
+// constant time lookups into addrMappingTable, slots hold entry index + 1
+static uint8_t  addr_index[256];                        // by source address
+static uint8_t  name_index[SAE_J1939_NAME_HASH_SIZE];   // by NAME, linear probing
+static uint32_t tbl_free[SAE_J1939_MAX_TABLE_ENTRY / 32];  // set bit = idle entry
+
+static SAE_J1939_PGN_ENTRY pgn_table[SAE_J1939_PGN_TABLE_SIZE];
+
+static SAE_J1939_TX_QUEUE ecu_tx_queue[SAE_J1939_PRIORITY_LEVELS];
+SAE_J1939_TX_STATS        ecu_tx_stats;
+
+// TIM5 runs free at 60 MHz, see platformGetCurrTimeStamp()
+#define TX_TIMER_COUNT()          (TIM5->CNT)
+#define TX_TIMER_TICKS_PER_US     SAE_J1939_TIMER_TICKS_PER_US
+
+
+/** ***************************************************************************
+ * @name _bitmap_take() take the lowest set bit of a bitmap
+ * @brief  clears the bit, bounded by the bitmap size
+ *
+ * @param [in] map, bitmap words
+ *             words, number of words
+ * @retval bit index or -1 if none set
+ ******************************************************************************/
+static int _bitmap_take(uint32_t *map, int words)
+{
+  int w, bit;
+  
+  for (w = 0; w < words; w++) {
+    if (map[w]) {
+      bit = __CLZ(__RBIT(map[w]));
+      map[w] &= ~(1u << bit);
+      return (w << 5) + bit;
+    }
+  }
+  
+  return -1;
+}
+
+/** ***************************************************************************
+ * @name _name_hash() home slot of a NAME in name_index
+ * @brief  folds the 64-bit NAME and applies a Fibonacci hash
+ *
+ * @param [in] name, ecu's name
+ * @retval slot
+ ******************************************************************************/
+static uint32_t _name_hash(uint64_t name)
+{
+  uint32_t folded = (uint32_t)name ^ (uint32_t)(name >> 32);
+  
+  return (folded * 2654435769u) >> (32 - SAE_J1939_NAME_HASH_BITS);
+}
+
+/** ***************************************************************************
+ * @name _name_slot() find a NAME in name_index
+ * @brief  probes until the NAME or an empty slot is found
+ *
+ * @param [in] name, ecu's name
+ * @retval slot holding the NAME, or the empty slot it would go in
+ ******************************************************************************/
+static uint32_t _name_slot(uint64_t name)
+{
+  uint32_t slot = _name_hash(name);
+  
+  while (name_index[slot] &&
+         gAddrMapTblPtr[name_index[slot] - 1].ecu_name.words != name)
+    slot = (slot + 1) & (SAE_J1939_NAME_HASH_SIZE - 1);
+  
+  return slot;
+}
+
+/** ***************************************************************************
+ * @name _name_remove() remove a slot from name_index
+ * @brief  backward shift deletion, keeps probe chains intact without tombstones
+ *
+ * @param [in] slot, occupied slot
+ * @retval N/A
+ ******************************************************************************/
+static void _name_remove(uint32_t slot)
+{
+  uint32_t next = slot, home;
+  
+  while (1) {
+    next = (next + 1) & (SAE_J1939_NAME_HASH_SIZE - 1);
+    if (!name_index[next])
+      break;
+    
+    // move it back unless its home lies cyclically in (slot, next]
+    home = _name_hash(gAddrMapTblPtr[name_index[next] - 1].ecu_name.words);
+    if (((next - home) & (SAE_J1939_NAME_HASH_SIZE - 1)) >=
+        ((next - slot) & (SAE_J1939_NAME_HASH_SIZE - 1))) {
+      name_index[slot] = name_index[next];
+      slot = next;
+    }
+  }
+  
+  name_index[slot] = 0;
+}
+
+/** ***************************************************************************
+ * @name _set_entry_addr() change the address of a table entry
+ * @brief  keeps addr_index pointing at the latest claimant of an address
+ *
+ * @param [in] addrTbl, table entry
+ *             addr, new address
+ * @retval N/A
+ ******************************************************************************/
+static void _set_entry_addr(ECU_ADDRESS_ENTRY *addrTbl, uint8_t addr)
+{
+  uint8_t idx = (uint8_t)(addrTbl - gAddrMapTblPtr) + 1;
+  
+  if (addr_index[addrTbl->address] == idx)
+    addr_index[addrTbl->address] = 0;
+  
+  addrTbl->address = addr;
+  addr_index[addr] = idx;
+}
 
 /** ***************************************************************************
  * @name add_ecu_mapping_table() add an entry in address pool
@@ -50,20 +170,22 @@ static ACEINNA_ECU_ADDR ecu_pool[ACEINNA_ECU_ADDRESS_MAX];
 uint8_t add_ecu_mapping_table(uint8_t addr, SAE_J1939_NAME_FIELD name) 
 {
   int i;
-  ECU_ADDRESS_ENTRY *addrTbl =  gAddrMapTblPtr;
+  uint32_t slot;
+  ECU_ADDRESS_ENTRY *addrTbl;
   
-  for ( i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
-    if (addrTbl->status == _ECU_IDLE){
-      break;
-    }
-    addrTbl++;
-  }
+  slot = _name_slot(name.words);
+  if (name_index[slot])
+    return 0;
   
-  if ( i == SAE_J1939_MAX_TABLE_ENTRY)
+  i = _bitmap_take(tbl_free, SAE_J1939_MAX_TABLE_ENTRY / 32);
+  if (i < 0)
     return 0;
   
+  addrTbl = gAddrMapTblPtr + i;
+  name_index[slot] = (uint8_t)(i + 1);
+  
   addrTbl->ecu_name.words = name.words;
-  addrTbl->address = addr;
+  _set_entry_addr(addrTbl, addr);
   addrTbl->status = _ECU_NORMAL;
   addrTbl->category = _ECU_SLAVE;
   addrTbl->last_scan_time = 0;
@@ -153,6 +275,14 @@ void initialize_j1939_config(uint16_t baudRate, uint8_t address)
   if (!gEcuConfigPtr->mag_align_ps)
     gEcuConfigPtr->mag_align_ps = SAE_J1939_GROUP_EXTENSION_MAG_ALIGN_CMD;
   
+  // init telemetry ps value and period
+  if (!gEcuConfigPtr->telemetry_ps)
+    gEcuConfigPtr->telemetry_ps = SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY;
+  
+  // the PGN is only sent once configured
+  if (!gEcuConfigPtr->telemetry_period)
+    gEcuConfigPtr->telemetry_period = SAE_J1939_TELEMETRY_PERIOD_OFF;
+  
  
   return;
 }
@@ -161,12 +291,14 @@ void initialize_j1939_config(uint16_t baudRate, uint8_t address)
  * @name process_j1939_packet() call ecu_process() to decode the incoming message
  * @brief  a genetal API called by caller
  *
- * @param [in] rx_desc, current rx descriptor
+ * @param [in] rx_desc, unused: the frames are taken from the rx ring
  * @retval N/A
  ******************************************************************************/
 void process_j1939_packet(struct sae_j1939_rx_desc * rx_desc)
 {
-  if (rx_desc->rx_pkt_ready != DESC_OCCUPIED)
+  (void)rx_desc;
+  
+  if (ecu_rx_ring.head == ecu_rx_ring.tail)
     return;
   
    // process incoming packets
@@ -175,6 +307,146 @@ void process_j1939_packet(struct sae_j1939_rx_desc * rx_desc)
   return;
 }
 
+/** ***************************************************************************
+ * @name j1939_pgn() parameter group number of an identifier
+ * @brief PDU1 formats (PF < 240) carry the destination address in PS, which is
+ *        not part of the PGN
+ *
+ * @param [in] ident, decoded identifier
+ * @retval 18-bit PGN
+ ******************************************************************************/
+uint32_t j1939_pgn(SAE_J1939_IDENTIFIER_FIELD *ident)
+{
+  uint32_t pgn = ((uint32_t)ident->control_bits.data_page << 16) |
+                 ((uint32_t)ident->pdu_format << 8);
+  
+  if (ident->pdu_format >= SAE_J1939_PDU_FORMAT_DATA)
+    pgn |= ident->pdu_specific;
+  
+  return pgn;
+}
+
+static uint32_t _pgn_hash(uint32_t pgn)
+{
+  // Fibonacci hashing, top bits index the table
+  return (pgn * 2654435761u) >> 26;
+}
+
+#if (SAE_J1939_PGN_TABLE_SIZE != 64)
+#error "_pgn_hash() assumes a 64 entry table"
+#endif
+
+/** ***************************************************************************
+ * @name j1939_register_pgn() route a PGN to its handler
+ * @brief frames still have to pass the CAN acceptance filters. Registering
+ *        a PGN again replaces its handler and flags.
+ *
+ * @param [in] pgn, parameter group number (PS = 0 for PDU1 formats)
+ *             handler, called from ecu_process() with the rx descriptor
+ *             flags, SAE_J1939_PGN_ANY_DEST, SAE_J1939_PGN_IGNORE
+ * @retval 1 successful or 0 table full
+ ******************************************************************************/
+uint8_t j1939_register_pgn(uint32_t pgn, j1939_pgn_handler_t handler, uint8_t flags)
+{
+  SAE_J1939_PGN_ENTRY *entry, *slot = NULL;
+  uint32_t idx = _pgn_hash(pgn);
+  int i;
+  
+  if ((handler == NULL) && !(flags & SAE_J1939_PGN_IGNORE))
+    return 0;
+  
+  // the PGN may sit past a removed slot, which is only reused when it does not
+  for (i = 0; i < SAE_J1939_PGN_TABLE_SIZE; i++) {
+    entry = &pgn_table[(idx + i) & (SAE_J1939_PGN_TABLE_SIZE - 1)];
+    if (entry->used == SAE_J1939_PGN_SLOT_FREE) {
+      if (slot == NULL)
+        slot = entry;
+      break;
+    }
+    if (entry->used == SAE_J1939_PGN_SLOT_REMOVED) {
+      if (slot == NULL)
+        slot = entry;
+      continue;
+    }
+    if (entry->pgn == pgn) {
+      slot = entry;
+      break;
+    }
+  }
+  
+  if (slot == NULL)
+    return 0;
+  
+  slot->pgn     = pgn;
+  slot->handler = handler;
+  slot->flags   = flags;
+  slot->used    = SAE_J1939_PGN_SLOT_USED;
+  return 1;
+}
+
+/** ***************************************************************************
+ * @name j1939_unregister_pgn() stop routing a PGN
+ * @brief frames of the PGN are dropped again, as if never registered
+ *
+ * @param [in] pgn, parameter group number
+ * @retval N/A
+ ******************************************************************************/
+void j1939_unregister_pgn(uint32_t pgn)
+{
+  SAE_J1939_PGN_ENTRY *entry = j1939_lookup_pgn(pgn);
+  
+  if (entry != NULL) {
+    entry->handler = NULL;
+    entry->flags   = 0;
+    entry->used    = SAE_J1939_PGN_SLOT_REMOVED;
+  }
+}
+
+/** ***************************************************************************
+ * @name j1939_lookup_pgn() find the registration of a PGN
+ *
+ * @param [in] pgn, parameter group number
+ * @retval table entry or NULL if the PGN is not registered
+ ******************************************************************************/
+SAE_J1939_PGN_ENTRY *j1939_lookup_pgn(uint32_t pgn)
+{
+  SAE_J1939_PGN_ENTRY *entry;
+  uint32_t idx = _pgn_hash(pgn);
+  int i;
+  
+  // the first free slot ends the probe sequence, removed ones do not
+  for (i = 0; i < SAE_J1939_PGN_TABLE_SIZE; i++) {
+    entry = &pgn_table[(idx + i) & (SAE_J1939_PGN_TABLE_SIZE - 1)];
+    if (entry->used == SAE_J1939_PGN_SLOT_FREE)
+      return NULL;
+    if (entry->used == SAE_J1939_PGN_SLOT_USED && entry->pgn == pgn)
+      return entry;
+  }
+  
+  return NULL;
+}
+
+/** ***************************************************************************
+ * @name sae_j1939_bitrate_kbps() configured bus bitrate
+ * @brief _ECU_BAUD_RATE of gEcuConfig, 250 kbit/s when unknown or detecting
+ *
+ * @param [in]
+ * @retval bitrate in kbit/s
+ ******************************************************************************/
+uint32_t sae_j1939_bitrate_kbps(void)
+{
+  switch (gEcuConfig.baudRate) {
+  case _ECU_500K:
+    return 500;
+  case _ECU_125K:
+    return 125;
+  case _ECU_1000K:
+    return 1000;
+  default:
+    return 250;
+  }
+}
+
 /** ***************************************************************************
  * @name sae_j1939_initialize() general initialization of all data structures
  * @brief  called in initial routine 
@@ -190,7 +462,9 @@ void sae_j1939_initialize(uint16_t baudRate, uint8_t address)
 
 
   memset(ecu_tx_desc, 0, sizeof(ecu_tx_desc));
-  memset(ecu_rx_desc, 0, sizeof(ecu_rx_desc));
+  memset(ecu_tx_queue, 0, sizeof(ecu_tx_queue));
+  memset(&ecu_tx_stats, 0, sizeof(ecu_tx_stats));
+  memset(&ecu_rx_ring, 0, sizeof(ecu_rx_ring));
 
   
   for ( i = 0; i < SAE_J1939_MAX_TX_DESC; i++) {
@@ -204,24 +478,18 @@ void sae_j1939_initialize(uint16_t baudRate, uint8_t address)
     }
   }
 
-  for ( i = 0; i < SAE_J1939_MAX_RX_DESC; i++) {
-    if (i == SAE_J1939_MAX_RX_DESC - 1)
-    {
-        ecu_rx_desc[i].next = &ecu_rx_desc[0]; 
-    }
-    else 
-    {
-        ecu_rx_desc[i].next = &ecu_rx_desc[i+1]; 
-    }
-  }
-  
-  for (i = 0; i < ACEINNA_ECU_ADDRESS_MAX; i++) {
-    ecu_pool[i].status = _ECU_ADDR_AVAILABLE;
-    ecu_pool[i].addr = i + 128;
-  }
+  memset(ecu_pool_free, 0, sizeof(ecu_pool_free));
+  for (i = 0; i < ACEINNA_ECU_ADDRESS_MAX; i++)
+    ecu_pool_free[i >> 5] |= 1u << (i & 31);
   
   initialize_mapping_table();
   
+  memset(pgn_table, 0, sizeof(pgn_table));
+  aceinna_j1939_register_pgns();
+  j1939_tp_init();
+  j1939_telemetry_init();
+  j1939_sched_init();
+  
   gEcuConfig.baud_rate_detect_enable = FALSE; 
   
   gEcuInst.name = (SAE_J1939_NAME_FIELD *)&gEcuConfigPtr->ecu_name;
@@ -244,8 +512,7 @@ void sae_j1939_initialize(uint16_t baudRate, uint8_t address)
 #endif
   
   gEcuInst.curr_tx_desc = &(ecu_tx_desc[0]);
-  gEcuInst.curr_rx_desc = &(ecu_rx_desc[0]);
-  gEcuInst.curr_process_desc = &(ecu_rx_desc[0]);
+  gEcuInst.rx_ring = &ecu_rx_ring;
   gEcuInst.init_table = initialize_mapping_table;
   gEcuInst.update_table = update_mapping_table;
   gEcuInst.add_entry = add_ecu_mapping_table;
@@ -269,9 +536,20 @@ void sae_j1939_initialize(uint16_t baudRate, uint8_t address)
 void initialize_mapping_table(void)
 {
   int i;
+  uint32_t slot;
   ECU_ADDRESS_ENTRY *addrTbl =  gAddrMapTblPtr;
   
+  memset(addr_index, 0, sizeof(addr_index));
+  memset(name_index, 0, sizeof(name_index));
+  memset(tbl_free, 0xFF, sizeof(tbl_free));
+  
   for (i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
+    if (addrTbl->ecu_name.words) {
+      slot = _name_slot(addrTbl->ecu_name.words);
+      if (name_index[slot])
+        memset((void *)addrTbl, '\0', sizeof(ECU_ADDRESS_ENTRY));   // duplicate NAME
+    }
+    
     if (!addrTbl->ecu_name.words)
         addrTbl->status = _ECU_IDLE;
     else if (!addrTbl->address)
@@ -279,6 +557,13 @@ void initialize_mapping_table(void)
     else
         addrTbl->status = _ECU_EXPIRED;
     
+    if (addrTbl->status != _ECU_IDLE) {
+      tbl_free[i >> 5] &= ~(1u << (i & 31));
+      name_index[slot] = (uint8_t)(i + 1);
+      if (addrTbl->status != _ECU_EMPTY_ADDRESS)
+        addr_index[addrTbl->address] = (uint8_t)(i + 1);
+    }
+    
     addrTbl++;
   }
     
@@ -356,7 +641,7 @@ void send_address_claim(ECU_INSTANCE *ecu)
   addr_claim_desc->tx_buffer.IDE = CAN_ID_EXT;
   addr_claim_desc->tx_buffer.RTR = CAN_RTR_Data;
   addr_claim_desc->tx_buffer.DLC = addr_claim_desc->tx_payload_len;
-  addr_claim_desc->tx_pkt_ready  = DESC_OCCUPIED;
+  ecu_tx_enqueue(addr_claim_desc);
   
   return;
 }
@@ -370,10 +655,15 @@ void send_address_claim(ECU_INSTANCE *ecu)
  ******************************************************************************/
 void scan_address_mapping_table(void)
 {
-  int i;
-  ECU_ADDRESS_ENTRY *addrTbl =  gAddrMapTblPtr;
-  
-  for ( i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
+  int w, bit, claims = 0;
+  uint32_t used;
+  ECU_ADDRESS_ENTRY *addrTbl;
+  
+  for (w = 0; w < SAE_J1939_MAX_TABLE_ENTRY / 32; w++) {
+   for (used = ~tbl_free[w]; used; used &= used - 1) {
+    bit = __CLZ(__RBIT(used));
+    addrTbl = gAddrMapTblPtr + (w << 5) + bit;
+    
     if (addrTbl->status == _ECU_NORMAL) {
         addrTbl->idle_time  += timeElapsed(addrTbl->last_scan_time); 
         addrTbl->alive_time += timeElapsed(addrTbl->last_scan_time) / 1000;
@@ -383,17 +673,18 @@ void scan_address_mapping_table(void)
           addrTbl->status = _ECU_EXPIRED;
     }
     
-    if (i >= SAE_J1939_TX_THRESHOLD)
-      break;
-    
-    if ((addrTbl->status == _ECU_EMPTY_ADDRESS) || (addrTbl->status == _ECU_EXPIRED))   {
+    // bounded number of claims per scan
+    if (((addrTbl->status == _ECU_EMPTY_ADDRESS) || (addrTbl->status == _ECU_EXPIRED)) &&
+        (claims < SAE_J1939_TX_THRESHOLD)) {
       ECU_INSTANCE target_ecu;
       
       target_ecu.name = &addrTbl->ecu_name;
       target_ecu.addr = &addrTbl->address;
       
       send_address_claim(&target_ecu);
+      claims++;
     }
+   }
   }
   
   return;
@@ -408,16 +699,12 @@ void scan_address_mapping_table(void)
  ******************************************************************************/
 uint8_t allocate_ecu_addr(void)
 {
-  int i;
+  int i = _bitmap_take(ecu_pool_free, (ACEINNA_ECU_ADDRESS_MAX + 31) / 32);
   
-  for (i = 0; i < ACEINNA_ECU_ADDRESS_MAX; i++) {
-    if (ecu_pool[i].status == _ECU_ADDR_AVAILABLE) {
-      ecu_pool[i].status = _ECU_ADDR_OCCUPIED;
-      return ecu_pool[i].addr;
-    }
-  }
+  if (i < 0)
+    return 247;
   
-  return 247;
+  return (uint8_t)(i + 128);
 }
 
 
@@ -431,17 +718,25 @@ uint8_t allocate_ecu_addr(void)
 uint8_t del_ecu_mapping_table(ECU_ADDRESS_ENTRY *input)
 {
   int i;
-  ECU_ADDRESS_ENTRY *addrTbl =  gAddrMapTblPtr;
+  uint32_t slot;
+  ECU_ADDRESS_ENTRY *addrTbl;
   
-  for ( i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
-    if (addrTbl->ecu_name.words == input->ecu_name.words) {
-      ecu_pool[addrTbl->address - 128].status = _ECU_ADDR_AVAILABLE;
-      memset((void *)addrTbl, '\0', sizeof(ECU_ADDRESS_ENTRY));
-      addrTbl->status = _ECU_IDLE;
-      
-      break;
-    }
-  }
+  slot = _name_slot(input->ecu_name.words);
+  if (!name_index[slot])
+    return 0;
+  
+  i = name_index[slot] - 1;
+  addrTbl = gAddrMapTblPtr + i;
+  
+  if ((addrTbl->address >= 128) && (addrTbl->address < 128 + ACEINNA_ECU_ADDRESS_MAX))
+    ecu_pool_free[(addrTbl->address - 128) >> 5] |= 1u << ((addrTbl->address - 128) & 31);
+  if (addr_index[addrTbl->address] == i + 1)
+    addr_index[addrTbl->address] = 0;
+  _name_remove(slot);
+  
+  memset((void *)addrTbl, '\0', sizeof(ECU_ADDRESS_ENTRY));
+  addrTbl->status = _ECU_IDLE;
+  tbl_free[i >> 5] |= 1u << (i & 31);
   
   return 0;
 }
@@ -455,21 +750,19 @@ uint8_t del_ecu_mapping_table(ECU_ADDRESS_ENTRY *input)
  ******************************************************************************/
 void update_mapping_table(ECU_ADDRESS_ENTRY *entry)
 {
-  int i;
-  ECU_ADDRESS_ENTRY *addrTbl =  gAddrMapTblPtr;
+  uint32_t slot;
+  ECU_ADDRESS_ENTRY *addrTbl;
    
-  for (i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
-    if (entry->ecu_name.words == addrTbl->ecu_name.words) {
-      addrTbl->address = entry->address;
-      addrTbl->status = entry->status;
-      addrTbl->category = entry->category;
-      if (entry->status == _ECU_NORMAL)
-          addrTbl->idle_time = 0;
-      
-      return;
-    }
+  slot = _name_slot(entry->ecu_name.words);
+  if (name_index[slot]) {
+    addrTbl = gAddrMapTblPtr + name_index[slot] - 1;
+    _set_entry_addr(addrTbl, entry->address);
+    addrTbl->status = entry->status;
+    addrTbl->category = entry->category;
+    if (entry->status == _ECU_NORMAL)
+        addrTbl->idle_time = 0;
     
-    addrTbl++;
+    return;
   }
   
   add_ecu_mapping_table(entry->address, entry->ecu_name);
@@ -487,20 +780,33 @@ void update_mapping_table(ECU_ADDRESS_ENTRY *entry)
  ******************************************************************************/
 ECU_ADDRESS_ENTRY * find_remote_ecu(uint8_t addr, SAE_J1939_NAME_FIELD name)
 {
-  int i;
-  ECU_ADDRESS_ENTRY *addrTbl =  gAddrMapTblPtr;
+  uint32_t slot;
+  ECU_ADDRESS_ENTRY *addrTbl;
   
-  for (i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
-    if (name.words == addrTbl->ecu_name.words) {
-      if (addr != addrTbl->address)
-        addrTbl->address = addr;
-      return addrTbl;
-    }
-    
-    addrTbl++;
-  }
+  slot = _name_slot(name.words);
+  if (!name_index[slot])
+    return NULL;
+  
+  addrTbl = gAddrMapTblPtr + name_index[slot] - 1;
+  if (addr != addrTbl->address)
+    _set_entry_addr(addrTbl, addr);
   
-  return NULL;  
+  return addrTbl;  
+}
+
+/** ***************************************************************************
+ * @name find_ecu_by_address() an API of finding out the ecu at an address
+ * @brief  direct lookup of the latest claimant of a source address
+ *        
+ * @param [in] addr, ecu's address
+ * @retval ecu object or NULL
+ ******************************************************************************/
+ECU_ADDRESS_ENTRY * find_ecu_by_address(uint8_t addr)
+{
+  if (!addr_index[addr])
+    return NULL;
+  
+  return gAddrMapTblPtr + addr_index[addr] - 1;
 }
 
 /** ***************************************************************************
@@ -520,6 +826,7 @@ uint8_t find_tx_desc(struct sae_j1939_tx_desc **input)
     *input =  (*input)->next;
     if (*input == gEcuInst.curr_tx_desc) {
 //      gEcuInst.state = _ECU_TX_OVERFLOW;
+      ecu_tx_stats.no_desc++;
       return 0;
     }
   }
@@ -528,6 +835,106 @@ uint8_t find_tx_desc(struct sae_j1939_tx_desc **input)
 }
 
 
+/** ***************************************************************************
+ * @name ecu_tx_enqueue() queue a built tx descriptor by its priority
+ * @brief called from task context only, the tx ISR is the only consumer.
+ *        Pends the tx interrupt so free mailboxes are filled right away.
+ *
+ * @param [in] desc, fully built tx descriptor
+ * @retval N/A
+ ******************************************************************************/
+void ecu_tx_enqueue(struct sae_j1939_tx_desc *desc)
+{
+  SAE_J1939_TX_QUEUE *q = &ecu_tx_queue[desc->tx_identifier.control_bits.priority];
+  
+  desc->tx_queued_at = TX_TIMER_COUNT();
+  desc->tx_pkt_ready = DESC_PENDING;
+  
+  // a pool of SAE_J1939_MAX_TX_DESC descriptors can't overfill a queue
+  q->slot[q->head & (SAE_J1939_MAX_TX_DESC - 1)] = (uint8_t)(desc - ecu_tx_desc);
+  __DMB();
+  q->head++;
+  
+  CAN_Tx_Request();
+}
+
+/** ***************************************************************************
+ * @name ecu_tx_pending() frames waiting for a mailbox
+ * @brief a snapshot, the tx interrupt keeps draining the queues
+ *
+ * @param [in] prio, count the queues of this J1939 priority and above
+ * @retval number of queued frames
+ ******************************************************************************/
+uint8_t ecu_tx_pending(uint8_t prio)
+{
+  uint8_t n = 0;
+  int i;
+  
+  for (i = 0; i <= prio && i < SAE_J1939_PRIORITY_LEVELS; i++)
+    n += (uint8_t)(ecu_tx_queue[i].head - ecu_tx_queue[i].tail);
+  
+  return n;
+}
+
+static void _tx_record_latency(uint8_t prio, uint32_t ticks)
+{
+  uint32_t us  = ticks / TX_TIMER_TICKS_PER_US;
+  uint32_t v   = us >> 6;
+  uint8_t  bin = 0;
+  
+  while (v && bin < SAE_J1939_TX_LATENCY_BINS - 1) {
+    v >>= 1;
+    bin++;
+  }
+  
+  ecu_tx_stats.sent[prio]++;
+  ecu_tx_stats.latency_hist[prio][bin]++;
+  if (us > ecu_tx_stats.max_latency_us[prio])
+    ecu_tx_stats.max_latency_us[prio] = us;
+}
+
+/** ***************************************************************************
+ * @name ecu_tx_refill() hand queued frames to the free mailboxes
+ * @brief runs in the CAN tx interrupt, on mailbox completion or when
+ *        ecu_tx_enqueue() pends it. Highest J1939 priority first, FIFO
+ *        within a priority.
+ *
+ * @param [in] 
+ * @retval number of frames loaded into mailboxes, ecu_tx_pending() tells
+ *         whether any are left waiting
+ ******************************************************************************/
+uint8_t ecu_tx_refill(void)
+{
+  SAE_J1939_TX_QUEUE *q;
+  struct sae_j1939_tx_desc *desc;
+  uint32_t now;
+  uint8_t prio = 0;
+  uint8_t loaded = 0;
+  
+  while (prio < SAE_J1939_PRIORITY_LEVELS) {
+    q = &ecu_tx_queue[prio];
+    if (q->tail == q->head) {
+      prio++;
+      continue;
+    }
+    __DMB();
+    desc = &ecu_tx_desc[q->slot[q->tail & (SAE_J1939_MAX_TX_DESC - 1)]];
+    if (gEcuInst.xmit(desc) == CAN_TxStatus_NoMailBox) {
+      ecu_tx_stats.mailbox_full++;
+      return loaded;
+    }
+    now = TX_TIMER_COUNT();
+    _tx_record_latency(prio, now - desc->tx_queued_at);
+    ecu_tx_stats.bits += SAE_J1939_FRAME_BITS(desc->tx_buffer.DLC);
+    j1939_telemetry_tx(desc, now);
+    desc->tx_pkt_ready = DESC_IDLE;
+    q->tail++;
+    loaded++;
+  }
+  
+  return loaded;
+}
+
 /** ***************************************************************************
  * @name is_valid_pf() check pf is supported or not
  * @brief a general API of pf value checking
@@ -602,7 +1009,8 @@ void process_address_claim(struct sae_j1939_rx_desc *desc)
 //      ERROR_STRING("\r\naddress table full.\r\n");
       }
   } else if (source_addr == *gEcuInst.addr) {
-    if (remote_ecu->ecu_name.words > gEcuInst.name->words)
+    // contender for our address, usually not in the table yet: lower NAME wins
+    if (ecu_name.words > gEcuInst.name->words)
       send_address_claim(&gEcuInst);
     else {
       *gEcuInst.addr = allocate_ecu_addr();
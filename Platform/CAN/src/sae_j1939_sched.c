@@ -0,0 +1,296 @@
+/** ***************************************************************************
+ * @file sae_j1939_sched.c periodic data PGN scheduler
+ * @brief  Copyright (c) 2018 All Rights Reserved.
+ *
+ * Phases are planned over one second of ticks: the fastest types are placed
+ * first, each on the phase whose busiest tick is the least busy so far. The
+ * plan is redone whenever packet_type, packet_rate, pgn_rate or the bitrate
+ * change.
+ *
+ * Admission runs every tick in task context. The budget is the configured
+ * share of the bus for one tick, less the frames of the same or higher
+ * priority still queued from earlier ticks, and never more than the free
+ * tx descriptors above SAE_J1939_SCHED_DESC_RESERVE. Due types that do not
+ * fit wait, the longest waiting first; one still waiting when it is due again
+ * loses that sample.
+ *
+ * For an application with the flag callback only, every type starts on
+ * phase 0 and all due types are admitted on the same tick.
+ *
+ * THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+ * KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ *****************************************************************************/
+#ifdef SAE_J1939
+#include <string.h>
+#include "sae_j1939.h"
+#include "sae_j1939_sched.h"
+
+#define SCHED_HORIZON           SAE_J1939_SCHED_TICK_HZ     // ticks planned
+
+SAE_J1939_SCHED ecu_sched;
+
+// configuration the plan was made for
+static uint16_t plan_type;
+static uint16_t plan_rate;
+static uint16_t plan_baud;
+static uint8_t  plan_pgn_rate[ACEINNA_SAE_J1939_PACKET_TYPES];
+
+
+// the application sends all its types on one flag
+static BOOL _grouped(void)
+{
+  return EnqueueScheduledDataPackets == NULL;
+}
+
+
+static uint16_t _period(int i)
+{
+  uint8_t  div = gEcuConfig.pgn_rate[i];
+  uint32_t period;
+
+  if (!(gEcuConfig.packet_type & (1 << i)) || div == SAE_J1939_SCHED_RATE_OFF)
+    return 0;
+
+  if (div == SAE_J1939_SCHED_RATE_DEFAULT)
+    div = gEcuConfig.packet_rate;
+
+  // dividers of 100 Hz, the nearest whole number of ticks, at least one
+  period = ((uint32_t)div * SAE_J1939_SCHED_TICK_HZ + 50) / 100;
+  return period ? (uint16_t)period : 1;
+}
+
+static uint8_t _budget(void)
+{
+  uint32_t frames = sae_j1939_bitrate_kbps() * 1000 / SAE_J1939_SCHED_TICK_HZ / SAE_J1939_FRAME_BITS(8);
+
+  frames = frames * SAE_J1939_SCHED_BUS_SHARE / 100;
+
+  return frames ? (uint8_t)frames : 1;
+}
+
+/** ***************************************************************************
+ * @name _plan() pick the rate and phase of each periodic type
+ * @brief restarts every type at its phase, types waiting for admission are
+ *        dropped
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+static void _plan(void)
+{
+  static uint8_t occ[SCHED_HORIZON];   // up to 1000 bytes, off the task stack
+  uint16_t placed = 0;
+  uint16_t t, p, best_phase, period;
+  uint8_t  cost, best_cost;
+  int      i, next;
+
+  memset(occ, 0, sizeof(occ));
+  ecu_sched.peak   = 0;
+  ecu_sched.budget = _budget();
+
+  for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++) {
+    ecu_sched.slot[i].type   = 1 << i;
+    ecu_sched.slot[i].period = _period(i);
+    ecu_sched.slot[i].phase  = 0;
+    ecu_sched.slot[i].late   = 0;
+  }
+
+  // fastest first, it has the fewest phases to choose from
+  for (;;) {
+    next = -1;
+    for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++) {
+      period = ecu_sched.slot[i].period;
+      if (!period || (placed & (1 << i)))
+        continue;
+      if (next < 0 || period < ecu_sched.slot[next].period)
+        next = i;
+    }
+    if (next < 0)
+      break;
+    placed |= 1 << next;
+
+    period     = ecu_sched.slot[next].period;
+    best_phase = 0;
+    best_cost  = 0xFF;
+    for (p = 0; p < period && p < SCHED_HORIZON && !(p && _grouped()); p++) {
+      cost = 0;
+      for (t = p; t < SCHED_HORIZON; t += period)
+        if (occ[t] > cost)
+          cost = occ[t];
+      if (cost < best_cost) {
+        best_cost  = cost;
+        best_phase = p;
+      }
+    }
+
+    for (t = best_phase; t < SCHED_HORIZON; t += period)
+      if (++occ[t] > ecu_sched.peak)
+        ecu_sched.peak = occ[t];
+    ecu_sched.slot[next].phase     = best_phase;
+    ecu_sched.slot[next].countdown = best_phase;
+  }
+
+  plan_type = gEcuConfig.packet_type;
+  plan_rate = gEcuConfig.packet_rate;
+  plan_baud = gEcuConfig.baudRate;
+  memcpy(plan_pgn_rate, gEcuConfig.pgn_rate, sizeof(plan_pgn_rate));
+}
+
+static BOOL _plan_stale(void)
+{
+  return plan_type != gEcuConfig.packet_type ||
+         plan_rate != gEcuConfig.packet_rate ||
+         plan_baud != gEcuConfig.baudRate ||
+         memcmp(plan_pgn_rate, gEcuConfig.pgn_rate, sizeof(plan_pgn_rate)) != 0;
+}
+
+/** ***************************************************************************
+ * @name j1939_sched_set_rate() set pgn_rate of packet types
+ * @brief the plan follows on the next tick
+ *
+ * @param [in] types, ACEINNA_SAE_J1939_PACKET_* bits
+ *             rate, SAE_J1939_SCHED_RATE_DEFAULT, a divider of 100 Hz up to
+ *             SAE_J1939_SCHED_RATE_MAX or SAE_J1939_SCHED_RATE_OFF
+ * @retval 1 successful or 0 failure
+ ******************************************************************************/
+uint8_t j1939_sched_set_rate(uint16_t types, uint8_t rate)
+{
+  int i;
+
+  if (!types || (types >> ACEINNA_SAE_J1939_PACKET_TYPES))
+    return 0;
+
+  if (rate > SAE_J1939_SCHED_RATE_MAX && rate != SAE_J1939_SCHED_RATE_OFF)
+    return 0;
+
+  for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++)
+    if (types & (1 << i))
+      gEcuConfig.pgn_rate[i] = rate;
+
+  return 1;
+}
+
+// SET command, SAE_J1939_PGN_RATE_PAYLOAD
+static void _sched_rate_config(struct sae_j1939_rx_desc *desc)
+{
+  SAE_J1939_PGN_RATE_PAYLOAD *cfg = (SAE_J1939_PGN_RATE_PAYLOAD *)desc->rx_buffer.Data;
+
+  if (cfg->dest_address != *gEcuInst.addr)
+    return;
+
+  if (j1939_sched_set_rate(cfg->types[0] | (cfg->types[1] << 8), cfg->rate))
+    gEcuConfig.config_changed = 1;
+}
+
+/** ***************************************************************************
+ * @name j1939_sched_init() plan the periodic types
+ * @brief called from sae_j1939_initialize(), after the bitrate is known.
+ *        Routes the pgn_rate SET command to _sched_rate_config() when the
+ *        application takes the types one by one
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void j1939_sched_init(void)
+{
+  memset(&ecu_sched, 0, sizeof(ecu_sched));
+  _plan();
+
+  if (!_grouped())
+    j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | SAE_J1939_GROUP_EXTENSION_PGN_RATE,
+                       _sched_rate_config, 0);
+}
+
+/** ***************************************************************************
+ * @name j1939_sched_tick() periodic types to send on this tick
+ * @brief once per acquisition tick of the CAN task, before the data packets
+ *        are built
+ *
+ * @param [in]
+ * @retval ACEINNA_SAE_J1939_PACKET_* bits due and admitted, 0 none
+ ******************************************************************************/
+uint16_t j1939_sched_tick(void)
+{
+  SAE_J1939_SCHED_SLOT *s;
+  uint16_t admitted = 0;
+  uint8_t  queued, room, budget, n = 0;
+  int      i, next;
+
+  if (_plan_stale())
+    _plan();
+
+  for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++) {
+    s = &ecu_sched.slot[i];
+    if (!s->period)
+      continue;
+    if (s->countdown) {
+      s->countdown--;
+      if (s->late)
+        s->late++;
+      continue;
+    }
+    s->countdown = s->period - 1;
+    if (s->late)
+      s->skipped++;
+    s->late = 1;
+  }
+
+  // frames ahead of ours from earlier ticks still need this tick's bus time
+  queued = ecu_tx_pending(SAE_J1939_CONTROL_PRIORITY);
+  budget = ecu_sched.budget > queued ? ecu_sched.budget - queued : 0;
+  queued = ecu_tx_pending(SAE_J1939_PRIORITY_LEVELS - 1);
+  room   = SAE_J1939_MAX_TX_DESC - SAE_J1939_SCHED_DESC_RESERVE > queued ?
+           SAE_J1939_MAX_TX_DESC - SAE_J1939_SCHED_DESC_RESERVE - queued : 0;
+  if (budget > room)
+    budget = room;
+  if (_grouped() && budget)
+    budget = ACEINNA_SAE_J1939_PACKET_TYPES;
+
+  // longest waiting first, every type is one frame
+  while (n < budget) {
+    next = -1;
+    for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++) {
+      s = &ecu_sched.slot[i];
+      if (s->late && (next < 0 || s->late > ecu_sched.slot[next].late))
+        next = i;
+    }
+    if (next < 0)
+      break;
+    s = &ecu_sched.slot[next];
+    admitted |= s->type;
+    s->late   = 0;
+    s->sent++;
+    n++;
+  }
+
+  for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++)
+    if (ecu_sched.slot[i].late)
+      ecu_sched.slot[i].deferred++;
+
+  if (n > ecu_sched.max_admitted)
+    ecu_sched.max_admitted = n;
+
+  return admitted;
+}
+
+/** ***************************************************************************
+ * @name j1939_sched_enqueue() build the admitted types
+ * @brief EnqueueScheduledDataPackets() of the application, or its
+ *        EnqeuePeriodicDataPackets() with the flag set when any is admitted
+ *
+ * @param [in] latency, tick to now in 0.1 ms
+ *             types, j1939_sched_tick() of this tick
+ * @retval N/A
+ ******************************************************************************/
+void j1939_sched_enqueue(int latency, uint16_t types)
+{
+  if (EnqueueScheduledDataPackets != NULL)
+    EnqueueScheduledDataPackets(latency, types);
+  else if (EnqeuePeriodicDataPackets != NULL)
+    EnqeuePeriodicDataPackets(latency, types != 0);
+}
+
+#endif // SAE_J1939
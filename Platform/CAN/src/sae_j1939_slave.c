@@ -20,6 +20,7 @@
 #include "UserMessagingCAN.h"
 #include "canAPI.h"
 #include "sae_j1939.h"
+#include "sae_j1939_tp.h"
 
 #define CAN_OUTPUT_INTERVAL                         15
 
@@ -83,6 +84,40 @@ uint8_t aceinna_j1939_send_ecu_id(void)
 	return aceinna_j1939_build_msg((void *)&(gEcuConfigPtr->ecu_name.words), &params);
 }
 
+/** ***************************************************************************
+ * @name aceinna_j1939_send_component_id() builds up component id message
+ * @brief PGN 65259, "make*model*serial number*unit number*", longer than a
+ *        frame so it goes out through the transport protocol: RTS/CTS to a
+ *        node, BAM to the global address. The text stays in a static buffer
+ *        until the session is over
+ *
+ * @param [in] dest, requester or SAE_J1939_GROUP_EXTENSION_ACK (global)
+ *
+ * @retval 1 successful or 0 failure, also while the previous one is sent
+ ******************************************************************************/
+uint8_t aceinna_j1939_send_component_id(uint8_t dest)
+{
+    static uint8_t component_id[ACEINNA_SAE_J1939_COMPONENT_ID_MAX_LEN];
+    const char *model = unitVersionString();
+    uint16_t len;
+    int i;
+
+    if (j1939_tp_tx_pending(component_id))
+        return 0;
+
+    // the model is cut at its first space, fields must not hold a '*'
+    len = (uint16_t)snprintf((char *)component_id, sizeof(component_id), "ACEINNA*");
+    for (i = 0; model != NULL && model[i] > ' ' && model[i] != '*' &&
+         len < sizeof(component_id) - 16; i++) {
+        component_id[len++] = (uint8_t)model[i];
+    }
+    len += (uint16_t)snprintf((char *)&component_id[len], sizeof(component_id) - len,
+                              "*%lu**", (unsigned long)unitSerialNumber());
+
+    return j1939_tp_send((SAE_J1939_PDU_FORMAT_254 << 8) | SAE_J1939_GROUP_EXTENSION_COMPONENT_ID,
+                         SAE_J1939_CONTROL_PRIORITY, dest, component_id, len);
+}
+
 /** ***************************************************************************
  * @name aceinna_j1939_send_mag_align builds up mag align response packet
  *        
@@ -537,7 +572,7 @@ uint8_t aceinna_j1939_build_msg(void *payload, msg_params_t *params)
   
   // payload of position packet
   memcpy((void *)desc->tx_buffer.Data, (void *)payload, desc->tx_payload_len);
-  desc->tx_pkt_ready  = DESC_OCCUPIED;
+  ecu_tx_enqueue(desc);
   
   return 1;
 }
@@ -547,53 +582,61 @@ uint8_t aceinna_j1939_build_msg(void *payload, msg_params_t *params)
 
 
 /** ***************************************************************************
- * @name  is_valid_j1939_rcv() check incoming packets valid or not
-* @brief a general API of received packets check
- *        
- * @param [in] rx_desc, rx descriptor
- * @retval ACEINNA_J1939_INVALID_IDENTIFIER, ACEINNA_J1939_IGNORE, ACEINNA_J1939_DATA,
- *         ACEINNA_J1939_ADDRESS_CLAIM, ACEINNA_J1939_CONFIG
- ******************************************************************************/ 
-ACEINNA_J1939_PACKET_TYPE is_valid_j1939_rcv(struct sae_j1939_rx_desc *rx_desc)
+ * @name  aceinna_j1939_filter_route() pick the rx FIFO for a filter
+ * @brief address claim and configuration traffic goes to FIFO1, data to
+ *        FIFO0. The frames are classified by ecu_process() through the PGN
+ *        table, whichever filter let them in.
+ *
+ * @param [in] baseID, baseMask - filter as passed to ConfigureCANMessageFilter()
+ * @param [out] fifo - CAN_Filter_FIFOx
+ * @retval FALSE if the filter only matches frames that are always ignored
+ ******************************************************************************/
+BOOL aceinna_j1939_filter_route(uint32_t baseID, uint32_t baseMask, uint8_t *fifo)
 {
-  SAE_J1939_IDENTIFIER_FIELD *ident;
-  ACEINNA_J1939_PACKET_TYPE result;
- 
-  // check rx desc is NULL
-  if (rx_desc == NULL)
-       return ACEINNA_J1939_INVALID_IDENTIFIER;
-
-  ident = &(rx_desc->rx_identifier);
+  SAE_J1939_IDENTIFIER_FIELD ident;
+  BOOL exactPgn = (baseMask & 0x03FFFF00) == 0x03FFFF00;
   
-  // valid identifier
-  if (!is_valid_sae_j1939_identifier(ident))
-    return ACEINNA_J1939_INVALID_IDENTIFIER;
+  ident.control_bits.priority  = (baseID >> 26) & 0x7;
+  ident.control_bits.data_page = (baseID >> 24) & 0x1;
+  ident.pdu_format             = (baseID >> 16) & 0xff;
+  ident.pdu_specific           = (baseID >> 8) & 0xff;
+  ident.source                 = baseID & 0xff;
   
-  // is aceinna data packet
-  result = is_aceinna_data_packet(ident);
-  if (result == ACEINNA_J1939_DATA)
-     return ACEINNA_J1939_IGNORE;
-
-  // is data packet
-  result = is_algorithm_data_packet(ident);
-  if (result == ACEINNA_J1939_DATA)
-    goto end_j1939_rcv;
-
-  // is address claim packet
-  result = is_valid_address_claim(ident);
-  if (result == ACEINNA_J1939_ADDRESS_CLAIM)
-     goto end_j1939_rcv;
+  *fifo = CAN_Filter_FIFO1;
   
-  // is SET commands
-  result = is_valid_config_command(ident);
-  if (result == ACEINNA_J1939_CONFIG)
-    goto end_j1939_rcv;
+  // PF not pinned, can't tell
+  if ((baseMask & 0x00FF0000) != 0x00FF0000) {
+    return TRUE;
+  }
   
-  result = ACEINNA_J1939_REQUEST_PACKET;
+  if (exactPgn && is_aceinna_data_packet(&ident) == ACEINNA_J1939_DATA) {
+    return FALSE;
+  }
+  
+  if (exactPgn && is_algorithm_data_packet(&ident) == ACEINNA_J1939_DATA) {
+    *fifo = CAN_Filter_FIFO0;
+    return TRUE;
+  }
+  
+  if (ident.pdu_format == SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM) {
+    return TRUE;
+  }
+  
+  // transport data is bulk traffic, its connection management stays on FIFO1
+  if (ident.pdu_format == SAE_J1939_PDU_FORMAT_TP_DT) {
+    *fifo = CAN_Filter_FIFO0;
+    return TRUE;
+  }
   
-end_j1939_rcv:
+  // request and SET commands stay on FIFO1, the SET command PS values can be
+  // remapped at run time
+  if (ident.pdu_format < SAE_J1939_PDU_FORMAT_DATA ||
+      ident.pdu_format == SAE_J1939_PDU_FORMAT_GLOBAL) {
+    return TRUE;
+  }
   
-  return result;        
+  *fifo = CAN_Filter_FIFO0;
+  return TRUE;
 }
 
 /** ***************************************************************************
@@ -605,7 +648,7 @@ end_j1939_rcv:
  ******************************************************************************/ 
 void user_alg_reset(void)
 {
-  InitializeAlgorithmStruct(FREQ_200_HZ);
+  InitializeAlgorithmStruct(getAlgorithmFrequency());
 }
 
 
@@ -649,31 +692,143 @@ void process_config_set(struct sae_j1939_rx_desc *desc)
   
 }
 
+/** ***************************************************************************
+ * @name  ecu_transmit() kick the tx queues
+ * @brief frames are queued per priority by ecu_tx_enqueue() and moved to the
+ *        mailboxes by the tx interrupt; this only makes sure it runs
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
 void ecu_transmit()
 {
-  struct sae_j1939_tx_desc *tx_desc;
-  uint8_t result;
+  if (ecu_tx_pending(SAE_J1939_PRIORITY_LEVELS - 1))
+    CAN_Tx_Request();
+}
 
-  // place outgoing message into queue
-  tx_desc = gEcu->curr_tx_desc;
+/// PDU1 frames are for us when addressed to us or global
+static BOOL _is_for_us(SAE_J1939_IDENTIFIER_FIELD *ident, uint8_t flags)
+{
+  if ((ident->pdu_format >= SAE_J1939_PDU_FORMAT_DATA) || (flags & SAE_J1939_PGN_ANY_DEST))
+    return TRUE;
+  
+  return (ident->pdu_specific == *gEcu->addr) ||
+         (ident->pdu_specific == SAE_J1939_GROUP_EXTENSION_ACK);
+}
 
-  while (tx_desc->next != gEcu->curr_tx_desc) 
-  {
-    if (tx_desc->tx_pkt_ready == DESC_IDLE) {
-      tx_desc = tx_desc->next;
-      continue;
-    }
-    result = gEcu->xmit(tx_desc);
-    if (result != CAN_TxStatus_NoMailBox) {
-      tx_desc->tx_pkt_ready = DESC_IDLE;
-      tx_desc = tx_desc->next;
-      continue;
-    }
-    // always end up on busy unsent descriptor
-    gEcu->curr_tx_desc = tx_desc; 
+static void _process_data_packet(struct sae_j1939_rx_desc *desc)
+{
+  ProcessDataPackets(desc);
+}
+
+// multi-frame answers are the stack's, the others the application's
+static void _process_request(struct sae_j1939_rx_desc *desc)
+{
+  uint8_t *pgn = desc->rx_buffer.Data;
+  
+  if ((pgn[0] == SAE_J1939_GROUP_EXTENSION_COMPONENT_ID) &&
+      (pgn[1] == SAE_J1939_PDU_FORMAT_254) && (pgn[2] == 0)) {
+    // a global request gets a global answer
+    aceinna_j1939_send_component_id(
+        (desc->rx_identifier.pdu_specific == SAE_J1939_GROUP_EXTENSION_ACK) ?
+        SAE_J1939_GROUP_EXTENSION_ACK : desc->rx_identifier.source);
     return;
   }
+  
+  ProcessRequest(desc);
+}
+
+// SET commands, PF = SAE_J1939_PDU_FORMAT_GLOBAL; PS values as registered
+#define SET_PGN_NUM     10
+static uint8_t set_pgn_ps[SET_PGN_NUM];
 
+static void _set_pgn_ps(uint8_t *ps)
+{
+  ps[0] = SAE_J1939_GROUP_EXTENSION_BANK0;
+  ps[1] = SAE_J1939_GROUP_EXTENSION_BANK1;
+  ps[2] = gEcuConfigPtr->alg_reset_ps;
+  ps[3] = gEcuConfigPtr->save_cfg_ps;
+  ps[4] = gEcuConfigPtr->packet_rate_ps;
+  ps[5] = gEcuConfigPtr->packet_type_ps;
+  ps[6] = gEcuConfigPtr->digital_filter_ps;
+  ps[7] = gEcuConfigPtr->orientation_ps;
+  ps[8] = gEcuConfigPtr->user_behavior_ps;
+  ps[9] = gEcuConfigPtr->mag_align_ps;
+}
+
+static void _process_set(struct sae_j1939_rx_desc *desc)
+{
+  process_config_set(desc);
+  // a bank command may have remapped the PS values
+  aceinna_j1939_register_set_pgns();
+}
+
+/** ***************************************************************************
+ * @name  aceinna_j1939_register_set_pgns() route the SET commands
+ * @brief registers the current PS values of gEcuConfig and drops the ones
+ *        remapped away from. Runs after every SET command and from
+ *        ecu_process(), so a remap takes effect with the next frame; a PS
+ *        already registered for something else is left to it
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void aceinna_j1939_register_set_pgns(void)
+{
+  SAE_J1939_PGN_ENTRY *entry;
+  uint8_t ps[SET_PGN_NUM];
+  int i, j;
+  
+  _set_pgn_ps(ps);
+  if (!memcmp(ps, set_pgn_ps, sizeof(ps)))
+    return;
+  
+  for (i = 0; i < SET_PGN_NUM; i++) {
+    for (j = 0; j < SET_PGN_NUM && ps[j] != set_pgn_ps[i]; j++)
+      ;
+    entry = j1939_lookup_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | set_pgn_ps[i]);
+    if (j == SET_PGN_NUM && entry != NULL && entry->handler == _process_set)
+      j1939_unregister_pgn(entry->pgn);
+  }
+  
+  for (i = 0; i < SET_PGN_NUM; i++) {
+    entry = j1939_lookup_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | ps[i]);
+    if (entry == NULL || entry->handler == _process_set)
+      j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | ps[i], _process_set, 0);
+  }
+  
+  memcpy(set_pgn_ps, ps, sizeof(set_pgn_ps));
+}
+
+/** ***************************************************************************
+ * @name  aceinna_j1939_register_pgns() default PGN handlers of the slave
+ * @brief address claim, requests, the SET commands, the algorithm's vehicle
+ *        data inputs and the broadcasts of other Aceinna units (ignored).
+ *        Frames of PGNs not in the table are dropped; applications add their
+ *        own with j1939_register_pgn() after sae_j1939_initialize()
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void aceinna_j1939_register_pgns(void)
+{
+  j1939_register_pgn(SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM << 8, process_address_claim, 0);
+  j1939_register_pgn(SAE_J1939_PDU_FORMAT_REQUEST << 8, _process_request, 0);
+  
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_254 << 8) | SAE_J1939_PDU_SPECIFIC_243, _process_data_packet, 0);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_254 << 8) | SAE_J1939_PDU_SPECIFIC_191, _process_data_packet, 0);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_254 << 8) | SAE_J1939_PDU_SPECIFIC_232, _process_data_packet, 0);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_251 << 8) | SAE_J1939_PDU_SPECIFIC_246, _process_data_packet, 0);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | SAE_J1939_PDU_SPECIFIC_110, _process_data_packet, 0);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | SAE_J1939_PDU_SPECIFIC_111, _process_data_packet, 0);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | SAE_J1939_PDU_SPECIFIC_112, _process_data_packet, 0);
+  
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_DATA << 8) | SAE_J1939_GROUP_EXTENSION_SLOPE_SENSOR, NULL, SAE_J1939_PGN_IGNORE);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_DATA << 8) | SAE_J1939_GROUP_EXTENSION_ANGULAR_RATE, NULL, SAE_J1939_PGN_IGNORE);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_DATA << 8) | SAE_J1939_GROUP_EXTENSION_ACCELERATION, NULL, SAE_J1939_PGN_IGNORE);
+  
+  memset(set_pgn_ps, 0, sizeof(set_pgn_ps));
+  aceinna_j1939_register_set_pgns();
 }
 
 /** ***************************************************************************
@@ -685,8 +840,9 @@ void ecu_transmit()
  ******************************************************************************/
 void ecu_process(void)
 {
-  struct sae_j1939_rx_desc *rx_desc = gEcu->curr_process_desc;
-  ACEINNA_J1939_PACKET_TYPE incoming_type;
+  SAE_J1939_RX_RING *ring = gEcu->rx_ring;
+  struct sae_j1939_rx_desc *rx_desc;
+  SAE_J1939_PGN_ENTRY *pgn_entry;
   ECU_ADDRESS_ENTRY ecu_entry;
   
   memcpy((void *)&ecu_entry.ecu_name, (void *)gEcu->name, 8);
@@ -694,93 +850,133 @@ void ecu_process(void)
   ecu_entry.status   = _ECU_NORMAL;
   ecu_entry.category = _ECU_MASTER;
   
-  // check rx desc
-  if (rx_desc == NULL)
+  // check rx ring
+  if (ring == NULL)
     return;
+  
+  // PS values changed outside a SET command, e.g. a configuration load
+  aceinna_j1939_register_set_pgns();
  
   // decode and analyze identifier
-  while (rx_desc->rx_pkt_ready == DESC_OCCUPIED) {
+  while (ring->tail != ring->head) {
+    // head is read before the slot it publishes
+    __DMB();
+    rx_desc = &ring->desc[ring->tail & (SAE_J1939_RX_RING_DEPTH - 1)];
     rx_desc->rx_identifier.control_bits.priority 	= (rx_desc->rx_buffer.ExtId >> 26) & 0x7;
     rx_desc->rx_identifier.control_bits.data_page 	= (rx_desc->rx_buffer.ExtId >> 24) & 0x1;
     rx_desc->rx_identifier.pdu_format 				= (rx_desc->rx_buffer.ExtId >> 16) & 0xff;
     rx_desc->rx_identifier.pdu_specific 			= (rx_desc->rx_buffer.ExtId >> 8) & 0xff;
     rx_desc->rx_identifier.source 					= rx_desc->rx_buffer.ExtId & 0xff;
     
-    incoming_type = is_valid_j1939_rcv(rx_desc);
-    if ((incoming_type == ACEINNA_J1939_IGNORE) ||
-        (incoming_type == ACEINNA_J1939_INVALID_IDENTIFIER)) {
-      	rx_desc->rx_pkt_ready = DESC_IDLE;
-      	rx_desc = rx_desc->next;
-      	continue;
-    }
-    
-    // dispatch to message handler
-    switch (incoming_type) {
-    // address claim handler
-    case ACEINNA_J1939_ADDRESS_CLAIM:
-      process_address_claim(rx_desc);
-      break;
-      // request handler
-    case ACEINNA_J1939_REQUEST_PACKET:
-      ProcessRequest(rx_desc);
-      break; 
-    case ACEINNA_J1939_DATA:
-      ProcessDataPackets(rx_desc);
-      break; 
-    default:
-      // SET commands handler
-      process_config_set(rx_desc);
-      break;
+    // every PGN goes through the table, unregistered ones are dropped
+    pgn_entry = j1939_lookup_pgn(j1939_pgn(&rx_desc->rx_identifier));
+    if ((pgn_entry != NULL) &&
+        !(pgn_entry->flags & SAE_J1939_PGN_IGNORE) &&
+        _is_for_us(&rx_desc->rx_identifier, pgn_entry->flags)) {
+      pgn_entry->handler(rx_desc);
     }
     
     rx_desc->rx_pkt_ready = DESC_IDLE;
-    rx_desc = rx_desc->next;
+    // slot is done with before it is handed back to the ISR
+    __DMB();
+    ring->tail++;
   }
-  
-  gEcu->curr_process_desc =  rx_desc;
 
   return;
 }
 
 /** ***************************************************************************
  * @name  aceinna_j1939_transmit_isr() an API of transmitting handler
- * @brief manage transmitting queue
+ * @brief manage transmitting queue. The CAN task is woken only when this
+ *        interrupt moved frames and drained the queues while a TP window is
+ *        open, so a wakeup with nothing to send can't pend it again
  *
  * @param [in]
  * @retval N/A
  ******************************************************************************/
 void aceinna_j1939_transmit_isr(void)
 {
-    ecu_transmit();
+    if (ecu_tx_refill() &&
+        !ecu_tx_pending(SAE_J1939_PRIORITY_LEVELS - 1) &&
+        j1939_tp_tx_window_open())
+        CANTaskSignal(CAN_EVENT_TX_FREE);
 }
 
 extern BOOL canStarted;
 /** ***************************************************************************
- * @name  aceinna_j1939_receive_isr() an API of receiving handler
- * @brief manage receiving queue
+ * @name  aceinna_j1939_rx_reserve() get the slot for the next received frame
+ * @brief called from the rx ISR before reading a frame out of the controller.
+ *        A full ring never overwrites an unprocessed slot, the frame is
+ *        dropped and counted against its FIFO instead
  *
- * @param [in]
- * @retval N/A
+ * @param [in] fifo, controller FIFO the frame is pending in
+ * @retval slot to receive into, NULL if the frame has to be dropped
  ******************************************************************************/
-void aceinna_j1939_receive_isr(void)
+struct sae_j1939_rx_desc *aceinna_j1939_rx_reserve(uint8_t fifo)
 {
+  SAE_J1939_RX_RING *ring = gEcu->rx_ring;
   struct sae_j1939_rx_desc *desc;
   
-  if(!canStarted){
-      return;
+  if (!canStarted || ring == NULL) {
+      return NULL;
   }
   
-  desc = gEcu->curr_rx_desc;
+  if ((uint16_t)(ring->head - ring->tail) >= SAE_J1939_RX_RING_DEPTH) {
+      ring->overrun[fifo & (SAE_J1939_RX_FIFO_NUM - 1)]++;
+      return NULL;
+  }
   
-  // check current rx desc
-  if ((desc == NULL) || (desc->next == NULL) || (desc->rx_pkt_ready == DESC_OCCUPIED)){
-    return;
+  desc = &ring->desc[ring->head & (SAE_J1939_RX_RING_DEPTH - 1)];
+  desc->rx_fifo = fifo;
+  
+  return desc;
+}
+
+/** ***************************************************************************
+ * @name  aceinna_j1939_rx_hw_overrun() count frames lost in the controller
+ * @brief called from the rx ISR when the controller flags a FIFO overrun
+ *
+ * @param [in] fifo, controller FIFO
+ * @retval N/A
+ ******************************************************************************/
+void aceinna_j1939_rx_hw_overrun(uint8_t fifo)
+{
+  if (gEcu->rx_ring != NULL) {
+      gEcu->rx_ring->hw_overrun[fifo & (SAE_J1939_RX_FIFO_NUM - 1)]++;
   }
+}
+
+/** ***************************************************************************
+ * @name  aceinna_j1939_receive_isr() an API of receiving handler
+ * @brief publishes the slot returned by aceinna_j1939_rx_reserve() once the
+ *        frame has been read into it, and wakes the CAN task when the ring
+ *        was empty
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void aceinna_j1939_receive_isr(void)
+{
+  SAE_J1939_RX_RING *ring = gEcu->rx_ring;
+  struct sae_j1939_rx_desc *desc = &ring->desc[ring->head & (SAE_J1939_RX_RING_DEPTH - 1)];
+  uint16_t level;
   
   desc->rx_pkt_ready = DESC_OCCUPIED;
+  ring->frames++;
+  ring->bits += SAE_J1939_FRAME_BITS(desc->rx_buffer.DLC);
+  
+  // slot contents are visible before the new head
+  __DMB();
+  ring->head++;
+  
+  level = ring->head - ring->tail;
+  if (level > ring->high_water) {
+      ring->high_water = level;
+  }
   
-  if (desc->next->rx_pkt_ready == DESC_IDLE){
-    gEcu->curr_rx_desc = gEcu->curr_rx_desc->next;
+  // a non-empty ring is drained by the wakeup already pending
+  if (level == 1) {
+      CANTaskSignal(CAN_EVENT_RX);
   }
   
   return;
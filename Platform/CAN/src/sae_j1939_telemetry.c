@@ -0,0 +1,468 @@
+/** ***************************************************************************
+ * @file sae_j1939_telemetry.c CAN bus load and error telemetry
+ * @brief  Copyright (c) 2018 All Rights Reserved.
+ *
+ * The rx and tx interrupts keep free running frame and bit counts in
+ * ecu_rx_ring and ecu_tx_stats; a window is the difference between two
+ * readings. Only frames that pass the acceptance filters are seen, so the
+ * load is a lower bound of the real bus load when the filters are narrow,
+ * the mailbox waits of the data PGNs show contention from the rest of the bus.
+ *
+ * Per PGN timing is recorded by the tx interrupt into one of two banks; the
+ * task flips the bank at the end of a window and reads the other one, which
+ * the interrupt no longer touches.
+ *
+ * THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+ * KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ *****************************************************************************/
+#ifdef SAE_J1939
+#include <string.h>
+#include "stm32f4xx.h"
+#include "osapi.h"
+#include "sae_j1939.h"
+#include "sae_j1939_telemetry.h"
+
+#define TELEMETRY_NA_8          250         // J1939 valid range of 1 and 2 byte values
+#define TELEMETRY_NA_16         0xFAFF
+
+// tx interrupt side of a tracked PGN, carried across windows
+typedef struct {
+  uint32_t        pgn;
+  uint32_t        last_queued;          // TIM5 counts
+  uint32_t        last_sent;
+  uint8_t         primed;               // last_* valid
+} TELEMETRY_PGN_TRACK;
+
+// one window of a tracked PGN, TIM5 counts
+typedef struct {
+  uint16_t        sent;
+  uint32_t        queue_min;
+  uint32_t        queue_max;
+  uint32_t        tx_min;
+  uint32_t        tx_max;
+  uint32_t        wait_max;
+} TELEMETRY_PGN_WINDOW;
+
+// free running counters at the start of the window
+typedef struct {
+  uint32_t        time_ms;
+  uint32_t        rx_frames;
+  uint32_t        rx_bits;
+  uint32_t        tx_frames;
+  uint32_t        tx_bits;
+  uint32_t        rx_lost;
+  uint32_t        rx_hw_lost;
+  uint32_t        mailbox_full;
+  uint32_t        no_desc;
+} TELEMETRY_MARK;
+
+static TELEMETRY_PGN_TRACK   pgn_track[SAE_J1939_TELEMETRY_MAX_PGNS];
+static uint8_t               pgn_tracked;
+static TELEMETRY_PGN_WINDOW  pgn_window[2][SAE_J1939_TELEMETRY_MAX_PGNS];
+static volatile uint8_t      pgn_bank;
+
+static TELEMETRY_MARK        mark;
+static uint8_t               tec_max, rec_max, state_max, window_lec, last_state;
+static uint16_t              bus_off;
+
+static SAE_J1939_TELEMETRY   report[2];
+static volatile uint8_t      report_idx;
+static uint8_t               report_valid;
+
+
+static void _mark(TELEMETRY_MARK *m)
+{
+  int i;
+
+  memset(m, 0, sizeof(*m));
+  m->time_ms      = getSystemTime();
+  m->rx_frames    = ecu_rx_ring.frames;
+  m->rx_bits      = ecu_rx_ring.bits;
+  m->tx_bits      = ecu_tx_stats.bits;
+  m->mailbox_full = ecu_tx_stats.mailbox_full;
+  m->no_desc      = ecu_tx_stats.no_desc;
+  for (i = 0; i < SAE_J1939_PRIORITY_LEVELS; i++)
+    m->tx_frames += ecu_tx_stats.sent[i];
+  for (i = 0; i < SAE_J1939_RX_FIFO_NUM; i++) {
+    m->rx_lost    += ecu_rx_ring.overrun[i];
+    m->rx_hw_lost += ecu_rx_ring.hw_overrun[i];
+  }
+}
+
+static void _reset_errors(void)
+{
+  tec_max    = 0;
+  rec_max    = 0;
+  state_max  = last_state;
+  window_lec = 0;
+  bus_off    = 0;
+}
+
+/** ***************************************************************************
+ * @name _sample_errors() read the controller error state
+ * @brief once per CAN task tick. LEC is set to 7 after each read so a code
+ *        other than 7 is a new error; bus-off episodes shorter than a tick
+ *        are recovered by ABOM before they are seen
+ *
+ * @param [out] tec, rec, current counters
+ * @retval N/A
+ ******************************************************************************/
+static void _sample_errors(uint8_t *tec, uint8_t *rec)
+{
+  uint32_t esr = CAN1->ESR;
+  uint8_t  lec = (esr & CAN_ESR_LEC) >> 4;
+  uint8_t  state;
+
+  *tec = (esr & CAN_ESR_TEC) >> 16;
+  *rec = (esr & CAN_ESR_REC) >> 24;
+
+  if (esr & CAN_ESR_BOFF)
+    state = J1939_BUS_OFF;
+  else if (esr & CAN_ESR_EPVF)
+    state = J1939_BUS_ERROR_PASSIVE;
+  else if (esr & CAN_ESR_EWGF)
+    state = J1939_BUS_ERROR_WARNING;
+  else
+    state = J1939_BUS_ERROR_ACTIVE;
+
+  if (state == J1939_BUS_OFF && last_state != J1939_BUS_OFF && bus_off < 0xFFFF)
+    bus_off++;
+  last_state = state;
+
+  if (state > state_max)
+    state_max = state;
+  if (*tec > tec_max)
+    tec_max = *tec;
+  if (*rec > rec_max)
+    rec_max = *rec;
+  if (lec != 0 && lec != 7) {
+    window_lec = lec;
+    CAN1->ESR = CAN_ESR_LEC;
+  }
+}
+
+static void _put16(uint8_t *data, uint32_t value)
+{
+  if (value > TELEMETRY_NA_16)
+    value = TELEMETRY_NA_16;
+  data[0] = value;
+  data[1] = value >> 8;
+}
+
+static uint8_t _sat8(uint32_t value)
+{
+  return value > TELEMETRY_NA_8 ? TELEMETRY_NA_8 : value;
+}
+
+static uint8_t _send_page(uint8_t *data)
+{
+  msg_params_t params;
+
+  params.data_page = 0;
+  params.ext_page  = 0;
+  params.pkt_type  = SAE_J1939_RESPONSE_PACKET;
+  params.priority  = SAE_J1939_TELEMETRY_PRIORITY;
+  params.PF        = SAE_J1939_PDU_FORMAT_GLOBAL;
+  params.PS        = gEcuConfigPtr->telemetry_ps;
+  params.len       = SAE_J1939_PAYLOAD_MAX_LEN;
+
+  return aceinna_j1939_build_msg((void *)data, &params);
+}
+
+/** ***************************************************************************
+ * @name _send_report() publish a window on the telemetry PGN
+ * @brief little endian, 0.4 %/bit load, jitters in 10 us and the mailbox
+ *        wait in 100 us. Counts saturate at 250 / 0xFAFF
+ *
+ * @param [in] r, closed window
+ * @retval N/A
+ ******************************************************************************/
+static void _send_report(SAE_J1939_TELEMETRY *r)
+{
+  uint8_t data[8];
+  int     i;
+
+  data[0] = SAE_J1939_TELEMETRY_PAGE_BUS;
+  data[1] = r->load_permille / 4;
+  data[2] = r->tec;
+  data[3] = r->rec;
+  data[4] = r->tec_max;
+  data[5] = r->rec_max;
+  data[6] = 0xE0 | (r->lec << 2) | r->state;
+  data[7] = _sat8(r->bus_off);
+  if (!_send_page(data))
+    return;
+
+  data[0] = SAE_J1939_TELEMETRY_PAGE_FRAMES;
+  _put16(&data[1], r->rx_lost);
+  data[3] = _sat8(r->rx_hw_lost);
+  _put16(&data[4], r->mailbox_full);
+  data[6] = _sat8(r->tx_no_desc);
+  data[7] = _sat8(r->rx_high_water);
+  if (!_send_page(data))
+    return;
+
+  for (i = 0; i < r->pgns; i++) {
+    data[0] = SAE_J1939_TELEMETRY_PAGE_PGN + i;
+    data[1] = r->pgn[i].pgn;                // data page 0 PGNs only
+    data[2] = r->pgn[i].pgn >> 8;
+    _put16(&data[3], r->pgn[i].queue_jitter_us / 10);
+    _put16(&data[5], r->pgn[i].tx_jitter_us / 10);
+    data[7] = _sat8(r->pgn[i].max_wait_us / 100);
+    if (!_send_page(data))
+      return;
+  }
+}
+
+/** ***************************************************************************
+ * @name _close_window() turn the counters since the last window into a report
+ * @brief the report is built in the spare buffer and becomes current when
+ *        complete
+ *
+ * @param [in] tec, rec, counters at the end of the window
+ * @retval N/A
+ ******************************************************************************/
+static void _close_window(uint8_t tec, uint8_t rec)
+{
+  SAE_J1939_TELEMETRY *r = &report[report_idx ^ 1];
+  TELEMETRY_PGN_WINDOW *w;
+  TELEMETRY_MARK now;
+  uint64_t bits;
+  uint8_t  bank;
+  int      i;
+
+  // the tx ISR moves to the other bank from its next frame on
+  bank     = pgn_bank;
+  pgn_bank = bank ^ 1;
+  __DMB();
+
+  _mark(&now);
+  memset(r, 0, sizeof(*r));
+  r->window_ms     = now.time_ms - mark.time_ms;
+  r->tec           = tec;
+  r->rec           = rec;
+  r->tec_max       = tec_max;
+  r->rec_max       = rec_max;
+  r->state         = state_max;
+  r->lec           = window_lec;
+  r->bus_off       = bus_off;
+  r->rx_frames     = now.rx_frames - mark.rx_frames;
+  r->tx_frames     = now.tx_frames - mark.tx_frames;
+  r->rx_lost       = now.rx_lost - mark.rx_lost;
+  r->rx_hw_lost    = now.rx_hw_lost - mark.rx_hw_lost;
+  r->mailbox_full  = now.mailbox_full - mark.mailbox_full;
+  r->tx_no_desc    = now.no_desc - mark.no_desc;
+  r->rx_high_water = ecu_rx_ring.high_water;
+
+  // frames dropped on a full ring were on the bus too, count them full size
+  bits = (uint64_t)(now.rx_bits - mark.rx_bits) + (now.tx_bits - mark.tx_bits) +
+         (uint64_t)r->rx_lost * SAE_J1939_FRAME_BITS(SAE_J1939_PAYLOAD_MAX_LEN);
+  if (r->window_ms) {
+    bits = bits * 1000 / ((uint64_t)sae_j1939_bitrate_kbps() * r->window_ms);
+    r->load_permille = bits > 1000 ? 1000 : (uint16_t)bits;
+  }
+
+  for (i = 0; i < pgn_tracked; i++) {
+    w = &pgn_window[bank][i];
+    if (!w->sent)
+      continue;
+    r->pgn[r->pgns].pgn  = pgn_track[i].pgn;
+    r->pgn[r->pgns].sent = w->sent;
+    if (w->queue_max) {
+      r->pgn[r->pgns].queue_jitter_us = (w->queue_max - w->queue_min) / SAE_J1939_TIMER_TICKS_PER_US;
+      r->pgn[r->pgns].tx_jitter_us    = (w->tx_max - w->tx_min) / SAE_J1939_TIMER_TICKS_PER_US;
+    }
+    r->pgn[r->pgns].max_wait_us = w->wait_max / SAE_J1939_TIMER_TICKS_PER_US;
+    r->pgns++;
+  }
+  memset(pgn_window[bank], 0, sizeof(pgn_window[bank]));
+
+  report_idx   ^= 1;
+  report_valid  = 1;
+  mark          = now;
+  _reset_errors();
+}
+
+/** ***************************************************************************
+ * @name j1939_telemetry_set_ps() move the telemetry PGN
+ * @brief the IGNORE entry follows, so the telemetry of other units stays
+ *        dropped. A PS already routed to something else is refused
+ *
+ * @param [in] ps, new PS of the telemetry PGN
+ * @retval 1 successful or 0 failure
+ ******************************************************************************/
+uint8_t j1939_telemetry_set_ps(uint8_t ps)
+{
+  SAE_J1939_PGN_ENTRY *entry;
+  uint32_t old = (SAE_J1939_PDU_FORMAT_GLOBAL << 8) | gEcuConfigPtr->telemetry_ps;
+  uint32_t pgn = (SAE_J1939_PDU_FORMAT_GLOBAL << 8) | ps;
+
+  if (pgn == old)
+    return 1;
+
+  entry = j1939_lookup_pgn(pgn);
+  if (entry != NULL && !(entry->handler == NULL && (entry->flags & SAE_J1939_PGN_IGNORE)))
+    return 0;
+  if (!j1939_register_pgn(pgn, NULL, SAE_J1939_PGN_IGNORE))
+    return 0;
+
+  entry = j1939_lookup_pgn(old);
+  if (entry != NULL && entry->handler == NULL && (entry->flags & SAE_J1939_PGN_IGNORE))
+    j1939_unregister_pgn(old);
+
+  gEcuConfigPtr->telemetry_ps = ps;
+  return 1;
+}
+
+// SET command, SAE_J1939_TELEMETRY_CFG_PAYLOAD
+static void _telemetry_config(struct sae_j1939_rx_desc *desc)
+{
+  SAE_J1939_TELEMETRY_CFG_PAYLOAD *cfg = (SAE_J1939_TELEMETRY_CFG_PAYLOAD *)desc->rx_buffer.Data;
+
+  if (cfg->dest_address != *gEcuInst.addr)
+    return;
+
+  if (cfg->telemetry_ps && !j1939_telemetry_set_ps(cfg->telemetry_ps))
+    return;
+
+  if (cfg->telemetry_period)
+    gEcuConfigPtr->telemetry_period = cfg->telemetry_period;
+
+  if (cfg->telemetry_ps || cfg->telemetry_period)
+    gEcuConfigPtr->config_changed = 1;
+}
+
+/** ***************************************************************************
+ * @name j1939_telemetry_init() start the first window
+ * @brief called from sae_j1939_initialize(). Telemetry of other units on the
+ *        same PGN is dropped, the SET command is routed to
+ *        _telemetry_config()
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void j1939_telemetry_init(void)
+{
+  memset(pgn_track, 0, sizeof(pgn_track));
+  memset(pgn_window, 0, sizeof(pgn_window));
+  pgn_tracked  = 0;
+  pgn_bank     = 0;
+  report_idx   = 0;
+  report_valid = 0;
+  last_state   = J1939_BUS_ERROR_ACTIVE;
+  _reset_errors();
+  _mark(&mark);
+
+  if (j1939_lookup_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | gEcuConfigPtr->telemetry_ps) == NULL)
+    j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | gEcuConfigPtr->telemetry_ps, NULL, SAE_J1939_PGN_IGNORE);
+  j1939_register_pgn((SAE_J1939_PDU_FORMAT_GLOBAL << 8) | SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY_CFG,
+                     _telemetry_config, 0);
+}
+
+/** ***************************************************************************
+ * @name j1939_telemetry_process() sample and publish
+ * @brief called on every CAN task tick; closes a window every
+ *        telemetry_period and sends it unless the period is
+ *        SAE_J1939_TELEMETRY_PERIOD_OFF
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void j1939_telemetry_process(void)
+{
+  uint32_t period = gEcuConfigPtr->telemetry_period;
+  uint8_t  tec, rec;
+
+  _sample_errors(&tec, &rec);
+
+  if (period == SAE_J1939_TELEMETRY_PERIOD_OFF || period == 0)
+    period = SAE_J1939_TELEMETRY_PERIOD_DEFAULT;
+  if (getSystemTime() - mark.time_ms < period * SAE_J1939_TELEMETRY_PERIOD_UNIT_MS)
+    return;
+
+  _close_window(tec, rec);
+
+  if (gEcuConfigPtr->telemetry_period != SAE_J1939_TELEMETRY_PERIOD_OFF)
+    _send_report(&report[report_idx]);
+}
+
+/** ***************************************************************************
+ * @name j1939_telemetry_tx() record a frame loaded into a mailbox
+ * @brief tx interrupt, from ecu_tx_refill(). Broadcast data PGNs only, the
+ *        first SAE_J1939_TELEMETRY_MAX_PGNS seen get a slot
+ *
+ * @param [in] desc, the frame
+ *             now, TIM5 count at the mailbox load
+ * @retval N/A
+ ******************************************************************************/
+void j1939_telemetry_tx(struct sae_j1939_tx_desc *desc, uint32_t now)
+{
+  TELEMETRY_PGN_TRACK  *t;
+  TELEMETRY_PGN_WINDOW *w;
+  uint32_t pgn;
+  uint32_t queue, tx, wait;
+  int      i;
+
+  if (desc->tx_pkt_type != SAE_J1939_DATA_PACKET ||
+      desc->tx_identifier.pdu_format < SAE_J1939_PDU_FORMAT_DATA)
+    return;
+
+  pgn = j1939_pgn(&desc->tx_identifier);
+  for (i = 0; i < pgn_tracked; i++) {
+    if (pgn_track[i].pgn == pgn)
+      break;
+  }
+  if (i == pgn_tracked) {
+    if (pgn_tracked == SAE_J1939_TELEMETRY_MAX_PGNS)
+      return;
+    pgn_track[i].pgn    = pgn;
+    pgn_track[i].primed = 0;
+    pgn_tracked++;
+  }
+
+  t    = &pgn_track[i];
+  w    = &pgn_window[pgn_bank][i];
+  wait = now - desc->tx_queued_at;
+
+  if (t->primed) {
+    queue = desc->tx_queued_at - t->last_queued;
+    tx    = now - t->last_sent;
+    if (!w->queue_max || queue < w->queue_min)
+      w->queue_min = queue;
+    if (queue > w->queue_max)
+      w->queue_max = queue;
+    if (!w->tx_max || tx < w->tx_min)
+      w->tx_min = tx;
+    if (tx > w->tx_max)
+      w->tx_max = tx;
+  }
+  if (wait > w->wait_max)
+    w->wait_max = wait;
+  w->sent++;
+
+  t->last_queued = desc->tx_queued_at;
+  t->last_sent   = now;
+  t->primed      = 1;
+}
+
+/** ***************************************************************************
+ * @name j1939_telemetry_get() latest closed window
+ * @brief for the UCB "CT" packet, any task
+ *
+ * @param [out] out, copy of the window
+ * @retval 1 valid or 0 no window closed yet
+ ******************************************************************************/
+uint8_t j1939_telemetry_get(SAE_J1939_TELEMETRY *out)
+{
+  if (!report_valid)
+    return 0;
+
+  memcpy(out, &report[report_idx], sizeof(*out));
+
+  return 1;
+}
+
+#endif // SAE_J1939
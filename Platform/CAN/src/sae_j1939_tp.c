@@ -0,0 +1,521 @@
+/** ***************************************************************************
+ * @file sae_j1939_tp.c SAE J1939-21 transport protocol
+ * @brief  Copyright (c) 2018 All Rights Reserved.
+ *
+ * TP.CM / TP.DT handling for messages longer than 8 bytes. Incoming TP.DT
+ * payloads are written straight to their offset in the session's reassembly
+ * buffer and handed to the application in place; outgoing messages are sent
+ * from the caller's buffer. Transmission is paced from j1939_tp_process() and
+ * j1939_tp_pump() so a bulk transfer never takes more than
+ * SAE_J1939_TP_DT_PER_TICK tx descriptors per CAN task wakeup.
+ *
+ * THIS CODE AND INFORMATION ARE PROVIDED "AS IS" WITHOUT WARRANTY OF ANY
+ * KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+ * PARTICULAR PURPOSE.
+ *
+ *****************************************************************************/
+#ifdef SAE_J1939
+#include <string.h>
+#include "sae_j1939.h"
+#include "sae_j1939_tp.h"
+
+#define TP_MAX_MESSAGE_SIZE     (255 * SAE_J1939_TP_PACKET_LEN)
+#define TP_GLOBAL_ADDRESS       SAE_J1939_GROUP_EXTENSION_ACK
+#define TP_US(ms)               ((int32_t)(ms) * 1000)    // session timer
+
+SAE_J1939_TP_STATS j1939TpStats;
+
+static SAE_J1939_TP_SESSION  tp_session[SAE_J1939_TP_MAX_SESSIONS];
+static uint8_t               tp_rx_buffer[SAE_J1939_TP_MAX_SESSIONS][SAE_J1939_TP_MAX_SIZE];
+static j1939_tp_rx_handler_t tp_rx_handler = NULL;
+
+
+static uint8_t _tp_send_frame(uint8_t pf, uint8_t ps, uint8_t priority, uint8_t *data)
+{
+  msg_params_t params;
+
+  params.data_page = 0;
+  params.ext_page  = 0;
+  params.pkt_type  = SAE_J1939_DATA_PACKET;
+  params.len       = SAE_J1939_PAYLOAD_MAX_LEN;
+  params.priority  = priority;
+  params.PF        = pf;
+  params.PS        = ps;
+
+  return aceinna_j1939_build_msg((void *)data, &params);
+}
+
+static uint8_t _tp_send_cm(SAE_J1939_TP_SESSION *s, uint8_t control, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+{
+  uint8_t data[8];
+
+  data[0] = control;
+  data[1] = b1;
+  data[2] = b2;
+  data[3] = b3;
+  data[4] = b4;
+  data[5] = s->pgn;
+  data[6] = s->pgn >> 8;
+  data[7] = s->pgn >> 16;
+
+  return _tp_send_frame(SAE_J1939_PDU_FORMAT_TP_CM, s->peer, s->priority, data);
+}
+
+static void _tp_abort(SAE_J1939_TP_SESSION *s, uint8_t reason)
+{
+  if (s->peer != TP_GLOBAL_ADDRESS) {
+    _tp_send_cm(s, SAE_J1939_TP_CM_ABORT, reason, 0xFF, 0xFF, 0xFF);
+  }
+  j1939TpStats.aborts++;
+  s->state = J1939_TP_IDLE;
+}
+
+static uint8_t _tp_send_dt(SAE_J1939_TP_SESSION *s)
+{
+  uint8_t  data[8];
+  uint16_t offset = (uint16_t)(s->next - 1) * SAE_J1939_TP_PACKET_LEN;
+  uint16_t len    = s->size - offset;
+
+  if (len > SAE_J1939_TP_PACKET_LEN)
+    len = SAE_J1939_TP_PACKET_LEN;
+
+  data[0] = (uint8_t)s->next;
+  memset(&data[1], 0xFF, SAE_J1939_TP_PACKET_LEN);
+  memcpy(&data[1], s->tx_data + offset, len);
+
+  if (!_tp_send_frame(SAE_J1939_PDU_FORMAT_TP_DT, s->peer, s->priority, data))
+    return 0;
+
+  s->next++;
+  return 1;
+}
+
+/// grant the next window of a connection mode receive
+static void _tp_send_cts(SAE_J1939_TP_SESSION *s)
+{
+  uint8_t num = s->packets - s->next + 1;
+
+  if (num > SAE_J1939_TP_CTS_PACKETS)
+    num = SAE_J1939_TP_CTS_PACKETS;
+  if (num > s->max_per_cts)
+    num = s->max_per_cts;
+
+  s->window_end = s->next + num - 1;
+  s->timer      = TP_US(SAE_J1939_TP_T2);
+  _tp_send_cm(s, SAE_J1939_TP_CM_CTS, num, (uint8_t)s->next, 0xFF, 0xFF);
+}
+
+/// transmit session to peer (0xFF for BAM), any PGN when anyPgn is set
+static SAE_J1939_TP_SESSION *_tp_find_tx(uint8_t peer, uint32_t pgn, BOOL anyPgn)
+{
+  SAE_J1939_TP_SESSION *s;
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    s = &tp_session[i];
+    if (s->state >= J1939_TP_TX_BAM && s->peer == peer && (anyPgn || s->pgn == pgn))
+      return s;
+  }
+
+  return NULL;
+}
+
+/// receive session from source, broadcast or connection mode
+static SAE_J1939_TP_SESSION *_tp_find_rx(uint8_t source, BOOL bam)
+{
+  SAE_J1939_TP_SESSION *s;
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    s = &tp_session[i];
+    if (s->peer == source && s->state == (bam ? J1939_TP_RX_BAM : J1939_TP_RX_CMDT))
+      return s;
+  }
+
+  return NULL;
+}
+
+static SAE_J1939_TP_SESSION *_tp_alloc(void)
+{
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    if (tp_session[i].state == J1939_TP_IDLE) {
+      memset(&tp_session[i], 0, sizeof(SAE_J1939_TP_SESSION));
+      tp_session[i].rx_data = tp_rx_buffer[i];
+      return &tp_session[i];
+    }
+  }
+
+  return NULL;
+}
+
+/** ***************************************************************************
+ * @name _tp_rx_open() start receiving a BAM or RTS announced message
+ *
+ * @param [in] desc, TP.CM frame
+ *             bam, TRUE for a broadcast announce
+ * @retval N/A
+ ******************************************************************************/
+static void _tp_rx_open(struct sae_j1939_rx_desc *desc, BOOL bam)
+{
+  SAE_J1939_TP_SESSION *s;
+  SAE_J1939_TP_SESSION reject;
+  uint8_t  *data   = desc->rx_buffer.Data;
+  uint8_t  source  = desc->rx_identifier.source;
+  uint16_t size    = data[1] | ((uint16_t)data[2] << 8);
+  uint8_t  packets = data[3];
+  uint32_t pgn     = data[5] | ((uint32_t)data[6] << 8) | ((uint32_t)data[7] << 16);
+
+  // a new announce from the same node replaces its open session
+  s = _tp_find_rx(source, bam);
+  if (s != NULL) {
+    s->state = J1939_TP_IDLE;
+  }
+
+  if (size > SAE_J1939_TP_MAX_SIZE || size <= SAE_J1939_PAYLOAD_MAX_LEN ||
+      packets != (size + SAE_J1939_TP_PACKET_LEN - 1) / SAE_J1939_TP_PACKET_LEN ||
+      (s = _tp_alloc()) == NULL) {
+    j1939TpStats.rejected++;
+    if (!bam) {
+      reject.peer     = source;
+      reject.pgn      = pgn;
+      reject.priority = SAE_J1939_TP_PRIORITY;
+      _tp_abort(&reject, SAE_J1939_TP_ABORT_RESOURCES);
+    }
+    return;
+  }
+
+  s->peer     = source;
+  s->priority = SAE_J1939_TP_PRIORITY;
+  s->pgn      = pgn;
+  s->size     = size;
+  s->packets  = packets;
+  s->next     = 1;
+
+  if (bam) {
+    s->window_end = packets;
+    s->timer      = TP_US(SAE_J1939_TP_T1);
+    s->state      = J1939_TP_RX_BAM;
+  } else {
+    s->max_per_cts = data[4] ? data[4] : 0xFF;
+    s->state       = J1939_TP_RX_CMDT;
+    _tp_send_cts(s);
+  }
+}
+
+/** ***************************************************************************
+ * @name _tp_cm_handler() TP.CM frames, registered PGN handler
+ *
+ * @param [in] desc, rx descriptor
+ * @retval N/A
+ ******************************************************************************/
+static void _tp_cm_handler(struct sae_j1939_rx_desc *desc)
+{
+  SAE_J1939_TP_SESSION *s;
+  uint8_t  *data  = desc->rx_buffer.Data;
+  uint8_t  source = desc->rx_identifier.source;
+  uint32_t pgn    = data[5] | ((uint32_t)data[6] << 8) | ((uint32_t)data[7] << 16);
+
+  if (desc->rx_buffer.DLC < SAE_J1939_PAYLOAD_MAX_LEN)
+    return;
+
+  switch (data[0]) {
+  case SAE_J1939_TP_CM_BAM:
+    if (desc->rx_identifier.pdu_specific == TP_GLOBAL_ADDRESS)
+      _tp_rx_open(desc, TRUE);
+    break;
+  case SAE_J1939_TP_CM_RTS:
+    if (desc->rx_identifier.pdu_specific != TP_GLOBAL_ADDRESS)
+      _tp_rx_open(desc, FALSE);
+    break;
+  case SAE_J1939_TP_CM_CTS:
+    s = _tp_find_tx(source, pgn, FALSE);
+    if (s == NULL || (s->state != J1939_TP_TX_WAIT_CTS && s->state != J1939_TP_TX_CMDT))
+      break;
+    if (data[1] == 0) {
+      // peer holds the connection open
+      s->state = J1939_TP_TX_WAIT_CTS;
+      s->timer = TP_US(SAE_J1939_TP_T4);
+      break;
+    }
+    if (data[2] == 0 || data[2] > s->packets) {
+      _tp_abort(s, SAE_J1939_TP_ABORT_RESOURCES);
+      break;
+    }
+    s->next       = data[2];
+    s->window_end = data[2] + data[1] - 1;
+    if (s->window_end > s->packets || s->window_end < s->next)
+      s->window_end = s->packets;
+    s->state      = J1939_TP_TX_CMDT;
+    break;
+  case SAE_J1939_TP_CM_EOM_ACK:
+    s = _tp_find_tx(source, pgn, FALSE);
+    if (s != NULL && s->state == J1939_TP_TX_WAIT_ACK) {
+      j1939TpStats.tx_done++;
+      s->state = J1939_TP_IDLE;
+    }
+    break;
+  case SAE_J1939_TP_CM_ABORT:
+    s = _tp_find_tx(source, pgn, FALSE);
+    if (s == NULL) {
+      s = _tp_find_rx(source, FALSE);
+      if (s != NULL && s->pgn != pgn)
+        s = NULL;
+    }
+    if (s != NULL) {
+      j1939TpStats.aborts++;
+      s->state = J1939_TP_IDLE;
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+/** ***************************************************************************
+ * @name _tp_dt_handler() TP.DT frames, registered PGN handler
+ * @brief payload goes straight to its offset in the reassembly buffer
+ *
+ * @param [in] desc, rx descriptor
+ * @retval N/A
+ ******************************************************************************/
+static void _tp_dt_handler(struct sae_j1939_rx_desc *desc)
+{
+  SAE_J1939_TP_SESSION *s;
+  uint8_t  *data  = desc->rx_buffer.Data;
+  BOOL     bam    = desc->rx_identifier.pdu_specific == TP_GLOBAL_ADDRESS;
+  uint16_t offset, len;
+
+  s = _tp_find_rx(desc->rx_identifier.source, bam);
+  if (s == NULL)
+    return;
+
+  if (data[0] != s->next) {
+    // lost or repeated packet: BAM can't recover, CMDT asks again
+    if (bam) {
+      j1939TpStats.rejected++;
+      s->state = J1939_TP_IDLE;
+    } else if (data[0] > s->next) {
+      _tp_send_cts(s);
+    }
+    return;
+  }
+
+  offset = (uint16_t)(s->next - 1) * SAE_J1939_TP_PACKET_LEN;
+  len    = s->size - offset;
+  if (len > SAE_J1939_TP_PACKET_LEN)
+    len = SAE_J1939_TP_PACKET_LEN;
+  memcpy(s->rx_data + offset, &data[1], len);
+  s->next++;
+  s->timer = TP_US(SAE_J1939_TP_T1);
+
+  if (s->next > s->packets) {
+    if (!bam)
+      _tp_send_cm(s, SAE_J1939_TP_CM_EOM_ACK, s->size, s->size >> 8, s->packets, 0xFF);
+    j1939TpStats.rx_done++;
+    if (tp_rx_handler != NULL)
+      tp_rx_handler(s->pgn, desc->rx_identifier.source, s->rx_data, s->size);
+    s->state = J1939_TP_IDLE;
+  } else if (!bam && s->next > s->window_end) {
+    _tp_send_cts(s);
+  }
+}
+
+/** ***************************************************************************
+ * @name j1939_tp_init() reset sessions and register the TP PGNs
+ * @brief called from sae_j1939_initialize() after the PGN table is cleared
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void j1939_tp_init(void)
+{
+  memset(tp_session, 0, sizeof(tp_session));
+  memset(&j1939TpStats, 0, sizeof(j1939TpStats));
+
+  j1939_register_pgn(SAE_J1939_PDU_FORMAT_TP_CM << 8, _tp_cm_handler, 0);
+  j1939_register_pgn(SAE_J1939_PDU_FORMAT_TP_DT << 8, _tp_dt_handler, 0);
+}
+
+void j1939_tp_set_rx_handler(j1939_tp_rx_handler_t handler)
+{
+  tp_rx_handler = handler;
+}
+
+/** ***************************************************************************
+ * @name j1939_tp_send() send a message of any length
+ * @brief up to 8 bytes go out as a single frame. Longer messages are
+ *        broadcast with BAM (dest 0xFF) or sent with RTS/CTS; the data is not
+ *        copied and must stay valid while j1939_tp_tx_pending() reports it.
+ *
+ * @param [in] pgn, parameter group number
+ *             priority, priority of the single frame or TP frames
+ *             dest, destination address or 0xFF
+ *             data, len - message
+ * @retval 1 queued or 0 no session / tx descriptor available
+ ******************************************************************************/
+uint8_t j1939_tp_send(uint32_t pgn, uint8_t priority, uint8_t dest, const uint8_t *data, uint16_t len)
+{
+  SAE_J1939_TP_SESSION *s;
+  uint8_t pf = (pgn >> 8) & 0xff;
+  uint8_t ps = (pf < SAE_J1939_PDU_FORMAT_DATA) ? dest : (pgn & 0xff);
+  uint8_t frame[8];
+
+  if (len <= SAE_J1939_PAYLOAD_MAX_LEN) {
+    memset(frame, 0xFF, sizeof(frame));
+    memcpy(frame, data, len);
+    return _tp_send_frame(pf, ps, priority, frame);
+  }
+
+  if (len > TP_MAX_MESSAGE_SIZE)
+    return 0;
+
+  // one BAM at a time, one connection per destination
+  if (_tp_find_tx(dest, 0, TRUE) != NULL || (s = _tp_alloc()) == NULL)
+    return 0;
+
+  s->peer     = dest;
+  s->priority = priority;
+  s->pgn      = pgn;
+  s->size     = len;
+  s->packets  = (len + SAE_J1939_TP_PACKET_LEN - 1) / SAE_J1939_TP_PACKET_LEN;
+  s->next     = 1;
+  s->tx_data  = data;
+
+  if (dest == TP_GLOBAL_ADDRESS) {
+    if (!_tp_send_cm(s, SAE_J1939_TP_CM_BAM, len, len >> 8, s->packets, 0xFF))
+      return 0;
+    s->window_end = s->packets;
+    s->timer      = TP_US(SAE_J1939_TP_BAM_INTERVAL_MS);
+    s->state      = J1939_TP_TX_BAM;
+  } else {
+    if (!_tp_send_cm(s, SAE_J1939_TP_CM_RTS, len, len >> 8, s->packets, 0xFF))
+      return 0;
+    s->timer = TP_US(SAE_J1939_TP_T3);
+    s->state = J1939_TP_TX_WAIT_CTS;
+  }
+
+  return 1;
+}
+
+uint8_t j1939_tp_tx_pending(const uint8_t *data)
+{
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    if (tp_session[i].state >= J1939_TP_TX_BAM && tp_session[i].tx_data == data)
+      return 1;
+  }
+
+  return 0;
+}
+
+/** ***************************************************************************
+ * @name _tp_send_window() send the next frames of an open CTS window
+ * @brief at most SAE_J1939_TP_DT_PER_TICK frames, then waits for the next
+ *        CTS or the EOM once the window is done
+ *
+ * @param [in] s, session in J1939_TP_TX_CMDT
+ * @retval N/A
+ ******************************************************************************/
+static void _tp_send_window(SAE_J1939_TP_SESSION *s)
+{
+  int n;
+
+  for (n = 0; n < SAE_J1939_TP_DT_PER_TICK && s->next <= s->window_end; n++) {
+    if (!_tp_send_dt(s))
+      break;
+  }
+  if (s->next > s->window_end) {
+    s->state = (s->next > s->packets) ? J1939_TP_TX_WAIT_ACK : J1939_TP_TX_WAIT_CTS;
+    s->timer = TP_US(SAE_J1939_TP_T3);
+  }
+}
+
+/** ***************************************************************************
+ * @name j1939_tp_tx_window_open() a CTS window has frames left to send
+ * @brief read by the tx interrupt to decide whether j1939_tp_pump() has work
+ *
+ * @param [in]
+ * @retval 1 open or 0 none
+ ******************************************************************************/
+uint8_t j1939_tp_tx_window_open(void)
+{
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    if (tp_session[i].state == J1939_TP_TX_CMDT)
+      return 1;
+  }
+
+  return 0;
+}
+
+/** ***************************************************************************
+ * @name j1939_tp_pump() keep connection mode windows moving between loops
+ * @brief called from the CAN task when the tx queue has drained, so a CTS
+ *        window goes out at bus speed instead of one step per loop. Session
+ *        timers are left to j1939_tp_process()
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void j1939_tp_pump(void)
+{
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    if (tp_session[i].state == J1939_TP_TX_CMDT)
+      _tp_send_window(&tp_session[i]);
+  }
+}
+
+/** ***************************************************************************
+ * @name j1939_tp_process() timeouts and paced transmission
+ * @brief called once per CAN task loop, after the periodic data packets are
+ *        queued so they get the tx descriptors first
+ *
+ * @param [in]
+ * @retval N/A
+ ******************************************************************************/
+void j1939_tp_process(void)
+{
+  SAE_J1939_TP_SESSION *s;
+  int i;
+
+  for (i = 0; i < SAE_J1939_TP_MAX_SESSIONS; i++) {
+    s = &tp_session[i];
+    if (s->state == J1939_TP_IDLE)
+      continue;
+
+    s->timer -= SAE_J1939_TP_TICK_US;
+
+    switch (s->state) {
+    case J1939_TP_TX_BAM:
+      if (s->timer > 0 || !_tp_send_dt(s))
+        break;
+      s->timer = TP_US(SAE_J1939_TP_BAM_INTERVAL_MS);
+      if (s->next > s->packets) {
+        j1939TpStats.tx_done++;
+        s->state = J1939_TP_IDLE;
+      }
+      break;
+    case J1939_TP_TX_CMDT:
+      _tp_send_window(s);
+      break;
+    default:
+      if (s->timer <= 0) {
+        j1939TpStats.timeouts++;
+        if (s->state == J1939_TP_RX_BAM)
+          s->state = J1939_TP_IDLE;
+        else
+          _tp_abort(s, SAE_J1939_TP_ABORT_TIMEOUT);
+      }
+      break;
+    }
+  }
+}
+
+#endif // SAE_J1939
@@ -30,21 +30,42 @@
 // for can interface
 #include "canAPI.h"
 #include "sae_j1939.h"
+#include "sae_j1939_tp.h"
+#include "sae_j1939_telemetry.h"
+#include "sae_j1939_sched.h"
+#include "latency_probe.h"
 
    
-#define ADDRESS_CLAIM_RETRY                 5
+#define ADDRESS_CLAIM_RETRY                 (DACQ_ODR_HZ / 40)  // ticks, 25 ms
+#define ADDRESS_CLAIM_PERIOD                DACQ_ODR_HZ         // ticks, 1 s
 
 extern uint32_t tim5_heart_beat;
 
 extern uint32_t userCommunicationType;
 extern void setUserCommunicationType(uint32_t);
-uint32_t PacketRateCounter = 0;
 uint32_t CanLoopCounter    = 0;
 BOOL canStarted            = FALSE;
 
 _ECU_BAUD_RATE baudRate; 
 #define SAE_J1939_HEART_BEAT 2  // packets at 100 Hz
 
+static osThreadId canTaskId = NULL;
+
+/** ***************************************************************************
+ * @name CANTaskSignal() wake the CAN task
+ * @brief  sets CAN_EVENT_* flags of the task, callable from interrupts.
+ *         Events raised before the task runs are dropped
+ *
+ * @param [in] events, CAN_EVENT_* flags
+ * @retval N/A
+ ******************************************************************************/
+void CANTaskSignal(int32_t events)
+{
+    if (canTaskId != NULL) {
+        osSignalSet(canTaskId, events);
+    }
+}
+
 /** ***************************************************************************
  * @name TaskCANCommunication() CAN communication task
  * @brief  perform a thread of CAN transmission and receiving
@@ -54,8 +75,8 @@ _ECU_BAUD_RATE baudRate;
  ******************************************************************************/
 void TaskCANCommunicationJ1939(void const *argument)
 {
-    static int sendPeriodicPackets = 0;
-    int res;
+    osEvent evt;
+    int32_t events;
     _ECU_BAUD_RATE baudRate = (_ECU_BAUD_RATE)gEcuConfig.baudRate;
     int              address    = GetEcuAddress();
     BOOL  finished;
@@ -72,57 +93,79 @@ void TaskCANCommunicationJ1939(void const *argument)
     
     sae_j1939_initialize(baudRate, address);
     
-    // deactivate semaphore if active 
-    res = osSemaphoreWait(canDataSem, 0);
+    // start taking wakeups, drop anything left from before
+    canTaskId = osThreadGetId();
+    osSignalWait(CAN_EVENT_ALL, 0);
     // Main loop for the task
     while( 1 )
     {  
-        // wait for events from DACQ task
-        // Semaphore given at 200Hz
-        res = osSemaphoreWait(canDataSem, 1000);
-        if(res != osOK){
+        // acquisition tick at DACQ_ODR_HZ from the DACQ timer, rx and tx
+        // wakeups from the CAN interrupts in between
+        evt = osSignalWait(CAN_EVENT_ALL, 1000);
+        if(evt.status != osEventSignal){
             continue;
         }
+        events = evt.value.signals;
         
-        sendPeriodicPackets = 0;
-        CanLoopCounter++;
-
-        // Auto-detection 
-        if (gEcuInst.state == _ECU_BAUDRATE_DETECT) {
-            canStartDetectRxIntCounter =  canRxIntCounter;
-            finished = CAN_Detect_Baudrate(&baudRate);
-            if(!finished){
-                continue;
+        if (events & CAN_EVENT_TICK) {
+            CanLoopCounter++;
+
+            // Auto-detection 
+            if (gEcuInst.state == _ECU_BAUDRATE_DETECT) {
+                canStartDetectRxIntCounter =  canRxIntCounter;
+                finished = CAN_Detect_Baudrate(&baudRate);
+                if(!finished){
+                    continue;
+                }
+                gEcuInst.state = _ECU_CHECK_ADDRESS; 
             }
-            gEcuInst.state = _ECU_CHECK_ADDRESS; 
-        }
 
-        canStarted = TRUE;        
+            canStarted = TRUE;        
 
-        // address claiming state
-        if ((gEcuInst.state == _ECU_CHECK_ADDRESS) || (gEcuInst.state == _ECU_WAIT_ADDRESS)|| !(CanLoopCounter % 200)) {
-            if (CanLoopCounter > ADDRESS_CLAIM_RETRY){
-                gEcuInst.state = _ECU_READY;
+            // address claiming state
+            if ((gEcuInst.state == _ECU_CHECK_ADDRESS) || (gEcuInst.state == _ECU_WAIT_ADDRESS)|| !(CanLoopCounter % ADDRESS_CLAIM_PERIOD)) {
+                if (CanLoopCounter > ADDRESS_CLAIM_RETRY){
+                    gEcuInst.state = _ECU_READY;
+                }
+                send_address_claim(&gEcuInst);
             }
-            send_address_claim(&gEcuInst);
+        } else if (!canStarted) {
+            continue;
         }
+        
         // process incoming messages
         ecu_process();
 
+        if (!(events & CAN_EVENT_TICK)) {
+            // between ticks only responses and open TP windows go out
+            if (events & CAN_EVENT_TX_FREE) {
+                j1939_tp_pump();
+            }
+            ecu_transmit();
+            continue;
+        }
+
         uint64_t  dts = platformGetDacqTimeStamp();
         uint64_t  cts = platformGetCurrTimeStamp();
           // prepare outgoing data packets
         int latency   = (cts - dts)/100;    // in 0.1 ms  
 
-        PacketRateCounter++;
-        
-        if(PacketRateCounter >= gEcuConfig.packet_rate*2){
-            PacketRateCounter   = 0;
-            sendPeriodicPackets = 1;
-            // prepare and send outgoing periodic data packets
+        // periodic data packets due on this tick, each type at its own
+        // rate and phase, as many as the bus and tx queue can take
+        uint16_t due = j1939_sched_tick();
+        if (due) {
+          LATENCY_ARM(LATENCY_PATH_CAN);
         }
-
-        EnqeuePeriodicDataPackets(latency,sendPeriodicPackets);
+        j1939_sched_enqueue(latency, due);
+        if (due) {
+          LATENCY_PROBE(LATENCY_CAN_ENCODED);
+        }
+        
+        // bus load and error counters, telemetry PGN at its own period
+        j1939_telemetry_process();
+        
+        // multi-packet transfers get what is left of the tx queue
+        j1939_tp_process();
         
         
         ecu_transmit(); 
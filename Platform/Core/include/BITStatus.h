@@ -195,7 +195,8 @@ struct SW_STATUS_BITS {                 // bits
     uint16_t noMagnetometerheading : 1; // 5  magnetometer heading
     uint16_t noGPSTrackReference   : 1; // 6  GPS track
     uint16_t gpsUpdate             : 1; // 7  GPS measurement update
-    uint16_t rsvd                  : 8; // 8:15
+    uint16_t dacqDeadlineMiss      : 1; // 8  acquisition tick overrun or missed within the last second
+    uint16_t rsvd                  : 7; // 9:15
 };
 
 union SW_STATUS {
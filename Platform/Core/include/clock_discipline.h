@@ -0,0 +1,58 @@
+/** ***************************************************************************
+ * @file   clock_discipline.h
+ * @brief  PPS discipline of the data acquisition timer: a PI loop on the
+ *         phase of the dacq tick against the PPS sets the timer ticks of each
+ *         second, spread evenly over the samples of that second.
+ *         No hardware access, TIM2/TIM5 handling stays in
+ *         DataAcquisitionSupport.c.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef CLOCK_DISCIPLINE_H
+#define CLOCK_DISCIPLINE_H
+
+#include <stdint.h>
+
+// dacq tick this many timer ticks after the PPS edge (40 us at 60 MHz)
+#ifndef CLOCK_PHASE_TARGET
+#define CLOCK_PHASE_TARGET          2400
+#endif
+
+typedef enum {
+    CLOCK_UNLOCKED  = 0,        // no PPS yet, free running
+    CLOCK_ACQUIRING = 1,        // slewing the phase, frequency from the PPS period
+    CLOCK_LOCKED    = 2,        // phase error within CLOCK_LOCK_WINDOW
+    CLOCK_HOLDOVER  = 3         // PPS lost, last frequency kept
+} clock_lock_state_t;
+
+typedef struct {
+    clock_lock_state_t state;
+    int32_t  phaseErr;          // timer ticks, last PPS, tick late when positive
+    uint32_t phaseRms;          // timer ticks, running rms of phaseErr
+    uint32_t ticksPerSecond;    // frequency estimate, timer ticks per PPS second
+    uint32_t ppsCount;          // PPS edges used
+    uint32_t lockCount;         // entries into CLOCK_LOCKED
+} clock_discipline_status_t;
+
+extern void     ClockDisciplineInit      (uint32_t ticksPerSecond, uint32_t samplesPerSecond);
+extern void     ClockDisciplinePps       (int32_t tickToPps, uint32_t ppsPeriod);
+extern uint32_t ClockDisciplineNextPeriod(void);
+extern void     ClockDisciplineGetStatus (clock_discipline_status_t *status);
+extern clock_lock_state_t ClockDisciplineState(void);
+
+#endif // CLOCK_DISCIPLINE_H
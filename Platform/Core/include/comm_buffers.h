@@ -52,6 +52,8 @@ extern unsigned int COM_buf_delete_byte (cir_buf_t *circBuf );
 extern BOOL COM_buf_copy (cir_buf_t *buf_struc,unsigned int buf_index,unsigned int cnt,unsigned char *buf_out);
 extern BOOL COM_buf_copy_byte (cir_buf_t *circBuf, unsigned int  bufIndex, unsigned char *bufOut);
 extern int  COM_buf_add(cir_buf_t *buf_struc, unsigned char *buf, unsigned int cnt);
+extern void COM_buf_put_at(cir_buf_t *circBuf, unsigned int offset, unsigned char byte);
+extern void COM_buf_commit(cir_buf_t *circBuf, unsigned int cnt);
 extern int  COM_buf_get(cir_buf_t *buf_struc, unsigned char *buf, unsigned int cnt);
 extern unsigned int COM_buf_prepare_dma_tx_transaction (cir_buf_t *circBuf, uint8_t **dataBufPtr);
 #ifdef __cplusplus
@@ -0,0 +1,69 @@
+/** ***************************************************************************
+ * @file   compact_stream.h
+ * @brief  delta / zig-zag varint encoding of the high-rate IMU output stream
+ *         (C1 packet). Encoder runs on the unit, decoder is plain C so it can
+ *         be linked into host-side tools unchanged.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef COMPACT_STREAM_H
+#define COMPACT_STREAM_H
+
+#include <stdint.h>
+#include "GlobalConstants.h"
+
+// roll, pitch, yaw, X/Y/Z corrected rate, X/Y/Z accel - same scaling as A2
+#define COMPACT_STREAM_NUM_CHANNELS     9
+
+// full key-frame every N samples (N = 40 -> 5 per second at 200 Hz)
+#define COMPACT_STREAM_KEYFRAME_PERIOD  40
+
+// payload flags (byte 0)
+#define COMPACT_FLAG_KEYFRAME           0x01    // absolute values follow
+#define COMPACT_FLAG_BIT_STATUS         0x02    // BIT status word appended
+
+/// key-frame: flags, seq, 9 x int16, uint32 timer, uint16 BIT   = 26 bytes
+/// delta:     flags, seq, 9 x 3-byte varint, 5-byte varint, BIT = 36 bytes max
+#define COMPACT_STREAM_MAX_LENGTH       36
+
+typedef struct {
+    int16_t  channel[COMPACT_STREAM_NUM_CHANNELS];
+    uint32_t timer;
+    uint16_t bitStatus;
+} compact_sample_t;
+
+/// one instance per direction: the unit owns an encoder, the host a decoder
+typedef struct {
+    compact_sample_t ref;           // last sample sent / reconstructed
+    BOOL     refValid;              // decoder: ref holds a usable sample
+    uint8_t  sequence;              // next (encoder) or expected (decoder) seq
+    uint16_t keyFramePeriod;
+    uint16_t sinceKeyFrame;
+    uint32_t frames;                // frames encoded / accepted
+    uint32_t fullBytes;             // bytes the same samples cost as A2 packets
+    uint32_t compactBytes;          // bytes actually sent as C1 packets
+    uint32_t lost;                  // decoder: sequence gaps
+    uint32_t discarded;             // decoder: deltas dropped waiting for key-frame
+} compact_stream_t;
+
+extern void    CompactStreamInit          (compact_stream_t *stream, uint16_t keyFramePeriod);
+extern void    CompactStreamForceKeyFrame (compact_stream_t *stream);
+extern uint8_t CompactStreamEncode        (compact_stream_t *stream, const compact_sample_t *sample, uint8_t *payload);
+extern BOOL    CompactStreamDecode        (compact_stream_t *stream, const uint8_t *payload, uint8_t length, compact_sample_t *sample);
+
+#endif // COMPACT_STREAM_H
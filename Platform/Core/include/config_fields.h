@@ -47,7 +47,7 @@ extern BOOL     eraseUserConfigInEeprom(void);
 #define PACKET_TYPE_FIELD_ID  				0x0003	///< continuous packet type
 #define ORIENTATION_FIELD_ID  				0x0007	///< user defined axis orientation
 #define USER_BEHAVIOR_FIELD_ID				0x0008	///< user behaviour switches
-#define TURN_SWITCH_THRESHOLD_FIELD_ID		0x000D	///< turn switch threshold
+#define STREAM_TRAILER_FIELD_ID				0x000D	///< sequence / dacq tick trailer, see serial_port.h
 #define HARDWARE_STATUS_ENABLE_FIELD_ID 	0x0010	///< hardware status enable
 #define COM_STATUS_ENABLE_FIELD_ID  		0x0011	///< communication status enable
 #define SOFTWARE_STATUS_ENABLE_FIELD_ID	 	0x0012	///< software status enable
@@ -80,6 +80,14 @@ extern BOOL     eraseUserConfigInEeprom(void);
 #define NUM_CONFIG_FIELDS					(UPPER_CONFIG_ADDR_BOUND - LOWER_CONFIG_ADDR_BOUND - 2)
 #define BYTES_PER_CONFIG_FIELD				2
 
+/// bulk configuration transfer ("BR" / "BW" packets)
+#define CONFIG_IMAGE_WORDS                  (sizeof(ConfigurationStruct) / BYTES_PER_CONFIG_FIELD)
+#define CONFIG_BLOCK_TAG                    ((VERSION_MAJOR_NUM << 8) | VERSION_MINOR_NUM)
+#define CONFIG_BLOCK_RAM                    0x01    ///< read from / apply to gConfiguration
+#define CONFIG_BLOCK_EEPROM                 0x02    ///< read from / commit to EEPROM
+#define CONFIG_BLOCK_BEGIN                  0x40    ///< write: start a new staged image
+#define CONFIG_BLOCK_COMMIT                 0x80    ///< write: validate and apply staged image
+
 /// servicing/calling frequency of serial port transmit routine
 #define SERIAL_TX_ROUTINE_FREQUENCY 200 ///< Hz
 
@@ -87,6 +95,7 @@ extern BOOL CheckOrientation (uint16_t orientation) ;
 extern void DefaultPortConfiguration (void);
 extern BOOL CheckBaroCorrection(int32_t baroCorrection) ;
 extern BOOL WriteFieldData (void);
+extern BOOL ApplyConfigurationWords (const uint16_t *image, const uint8_t *dirty, BOOL toRam, BOOL toEeprom);
 
 extern uint16_t appendAttitudeTrue (uint8_t *response, uint16_t index);
 extern uint16_t appendCorrectedRates (uint8_t *response, uint16_t index) ;
@@ -31,8 +31,9 @@ limitations under the License.
 #include "GlobalConstants.h"
 
 
-// here is definition for packet rate divider
-// considering that data acquisition task runs at 200 Hz 
+// here is definition for packet rate divider, of 100 Hz (200 Hz coded
+// apart); platformConvertPacketRateDivider() turns it into dacq ticks at
+// DACQ_ODR_HZ
 typedef enum {
     PACKET_RATE_DIV_INVALID = -1,
     PACKET_RATE_DIV_QUIET = 0,      // quiet mode
@@ -83,7 +84,7 @@ typedef enum {
 
 /// constants for port type configuration fields (see DMU specification)
 #ifndef NUM_BAUD_RATES
-    #define NUM_BAUD_RATES      8
+    #define NUM_BAUD_RATES      12
 #endif
 
 #ifndef PORT_BAUD_CONFIG
@@ -97,6 +98,10 @@ typedef enum {
     #define BAUD_115200	5
     #define BAUD_230400	6
     #define BAUD_460800	7
+    #define BAUD_921600	8       // 921600 and up: user port only, 8x oversampling
+    #define BAUD_1500000	9   //   where 16x can not reach the rate
+    #define BAUD_2000000	10
+    #define BAUD_3000000	11
 #endif
 
 
@@ -134,7 +139,7 @@ typedef struct {
     uint16_t           softIronScaleRatio; ///< [0,2), [0-200%)                 0x000b
     uint16_t           headingTrackOffset;                                  //  0x000c
     int16_t            softIronAngle;                                       //  0x000e
-    uint16_t           rsvd;                                                //  0x000f
+    uint16_t           streamTrailer;     /// 1: continuous packet trailer  STREAM_TRAILER_FIELD_ID
 
     uint16_t           hardwareStatusEnable;                                //  0x0010
     uint16_t           comStatusEnable;                                     //  0x0011
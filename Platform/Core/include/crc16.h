@@ -17,6 +17,9 @@ limitations under the License.
 #ifndef __CRC16_H
 #define __CRC16_H
 
+#define CRC16_SEED  0x1D0F
+
 uint16_t CalculateCRC (uint8_t *buf, uint16_t  length);
+uint16_t UpdateCRC    (uint16_t crc, uint8_t data);   // running, not byte swapped
 
 #endif
@@ -0,0 +1,71 @@
+/** ***************************************************************************
+ * @file   dacq_monitor.h
+ * @brief  deadline monitor of the acquisition tick. Each release of
+ *         dataAcqSem is checked against the end of the previous tick, the
+ *         stages of the tick keep their worst case execution time, and the
+ *         interrupt nesting and sync pulse losses are counted. Read as the
+ *         UCB "DM" packet; a deadline miss within the last second sets
+ *         gBitStatus.swStatus.bit.dacqDeadlineMiss.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef DACQ_MONITOR_H
+#define DACQ_MONITOR_H
+
+#include <stdint.h>
+#include "GlobalConstants.h"
+
+typedef enum {
+    // interrupts, entry to exit
+    DACQ_STAGE_TIM2_ISR     = 0,
+    DACQ_STAGE_TIM5_ISR     = 1,
+    // task, back to back from the update event of the tick
+    DACQ_STAGE_PROCESSING   = 2,    // wake, sensors, algorithm: up to the first library call
+    DACQ_STAGE_COMMANDS     = 3,    // ProcessUserCommands()
+    DACQ_STAGE_OUTPUT       = 4,    // SendContinuousPacket()
+    DACQ_STAGE_HOUSEKEEPING = 5,    // PrepareToNewDacqTick()
+    DACQ_STAGE_RESPONSE     = 6,    // update event to the end of the tick
+    DACQ_STAGES
+} dacq_stage_t;
+
+typedef enum {
+    DACQ_EVENT_NESTED_TIM2  = 0,    // TIM2 interrupt entered while running
+    DACQ_EVENT_NESTED_TIM5  = 1,
+    DACQ_EVENT_SYNC_MISSED  = 2,    // external sync pulse out of range, dropped
+    DACQ_EVENTS
+} dacq_event_t;
+
+typedef struct {
+    uint32_t released;              // dacq ticks released
+    uint32_t completed;             // dacq ticks the task finished
+    uint32_t overruns;              // released with the previous tick still running
+    uint32_t missed;                // released with dataAcqSem still not taken
+    uint32_t events[DACQ_EVENTS];
+    uint32_t wcetUs[DACQ_STAGES];   // since the previous read, 0 not run
+} dacq_monitor_stats_t;
+
+extern void DacqMonitorRelease (uint32_t eventTicks, BOOL consumed);
+extern void DacqMonitorIsrDone (dacq_stage_t stage, uint32_t enterTicks);
+extern void DacqMonitorEvent   (dacq_event_t event);
+extern void DacqMonitorStart   (void);
+extern void DacqMonitorMark    (dacq_stage_t stage);
+extern void DacqMonitorTickDone(void);
+extern BOOL DacqMonitorDeadlineMissed(void);
+extern void DacqMonitorGetStats(dacq_monitor_stats_t *stats);
+
+#endif // DACQ_MONITOR_H
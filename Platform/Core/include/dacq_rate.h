@@ -0,0 +1,43 @@
+/** ***************************************************************************
+ * @file   dacq_rate.h
+ * @brief  output data rate of the acquisition tick. Everything that counts
+ *         dacq ticks (TIM2 period, ITOW and millisecond increments, packet
+ *         and CAN rate dividers, IIR filter coefficients) is derived from
+ *         DACQ_ODR_HZ; build with e.g. -DDACQ_ODR_HZ=400 to change it.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef DACQ_RATE_H
+#define DACQ_RATE_H
+
+#ifndef DACQ_ODR_HZ
+#define DACQ_ODR_HZ                 200
+#endif
+
+// a whole number of microseconds per tick keeps the ITOW exact:
+// 50, 80, 100, 125, 160, 200, 250, 400, 500, 625, 800 or 1000 Hz
+#if DACQ_ODR_HZ < 50 || DACQ_ODR_HZ > 1000 || (1000000 % DACQ_ODR_HZ) != 0
+#error "DACQ_ODR_HZ must be 50..1000 Hz and divide 1000000"
+#endif
+
+#define DACQ_TICK_US                (1000000 / DACQ_ODR_HZ)
+
+// N_per, read by the sensor library, runs 0..799 once a second
+#define DACQ_NPER_PER_SECOND        800
+
+#endif // DACQ_RATE_H
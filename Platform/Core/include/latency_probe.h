@@ -0,0 +1,83 @@
+/** ***************************************************************************
+ * @file   latency_probe.h
+ * @brief  sample to wire latency probes. Each stage of a dacq tick is
+ *         timestamped on TIM5 against the TIM2 update event that started the
+ *         tick and binned in a fixed log2 histogram, read as the UCB "LT"
+ *         packet. Built only with DACQ_LATENCY_PROBES defined; otherwise the
+ *         probe macros are empty and nothing is linked in.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef LATENCY_PROBE_H
+#define LATENCY_PROBE_H
+
+#include <stdint.h>
+
+#define LATENCY_BINS            11      // bin n counts latencies below 16 us << n, last bin the rest
+
+typedef enum {
+    // within the tick, the last probe of the tick counts
+    LATENCY_ISR_ENTRY    = 0,   // TIM2 interrupt entered
+    LATENCY_SEM_RELEASE  = 1,   // dacq task signalled
+    LATENCY_TASK_WAKE    = 2,   // dacq task running, probed by the application task
+    LATENCY_FILTER_DONE  = 3,   // last sensor filter of the tick
+    LATENCY_UART_ENCODED = 4,   // continuous packet in the user port tx ring
+    LATENCY_CAN_ENCODED  = 5,   // periodic PGNs of the tick queued
+    // on the way out, against the tick whose data is being sent
+    LATENCY_UART_TX_START = 6,  // first tx DMA started after the packet was queued
+    LATENCY_UART_TX_DONE  = 7,  // tx ring drained, last byte handed to the UART
+    LATENCY_CAN_TX_START  = 8,  // first frame in a mailbox
+    LATENCY_CAN_TX_DONE   = 9,  // all mailboxes empty again
+    LATENCY_STAGES
+} latency_stage_t;
+
+typedef enum {
+    LATENCY_PATH_UART = 0,
+    LATENCY_PATH_CAN  = 1,
+    LATENCY_PATHS
+} latency_path_t;
+
+typedef struct {
+    uint32_t ticks;                                 // dacq ticks since the last reset
+    uint32_t maxUs[LATENCY_STAGES];
+    uint32_t hist[LATENCY_STAGES][LATENCY_BINS];
+} latency_stats_t;
+
+#ifdef DACQ_LATENCY_PROBES
+
+extern void LatencyTick    (uint32_t sinceEvent);
+extern void LatencyProbe   (latency_stage_t stage);
+extern void LatencyArm     (latency_path_t path);
+extern void LatencyGetStats(latency_stats_t *stats);
+extern void LatencyReset   (void);
+
+// TIM2 interrupt entry, sinceEvent = TIM2->CNT: TIM5 ticks since the update event
+#define LATENCY_TICK(sinceEvent)    LatencyTick(sinceEvent)
+#define LATENCY_PROBE(stage)        LatencyProbe(stage)
+// before a packet is queued: its tx stages are measured against this tick
+#define LATENCY_ARM(path)           LatencyArm(path)
+
+#else
+
+#define LATENCY_TICK(sinceEvent)    ((void)0)
+#define LATENCY_PROBE(stage)        ((void)0)
+#define LATENCY_ARM(path)           ((void)0)
+
+#endif // DACQ_LATENCY_PROBES
+
+#endif // LATENCY_PROBE_H
@@ -0,0 +1,62 @@
+/** ***************************************************************************
+ * @file   low_power_idle.h
+ * @brief  sleep policy of the tickless idle (vPortSuppressTicksAndSleep in
+ *         FreeRTOS_M4/src/port.c, built with configUSE_TICKLESS_IDLE 1) and
+ *         its statistics. The core sleeps (WFI, every clock keeps running)
+ *         only up to LOW_POWER_IDLE_GUARD_US before the next interrupt that
+ *         releases a dacq tick, so that interrupt always finds the idle task
+ *         awake with the scheduler running. Read as the UCB "LP" packet.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef LOW_POWER_IDLE_H
+#define LOW_POWER_IDLE_H
+
+#include <stdint.h>
+#include "stm32f4xx.h"
+
+// time awake before a dacq tick: covers the sleep exit and the tick step
+// of the kernel, and the TIM2 period change of the PPS discipline
+#ifndef LOW_POWER_IDLE_GUARD_US
+#define LOW_POWER_IDLE_GUARD_US     20
+#endif
+
+typedef struct {
+    uint32_t windowUs;              // since the previous read
+    uint32_t sleptUs;               // in WFI
+    uint32_t sleeps;
+    uint32_t skipped;               // idle passes that did not sleep, too close to a dacq tick
+    uint32_t wakes;                 // TIM2 update and 1 kHz sync interrupts
+    uint32_t wakeMinNs;             // dacq event to interrupt entry
+    uint32_t wakeMaxNs;
+    uint32_t wakeMeanNs;
+} low_power_idle_stats_t;
+
+// TIM5, the sleep is timed with register reads only while interrupts are off
+static inline uint32_t LowPowerIdleNow(void)
+{
+    return TIM5->CNT;
+}
+
+extern uint32_t LowPowerIdleCountsToDeadline(uint32_t countsPerSecond);
+extern void     LowPowerIdleSlept           (uint32_t fromTicks, uint32_t toTicks);
+extern void     LowPowerIdleSkipped         (void);
+extern void     LowPowerIdleDacqEntry       (uint32_t latencyTicks);
+extern void     LowPowerIdleGetStats        (low_power_idle_stats_t *stats);
+
+#endif // LOW_POWER_IDLE_H
@@ -0,0 +1,61 @@
+/** ***************************************************************************
+ * @file   sample_history.h
+ * @brief  ring of recent timestamped sensor samples (body-frame q27 rates,
+ *         accels and mags), written once per dacq tick. Output paths that need
+ *         more than the latest sample (batched packets) read from here instead
+ *         of gSensorsData, by sequence number or by time.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef SAMPLE_HISTORY_H
+#define SAMPLE_HISTORY_H
+
+#include <stdint.h>
+#include "GlobalConstants.h"
+#include "sensors_data.h"
+#include "dacq_rate.h"
+
+// must be a power of two; 2.56 s of samples up to 400 Hz, above that the
+// 64 KB of 1024 entries is the limit (1.02 s at 1000 Hz)
+#ifndef SAMPLE_HISTORY_DEPTH
+#if DACQ_ODR_HZ <= 50
+#define SAMPLE_HISTORY_DEPTH    128
+#elif DACQ_ODR_HZ <= 100
+#define SAMPLE_HISTORY_DEPTH    256
+#elif DACQ_ODR_HZ <= 200
+#define SAMPLE_HISTORY_DEPTH    512
+#else
+#define SAMPLE_HISTORY_DEPTH    1024
+#endif
+#endif
+
+typedef struct {
+    uint32_t seq;                               // 0 - slot empty or being written
+    uint64_t tstamp;                            // dacq timestamp, usec
+    int32_t  q27[NUM_SENSOR_IN_AXIS];           // XACCEL..ZMAG, body frame
+    int32_t  groupDtUs[SENSOR_GROUPS];          // data ready - tstamp of each sensor_group_t
+} sample_history_entry_t;
+
+extern void     SampleHistoryPush      (const sensors_data_t *data, uint64_t tstamp);
+extern uint32_t SampleHistoryLatestSeq (void);
+extern uint32_t SampleHistoryOldestSeq (void);
+extern BOOL     SampleHistoryGet       (uint32_t seq, sample_history_entry_t *entry);
+extern uint32_t SampleHistoryFind      (uint64_t tstamp);
+extern BOOL     SampleHistoryAt        (uint64_t tstamp, sample_history_entry_t *entry);
+
+#endif // SAMPLE_HISTORY_H
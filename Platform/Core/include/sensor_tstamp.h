@@ -0,0 +1,41 @@
+/** ***************************************************************************
+ * @file   sensor_tstamp.h
+ * @brief  data ready timestamps of the accelerometer, rate sensor and
+ *         magnetometer, carried in the sample record (sensorTstamp of
+ *         sensors_data_t) next to the dacq tick timestamp. The data ready
+ *         edges are captured by DATA_READY_CAPTURE_TIM when built with
+ *         DACQ_DRDY_CAPTURE, otherwise stamped at interrupt entry; the rate
+ *         sensor has no data ready line and is stamped when its read starts.
+ *         With DACQ_ALIGN_SENSORS platformAlignSensorData() interpolates the
+ *         sample to the dacq tick timestamp, sensor by sensor, before the
+ *         algorithm runs on it.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef SENSOR_TSTAMP_H
+#define SENSOR_TSTAMP_H
+
+#include <stdint.h>
+#include "sensors_data.h"
+
+extern void SensorTstampInit     (void);
+extern void SensorTstampDataReady(sensor_group_t group, uint32_t isrEnter);
+extern void SensorTstampLatch    (sensors_data_t *data);
+extern void SensorTstampAlign    (sensors_data_t *data, uint64_t tstamp);
+
+#endif // SENSOR_TSTAMP_H
@@ -24,16 +24,33 @@ limitations under the License.
 #include <stdint.h>
 #include "Indices.h"
 
+// sensors that latch their three axes together, in XACCEL..ZMAG order
+typedef enum {
+    SENSOR_GROUP_ACCEL = 0,                             // XACCEL..ZACCEL
+    SENSOR_GROUP_RATE  = 1,                             // XRATE..ZRATE
+    SENSOR_GROUP_MAG   = 2,                             // XMAG..ZMAG
+    SENSOR_GROUPS
+} sensor_group_t;
+
+#define SENSOR_GROUP_AXES   3
+
 /* Global Sensor Data structure  */
 typedef struct {
     uint32_t            rawSensors[N_RAW_SENS];
     double              scaledSensors[N_RAW_SENS];      // g's, rad/s, G, deg C, (body frame)
     int32_t             scaledSensors_q27[N_RAW_SENS];  // g's, rad/s, G, deg C, (body frame)
     uint64_t            tstamp;                         // timestamp of last sample
+    uint64_t            sensorTstamp[SENSOR_GROUPS];    // usec, data ready of each group, 0 none, see sensor_tstamp.h
 }sensors_data_t;
 
+// working copy: the dacq task (sensor driver, filters, BIT, bias
+// compensation) updates it in place during a tick
 extern sensors_data_t gSensorsData;
 
+// published copy for the output encoders and other tasks, see sensors_data.c
+extern void SensorsDataPublish     (void);
+extern void SensorsDataGetPublished(sensors_data_t *out);
+
 
 #endif // SENSORS_DATA 
 
@@ -43,6 +43,30 @@ typedef uint16_t       ExternPortTypeEnum;
 extern void   	ExternPortInit         (void);
 extern BOOL     HandleUcbRx (UcbPacketStruct *ptrUcbPacket);
 extern void     HandleUcbTx (int port, UcbPacketStruct *ptrUcbPacket);
+
+/// packet encoded straight into the user port tx ring (no staging copy)
+typedef struct {
+    int      channel;
+    uint16_t offset;      ///< next byte position in the reserved tx area
+    uint16_t crc;         ///< running CRC over code, length and payload
+    BOOL     trailer;     ///< stream trailer goes in front of the CRC
+} ucb_tx_stream_t;
+
+/// optional trailer on continuous packets (configuration field
+/// STREAM_TRAILER_FIELD_ID), appended to the payload:
+/// uint16 sequence (per stream, restarts when the packet type changes),
+/// uint32 dacq tick of the sample the packet was built from. Big endian.
+#define UCB_STREAM_TRAILER_LENGTH   6
+
+extern void     UcbStreamTrailerArm    (uint32_t dacqTick);
+extern void     UcbStreamTrailerDisarm (void);
+extern void     UcbStreamTrailerReset  (void);
+
+extern BOOL     HandleUcbTxBegin (ucb_tx_stream_t *tx, int packetType, uint8_t payloadLength);
+extern void     HandleUcbTxPut   (ucb_tx_stream_t *tx, uint8_t byte);
+extern void     HandleUcbTxPut16 (ucb_tx_stream_t *tx, uint16_t value);
+extern void     HandleUcbTxPut32 (ucb_tx_stream_t *tx, uint32_t value);
+extern void     HandleUcbTxEnd   (ucb_tx_stream_t *tx);
 extern void	 	ExternPortWaitOnTxIdle (void);
 
 #endif
@@ -0,0 +1,84 @@
+/** ***************************************************************************
+ * @file   timebase.h
+ * @brief  TIM5 tick to microsecond conversions without 64-bit division or
+ *         double arithmetic, both library calls on the Cortex-M4. Used from
+ *         the timer interrupts and under OSDisableHook() in
+ *         DataAcquisitionSupport.c.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+#define TIMEBASE_TICKS_PER_US       60          // TIM5 nominal, SystemCoreClock / 2
+#define TIMEBASE_DIV60_MAGIC        0x88888889u // ceil(2^37 / 60)
+#define TIMEBASE_DIV60_SHIFT        37
+#define TIMEBASE_2POW32_DIV60       71582788u   // 2^32 = 60 * 71582788 + 16
+#define TIMEBASE_2POW32_MOD60       16
+
+/** ***************************************************************************
+ * @name timebaseDiv60() n / 60, exact for every 32-bit n
+ * @brief one UMULL and a shift
+ ******************************************************************************/
+static inline uint32_t timebaseDiv60(uint32_t n)
+{
+    return (uint32_t)(((uint64_t)n * TIMEBASE_DIV60_MAGIC) >> TIMEBASE_DIV60_SHIFT);
+}
+
+/** ***************************************************************************
+ * @name timebaseTicksToUs() nominal TIM5 ticks to microseconds
+ * @brief same result as ticks / 60 while the high word is below 2^27
+ *        (300 years of TIM5)
+ ******************************************************************************/
+static inline uint64_t timebaseTicksToUs(uint64_t ticks)
+{
+    uint32_t hi = (uint32_t)(ticks >> 32);
+    uint32_t lo = (uint32_t)ticks;
+    uint32_t q  = timebaseDiv60(lo);
+    uint32_t r  = lo - q * TIMEBASE_TICKS_PER_US;
+
+    return (uint64_t)hi * TIMEBASE_2POW32_DIV60 + q + timebaseDiv60(r + hi * TIMEBASE_2POW32_MOD60);
+}
+
+/** ***************************************************************************
+ * @name timebaseUsPerTickQ32() reciprocal of a measured tick rate
+ * @brief microseconds per tick in 0.32 fixed point. Has a 64-bit division,
+ *        call it when the rate changes, not per conversion
+ *
+ * @param [in] ticksPerSecond, above 1000000
+ ******************************************************************************/
+static inline uint32_t timebaseUsPerTickQ32(uint32_t ticksPerSecond)
+{
+    return (uint32_t)((1000000ull << 32) / ticksPerSecond);
+}
+
+/** ***************************************************************************
+ * @name timebaseScaleQ32() ticks of a measured rate to microseconds
+ * @brief 32.32 fixed point result, one UMULL
+ *
+ * @param [in] ticks, up to 71 s of TIM5
+ *             usPerTickQ32, from timebaseUsPerTickQ32()
+ ******************************************************************************/
+static inline uint64_t timebaseScaleQ32(uint32_t ticks, uint32_t usPerTickQ32)
+{
+    return (uint64_t)ticks * usPerTickQ32;
+}
+
+#endif // TIMEBASE_H
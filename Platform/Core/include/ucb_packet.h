@@ -53,6 +53,9 @@ typedef enum {
     UCB_JUMP2_IAP,          // 13         
     UCB_LOCK_EEPROM,        // 14         
     UCB_READ_APP,           // 15         
+    UCB_READ_CONFIG_BLOCK,  //      bulk configuration read
+    UCB_WRITE_CONFIG_BLOCK, //      bulk configuration write
+    UCB_SET_BAUD_TRIAL,     //      user port baud negotiation
     UCB_INPUT_PACKET_MAX,   // 16
 //**************************************************
     UCB_IDENTIFICATION,     // 16         
@@ -68,6 +71,12 @@ typedef enum {
     UCB_MAG_CAL_3_COMPLETE, // 26      
     UCB_MAG_CAL_COMPLETE,    
     UCB_ANGLE_2,
+    UCB_COMPACT_1,          //      delta encoded A2 stream
+    UCB_BATCH_1,            //      several S1-style samples per packet
+    UCB_CAN_TELEMETRY,      //      CAN bus load and error counters, polled
+    UCB_LATENCY,            //      sample to wire latency histograms, polled
+    UCB_DACQ_MONITOR,       //      dacq tick deadline monitor, polled
+    UCB_LOW_POWER_IDLE,     //      idle sleep ratio and dacq wake latency, polled
     UCB_PKT_NONE,           // 27   marker after last valid packet 
     UCB_NAK,                // 28
     UCB_ERROR_TIMEOUT,      // 29         
@@ -105,7 +114,15 @@ extern UcbPacketStruct gSpiUcbPacket;
 #define UCB_NAV_0_LENGTH			    32
 #define UCB_NAV_1_LENGTH			    42
 #define UCB_NAV_2_LENGTH			    46 // with ITOW
+#define UCB_COMPACT_1_LENGTH            36 // worst case, see compact_stream.h
+#define UCB_BATCH_1_HEADER_LENGTH        5 // count, first sample seq
+#define UCB_BATCH_1_SAMPLE_LENGTH       16 // tstamp, rates, accels
+#define UCB_BATCH_MAX_DEPTH             10 // samples per B1 packet
+#define UCB_CAN_TELEMETRY_HEADER_LENGTH 39 // window, load, error state, frame counts
+#define UCB_CAN_TELEMETRY_PGN_LENGTH    18 // pgn, sent, jitters, mailbox wait
 #define UCB_APP_MAX_LENGTH              240
+#define UCB_CONFIG_BLOCK_HEADER_LENGTH   8 // flags, tag, image words, start, count
+#define UCB_CONFIG_BLOCK_MAX_WORDS      ((UCB_MAX_PAYLOAD_LENGTH - UCB_CONFIG_BLOCK_HEADER_LENGTH - 2) / 2)
 
 
 
@@ -8,7 +8,7 @@
  * IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
  * PARTICULAR PURPOSE.
  *
- * sensor data acquisition task runs at 200Hz, gets the data for each sensor
+ * sensor data acquisition task runs at DACQ_ODR_HZ, gets the data for each sensor
  * and applies available calibration
  ******************************************************************************/
 /*******************************************************************************
@@ -44,6 +44,18 @@ limitations under the License.
 #include "spiAPI.h"
 #include "boardAPI.h"
 #include "commAPI.h"
+#include "sensors_data.h"
+#include "sample_history.h"
+#include "timebase.h"
+#include "clock_discipline.h"
+#include "dacq_rate.h"
+#include "latency_probe.h"
+#include "dacq_monitor.h"
+#include "sensor_tstamp.h"
+#include "low_power_idle.h"
+#if defined(CAN_BUS_COMM)
+#include "canAPI.h"
+#endif
 
 
 
@@ -65,69 +77,134 @@ typedef struct {
     };
 }stime_t;
 
-static uint32_t prevTim5Val    = 0;
-static uint64_t ppsTstamp      = 0;
-static int64_t  ppsTstampFull      = 0;
-static int64_t  dacqTstampFull     = 0;
+/* Time state shared by the TIM2/TIM5 interrupts and the tasks. Writers bump
+ * timeSeq to odd before and back to even after an update; task level readers
+ * copy the struct and retry while the sequence was odd or moved, so they never
+ * mask interrupts. An interrupt runs to completion before a task resumes, so
+ * a writer preempted by another one cannot leave a torn copy behind an even
+ * sequence. Clear-on-read flags are counters here: the reader keeps the count
+ * it has seen, the writer never touches it.
+ */
+typedef struct {
+    stime_t  tStamp;                    // TIM5 extended to 64 bits
+    uint32_t prevTim5Val;
+    uint64_t iTow;                      // usec
+    uint64_t iTowTstamp;                // usec, dacq tick while there is no PPS
+    uint64_t ppsTstamp;                 // usec, 0 until the first PPS
+    int64_t  ppsTstampFull;             // TIM5 ticks
+    int64_t  solutionTstampFull;
+    int64_t  solutionPpsTstampFull;
+    uint32_t usPerTickQ32;              // measured rate, see _SetTicksInPps()
+    uint32_t solutionPpsCount;          // PPS edges handed to the solution
+    uint32_t iTowUpdateCount;           // GPS itow updates accepted
+} time_state_t;
+
+#define  TICKS_IN_PPS_DEFAULT      59947833
+static volatile uint32_t timeSeq = 0;
+static time_state_t timeState = { .usPerTickQ32 = (uint32_t)((1000000ull << 32) / TICKS_IN_PPS_DEFAULT) };
 static uint64_t solutionTstamp = 0;
-static int64_t  solutionTstampFull    = 0;
-static int64_t  solutionPpsTstampFull  = 0;
-static uint64_t iTowTstamp     = 0;
+static int64_t  dacqTstampFull     = 0;
 static uint64_t prevItow       = 0;
-static uint64_t iTow = 0;
-static uint32_t numTicksInPps         = 59947833;
-static BOOL     iTowUpdated           = FALSE;
-stime_t tStamp;
+static uint32_t numTicksInPps         = TICKS_IN_PPS_DEFAULT;
 static  uint8_t  ppsDetected           =  0; // 0 not synced, 1 synced
-static  uint8_t  solutionPpsDetected   =  0; // 0 not synced, 1 synced
+static volatile uint32_t ppsPeriodTicks = 0; // TIM5 ticks between the last two PPS
 static uint32_t  gpsItow;
+static uint32_t  ppsFlagSeen           = 0;  // timeState.solutionPpsCount at the last clear
+static uint32_t  iTowUpdateSeen        = 0;  // timeState.iTowUpdateCount at the last read
+
+static inline void _TimeWriteBegin(void)
+{
+    timeSeq++;
+    __DMB();
+}
+
+static inline void _TimeWriteEnd(void)
+{
+    __DMB();
+    timeSeq++;
+}
+
+// consistent copy of the time state from task level, interrupts stay enabled
+static void _TimeSnapshot(time_state_t *out)
+{
+    uint32_t seq;
+
+    do{
+        seq  = timeSeq;
+        __DMB();
+        *out = timeState;
+        __DMB();
+    }while((seq & 1) || seq != timeSeq);
+}
+
+// extends a TIM5 reading, from interrupts or with them masked
+static uint64_t _ExtendTim5(uint32_t cur)
+{
+    _TimeWriteBegin();
+    if(cur < timeState.prevTim5Val){
+        timeState.tStamp.timeHi++;
+    }
+    timeState.tStamp.timeLo = cur;
+    timeState.prevTim5Val   = cur;
+    _TimeWriteEnd();
+    return timeState.tStamp.time;
+}
+
+// measured TIM5 rate from the sync pulses, keeps the reciprocal in step
+static void _SetTicksInPps(uint32_t ticks)
+{
+    numTicksInPps   = ticks;
+    _TimeWriteBegin();
+    timeState.usPerTickQ32 = timebaseUsPerTickQ32(ticks);
+    _TimeWriteEnd();
+}
+
+// signed tick difference at the measured rate, usec in 32.32 fixed point;
+// differences beyond 71 s saturate
+static int64_t _PpsTicksToUsQ32(int64_t ticks, uint32_t usPerTickQ32)
+{
+    uint32_t mag;
+
+    if(ticks < 0){
+        mag = ticks < -(int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)-ticks;
+        return -(int64_t)timebaseScaleQ32(mag, usPerTickQ32);
+    }
+    mag = ticks > (int64_t)UINT32_MAX ? UINT32_MAX : (uint32_t)ticks;
+    return (int64_t)timebaseScaleQ32(mag, usPerTickQ32);
+}
+
 // value in microseconds
 uint64_t platformGetCurrTimeStamp()
 {
     OSDisableHook();
-    uint32_t cur =  TIM5->CNT;
-    if(cur < prevTim5Val){
-        tStamp.timeHi++;
-    }
-    tStamp.timeLo = cur; 
-    prevTim5Val   = cur;
-    uint64_t res = tStamp.time / 60;
+    uint64_t ticks = _ExtendTim5(TIM5->CNT);
     OSEnableHook();
-    return res;
+    return timebaseTicksToUs(ticks);
 }
 
 uint64_t platformGetCurrTimeStampFromIsr()
 {
-    uint32_t cur =  TIM5->CNT;
-    if(cur < prevTim5Val){
-        tStamp.timeHi++;
-    }
-    tStamp.timeLo = cur; 
-    prevTim5Val   = cur;
-    return tStamp.time / 60;
+    return timebaseTicksToUs(_ExtendTim5(TIM5->CNT));
+}
+
+// a TIM5 value of the last 71 s in the timebase of platformGetCurrTimeStamp()
+uint64_t platformTicksToTimeStamp(uint32_t ticks)
+{
+    OSDisableHook();
+    uint64_t now = _ExtendTim5(TIM5->CNT);
+    OSEnableHook();
+    return timebaseTicksToUs(now - (uint32_t)((uint32_t)now - ticks));
 }
 
 uint64_t platformGetFullTimeStampFromIsr()
 {
-    uint32_t cur =  TIM5->CNT;
-    if(cur < prevTim5Val){
-        tStamp.timeHi++;
-    }
-    tStamp.timeLo = cur; 
-    prevTim5Val   = cur;
-    return tStamp.time / 60;
+    return timebaseTicksToUs(_ExtendTim5(TIM5->CNT));
 }
 
 
 uint64_t platformGetCurrTicksFromIsr()
 {
-    uint32_t cur =  TIM5->CNT;
-    if(cur < prevTim5Val){
-        tStamp.timeHi++;
-    }
-    tStamp.timeLo = cur; 
-    prevTim5Val   = cur;
-    return tStamp.time;
+    return _ExtendTim5(TIM5->CNT);
 }
 
 
@@ -143,23 +220,22 @@ int platformGetSensToPpsDelay()
 
 uint64_t platformGetPpsTimeStamp()
 {
-    return ppsTstamp;
+    return timeState.ppsTstamp;
 }
 
 void  platformSetPpsTimeStamp(uint32_t tmr)
 {
-    if(tmr < prevTim5Val){
-        tStamp.timeHi++;
-    }
-    tStamp.timeLo = tmr; 
-    prevTim5Val   = tmr;
-    ppsTstamp     = tStamp.time / 60;
+    uint64_t time = _ExtendTim5(tmr);
+
+    _TimeWriteBegin();
+    timeState.ppsTstamp     = timebaseTicksToUs(time);
     if(prevItow){
-        iTow     = prevItow;
+        timeState.iTow  = prevItow;
         prevItow = 0;
     }
-    ppsTstampFull = tStamp.time;
-    iTow += 1000000;
+    timeState.ppsTstampFull = time;
+    timeState.iTow += 1000000;
+    _TimeWriteEnd();
     ppsDetected  = 1;
 //    if(ppsTstampFull > solutionTstampFull && (ppsTstampFull - solutionTstampFull) < 600){   // 10 uS
 //        solutionPpsTstampFull = ppsTstampFull; 
@@ -169,30 +245,54 @@ void  platformSetPpsTimeStamp(uint32_t tmr)
 
 
 BOOL platformGetPpsFlag( bool fClear) { 
-    BOOL detected;
-    OSDisableHook();
-    detected    = solutionPpsDetected;
+    uint32_t count = timeState.solutionPpsCount;   // one word, no snapshot needed
+    BOOL     detected;
+
+    detected    = count != ppsFlagSeen;
     if(fClear){
-        solutionPpsDetected = FALSE;
+        ppsFlagSeen = count;
     }
-    OSEnableHook();
     return detected; 
 }
 
 
+/** ***************************************************************************
+ * @name platformGetPpsLockState
+ * @brief state of the PPS discipline of the dacq timer
+ * @param [out] phaseErrNs - dacq tick minus PPS minus 40 us, at the last PPS
+ * @param [out] phaseRmsNs - running rms of the phase error
+ * @retval clock_lock_state_t
+ ******************************************************************************/
+uint8_t platformGetPpsLockState(int32_t *phaseErrNs, uint32_t *phaseRmsNs)
+{
+    clock_discipline_status_t st;
+
+    OSDisableHook();
+    ClockDisciplineGetStatus(&st);
+    OSEnableHook();
+
+    // TIM5 ticks of 1/60 us
+    *phaseErrNs = st.phaseErr * 50 / 3;
+    *phaseRmsNs = st.phaseRms * 50 / 3;
+    return (uint8_t)st.state;
+}
+
+
 int    updErrCnt = 0;
 
 void    platformUpdateITOW(uint32_t itow)
 {
+    // writes prevItow, shared with the PPS capture interrupt
     OSDisableHook();
 
     uint64_t tStamp        = platformGetCurrTicksFromIsr();
-    int64_t  ddd           = (tStamp - ppsTstampFull); 
-    double   numTicksPerUs = (double)numTicksInPps/1000000;
-    double   offset        = (double)ddd/numTicksPerUs;
+    int64_t  ddd           = (tStamp - timeState.ppsTstampFull); 
+    int64_t  offset        = _PpsTicksToUsQ32(ddd, timeState.usPerTickQ32);
 
-    if(offset < 900000.0){
-        iTowUpdated  = TRUE;
+    if(offset < ((int64_t)900000 << 32)){
+        _TimeWriteBegin();
+        timeState.iTowUpdateCount++;
+        _TimeWriteEnd();
     prevItow = (uint64_t)itow * 1000;     // microsecond resolution
         gpsItow      = itow;
     }else{
@@ -207,29 +307,44 @@ void    platformUpdateITOW(uint32_t itow)
 
 uint64_t platformGetEstimatedITOW()
 {
-    OSDisableHook();
-    uint64_t tStamp = platformGetCurrTimeStampFromIsr();
-    uint64_t ddd;; 
+    time_state_t snap;
+    uint32_t     cur, seq;
+
+    // TIM5 read inside the retry loop, extended against the same snapshot
+    do{
+        seq  = timeSeq;
+        __DMB();
+        snap = timeState;
+        cur  = TIM5->CNT;
+        __DMB();
+    }while((seq & 1) || seq != timeSeq);
+
+    if(cur < snap.prevTim5Val){
+        snap.tStamp.timeHi++;
+    }
+    snap.tStamp.timeLo = cur;
 
-    if(!ppsTstamp){
-        ddd = tStamp - iTowTstamp; 
+    uint64_t tStamp = timebaseTicksToUs(snap.tStamp.time);
+    uint64_t ddd;
+
+    if(!snap.ppsTstamp){
+        ddd = tStamp - snap.iTowTstamp; 
     }else{
-        ddd = tStamp - ppsTstamp; 
+        ddd = tStamp - snap.ppsTstamp; 
     }
-    OSEnableHook();
 
-    return iTow + ddd;
+    return snap.iTow + ddd;
 }
 
 uint32_t platformGetItow(BOOL *detected, BOOL *updated)
 {
-    OSDisableHook();
-    uint32_t res         = iTow/1000;
-    *detected            = solutionPpsDetected;
-    *updated             = iTowUpdated;
-    iTowUpdated          = 0;
-    OSEnableHook();
-    return res;
+    time_state_t snap;
+
+    _TimeSnapshot(&snap);
+    *detected            = snap.solutionPpsCount != ppsFlagSeen;
+    *updated             = snap.iTowUpdateCount != iTowUpdateSeen;
+    iTowUpdateSeen       = snap.iTowUpdateCount;
+    return snap.iTow/1000;
 }
 
 uint32_t platformGetGpsItow()
@@ -243,13 +358,13 @@ uint64_t platformGetEstimatedITOWFromIsr()
     uint64_t tStamp = platformGetCurrTimeStampFromIsr();
     uint64_t ddd; 
 
-    if(!ppsTstamp){
-        ddd = tStamp - iTowTstamp; 
+    if(!timeState.ppsTstamp){
+        ddd = tStamp - timeState.iTowTstamp; 
     }else{
-        ddd = tStamp - ppsTstamp; 
+        ddd = tStamp - timeState.ppsTstamp; 
     }
     
-    return iTow + ddd;
+    return timeState.iTow + ddd;
 }
 
 
@@ -258,71 +373,22 @@ uint64_t lastItow   = 0;
 
 double platformGetSolutionTstampAsDouble()
 {
-    if(ppsTstampFull == 0){
+    time_state_t snap;
+
+    _TimeSnapshot(&snap);
+    if(snap.ppsTstampFull == 0){
         return 0;
     }
-    double res;
-    OSDisableHook();
-    int64_t  ddd = solutionTstampFull - solutionPpsTstampFull;
-    double   numTicksPerUs = (double)numTicksInPps/1000000;
-    double   offset = (double)ddd/numTicksPerUs;
-    if((offset > 1006000.0 || offset < 0 )&& numTicksPerUs != 0 && iTow != lastItow){
+    int64_t  ddd    = snap.solutionTstampFull - snap.solutionPpsTstampFull;
+    int64_t  offset = _PpsTicksToUsQ32(ddd, snap.usPerTickQ32);
+    if((offset > ((int64_t)1006000 << 32) || offset < 0 ) && snap.iTow != lastItow){
         itowErrCnt++;
     }
-    lastItow = iTow;
-    res      = (double)iTow + offset; 
-    OSEnableHook();
-    return res;
+    lastItow = snap.iTow;
+    // double math on the copy, nothing shared is held
+    return (double)snap.iTow + (double)offset * (1.0 / 4294967296.0);
 }
 
-BOOL   syncP  = FALSE;
-BOOL   resync = FALSE;
-int    rem    = 17;
-int    divv   = 299739;
-int    divva  = 0;
-int    ratioP = 0, ratioM = 0, adjStep = 0, adj1 = 0;
-BOOL   dir;
-
-void adjustDacqSyncPhase()
-{
-    int ddd;
-
-    // no valid sync pulse detected
-    // keep old settings
-
-    if(!syncP){
-        return;
-    }
-
-    if(resync){
-        resync  = FALSE;
-        ratioP  = rem;
-        ratioM  = 200 - ratioP;
-        dir     = 1;
-        divva   = divv; 
-        adj1    = adjStep;
-        adjStep = 0;
-    }
-    
-    if(ratioP && dir){
-        ddd  = divva + adj1;
-        if(ratioM){
-            dir ^= 1;
-        }
-        TIM_SetAutoreload(TIM2, ddd);
-        ratioP -= 1;
-    }
-
-    if(!dir && ratioM){
-        if(ratioP){
-            dir ^= 1;
-        }
-        ratioM -= 1; 
-        TIM_SetAutoreload(TIM2, divva-1);
-    }
-}
-
-
 /** ***************************************************************************
  * @name ONE_PPS_EXTI_IRQHandler() LOCAL TIM2 global interrupt request handler.
  * @brief The value of the timer that triggers the interrupt is based on the
@@ -375,7 +441,8 @@ void InitDataAcquisitionTimer(uint32_t outputDataRate)
     /// to sync with a 1PPS or 1kHz signal. ==> SystemCoreClock = 120MHz
     period = (double)( SystemCoreClock ); // >> 1; ///< period = 120 MHz / 2 = 60 MHz
     period = 0.5 * period / (double)outputDataRate;    ///< = period / ODR ==> 60 MHz / 500 Hz = 120,000
-    numTicksInPps =  SystemCoreClock/2;                
+    _SetTicksInPps(SystemCoreClock/2);
+    ClockDisciplineInit(SystemCoreClock/2, outputDataRate);
 
     /// Time base configuration
     TIM_TimeBaseStructInit( &TIM_TimeBaseStructure );
@@ -400,57 +467,6 @@ void InitDataAcquisitionTimer(uint32_t outputDataRate)
 }
 
 
-int deltaBuf[256] = {0};
-int deltaIdx = 0;
-
-
-void calculateSyncPhaseShift()
-{
-    int64_t        delta;
-    static int     lock1 = 0, lock2 = 0, lock3 = 0;
-
-    if(!ppsDetected){
-        return; 
-    }
-
-    delta = solutionTstampFull - solutionPpsTstampFull; 
-    deltaBuf[deltaIdx++] = delta;
-    deltaIdx &= 0xff;
-
-    if(!lock1){
-        if(delta < 10000){
-            // try to properly position phase shift
-            adjStep = 50;
-    }else{
-        lock1    = 1;
-            adjStep = -20;
-    }
-    }else if(!lock2){
-        if(delta > 6000){
-           adjStep = -20;
-        }else {
-            lock2   = 1;
-            adjStep = -10;
-        }
-    }else if(!lock3){
-        if(delta > 3000){
-           adjStep = -5;
-        }else {
-            lock3   = 1;
-        adjStep = 0;
-    }
-    }else {
-        if(delta > 2400){
-            rem -= 3;
-    }else{
-            rem += 3;
-        }
-    }
-
-}                
-
-
-
 /** ***************************************************************************
  * @name TIM2_IRQHandler()
  * @brief The value of the timer that triggers the interrupt (period) is based
@@ -462,6 +478,16 @@ void calculateSyncPhaseShift()
  * @retval N/A
  ******************************************************************************/
 uint16_t N_per = 0;
+static uint16_t nPerTick = 0;   // dacq ticks into the current N_per second
+
+// N_per keeps its 800 steps a second at any rate, evenly rounded down
+static void _AdvanceNPer(void)
+{
+    if(++nPerTick >= DACQ_ODR_HZ){
+        nPerTick = 0;
+    }
+    N_per = (uint16_t)((uint32_t)nPerTick * DACQ_NPER_PER_SECOND / DACQ_ODR_HZ);
+}
 
 // Leave this in here for now so the change can be easily rolled back if
 //   something going forward doesn't work quite right.
@@ -472,68 +498,75 @@ uint32_t    syncPulsePeriod = 0;
 
 uint32_t syncOffset  = 0;//, tmr;
 int  nestedTim2  = 0;
-int  nestCntTim2 = 0;
 int  nestedTim5  = 0;
-int  nestCntTim5 = 0;
-int  numDacqCycles   = 0;  
 void TIM2_IRQHandler(void)
 {
+    uint32_t isrEnter   = TIM5->CNT;
+    uint32_t sinceEvent = TIM2->CNT;    // TIM5 ticks since the update event
+
     nestedTim2 ++;
     if(nestedTim2 > 1){
-        nestCntTim2++;
+        DacqMonitorEvent(DACQ_EVENT_NESTED_TIM2);
     }
 
     OSEnterISR();
+    LATENCY_TICK(sinceEvent);
+    LowPowerIdleDacqEntry(sinceEvent);
     syncOffset = 0;
     
 
-    if(!ppsTstamp){
-        iTow          += 5000;    // in ms
-        iTowTstamp     = platformGetCurrTimeStampFromIsr();
-        solutionTstamp = iTow;
+    if(!timeState.ppsTstamp){
+        uint64_t now   = platformGetCurrTimeStampFromIsr();
+        _TimeWriteBegin();
+        timeState.iTow      += DACQ_TICK_US;
+        timeState.iTowTstamp = now;
+        _TimeWriteEnd();
+        solutionTstamp = timeState.iTow;
     }else{
         solutionTstamp = platformGetEstimatedITOWFromIsr();
     }
 
-    solutionTstampFull   = tStamp.time;
-    dacqTstampFull       = tStamp.time;
+    _TimeWriteBegin();
+    timeState.solutionTstampFull = timeState.tStamp.time;
+    _TimeWriteEnd();
+    dacqTstampFull       = timeState.tStamp.time;
 
-    if(platformIsGpsPPSUsed() && syncP){
+    if(platformIsGpsPPSUsed()){
         if(ppsDetected){
-            solutionPpsTstampFull   = ppsTstampFull;
-            solutionPpsDetected     = ppsDetected;
-            calculateSyncPhaseShift();
-            resync = 1; 
-            numDacqCycles = 0;
-        }else{
-            numDacqCycles++;
-            numDacqCycles %= 200;
-            if(numDacqCycles == 0){
-                resync = 1;
-            }
+            // update event of this tick: TIM2 counts from it at the TIM5 rate,
+            // which keeps the interrupt latency out of the phase error
+            int64_t tickEvent = (int64_t)timeState.tStamp.time - TIM2->CNT;
+            _TimeWriteBegin();
+            timeState.solutionPpsTstampFull = timeState.ppsTstampFull;
+            timeState.solutionPpsCount++;
+            _TimeWriteEnd();
+            ClockDisciplinePps((int32_t)(tickEvent - timeState.ppsTstampFull), ppsPeriodTicks);
+            ppsDetected = FALSE;
         }
-    adjustDacqSyncPhase();
-        ppsDetected = FALSE;
+        // ARR is preloaded, this is the period after the current one
+        TIM_SetAutoreload(TIM2, ClockDisciplineNextPeriod() - 1);
     }
     
-//  timer runs at 200 Hz
-   N_per = N_per + 4;
-    if( N_per >= 800 ) {
-        N_per = 0;
-    }
+    _AdvanceNPer();
 
         // Upon TIM2 timeout, signal taskDataAcquisition() to continue
-        osSemaphoreRelease(dataAcqSem);
+        DacqMonitorRelease(isrEnter - sinceEvent, osSemaphoreRelease(dataAcqSem) == osOK);
+        LATENCY_PROBE(LATENCY_SEM_RELEASE);
 #if defined(CAN_BUS_COMM)
         // Upon TIM2 timeout, signal taskDataCANComminication() to continue
         if(dacqInitialized){
+#if defined(SAE_J1939)
+        CANTaskSignal(CAN_EVENT_TICK);
+#else
         osSemaphoreRelease(canDataSem);
+#endif
         }
 #endif
 
     // reset the interrupt flag
     TIM2->SR = (uint16_t)~TIM_IT_Update;
 
+    DacqMonitorIsrDone(DACQ_STAGE_TIM2_ISR, isrEnter);
     OSExitISR();
     nestedTim2--;
 }
@@ -541,17 +574,15 @@ void TIM2_IRQHandler(void)
 #define  NUMBER_OF_FREQ_MATCHES     5
 #define  EXT_CLK_TEST_PRECISION     0.0001 //  (1/100 of %)
 
-static uint8_t   TIM5_Cntr      = 0;
-static uint8_t   TIM5_CntrLimit = 4;  // 200 Hz Sampling
+// 1 kHz sync: DACQ_ODR_HZ is added per pulse, a dacq tick each 1000. Rates
+// that do not divide 1000 alternate between the two nearest pulse counts
+static uint16_t  TIM5_Acc       = 0;
 static uint32_t  ref_min, ref_max;
+// last sync capture, for readers outside the ISR: reading CCR1 clears CC1IF
+// and the pulse would be lost
+static volatile uint32_t lastSyncCap = 0;
 
-#define  TS_FILT_SIZE 8
-uint32_t ppsFiltr[TS_FILT_SIZE] = {0,0,0,0,0,0,0,0};
-int      syncFltIdx;
 int      syncFreq    = 0;
-int      missedPulseCnt = 0;
-int      missedPulseIdx = 0;
-uint32_t missedPulseTab[1024] = {0};
 
 
 
@@ -571,18 +602,18 @@ void TIM5_IRQHandler(void)
     static uint8_t    freqValid = 0;
     static uint32_t   cap1 = 0, match = 0;
     static int        delta1 = 0;
-    static uint32_t   cap2, cnt = 0;
-    static uint32_t   syncPeriod = 0, syncAvg = 0;
-    static int        delta, err = 0, syncCnt = 0;
+    static uint32_t   cap2;
+    static int        delta, err = 0;
     static uint16_t   sr5;
     static uint32_t   ts;
     static uint32_t   cap;
+    uint32_t          isrEnter = TIM5->CNT;
 
 
     nestedTim5 ++;
 
     if(nestedTim5 > 1){
-        nestCntTim5++;
+        DacqMonitorEvent(DACQ_EVENT_NESTED_TIM5);
     }
 
     OSEnterISR();
@@ -593,25 +624,29 @@ void TIM5_IRQHandler(void)
         //    ts   = TIM5->CNT; 
         cap  = TIM5->CCR1;
         ts   = cap; 
+        lastSyncCap = cap;
+        if(freqValid && syncFreq == 1000){
+            LowPowerIdleDacqEntry(isrEnter - cap);
+        }
         while(1){
             if(freqValid){
             // Here sync achieved - keep synced
                 if(syncFreq == 1000){
-                TIM5_Cntr++;   // Incremented at 1000 Hz
-                if( TIM5_Cntr > TIM5_CntrLimit ) {
-                    // This loop is done at 200 Hz
-                    TIM5_Cntr = 0;
-                        //  timer runs at 200 Hz
-                        N_per = N_per + 4;
-                        if( N_per >= 800 ) {
-                            N_per = 0;
-                        }
+                TIM5_Acc += DACQ_ODR_HZ;   // at 1000 Hz
+                if( TIM5_Acc >= 1000 ) {
+                    // This loop is done at DACQ_ODR_HZ
+                    TIM5_Acc -= 1000;
+                        _AdvanceNPer();
                     // signal taskDataAcquisition() to continue
-                    osSemaphoreRelease(dataAcqSem);
+                    DacqMonitorRelease(cap, osSemaphoreRelease(dataAcqSem) == osOK);
 #if defined (CAN_BUS_COMM)
                         // Upon TIM2 timeout, signal taskDataCANComminication() to continue
                     if(dacqInitialized){
+#if defined(SAE_J1939)
+                    CANTaskSignal(CAN_EVENT_TICK);
+#else
                     osSemaphoreRelease(canDataSem);
+#endif
                     }
 #endif
                 }
@@ -622,37 +657,13 @@ void TIM5_IRQHandler(void)
             cap1   = cap; 
             if (delta1 < ref_min || delta1 > ref_max){
                 // disregard pulse and use previous numbers; 
-                    missedPulseCnt++;
-                    missedPulseTab[missedPulseIdx++] = delta1;
-//                    DEBUG_INT("Missed sync\n", missedPulseIdx);
-                    missedPulseIdx &= 0x3ff;
+                    DacqMonitorEvent(DACQ_EVENT_SYNC_MISSED);
                     break;
                 }
                 platformSetPpsTimeStamp(ts);
-                syncAvg             -= ppsFiltr[syncFltIdx];
-                ppsFiltr[syncFltIdx] = delta1;
-                syncFltIdx++;
-                syncFltIdx          &= 0x7;
-                syncAvg             += delta1;
-                if(syncCnt < TS_FILT_SIZE){
-                    syncCnt ++;
-                    syncPeriod = delta1;
-                }else {
-                    syncPeriod = syncAvg >> 3;    // divide by 8
-                }
-                numTicksInPps = syncPeriod; 
-                divv   = syncPeriod/200;
-                rem    = syncPeriod%200;
-                syncP  = TRUE; 
-                resync = 1;
-                cnt ++;
-//                DEBUG_UINT("\r\n", cnt);
-//                DEBUG_UINT(" ,"  , cap);
-//                DEBUG_INT(" ,"  ,  syncPeriod);
-//                DEBUG_INT(" ,"   , delta);
-//                DEBUG_INT(" ,"   , refDelta);
-//                DEBUG_INT(" , "  , divv);
-//                DEBUG_INT(" , "  , rem);
+                // TIM2 follows the PPS through clock_discipline.c
+                ppsPeriodTicks = delta1;
+                _SetTicksInPps(delta1);
                 break;
             }
 // Here sync not achieved yet
@@ -677,7 +688,7 @@ void TIM5_IRQHandler(void)
                     uint16_t sr2  = TIM2->SR;
                     // reset the interrupt flag
                     TIM2->SR &= ~sr2;
-                    TIM5_Cntr = syncOffset;    
+                    TIM5_Acc = 1000 - DACQ_ODR_HZ;     // first tick on the next pulse
                 }
             }
             break;
@@ -691,12 +702,48 @@ void TIM5_IRQHandler(void)
     // reset the interrupt flag
     TIM5->SR &= ~sr5;
 
+    DacqMonitorIsrDone(DACQ_STAGE_TIM5_ISR, isrEnter);
     OSExitISR();
     nestedTim5--;
 }
 
 
 
+/** ***************************************************************************
+ * @name platformTicksToDacqEvent()
+ * @brief time to the next interrupt that can release a dacq tick: the TIM2
+ *        update event, or the next 1 kHz sync pulse once synced to it. Under
+ *        the PPS discipline ARR already holds the next period, so the TIM2
+ *        estimate can be off by the last correction. The sync phase is taken
+ *        from the capture the TIM5 ISR saved, never from CCR1
+ * @retval TIM5 ticks, 0 if one is due, UINT32_MAX if neither timer runs
+ ******************************************************************************/
+uint32_t platformTicksToDacqEvent()
+{
+    uint32_t now  = TIM5->CNT;
+    uint32_t next = UINT32_MAX;
+    uint32_t late;
+    int32_t  left;
+
+    if(TIM2->CR1 & TIM_CR1_CEN){
+        left = (int32_t)(TIM2->ARR - TIM2->CNT);
+        next = left > 0 ? (uint32_t)left : 0;
+    }
+    if(syncFreq == 1000 && syncPulsePeriod){
+        left = (int32_t)(lastSyncCap + syncPulsePeriod - now);
+        if(left <= 0){
+            // pulses lost, keep to their phase
+            late = (uint32_t)-left % syncPulsePeriod;
+            left = (int32_t)(late ? syncPulsePeriod - late : 0);
+        }
+        if((uint32_t)left < next){
+            next = (uint32_t)left;
+        }
+    }
+    return next;
+}
+
+
 /** ***************************************************************************
  * @name InitClockMeasurementTimer() Set up and initialize the timer interrupt
  *       that drives data acquisition.
@@ -760,7 +807,7 @@ void DataAquisitionStart(void)
 {
     // Configure and enable timers
     InitClockMeasurementTimer(1);
-    InitDataAcquisitionTimer(200);
+    InitDataAcquisitionTimer(DACQ_ODR_HZ);
 
      /// Enable external sync 1 PPS A0 interrupt
     if(!BoardIsTestMode()){
@@ -768,6 +815,7 @@ void DataAquisitionStart(void)
     }
 
     ActivateSensors();
+    SensorTstampInit();
 
     /// Select UART or SPI (if DR pin is pulled LOW then select UART, else SPI).
     if(platformGetUnitCommunicationType() != SPI_COMM ) {
@@ -804,12 +852,89 @@ void TaskDataAcquisition_Init(void)
 
 
 uint32_t imuCounter = 0;
+static uint16_t imuCounterUs = 0;   // microseconds not yet counted in imuCounter
+uint32_t dacqTick   = 0;     // dacq ticks since start
+
+static uint64_t alignedTstamp = 0;  // tick of the last platformAlignSensorData()
+
+/** ***************************************************************************
+ * @name platformBeginRateSensorRead
+ * @brief starts the SPI read of the rate sensor and stamps it, the rate
+ *        sensor has no data ready line. The application calls it in place of
+ *        BeginRateSensorRead()
+ * @retval N/A
+ ******************************************************************************/
+void platformBeginRateSensorRead(void)
+{
+    SensorTstampDataReady(SENSOR_GROUP_RATE, TIM5->CNT);
+    BeginRateSensorRead();
+}
+
+/** ***************************************************************************
+ * @name platformAlignSensorData
+ * @brief latches the data ready times of the sensors into gSensorsData and,
+ *        with DACQ_ALIGN_SENSORS, interpolates each sensor to the dacq tick
+ *        timestamp. The application calls it once per tick, after the sensor
+ *        reads and before the algorithm, so the algorithm, the outputs and
+ *        the history all see the aligned sample. Without the call the sample
+ *        is published as read, with the data ready times only
+ * @retval N/A
+ ******************************************************************************/
+void platformAlignSensorData(void)
+{
+    uint64_t tstamp = platformGetDacqTimeStamp();
+
+    if (tstamp == alignedTstamp) {
+        return;
+    }
+    SensorTstampLatch(&gSensorsData);
+#ifdef DACQ_ALIGN_SENSORS
+    SensorTstampAlign(&gSensorsData, tstamp);
+#endif
+    alignedTstamp = tstamp;
+}
+
+/** ***************************************************************************
+ * @name _PublishSample
+ * @brief publishes the sample of the current dacq tick to the readers of
+ *        sensors_data.c and records it in the history, once, whichever of the
+ *        tick entry points gets called first. The data ready times of the
+ *        sensors go with it, latched here when the application did not call
+ *        platformAlignSensorData() this tick
+ ******************************************************************************/
+static void _PublishSample()
+{
+    static uint64_t lastTstamp = 0;
+    uint64_t tstamp = platformGetDacqTimeStamp();
+
+    if (tstamp != lastTstamp) {
+        if (tstamp != alignedTstamp) {
+            SensorTstampLatch(&gSensorsData);
+        }
+        SensorsDataPublish();
+        SampleHistoryPush(&gSensorsData, tstamp);
+        lastTstamp = tstamp;
+    }
+}
 
 void PrepareToNewDacqTick()
 {
     static BOOL firstTime = TRUE;
 
-    imuCounter += 5;   // miliseconds considering 200Hz tick 
+    DacqMonitorStart();
+    _PublishSample();
+
+    imuCounter   += DACQ_TICK_US / 1000;    // miliseconds
+    imuCounterUs += DACQ_TICK_US % 1000;
+    if(imuCounterUs >= 1000){
+        imuCounterUs -= 1000;
+        imuCounter++;
+    }
+    dacqTick++;
+
+    if(platformIsGpsPPSUsed()){
+        gBitStatus.hwStatus.bit.unlocked1PPS = ClockDisciplineState() != CLOCK_LOCKED;
+    }
 
     if(BoardIsTestMode()){
     if(firstTime){
@@ -826,15 +951,22 @@ void PrepareToNewDacqTick()
       BITStartStop();
       // kick the watchdog timer
       PetWatchdog(); 
-      //
+
+    DacqMonitorMark(DACQ_STAGE_HOUSEKEEPING);
+    DacqMonitorTickDone();
+    gBitStatus.swStatus.bit.dacqDeadlineMiss = DacqMonitorDeadlineMissed();
 }
 
 void PrepareToNewDacqTickAndProcessUartMessages()
 {
     // Process commands and  output continuous packets to UART
     // Processing of user commands always goes first
+    DacqMonitorStart();
     ProcessUserCommands ();
-    SendContinuousPacket(200);
+    DacqMonitorMark(DACQ_STAGE_COMMANDS);
+    _PublishSample();       // before output, the encoders read the published sample
+    SendContinuousPacket(DACQ_ODR_HZ);
+    DacqMonitorMark(DACQ_STAGE_OUTPUT);
     PrepareToNewDacqTick();
 }
 
@@ -843,6 +975,11 @@ uint32_t   platformGetIMUCounter()
     return imuCounter;
 }
 
+uint32_t   platformGetDacqTick()
+{
+    return dacqTick;
+}
+
 
 /** ***************************************************************************
  * @name DataAquisitionStop() API
@@ -0,0 +1,242 @@
+/** ***************************************************************************
+ * @file   clock_discipline.c
+ * @brief  PPS discipline of the data acquisition timer
+ *
+ * Once per PPS the dacq tick that follows the edge reports how far it is from
+ * CLOCK_PHASE_TARGET after it. Far off (above CLOCK_CAPTURE_WINDOW) the
+ * frequency is taken from the measured PPS period and the phase slewed at up
+ * to CLOCK_MAX_SLEW_PPM. Closer in a PI loop on the phase error keeps the
+ * frequency in an integrator. The loop is updated once a second, so its poles
+ * are the roots of z^2 - (2 - Kp - Ki) z + (1 - Kp): the acquire gains put
+ * them at |z| = 0.7, the track gains near 0.87 so PPS jitter is averaged over
+ * ~8 s while a temperature ramp of 0.01 ppm/s still stays within 1 us.
+ *
+ * The loop output is the number of timer ticks for the next second in 16.16
+ * fixed point. The fraction carries over to the next second and the integer
+ * part is spread over the samples Bresenham style, so no two periods of a
+ * second differ by more than one tick. Everything runs from the TIM2
+ * interrupt: no 64-bit division, no floating point.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <string.h>
+#include "clock_discipline.h"
+
+#define CLOCK_CAPTURE_WINDOW        6000        // ticks, 100 us: beyond it slew, no PI
+#define CLOCK_LOCK_WINDOW           60          // ticks, 1 us
+#define CLOCK_UNLOCK_WINDOW         600         // ticks, 10 us
+#define CLOCK_LOCK_SECONDS          4           // in the lock window to declare lock
+#define CLOCK_HOLDOVER_SECONDS      2           // without PPS before holdover
+#define CLOCK_MAX_SLEW_PPM          1000
+
+// PI gains as right shifts
+#define CLOCK_ACQUIRE_KP_SHIFT      1           // 1/2
+#define CLOCK_ACQUIRE_KI_SHIFT      3           // 1/8
+#define CLOCK_TRACK_KP_SHIFT        2           // 1/4
+#define CLOCK_TRACK_KI_SHIFT        6           // 1/64
+
+#define CLOCK_RMS_SHIFT             3           // running mean square over ~8 s
+
+static clock_discipline_status_t status;
+static uint32_t samples;                // samples per second
+static int64_t  freqQ16;                // integrator, ticks per second
+static int64_t  errSq;                  // running mean of phaseErr^2
+static uint32_t fracQ16;                // fraction of a tick carried to the next second
+static uint32_t base, rem, acc;         // this second: rem of the periods are base + 1
+static uint32_t secondTick;             // samples into the current second
+static uint32_t sinceUpdate;            // samples since the last PPS
+static uint8_t  inWindow;               // consecutive seconds in the lock window
+static uint8_t  seeded;                 // integrator started from a measured PPS period
+
+
+static void _StartSecond(int64_t ticksQ16)
+{
+    uint64_t total = (uint64_t)ticksQ16 + fracQ16;
+    uint32_t ticks = (uint32_t)(total >> 16);
+
+    fracQ16    = (uint32_t)(total & 0xFFFF);
+    base       = ticks / samples;
+    rem        = ticks - base * samples;
+    acc        = 0;
+    secondTick = 0;
+}
+
+static uint32_t _Isqrt(uint64_t v)
+{
+    uint64_t res = 0, bit = 1ull << 62;
+
+    while (bit > v) {
+        bit >>= 2;
+    }
+    while (bit) {
+        if (v >= res + bit) {
+            v  -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+/** ***************************************************************************
+ * @name ClockDisciplineInit
+ * @brief free running at the nominal rate until the first PPS
+ * @param [in] ticksPerSecond - nominal timer ticks per second
+ * @param [in] samplesPerSecond - dacq ticks per second
+ * @retval N/A
+ ******************************************************************************/
+void ClockDisciplineInit(uint32_t ticksPerSecond, uint32_t samplesPerSecond)
+{
+    memset(&status, 0, sizeof(status));
+    samples     = samplesPerSecond;
+    freqQ16     = (int64_t)ticksPerSecond << 16;
+    errSq       = 0;
+    fracQ16     = 0;
+    sinceUpdate = 0;
+    inWindow    = 0;
+    seeded      = 0;
+    status.state          = CLOCK_UNLOCKED;
+    status.ticksPerSecond = ticksPerSecond;
+    _StartSecond(freqQ16);
+}
+
+/** ***************************************************************************
+ * @name ClockDisciplinePps
+ * @brief one loop update, from the first dacq tick after a PPS edge
+ * @param [in] tickToPps - timer ticks from the PPS edge to the update event of
+ *                         this dacq tick
+ * @param [in] ppsPeriod - timer ticks between the last two PPS edges, 0 when
+ *                         not known
+ * @retval N/A
+ ******************************************************************************/
+void ClockDisciplinePps(int32_t tickToPps, uint32_t ppsPeriod)
+{
+    int32_t  period = (int32_t)(status.ticksPerSecond / samples);
+    int32_t  err    = (tickToPps - CLOCK_PHASE_TARGET) % period;
+    int32_t  absErr, slew;
+    int64_t  cmdQ16;
+    int      kp, ki;
+
+    // any dacq tick can line up with the PPS, only the phase within a sample counts
+    if (err >= period / 2) {
+        err -= period;
+    } else if (err < -period / 2) {
+        err += period;
+    }
+    absErr = err < 0 ? -err : err;
+
+    status.ppsCount++;
+    status.phaseErr = err;
+    errSq      += ((int64_t)err * err - errSq) >> CLOCK_RMS_SHIFT;
+    sinceUpdate = 0;
+
+    // first period seen: start the integrator from it, not from the nominal rate
+    if (!seeded && ppsPeriod) {
+        freqQ16 = (int64_t)ppsPeriod << 16;
+        seeded  = 1;
+    }
+
+    if (status.state != CLOCK_LOCKED && absErr > CLOCK_CAPTURE_WINDOW) {
+        // frequency from the PPS period, phase slewed as fast as allowed
+        if (ppsPeriod) {
+            freqQ16 = (int64_t)ppsPeriod << 16;
+        }
+        slew = (int32_t)(status.ticksPerSecond / (1000000 / CLOCK_MAX_SLEW_PPM));
+        if (absErr > slew) {
+            err = err < 0 ? -slew : slew;
+        }
+        cmdQ16       = freqQ16 - ((int64_t)err << 16);
+        status.state = CLOCK_ACQUIRING;
+        inWindow     = 0;
+    } else {
+        if (status.state == CLOCK_LOCKED) {
+            kp = CLOCK_TRACK_KP_SHIFT;
+            ki = CLOCK_TRACK_KI_SHIFT;
+        } else {
+            kp = CLOCK_ACQUIRE_KP_SHIFT;
+            ki = CLOCK_ACQUIRE_KI_SHIFT;
+        }
+        // late tick, positive error: shorter periods
+        freqQ16 -= ((int64_t)err << 16) >> ki;
+        cmdQ16   = freqQ16 - (((int64_t)err << 16) >> kp);
+
+        if (status.state == CLOCK_LOCKED) {
+            if (absErr > CLOCK_UNLOCK_WINDOW) {
+                status.state = CLOCK_ACQUIRING;
+                inWindow     = 0;
+            }
+        } else {
+            status.state = CLOCK_ACQUIRING;
+            if (absErr > CLOCK_LOCK_WINDOW) {
+                inWindow = 0;
+            } else if (++inWindow >= CLOCK_LOCK_SECONDS) {
+                status.state = CLOCK_LOCKED;
+                status.lockCount++;
+            }
+        }
+    }
+
+    status.ticksPerSecond = (uint32_t)(freqQ16 >> 16);
+    _StartSecond(cmdQ16);
+}
+
+/** ***************************************************************************
+ * @name ClockDisciplineNextPeriod
+ * @brief timer ticks of the next dacq period, once per dacq tick. Without
+ *        PPS every second runs at the frequency estimate
+ * @retval timer ticks
+ ******************************************************************************/
+uint32_t ClockDisciplineNextPeriod(void)
+{
+    sinceUpdate++;
+    if (++secondTick > samples) {
+        if (status.state != CLOCK_UNLOCKED && sinceUpdate > CLOCK_HOLDOVER_SECONDS * samples) {
+            status.state = CLOCK_HOLDOVER;
+            inWindow     = 0;
+        }
+        _StartSecond(freqQ16);
+        secondTick = 1;
+    }
+
+    acc += rem;
+    if (acc >= samples) {
+        acc -= samples;
+        return base + 1;
+    }
+    return base;
+}
+
+/** ***************************************************************************
+ * @name ClockDisciplineGetStatus
+ * @brief copy of the loop state; the caller masks the dacq timer interrupt for
+ *        a consistent copy
+ * @param [out] status - loop state, phaseRms computed here
+ * @retval N/A
+ ******************************************************************************/
+void ClockDisciplineGetStatus(clock_discipline_status_t *out)
+{
+    *out          = status;
+    out->phaseRms = _Isqrt((uint64_t)errSq);
+}
+
+clock_lock_state_t ClockDisciplineState(void)
+{
+    return status.state;
+}
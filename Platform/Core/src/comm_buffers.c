@@ -293,6 +293,34 @@ int COM_buf_add(cir_buf_t  *circBuf, unsigned char *buf, unsigned int cnt)
 	return cnt;
 }   /* end of COM_buf_add */
 
+/** ****************************************************************************
+ * @name COM_buf_put_at - write a byte past the input pointer
+ * @brief used to build a packet in place: the caller checks headroom, writes
+ *        bytes at offsets 0..cnt-1 from buf_inptr, then makes them visible to
+ *        the consumer with COM_buf_commit(). Single producer only.
+ * @param [in] circBuf - pointer to the circular buffer structure
+ * @param [in] offset - offset from the current input pointer
+ * @param [in] byte - value to write
+ * @retval N/A
+ ******************************************************************************/
+void COM_buf_put_at(cir_buf_t *circBuf, unsigned int offset, unsigned char byte)
+{
+    // carefull here - buffer considered to be power of 2 length
+    *(circBuf->buf_add + ((circBuf->buf_inptr + offset) & (circBuf->buf_size - 1))) = byte;
+}   /* end of COM_buf_put_at */
+
+/** ****************************************************************************
+ * @name COM_buf_commit - publish bytes written with COM_buf_put_at
+ * @param [in] circBuf - pointer to the circular buffer structure
+ * @param [in] cnt - number of bytes to publish
+ * @retval N/A
+ ******************************************************************************/
+void COM_buf_commit(cir_buf_t *circBuf, unsigned int cnt)
+{
+    circBuf->buf_inptr        = (circBuf->buf_inptr + cnt) & (circBuf->buf_size - 1);
+    circBuf->bytes_in_buffer += cnt;
+}   /* end of COM_buf_commit */
+
 
 
 /** ****************************************************************************
@@ -0,0 +1,237 @@
+/** ***************************************************************************
+ * @file   compact_stream.c
+ * @brief  delta / zig-zag varint encoder and decoder for the C1 output packet
+ *
+ * Payload layout:
+ *   [flags][seq] then
+ *   key-frame: 9 x int16 (big endian, as A2), uint32 timer, uint16 BIT status
+ *   delta:     9 x varint(zigzag(sample - previous)), varint(zigzag(dTimer)),
+ *              uint16 BIT status only when COMPACT_FLAG_BIT_STATUS is set
+ *
+ * Deltas are taken modulo 2^16 so any step fits in a 3-byte varint. The host
+ * drops deltas after a sequence gap and resyncs on the next key-frame.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <string.h>
+#include "compact_stream.h"
+
+// sync(2) + code(2) + length(1) + crc(2) framing around every UCB payload
+#define UCB_FRAMING_BYTES   7
+// roll/pitch/yaw, rates, accels, 3 x rate temp, timer, BIT - see _UcbAngle2
+#define A2_PAYLOAD_BYTES    30
+
+
+static uint8_t _putVarint(uint8_t *buf, uint8_t index, uint32_t value)
+{
+    while (value >= 0x80) {
+        buf[index++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[index++] = (uint8_t)value;
+    return index;
+}
+
+static BOOL _getVarint(const uint8_t *buf, uint8_t length, uint8_t *index, uint32_t *value)
+{
+    uint32_t result = 0;
+    int      shift  = 0;
+
+    while (*index < length && shift < 35) {
+        uint8_t byte = buf[(*index)++];
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return TRUE;
+        }
+        shift += 7;
+    }
+    return FALSE;
+}
+
+static uint32_t _zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t _unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+
+/** ***************************************************************************
+ * @name CompactStreamInit
+ * @brief reset stream state; the next encoded frame is a key-frame
+ * @param [in] stream - encoder or decoder state
+ * @param [in] keyFramePeriod - samples between key-frames, 0 uses default
+ * @retval N/A
+ ******************************************************************************/
+void CompactStreamInit(compact_stream_t *stream, uint16_t keyFramePeriod)
+{
+    memset(stream, 0, sizeof(compact_stream_t));
+    stream->keyFramePeriod = keyFramePeriod ? keyFramePeriod : COMPACT_STREAM_KEYFRAME_PERIOD;
+}
+
+void CompactStreamForceKeyFrame(compact_stream_t *stream)
+{
+    stream->refValid = FALSE;
+}
+
+
+/** ***************************************************************************
+ * @name CompactStreamEncode
+ * @brief encode one sample as key-frame or delta frame
+ * @param [in] stream - encoder state
+ * @param [in] sample - current sample
+ * @param [out] payload - at least COMPACT_STREAM_MAX_LENGTH bytes
+ * @retval payload length
+ ******************************************************************************/
+uint8_t CompactStreamEncode(compact_stream_t        *stream,
+                            const compact_sample_t  *sample,
+                            uint8_t                 *payload)
+{
+    uint8_t index = 2;
+    uint8_t flags = 0;
+    int     i;
+
+    if (!stream->refValid || stream->sinceKeyFrame >= stream->keyFramePeriod) {
+        flags = COMPACT_FLAG_KEYFRAME | COMPACT_FLAG_BIT_STATUS;
+        for (i = 0; i < COMPACT_STREAM_NUM_CHANNELS; i++) {
+            payload[index++] = (uint8_t)((uint16_t)sample->channel[i] >> 8);
+            payload[index++] = (uint8_t)sample->channel[i];
+        }
+        payload[index++] = (uint8_t)(sample->timer >> 24);
+        payload[index++] = (uint8_t)(sample->timer >> 16);
+        payload[index++] = (uint8_t)(sample->timer >> 8);
+        payload[index++] = (uint8_t)sample->timer;
+        stream->sinceKeyFrame = 0;
+        stream->refValid      = TRUE;
+    } else {
+        for (i = 0; i < COMPACT_STREAM_NUM_CHANNELS; i++) {
+            int16_t delta = (int16_t)(sample->channel[i] - stream->ref.channel[i]);
+            index = _putVarint(payload, index, _zigzag(delta));
+        }
+        index = _putVarint(payload, index,
+                           _zigzag((int32_t)(sample->timer - stream->ref.timer)));
+        if (sample->bitStatus != stream->ref.bitStatus) {
+            flags |= COMPACT_FLAG_BIT_STATUS;
+        }
+    }
+
+    if (flags & COMPACT_FLAG_BIT_STATUS) {
+        payload[index++] = (uint8_t)(sample->bitStatus >> 8);
+        payload[index++] = (uint8_t)sample->bitStatus;
+    }
+
+    payload[0] = flags;
+    payload[1] = stream->sequence++;
+
+    stream->ref = *sample;
+    stream->sinceKeyFrame++;
+    stream->frames++;
+    stream->fullBytes    += A2_PAYLOAD_BYTES + UCB_FRAMING_BYTES;
+    stream->compactBytes += index + UCB_FRAMING_BYTES;
+
+    return index;
+}
+
+
+/** ***************************************************************************
+ * @name CompactStreamDecode
+ * @brief reconstruct a sample from a C1 payload (host side)
+ * @param [in] stream - decoder state
+ * @param [in] payload, length - C1 payload as received (CRC already checked)
+ * @param [out] sample - reconstructed sample
+ * @retval TRUE if sample is valid, FALSE while waiting for a key-frame
+ ******************************************************************************/
+BOOL CompactStreamDecode(compact_stream_t  *stream,
+                         const uint8_t     *payload,
+                         uint8_t           length,
+                         compact_sample_t  *sample)
+{
+    compact_sample_t next;
+    uint8_t  index = 2;
+    uint8_t  flags;
+    uint32_t value;
+    int      i;
+
+    if (length < 2) {
+        return FALSE;
+    }
+
+    flags = payload[0];
+
+    if (stream->frames && payload[1] != stream->sequence) {
+        stream->lost    += (uint8_t)(payload[1] - stream->sequence);
+        stream->refValid = FALSE;
+    }
+    stream->sequence = payload[1] + 1;
+    stream->frames++;
+
+    if (flags & COMPACT_FLAG_KEYFRAME) {
+        if (length < 2 + 2 * COMPACT_STREAM_NUM_CHANNELS + 4) {
+            return FALSE;
+        }
+        for (i = 0; i < COMPACT_STREAM_NUM_CHANNELS; i++) {
+            next.channel[i] = (int16_t)((payload[index] << 8) | payload[index + 1]);
+            index += 2;
+        }
+        next.timer = ((uint32_t)payload[index]     << 24) |
+                     ((uint32_t)payload[index + 1] << 16) |
+                     ((uint32_t)payload[index + 2] << 8)  |
+                      (uint32_t)payload[index + 3];
+        index += 4;
+        next.bitStatus = 0;
+    } else {
+        if (!stream->refValid) {
+            stream->discarded++;
+            return FALSE;
+        }
+        for (i = 0; i < COMPACT_STREAM_NUM_CHANNELS; i++) {
+            if (!_getVarint(payload, length, &index, &value)) {
+                stream->refValid = FALSE;
+                return FALSE;
+            }
+            next.channel[i] = (int16_t)(stream->ref.channel[i] + (int16_t)_unzigzag(value));
+        }
+        if (!_getVarint(payload, length, &index, &value)) {
+            stream->refValid = FALSE;
+            return FALSE;
+        }
+        next.timer     = stream->ref.timer + (uint32_t)_unzigzag(value);
+        next.bitStatus = stream->ref.bitStatus;
+    }
+
+    if (flags & COMPACT_FLAG_BIT_STATUS) {
+        if (index + 2 > length) {
+            stream->refValid = FALSE;
+            return FALSE;
+        }
+        next.bitStatus = (uint16_t)((payload[index] << 8) | payload[index + 1]);
+        index += 2;
+    }
+
+    stream->ref      = next;
+    stream->refValid = TRUE;
+    stream->fullBytes    += A2_PAYLOAD_BYTES + UCB_FRAMING_BYTES;
+    stream->compactBytes += length + UCB_FRAMING_BYTES;
+    *sample = next;
+
+    return TRUE;
+}
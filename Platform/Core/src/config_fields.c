@@ -163,6 +163,7 @@ static uint8_t CheckFieldData (ConfigurationStruct *currentConfiguration,
     BOOL                packetCodeChanged        = FALSE;
     BOOL                packetRateDividerChanged = FALSE;
     BOOL                userBaudChanged          = FALSE;
+    BOOL                trailerChanged           = FALSE;
     /// index for stepping through proposed configuration fields
     uint8_t             fieldIndex      = 0;
     uint8_t             validFieldIndex = 0; ///< index for building valid return array
@@ -197,6 +198,13 @@ static uint8_t CheckFieldData (ConfigurationStruct *currentConfiguration,
                     packetRateDividerChanged             = TRUE;
                     proposedPortConfig.packetRateDivider = fieldData[fieldIndex];
                     break;
+                case STREAM_TRAILER_FIELD_ID:
+                    /// changes the packet length, checked with the port settings
+                    if (fieldData[fieldIndex] <= 1) {
+                        trailerChanged                   = TRUE;
+                        proposedPortConfig.streamTrailer = fieldData[fieldIndex];
+                    }
+                    break;
                 case PORT_1_BAUD_RATE_FIELD_ID:
                     userBaudChanged = TRUE;
                     proposedPortConfig.baudRateUser = fieldData[fieldIndex];
@@ -249,9 +257,15 @@ static uint8_t CheckFieldData (ConfigurationStruct *currentConfiguration,
                 currentConfiguration->baudRateUser = proposedPortConfig.baudRateUser;
                 validFields[validFieldIndex++]     = BAUD_RATE_USER_ID;
             }
+
+            if (trailerChanged == TRUE) {
+                currentConfiguration->streamTrailer = proposedPortConfig.streamTrailer;
+                validFields[validFieldIndex++]      = STREAM_TRAILER_FIELD_ID;
+            }
         }
     } else if ((packetCodeChanged == TRUE) ||
-               (packetRateDividerChanged == TRUE)) {
+               (packetRateDividerChanged == TRUE) ||
+               (trailerChanged == TRUE)) {
         /// port usage or baud settings haven't changed, DON'T indicate port
         /// configuration change
         proposedPortConfig.baudRateUser = currentConfiguration->baudRateUser;
@@ -266,6 +280,11 @@ static uint8_t CheckFieldData (ConfigurationStruct *currentConfiguration,
                 currentConfiguration->packetRateDivider = proposedPortConfig.packetRateDivider;
                 validFields[validFieldIndex++]          = PACKET_RATE_DIVIDER_FIELD_ID;
             }
+
+            if (trailerChanged == TRUE) {
+                currentConfiguration->streamTrailer = proposedPortConfig.streamTrailer;
+                validFields[validFieldIndex++]      = STREAM_TRAILER_FIELD_ID;
+            }
         }
     }
     return validFieldIndex;
@@ -365,6 +384,92 @@ BOOL WriteFieldData (void)
     return success;
 } /* end WriteFieldData */
 
+/** ****************************************************************************
+ * @name _CheckConfigurationWords
+ * @brief run the dirty words of an image through the same checks as SF / WF
+ *        and overlay them on the proposed configuration. Only the field range
+ *        of SF / WF can be written: a dirty word past UPPER_CONFIG_ADDR_BOUND
+ *        rejects the image, and the CRC word is never taken from it.
+ * @param [in] proposed - proposed configuration, starts as the current one
+ * @param [in] image - configuration image, CONFIG_IMAGE_WORDS long
+ * @param [in] dirty - bitmap of the image words to apply
+ * @retval TRUE if every dirty field passed its check
+ ******************************************************************************/
+static BOOL _CheckConfigurationWords (ConfigurationStruct *proposed,
+                                      const uint16_t      *image,
+                                      const uint8_t       *dirty)
+{
+    uint16_t fieldId     [UPPER_CONFIG_ADDR_BOUND + 1];
+    uint16_t fieldData   [UPPER_CONFIG_ADDR_BOUND + 1];
+    uint16_t validFields [UPPER_CONFIG_ADDR_BOUND + 1];
+    uint8_t  numFields = 0;
+    uint8_t  expected  = 0;
+    uint16_t id;
+
+    for (id = UPPER_CONFIG_ADDR_BOUND + 1; id < CONFIG_IMAGE_WORDS; id++) {
+        if (dirty[id >> 3] & (1 << (id & 7))) {
+            return FALSE;
+        }
+    }
+
+    for (id = LOWER_CONFIG_ADDR_BOUND; id <= UPPER_CONFIG_ADDR_BOUND && id < CONFIG_IMAGE_WORDS; id++) {
+        if (dirty[id >> 3] & (1 << (id & 7))) {
+            fieldId[numFields]   = id;
+            fieldData[numFields] = image[id];
+            numFields++;
+            /// alignment offsets are accepted but ignored by the field interface
+            if (id < OFFSET_ROLL_ALIGN_FIELD_ID || id > OFFSET_YAW_ALIGN_FIELD_ID) {
+                expected++;
+            }
+        }
+    }
+
+    if (numFields > 0 &&
+        CheckFieldData(proposed, numFields, fieldId, fieldData, validFields) != expected) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/** ****************************************************************************
+ * @name ApplyConfigurationWords
+ * @brief all-or-nothing update of the RAM and/or EEPROM configuration from a
+ *        (partial) image, used by the bulk "BW" command. Every target is
+ *        checked before anything is changed and the EEPROM is written once.
+ * @param [in] image - configuration image, CONFIG_IMAGE_WORDS long
+ * @param [in] dirty - bitmap of the image words to apply
+ * @param [in] toRam, toEeprom - targets
+ * @retval TRUE if applied, FALSE if a field was rejected or the write failed
+ ******************************************************************************/
+BOOL ApplyConfigurationWords (const uint16_t *image,
+                              const uint8_t  *dirty,
+                              BOOL           toRam,
+                              BOOL           toEeprom)
+{
+    if (toRam) {
+        proposedRamConfiguration = gConfiguration;
+        if (_CheckConfigurationWords(&proposedRamConfiguration, image, dirty) == FALSE) {
+            return FALSE;
+        }
+    }
+
+    if (toEeprom) {
+        readUnitConfigurationStruct(&proposedEepromConfiguration);
+        if (_CheckConfigurationWords(&proposedEepromConfiguration, image, dirty) == FALSE) {
+            return FALSE;
+        }
+        /// single commit of the whole proposed structure
+        if (WriteFieldData() == FALSE) {
+            return FALSE;
+        }
+    }
+
+    if (toRam) {
+        SetFieldData();
+    }
+    return TRUE;
+} /* end ApplyConfigurationWords */
+
 
 /** ****************************************************************************
  * @name appendCorrectedRates
@@ -443,16 +548,19 @@ uint16_t appendCorrectedRates (uint8_t  *response,
 uint16_t appendRates (uint8_t  *response,
                       uint16_t index)
 {
+    sensors_data_t sample;
     int tmp;
 
+    SensorsDataGetPublished(&sample);
+
     /// X-Axis
-    tmp = _qmul( TWO_POW16_OVER_7PI_q19, gSensorsData.scaledSensors_q27[XRATE], 19, 27, 16) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_7PI_q19, sample.scaledSensors_q27[XRATE], 19, 27, 16) >> 16;
     index = uint16ToBuffer(response, index, (uint16_t)tmp);
     /// Y-Axis
-    tmp = _qmul( TWO_POW16_OVER_7PI_q19, gSensorsData.scaledSensors_q27[YRATE], 19, 27, 16) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_7PI_q19, sample.scaledSensors_q27[YRATE], 19, 27, 16) >> 16;
     index = uint16ToBuffer(response, index, (uint16_t)tmp);
     /// Z-Axis
-    tmp = _qmul( TWO_POW16_OVER_7PI_q19, gSensorsData.scaledSensors_q27[ZRATE], 19, 27, 16) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_7PI_q19, sample.scaledSensors_q27[ZRATE], 19, 27, 16) >> 16;
     index = uint16ToBuffer(response, index,  (uint16_t)tmp);
     return index;
 } /* end appendRates */
@@ -472,30 +580,33 @@ uint16_t appendRates (uint8_t  *response,
 uint16_t appendMagReadings( uint8_t  *response,
                             uint16_t index )
 {
+    sensors_data_t sample;
     int tmp;
 
+    SensorsDataGetPublished(&sample);
+
     if(!memsicMag){
 
     /// Cycle through each magnetometer axis and convert it to a 16-bit integer
     /// X-Axis
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[XMAG], 19, 27, 16 ) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[XMAG], 19, 27, 16 ) >> 16;
     /// Split the 16-bit integer into two 8-bit numbers and place it into the buffer
     index = uint16ToBuffer(response,
                            index,
                            tmp);
     /// Y-Axis
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[YMAG], 19, 27, 16 ) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[YMAG], 19, 27, 16 ) >> 16;
     index = uint16ToBuffer(response,
                            index,
                            tmp);
     /// Z-Axis
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[ZMAG], 19, 27, 16 ) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[ZMAG], 19, 27, 16 ) >> 16;
     index = uint16ToBuffer(response,
                            index,
                            tmp);
     }else{
         for(int i = 0; i < 3; i++){
-            tmp   = gSensorsData.scaledSensors[XMAG + i] * 32768;
+            tmp   = sample.scaledSensors[XMAG + i] * 32768;
             index = uint16ToBuffer(response, index, tmp);
         }
     }
@@ -551,18 +662,21 @@ uint16_t appendTangentRates (uint8_t  *response,
 uint16_t appendAccels (uint8_t  *response,
                        uint16_t index)
 {
+    sensors_data_t sample;
     uint16_t tmp;
+
+    SensorsDataGetPublished(&sample);
    
 
     /// X-Axis (i=0)
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[XACCEL], 19, 27, 16 ) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[XACCEL], 19, 27, 16 ) >> 16;
     index = uint16ToBuffer(response, index, tmp);
     /// Y-Axis (i=1)
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[YACCEL], 19, 27, 16 ) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[YACCEL], 19, 27, 16 ) >> 16;
     //tmp = (int)(SCALE_BY_2POW16_OVER_20(uncorrectedAccel_B[Z_AXIS]));
     index = uint16ToBuffer(response, index, tmp);
     /// Z-Axis (i=2)
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[ZACCEL], 19, 27, 16 ) >> 16;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[ZACCEL], 19, 27, 16 ) >> 16;
     index = uint16ToBuffer(response, index, tmp);
     
     return index;
@@ -685,10 +799,13 @@ uint16_t appendTangentAccels (uint8_t  *response,
 uint16_t appendRateTemp (uint8_t  *response,
                          uint16_t index)
 {
+    sensors_data_t sample;
     uint16_t tmp;
     double   tmpD;
 
-    tmpD = gSensorsData.scaledSensors[XRTEMP];
+    SensorsDataGetPublished(&sample);
+
+    tmpD = sample.scaledSensors[XRTEMP];
 
     if (tmpD >= MAX_TEMP_4_SENSOR_PACKET) {
         tmpD =  MAX_TEMP_4_SENSOR_PACKET;
@@ -721,43 +838,46 @@ uint16_t appendRateTemp (uint8_t  *response,
 uint16_t appendTemps (uint8_t  *response,
                       uint16_t index)
 {
+    sensors_data_t sample;
     uint16_t tmp;
 
+    SensorsDataGetPublished(&sample);
+
     // Rate sensor temperature hn units of [ 10 degC ] but the output must be in
     //   degC scaled by 2^16/200 so the multiplier must be ( 2^16/20 ). The max
     //   temp should be 15.5 [ 10 degC ], which places the max value of l
     // iqmath
-    if( gSensorsData.scaledSensors_q27[XRTEMP+0] >= MAX_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[XRTEMP+0] = MAX_OUTPUT_TEMP_q27;
-    } else if( gSensorsData.scaledSensors_q27[XRTEMP+0] <= MIN_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[XRTEMP+0] = MIN_OUTPUT_TEMP_q27;
+    if( sample.scaledSensors_q27[XRTEMP+0] >= MAX_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[XRTEMP+0] = MAX_OUTPUT_TEMP_q27;
+    } else if( sample.scaledSensors_q27[XRTEMP+0] <= MIN_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[XRTEMP+0] = MIN_OUTPUT_TEMP_q27;
     }
 
     // Convert to scaled output T { degC ] * ( 2^16/200 )
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[XRTEMP+0], 19, 27, 15 ) >> 15;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[XRTEMP+0], 19, 27, 15 ) >> 15;
     index = uint16ToBuffer(response,
                            index,
                            tmp);
 
     // iqmath
-    if( gSensorsData.scaledSensors_q27[XRTEMP+1] >= MAX_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[XRTEMP+1] = MAX_OUTPUT_TEMP_q27;
-    } else if( gSensorsData.scaledSensors_q27[XRTEMP+1] <= MIN_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[XRTEMP+1] = MIN_OUTPUT_TEMP_q27;
+    if( sample.scaledSensors_q27[XRTEMP+1] >= MAX_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[XRTEMP+1] = MAX_OUTPUT_TEMP_q27;
+    } else if( sample.scaledSensors_q27[XRTEMP+1] <= MIN_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[XRTEMP+1] = MIN_OUTPUT_TEMP_q27;
     }
 
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[XRTEMP+1], 19, 27, 15 ) >> 15;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[XRTEMP+1], 19, 27, 15 ) >> 15;
     index = uint16ToBuffer(response,
                            index,
                            tmp);
 
     // iqmath
-    if( gSensorsData.scaledSensors_q27[XRTEMP+2] >= MAX_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[XRTEMP+2] = MAX_OUTPUT_TEMP_q27;
-    } else if( gSensorsData.scaledSensors_q27[XRTEMP+2] <= MIN_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[XRTEMP+2] = MIN_OUTPUT_TEMP_q27;
+    if( sample.scaledSensors_q27[XRTEMP+2] >= MAX_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[XRTEMP+2] = MAX_OUTPUT_TEMP_q27;
+    } else if( sample.scaledSensors_q27[XRTEMP+2] <= MIN_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[XRTEMP+2] = MIN_OUTPUT_TEMP_q27;
     }
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[XRTEMP+2], 19, 27, 15 ) >> 15;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[XRTEMP+2], 19, 27, 15 ) >> 15;
     index = uint16ToBuffer(response,
                            index,
                            tmp);
@@ -766,13 +886,13 @@ uint16_t appendTemps (uint8_t  *response,
     //   degC scaled 2^16/200 so the multiplier must be ( 2^16/20 ). The max
     //   temp should be 15.5 [ 10 degC ], which places the max value of l
     // iqmath
-    if( gSensorsData.scaledSensors_q27[BTEMP] >= MAX_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[BTEMP] = MAX_OUTPUT_TEMP_q27;
-    } else if( gSensorsData.scaledSensors_q27[BTEMP] <= MIN_OUTPUT_TEMP_q27 ) {
-        gSensorsData.scaledSensors_q27[BTEMP] = MIN_OUTPUT_TEMP_q27;
+    if( sample.scaledSensors_q27[BTEMP] >= MAX_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[BTEMP] = MAX_OUTPUT_TEMP_q27;
+    } else if( sample.scaledSensors_q27[BTEMP] <= MIN_OUTPUT_TEMP_q27 ) {
+        sample.scaledSensors_q27[BTEMP] = MIN_OUTPUT_TEMP_q27;
     }
 
-    tmp = _qmul( TWO_POW16_OVER_20_q19, gSensorsData.scaledSensors_q27[BTEMP], 19, 27, 15 ) >> 15;
+    tmp = _qmul( TWO_POW16_OVER_20_q19, sample.scaledSensors_q27[BTEMP], 19, 27, 15 ) >> 15;
     // Split the 16-bit integer into two 8-bit numbers and place it into the response array
     index = uint16ToBuffer(response,
                            index,
@@ -851,34 +971,38 @@ uint16_t appendAttitudeTrue (uint8_t  *response,
 uint16_t appendInertialCounts (uint8_t  *response,
                                uint16_t index)
 {
+    sensors_data_t sample;
+
+    SensorsDataGetPublished(&sample);
+
     /// X-Axis Accelerometer
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[XACCEL]);
+                           sample.rawSensors[XACCEL]);
     /// Y-Axis Accelerometer
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[YACCEL]);
+                           sample.rawSensors[YACCEL]);
 
     /// Z-Axis Accelerometer
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[ZACCEL]);
+                           sample.rawSensors[ZACCEL]);
 
     /// X-Axis Rate-Sensor
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[XRATE]);
+                           sample.rawSensors[XRATE]);
 
     /// Y-Axis Rate-Sensor
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[YRATE]);
+                           sample.rawSensors[YRATE]);
 
     /// Z-Axis Rate-Sensor
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[ZRATE]);
+                           sample.rawSensors[ZRATE]);
 
     return index;
 } /* end appendInertialCounts */
@@ -895,18 +1019,22 @@ uint16_t appendInertialCounts (uint8_t  *response,
 uint16_t appendMagnetometerCounts (uint8_t  *response,
                                    uint16_t index)
 {
+    sensors_data_t sample;
+
+    SensorsDataGetPublished(&sample);
+
     /// X-Axis
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[XMAG]);
+                           sample.rawSensors[XMAG]);
     /// Y-Axis
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[YMAG]);
+                           sample.rawSensors[YMAG]);
     /// Z-Axis
     index = uint32ToBuffer(response,
                            index,
-                           gSensorsData.rawSensors[ZMAG]);
+                           sample.rawSensors[ZMAG]);
     return index;
 } /* end appendMagnetometerCounts */
 
@@ -924,8 +1052,11 @@ uint16_t appendMagnetometerCounts (uint8_t  *response,
 uint16_t appendAllTempCounts (uint8_t  *response,
                               uint16_t index)
 {
+    sensors_data_t sample;
     uint32_t temp;
 
+    SensorsDataGetPublished(&sample);
+
     /// @brief
     /// The older device had a temperature sensor on each of the sensors (prior
     /// to tri-axial device). The DMU380 only has a temperature sensor on the
@@ -934,7 +1065,7 @@ uint16_t appendAllTempCounts (uint8_t  *response,
     /// of the group of temperature sensors has data while the rest are zero.
 
     /// accelerometer temperature sensors
-    temp = gSensorsData.rawSensors[ XATEMP ];
+    temp = sample.rawSensors[ XATEMP ];
 
    /// X-Axis accelerometer temperature
     index = uint32ToBuffer(response,
@@ -952,7 +1083,7 @@ uint16_t appendAllTempCounts (uint8_t  *response,
                            temp);
 
     /// Rate Sensor temperature values
-    temp = gSensorsData.rawSensors[ XRTEMP ];
+    temp = sample.rawSensors[ XRTEMP ];
 
     /// X-Axis rate-sensor temperature
     index = uint32ToBuffer(response,
@@ -970,7 +1101,7 @@ uint16_t appendAllTempCounts (uint8_t  *response,
                            temp);
 
     /// The last element of the packet contains the board temperature.
-    temp = gSensorsData.rawSensors[ BTEMP ];
+    temp = sample.rawSensors[ BTEMP ];
     index = uint32ToBuffer(response,
                            index,
                            temp);
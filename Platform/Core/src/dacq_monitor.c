@@ -0,0 +1,198 @@
+/** ***************************************************************************
+ * @file   dacq_monitor.c
+ * @brief  deadline monitor of the acquisition tick
+ *
+ * The release interrupt stamps each tick with the TIM5 value of its update
+ * event and checks the previous tick: dataAcqSem still given means the task
+ * never took it (missed), taken but not finished means the task is late
+ * (overrun). The task side marks the end of each stage from the library
+ * entry points it calls every tick; the first mark of a tick measures from
+ * the update event, so the processing stage holds the task wakeup, the
+ * sensor reads and the algorithm of the application.
+ *
+ * Every variable has a single writer, the release interrupt, the TIM5
+ * interrupt or the dacq task, so nothing is masked. The worst case times are
+ * restarted by the reader through an epoch: a writer that sees a new epoch
+ * overwrites its slot instead of comparing.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include "stm32f4xx.h"
+#include "timebase.h"
+#include "dacq_rate.h"
+#include "dacq_monitor.h"
+
+// release interrupt
+static volatile uint32_t releaseSeq  = 0;   // ticks released
+static volatile uint32_t releaseRef  = 0;   // TIM5 at the update event of tick releaseSeq
+static volatile uint32_t lastMissSeq = 0;   // tick released late, 0 none yet
+static volatile uint32_t overruns    = 0;
+static volatile uint32_t missed      = 0;
+// one interrupt each
+static volatile uint32_t events[DACQ_EVENTS];
+// dacq task
+static volatile uint32_t doneSeq     = 0;   // last tick finished, 0 none yet
+static volatile uint32_t completed   = 0;
+static uint32_t          markSeq     = 0;   // tick the marks belong to
+static uint32_t          tickRef     = 0;   // its update event
+static uint32_t          markTicks   = 0;   // end of the last stage
+// worst case, TIM5 ticks, one writer per stage
+static volatile uint32_t epoch       = 0;
+static volatile uint32_t wcet     [DACQ_STAGES];
+static volatile uint32_t wcetEpoch[DACQ_STAGES];
+
+
+static void _Wcet(dacq_stage_t stage, uint32_t ticks)
+{
+    uint32_t e = epoch;
+
+    if (wcetEpoch[stage] != e) {
+        wcetEpoch[stage] = e;
+        wcet[stage]      = ticks;
+    } else if (ticks > wcet[stage]) {
+        wcet[stage] = ticks;
+    }
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorRelease
+ * @brief a dacq tick released, from the interrupt that gives dataAcqSem
+ * @param [in] eventTicks - TIM5 at the update event or sync edge of the tick
+ * @param [in] consumed - FALSE when dataAcqSem was still given
+ * @retval N/A
+ ******************************************************************************/
+void DacqMonitorRelease(uint32_t eventTicks, BOOL consumed)
+{
+    uint32_t seq  = releaseSeq;
+    uint32_t done = doneSeq;
+
+    if (!consumed) {
+        missed++;
+        lastMissSeq = seq + 1;
+    } else if (done && done != seq) {
+        overruns++;
+        lastMissSeq = seq + 1;
+    }
+    releaseRef = eventTicks;
+    __DMB();
+    releaseSeq = seq + 1;
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorIsrDone
+ * @brief interrupt duration, just before its exit
+ * @param [in] stage - DACQ_STAGE_TIM2_ISR or DACQ_STAGE_TIM5_ISR
+ * @param [in] enterTicks - TIM5 at its entry
+ * @retval N/A
+ ******************************************************************************/
+void DacqMonitorIsrDone(dacq_stage_t stage, uint32_t enterTicks)
+{
+    _Wcet(stage, TIM5->CNT - enterTicks);
+}
+
+void DacqMonitorEvent(dacq_event_t event)
+{
+    events[event]++;
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorStart
+ * @brief from every library entry point of the dacq task: the first call of
+ *        a tick closes the processing stage
+ * @retval N/A
+ ******************************************************************************/
+void DacqMonitorStart(void)
+{
+    uint32_t seq, ref;
+
+    do {
+        seq = releaseSeq;
+        __DMB();
+        ref = releaseRef;
+        __DMB();
+    } while (seq != releaseSeq);
+
+    if (seq != markSeq) {
+        markSeq   = seq;
+        tickRef   = ref;
+        markTicks = ref;
+        DacqMonitorMark(DACQ_STAGE_PROCESSING);
+    }
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorMark
+ * @brief end of a task stage, which started at the end of the previous one
+ * @param [in] stage - dacq_stage_t
+ * @retval N/A
+ ******************************************************************************/
+void DacqMonitorMark(dacq_stage_t stage)
+{
+    uint32_t now = TIM5->CNT;
+
+    _Wcet(stage, now - markTicks);
+    markTicks = now;
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorTickDone
+ * @brief end of the dacq tick, the next release must find it here
+ * @retval N/A
+ ******************************************************************************/
+void DacqMonitorTickDone(void)
+{
+    _Wcet(DACQ_STAGE_RESPONSE, TIM5->CNT - tickRef);
+    completed++;
+    doneSeq = markSeq;
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorDeadlineMissed
+ * @brief for the BIT status
+ * @retval TRUE if a tick was missed or overran within the last second
+ ******************************************************************************/
+BOOL DacqMonitorDeadlineMissed(void)
+{
+    uint32_t last = lastMissSeq;
+
+    return last != 0 && releaseSeq - last < DACQ_ODR_HZ;
+}
+
+/** ***************************************************************************
+ * @name DacqMonitorGetStats
+ * @brief counters since start, worst case times since the previous call
+ * @param [out] stats - dacq_monitor_stats_t
+ * @retval N/A
+ ******************************************************************************/
+void DacqMonitorGetStats(dacq_monitor_stats_t *stats)
+{
+    uint32_t e = epoch;
+    int      i;
+
+    stats->released  = releaseSeq;
+    stats->completed = completed;
+    stats->overruns  = overruns;
+    stats->missed    = missed;
+    for (i = 0; i < DACQ_EVENTS; i++) {
+        stats->events[i] = events[i];
+    }
+    for (i = 0; i < DACQ_STAGES; i++) {
+        stats->wcetUs[i] = wcetEpoch[i] == e ? timebaseDiv60(wcet[i]) : 0;
+    }
+    epoch = e + 1;
+}
@@ -28,6 +28,7 @@ limitations under the License.
 
 
 #include <stdint.h>
+#include <string.h>
 #include <GlobalConstants.h>
 #include "serial_port.h"
 #include "config_fields.h"
@@ -46,6 +47,12 @@ limitations under the License.
 
 static UcbPacketStruct primaryUcbPacket;    /// all other data
 
+/// bulk configuration transfer state
+static ConfigurationStruct eepromImage;     /// "BR" EEPROM read buffer
+static ConfigurationStruct stagedImage;     /// "BW" image being assembled
+static uint8_t stagedDirty[(CONFIG_IMAGE_WORDS + 7) / 8];
+static BOOL    staging = FALSE;
+
 BOOL fReset = FALSE;
 
 void Reset(){fReset = TRUE;}
@@ -831,6 +838,220 @@ static void _UcbReadApp(ExternPortTypeEnum port, UcbPacketStruct  *ptrUcbPacket)
 
 
 
+/** ****************************************************************************
+ * @name _ConfigBlockCrc
+ * @brief CRC-16 (same polynomial and seed as the packet CRC) over a block of
+ *        configuration words as they appear on the wire, big endian
+ ******************************************************************************/
+static uint16_t _ConfigBlockCrc (const uint16_t *words,
+                                 uint16_t       count)
+{
+    uint16_t crc = CRC16_SEED;
+    uint16_t i;
+
+    for (i = 0; i < count; i++) {
+        crc = UpdateCRC(crc, (uint8_t)(words[i] >> 8));
+        crc = UpdateCRC(crc, (uint8_t) words[i]);
+    }
+    return crc;
+}
+
+static uint8_t _PutConfigBlockHeader (uint8_t  *payload,
+                                      uint8_t  flags,
+                                      uint16_t start,
+                                      uint8_t  count)
+{
+    payload[0] = flags;
+    payload[1] = (uint8_t)(CONFIG_BLOCK_TAG >> 8);
+    payload[2] = (uint8_t) CONFIG_BLOCK_TAG;
+    payload[3] = (uint8_t)(CONFIG_IMAGE_WORDS >> 8);
+    payload[4] = (uint8_t) CONFIG_IMAGE_WORDS;
+    payload[5] = (uint8_t)(start >> 8);
+    payload[6] = (uint8_t) start;
+    payload[7] = count;
+    return UCB_CONFIG_BLOCK_HEADER_LENGTH;
+}
+
+/** ****************************************************************************
+ * @name _UcbReadConfigBlock
+ * @brief Handles UCB bulk configuration read "BR": a contiguous range of the
+ *        configuration image (RAM or EEPROM) in one reply, the EEPROM image is
+ *        read once per request instead of once per field.
+ *        Request: source flags(1), start word(2), word count(1), 0 = up to
+ *        the end of the image / as many as fit.
+ *        Reply:   flags(1), tag(2), image words(2), start(2), count(1),
+ *                 words(count * 2), CRC of the words(2).
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+static void _UcbReadConfigBlock (ExternPortTypeEnum port,
+                                 UcbPacketStruct    *ptrUcbPacket)
+{
+    uint8_t  *payload = ptrUcbPacket->payload;
+    uint8_t  source   = payload[0];
+    uint16_t start    = (uint16_t)((payload[1] << 8) | payload[2]);
+    uint16_t count    = payload[3];
+    uint16_t *image;
+    uint16_t crc;
+    uint16_t i;
+    uint8_t  index;
+
+    if (ptrUcbPacket->payloadLength != 4 || start >= CONFIG_IMAGE_WORDS) {
+        _SetNak(port, ptrUcbPacket);
+        HandleUcbTx(port, ptrUcbPacket);
+        return;
+    }
+
+    if (count == 0) {
+        count = CONFIG_IMAGE_WORDS - start;
+        if (count > UCB_CONFIG_BLOCK_MAX_WORDS) {
+            count = UCB_CONFIG_BLOCK_MAX_WORDS;
+        }
+    }
+
+    if (count > UCB_CONFIG_BLOCK_MAX_WORDS || start + count > CONFIG_IMAGE_WORDS) {
+        _SetNak(port, ptrUcbPacket);
+        HandleUcbTx(port, ptrUcbPacket);
+        return;
+    }
+
+    if (source & CONFIG_BLOCK_EEPROM) {
+        SetMaxDelay_Watchdog();
+        readUnitConfigurationStruct(&eepromImage);
+        RestoreDelay_Watchdog();
+        image = (uint16_t *)&eepromImage;
+    } else {
+        image = (uint16_t *)&gConfiguration;
+    }
+
+    index = _PutConfigBlockHeader(payload, source, start, (uint8_t)count);
+    for (i = 0; i < count; i++) {
+        payload[index++] = (uint8_t)(image[start + i] >> 8);
+        payload[index++] = (uint8_t) image[start + i];
+    }
+    crc = _ConfigBlockCrc(&image[start], count);
+    payload[index++] = (uint8_t)(crc >> 8);
+    payload[index++] = (uint8_t) crc;
+
+    ptrUcbPacket->payloadLength = index;
+    HandleUcbTx(port, ptrUcbPacket);
+}
+
+/** ****************************************************************************
+ * @name _UcbWriteConfigBlock
+ * @brief Handles UCB bulk configuration write "BW". Ranges are staged until a
+ *        packet with CONFIG_BLOCK_COMMIT, then validated like SF / WF and
+ *        applied all-or-nothing, with a single EEPROM write. One packet with
+ *        BEGIN | COMMIT writes a single range. Writable words are those of SF /
+ *        WF, LOWER_CONFIG_ADDR_BOUND to UPPER_CONFIG_ADDR_BOUND.
+ *        Request: flags(1), tag(2), image words(2), start(2), count(1),
+ *                 words(count * 2), CRC of the words(2).
+ *        Reply:   the request header and the CRC of the range as stored
+ *                 (read back from the target after a commit).
+ *        Tag or image size not matching this firmware, a CRC error or a
+ *        rejected field are NAKed and drop the staged image.
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+static void _UcbWriteConfigBlock (ExternPortTypeEnum port,
+                                  UcbPacketStruct    *ptrUcbPacket)
+{
+    uint8_t  *payload = ptrUcbPacket->payload;
+    uint8_t  flags    = payload[0];
+    uint16_t tag      = (uint16_t)((payload[1] << 8) | payload[2]);
+    uint16_t words    = (uint16_t)((payload[3] << 8) | payload[4]);
+    uint16_t start    = (uint16_t)((payload[5] << 8) | payload[6]);
+    uint16_t count    = payload[7];
+    uint8_t  *data    = &payload[UCB_CONFIG_BLOCK_HEADER_LENGTH];
+    uint16_t *staged  = (uint16_t *)&stagedImage;
+    uint16_t *stored  = staged;
+    BOOL     valid;
+    uint16_t crc;
+    uint16_t i;
+
+    valid = (BOOL)(ptrUcbPacket->payloadLength >= UCB_CONFIG_BLOCK_HEADER_LENGTH + 2 &&
+                   ptrUcbPacket->payloadLength == UCB_CONFIG_BLOCK_HEADER_LENGTH + count * 2 + 2 &&
+                   tag   == CONFIG_BLOCK_TAG &&
+                   words == CONFIG_IMAGE_WORDS &&
+                   start >= LOWER_CONFIG_ADDR_BOUND &&
+                   start + count <= UPPER_CONFIG_ADDR_BOUND + 1 &&
+                   start + count <= CONFIG_IMAGE_WORDS &&
+                   (flags & (CONFIG_BLOCK_RAM | CONFIG_BLOCK_EEPROM)) &&
+                   (!(flags & CONFIG_BLOCK_EEPROM) || !eepromLocked()));
+
+    if (valid && (flags & CONFIG_BLOCK_BEGIN)) {
+        memset(stagedDirty, 0, sizeof(stagedDirty));
+        staging = TRUE;
+    }
+    valid = (BOOL)(valid && staging);
+
+    if (valid) {
+        for (i = 0; i < count; i++) {
+            staged[start + i] = (uint16_t)((data[2 * i] << 8) | data[2 * i + 1]);
+        }
+        crc   = (uint16_t)((data[2 * count] << 8) | data[2 * count + 1]);
+        valid = (BOOL)(crc == _ConfigBlockCrc(&staged[start], count));
+    }
+
+    if (valid) {
+        for (i = start; i < start + count; i++) {
+            stagedDirty[i >> 3] |= (uint8_t)(1 << (i & 7));
+        }
+
+        if (flags & CONFIG_BLOCK_COMMIT) {
+            staging = FALSE;
+            SetMaxDelay_Watchdog();
+            valid = ApplyConfigurationWords(staged,
+                                            stagedDirty,
+                                            (BOOL)((flags & CONFIG_BLOCK_RAM) != 0),
+                                            (BOOL)((flags & CONFIG_BLOCK_EEPROM) != 0));
+            if (flags & CONFIG_BLOCK_EEPROM) {
+                readUnitConfigurationStruct(&eepromImage);
+                stored = (uint16_t *)&eepromImage;
+            } else {
+                stored = (uint16_t *)&gConfiguration;
+            }
+            RestoreDelay_Watchdog();
+        }
+    }
+
+    if (!valid) {
+        staging = FALSE;
+        _SetNak(port, ptrUcbPacket);
+    } else {
+        crc = _ConfigBlockCrc(&stored[start], count);
+        _PutConfigBlockHeader(payload, flags, start, (uint8_t)count);
+        payload[UCB_CONFIG_BLOCK_HEADER_LENGTH]     = (uint8_t)(crc >> 8);
+        payload[UCB_CONFIG_BLOCK_HEADER_LENGTH + 1] = (uint8_t) crc;
+        ptrUcbPacket->payloadLength = UCB_CONFIG_BLOCK_HEADER_LENGTH + 2;
+    }
+    HandleUcbTx(port, ptrUcbPacket);
+}
+
+
+/** ****************************************************************************
+ * @name _UcbSetBaudTrial
+ * @brief Handles UCB baud negotiation "BD": payload is the BAUD_* setting to
+ *        try. The reply is sent at the current rate, the port then switches
+ *        and falls back unless a valid packet arrives (platformStartBaudTrial).
+ *        A later NAK of "BD" means the switch never happened
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+static void _UcbSetBaudTrial (ExternPortTypeEnum port,
+                              UcbPacketStruct    *ptrUcbPacket)
+{
+    if (ptrUcbPacket->payloadLength != 1 ||
+        platformStartBaudTrial(ptrUcbPacket->payload[0]) == FALSE) {
+        _SetNak(port, ptrUcbPacket);
+    }
+    HandleUcbTx(port, ptrUcbPacket);
+}
+
+
 /** ****************************************************************************
  * @name HandleUcbPacket - API
  * @brief general handler
@@ -872,6 +1093,12 @@ void HandleUcbPacket ( UcbPacketStruct *ptrUcbPacket)
                 _UcbReadEeprom(port, ptrUcbPacket); break;
             case UCB_READ_APP:
                 _UcbReadApp(port, ptrUcbPacket); break;
+            case UCB_READ_CONFIG_BLOCK:
+                _UcbReadConfigBlock(port, ptrUcbPacket); break;
+            case UCB_WRITE_CONFIG_BLOCK:
+                _UcbWriteConfigBlock(port, ptrUcbPacket); break;
+            case UCB_SET_BAUD_TRIAL:
+                _UcbSetBaudTrial(port, ptrUcbPacket); break;
             case UCB_WRITE_EEPROM:
                 _UcbWriteEeprom(port, ptrUcbPacket); break;
             case UCB_PROGRAM_RESET:
@@ -977,6 +1204,13 @@ void WriteMagAlignParamsToMemory( ExternPortTypeEnum port,
  ******************************************************************************/
 void ProcessUserCommands (void)
 {
+    if (platformBaudTrialTick() == FALSE) {
+        /// the "BD" reply did not drain, the port stays at its rate
+        primaryUcbPacket.packetType = UCB_SET_BAUD_TRIAL;
+        _SetNak(userSerialChan, &primaryUcbPacket);
+        HandleUcbTx(userSerialChan, &primaryUcbPacket);
+    }
+
     /// check received packets and handle appropriately
     HandleUcbRx (&primaryUcbPacket);
 
@@ -0,0 +1,168 @@
+/** ***************************************************************************
+ * @file   latency_probe.c
+ * @brief  sample to wire latency histograms
+ *
+ * The reference of a tick is its TIM2 update event, found at interrupt entry
+ * as TIM5 minus TIM2->CNT (both count at the same rate). Stages within the
+ * tick only store their offset and the tick they belong to; the next
+ * LatencyTick() bins those of the tick just ended, so a stage probed several
+ * times (one filter call per sensor) counts once, with its last value. The tx
+ * stages can complete after the next tick has started and are binned at once
+ * against the reference LatencyArm() saved for their path.
+ *
+ * Every shared variable is written with single stores, never read-modify-
+ * write, so the probes need no critical section. Each histogram is updated
+ * from one context only; the reader copies them as they are, a count caught
+ * mid-update is off by one at most.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifdef DACQ_LATENCY_PROBES
+
+#include <string.h>
+#include "stm32f4xx.h"
+#include "timebase.h"
+#include "latency_probe.h"
+
+#define LATENCY_BIN0_SHIFT      4           // first bin below 16 us
+
+static latency_stats_t   stats;
+static volatile uint8_t  resetRequest = 0;
+static volatile uint32_t tickCount    = 0;
+static volatile uint32_t tickRef      = 0;  // TIM5 at the update event of this tick
+static uint32_t          stampTicks[LATENCY_STAGES];   // TIM5 ticks after tickRef
+static volatile uint32_t stampTick [LATENCY_STAGES];   // tickCount + 1 when probed
+static volatile uint32_t txRef     [LATENCY_PATHS];
+static volatile uint8_t  txArmed   [LATENCY_STAGES];
+
+static const latency_path_t txPath[LATENCY_STAGES] = {
+    [LATENCY_UART_TX_START] = LATENCY_PATH_UART,
+    [LATENCY_UART_TX_DONE]  = LATENCY_PATH_UART,
+    [LATENCY_CAN_TX_START]  = LATENCY_PATH_CAN,
+    [LATENCY_CAN_TX_DONE]   = LATENCY_PATH_CAN,
+};
+
+
+static void _Bin(latency_stage_t stage, uint32_t ticks)
+{
+    uint32_t us  = timebaseDiv60(ticks);
+    uint32_t v   = us >> LATENCY_BIN0_SHIFT;
+    uint8_t  bin = 0;
+
+    while (v && bin < LATENCY_BINS - 1) {
+        v >>= 1;
+        bin++;
+    }
+    stats.hist[stage][bin]++;
+    if (us > stats.maxUs[stage]) {
+        stats.maxUs[stage] = us;
+    }
+}
+
+
+/** ***************************************************************************
+ * @name LatencyTick
+ * @brief TIM2 interrupt entry: closes the previous tick and starts this one
+ * @param [in] sinceEvent - TIM2->CNT, TIM5 ticks since the update event
+ * @retval N/A
+ ******************************************************************************/
+void LatencyTick(uint32_t sinceEvent)
+{
+    uint32_t now  = TIM5->CNT;
+    uint32_t tick = tickCount;
+    int      i;
+
+    if (resetRequest) {
+        memset(&stats, 0, sizeof(stats));
+        resetRequest = 0;
+    } else {
+        for (i = 0; i < LATENCY_STAGES; i++) {
+            if (stampTick[i] == tick + 1) {
+                _Bin((latency_stage_t)i, stampTicks[i]);
+            }
+        }
+    }
+
+    stats.ticks++;
+    tickCount = tick + 1;
+    tickRef   = now - sinceEvent;
+    stampTicks[LATENCY_ISR_ENTRY] = sinceEvent;
+    stampTick [LATENCY_ISR_ENTRY] = tick + 2;
+}
+
+
+/** ***************************************************************************
+ * @name LatencyProbe
+ * @brief timestamps one stage, from any task or interrupt
+ * @param [in] stage - latency_stage_t
+ * @retval N/A
+ ******************************************************************************/
+void LatencyProbe(latency_stage_t stage)
+{
+    uint32_t now = TIM5->CNT;
+
+    if (stage >= LATENCY_STAGES) {
+        return;
+    }
+    if (stage < LATENCY_UART_TX_START) {
+        stampTicks[stage] = now - tickRef;
+        stampTick [stage] = tickCount + 1;
+    } else if (txArmed[stage] &&
+               (stage == LATENCY_UART_TX_START || stage == LATENCY_CAN_TX_START || !txArmed[stage - 1])) {
+        // a tx done only after the tx start of the same packet
+        txArmed[stage] = 0;
+        _Bin(stage, now - txRef[txPath[stage]]);
+    }
+}
+
+
+/** ***************************************************************************
+ * @name LatencyArm
+ * @brief the next tx start and tx done of a path belong to this tick
+ * @param [in] path - latency_path_t
+ * @retval N/A
+ ******************************************************************************/
+void LatencyArm(latency_path_t path)
+{
+    txRef[path] = tickRef;
+    if (path == LATENCY_PATH_UART) {
+        txArmed[LATENCY_UART_TX_START] = 1;
+        txArmed[LATENCY_UART_TX_DONE]  = 1;
+    } else {
+        txArmed[LATENCY_CAN_TX_START]  = 1;
+        txArmed[LATENCY_CAN_TX_DONE]   = 1;
+    }
+}
+
+
+void LatencyGetStats(latency_stats_t *out)
+{
+    *out = stats;
+}
+
+/** ***************************************************************************
+ * @name LatencyReset
+ * @brief clears the histograms at the next dacq tick
+ * @retval N/A
+ ******************************************************************************/
+void LatencyReset(void)
+{
+    resetRequest = 1;
+}
+
+#endif // DACQ_LATENCY_PROBES
@@ -0,0 +1,177 @@
+/** ***************************************************************************
+ * @file   low_power_idle.c
+ * @brief  tickless idle sleep policy and statistics
+ *
+ * The idle task suspends the scheduler around the sleep, so a task readied
+ * by the interrupt that ends a sleep only runs once the kernel has stepped
+ * its tick count. For the dacq tick that would be added latency on every
+ * tick: the sleep is rather bounded to end LOW_POWER_IDLE_GUARD_US before the
+ * next TIM2 update event (or 1 kHz sync pulse), and within the guard the idle
+ * task spins. Other interrupts still end a sleep at once; their handlers run
+ * a few instructions after the wakeup.
+ *
+ * The sleep counters are written by the idle task, the wake latency by the
+ * interrupt that releases the dacq tick; the reader restarts both through an
+ * epoch, like the worst case times of dacq_monitor.c.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include "timebase.h"
+#include "platformAPI.h"
+#include "low_power_idle.h"
+
+#define GUARD_TICKS     (LOW_POWER_IDLE_GUARD_US * TIMEBASE_TICKS_PER_US)
+
+static volatile uint32_t epoch       = 1;
+static uint64_t          windowStart = 0;   // usec, reader
+// idle task
+static volatile uint32_t sleepEpoch  = 0;
+static volatile uint64_t slept       = 0;   // TIM5 ticks
+static volatile uint32_t sleeps      = 0;
+static volatile uint32_t skipped     = 0;
+// dacq tick interrupt
+static volatile uint32_t wakeEpoch   = 0;
+static volatile uint32_t wakes       = 0;
+static volatile uint32_t wakeMin     = 0;   // TIM5 ticks
+static volatile uint32_t wakeMax     = 0;
+static volatile uint64_t wakeSum     = 0;
+
+
+/** ***************************************************************************
+ * @name LowPowerIdleCountsToDeadline
+ * @brief how long the core may sleep from now
+ * @param [in] countsPerSecond - clock of the caller's counts (SysTick)
+ * @retval counts until the guard before the next dacq tick interrupt, 0
+ *         within the guard, UINT32_MAX when no dacq timer runs
+ ******************************************************************************/
+uint32_t LowPowerIdleCountsToDeadline(uint32_t countsPerSecond)
+{
+    uint32_t ticks = platformTicksToDacqEvent();
+    uint64_t counts;
+
+    if (ticks == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+    if (ticks <= GUARD_TICKS) {
+        return 0;
+    }
+    counts = (uint64_t)timebaseDiv60(ticks - GUARD_TICKS) * (countsPerSecond / 1000000);
+    return counts > UINT32_MAX - 1 ? UINT32_MAX - 1 : (uint32_t)counts;
+}
+
+static void _SleepEpoch(void)
+{
+    uint32_t e = epoch;
+
+    if (sleepEpoch != e) {
+        slept      = 0;
+        sleeps     = 0;
+        skipped    = 0;
+        sleepEpoch = e;
+    }
+}
+
+/** ***************************************************************************
+ * @name LowPowerIdleSlept
+ * @brief one sleep of the idle task, after interrupts are enabled again
+ * @param [in] fromTicks - LowPowerIdleNow() before WFI
+ * @param [in] toTicks - LowPowerIdleNow() after WFI
+ * @retval N/A
+ ******************************************************************************/
+void LowPowerIdleSlept(uint32_t fromTicks, uint32_t toTicks)
+{
+    _SleepEpoch();
+    slept += toTicks - fromTicks;
+    sleeps++;
+}
+
+void LowPowerIdleSkipped(void)
+{
+    _SleepEpoch();
+    skipped++;
+}
+
+/** ***************************************************************************
+ * @name LowPowerIdleDacqEntry
+ * @brief from the interrupt that releases a dacq tick
+ * @param [in] latencyTicks - TIM5 ticks from the update event or sync edge to
+ *             interrupt entry
+ * @retval N/A
+ ******************************************************************************/
+void LowPowerIdleDacqEntry(uint32_t latencyTicks)
+{
+    uint32_t e = epoch;
+
+    if (wakeEpoch != e) {
+        wakes     = 0;
+        wakeMin   = latencyTicks;
+        wakeMax   = latencyTicks;
+        wakeSum   = 0;
+        wakeEpoch = e;
+    }
+    if (latencyTicks < wakeMin) {
+        wakeMin = latencyTicks;
+    }
+    if (latencyTicks > wakeMax) {
+        wakeMax = latencyTicks;
+    }
+    wakeSum += latencyTicks;
+    wakes++;
+}
+
+// TIM5 ticks to nanoseconds, 50 / 3 ns per tick
+static uint32_t _Ns(uint64_t ticks)
+{
+    ticks = ticks * 50 / 3;
+    return ticks > UINT32_MAX ? UINT32_MAX : (uint32_t)ticks;
+}
+
+/** ***************************************************************************
+ * @name LowPowerIdleGetStats
+ * @brief statistics since the previous call, which starts a new window
+ * @param [out] stats - low_power_idle_stats_t
+ * @retval N/A
+ ******************************************************************************/
+void LowPowerIdleGetStats(low_power_idle_stats_t *stats)
+{
+    uint32_t e   = epoch;
+    uint64_t now = platformGetCurrTimeStamp();
+
+    stats->windowUs = windowStart ? (uint32_t)(now - windowStart) : 0;
+    stats->sleptUs  = 0;
+    stats->sleeps   = 0;
+    stats->skipped  = 0;
+    if (sleepEpoch == e) {
+        stats->sleptUs = (uint32_t)timebaseTicksToUs(slept);
+        stats->sleeps  = sleeps;
+        stats->skipped = skipped;
+    }
+    stats->wakes      = 0;
+    stats->wakeMinNs  = 0;
+    stats->wakeMaxNs  = 0;
+    stats->wakeMeanNs = 0;
+    if (wakeEpoch == e && wakes) {
+        stats->wakes      = wakes;
+        stats->wakeMinNs  = _Ns(wakeMin);
+        stats->wakeMaxNs  = _Ns(wakeMax);
+        stats->wakeMeanNs = _Ns(wakeSum / stats->wakes);
+    }
+
+    windowStart = now;
+    epoch       = e + 1;
+}
@@ -42,10 +42,12 @@ limitations under the License.
 #include "BITStatus.h"
 #include "uart.h"
 #include "ucb_packet.h"
+#include "serial_port.h"
 #include "eepromAPI.h"
 #include "lowpass_filter.h"
 #include "filter.h"
 #include "Indices.h"
+#include "dacq_rate.h"
 
 #define PACKET_RATE_DIVIDER     10
 #define PACKET_CODE             0x4631
@@ -64,6 +66,8 @@ softwareVersionStruct bootFMversion; /// bootloader code base
 
 extern int calibrateTableValid;
 
+static int _BaudRateFromEnum(int baudEnum);
+
 
 #if 0
 /** ****************************************************************************
@@ -95,7 +99,8 @@ static void _CheckIfUnitHasConfigAndCal(void)
 
 /** ****************************************************************************
  * @name CheckPortBaudRate
- * @brief all serial port baud rates must be 9600, 19200, 38400 or 57600
+ * @brief user port baud rate must be one of the BAUD_* settings and the uart
+ *        must be able to generate it from the current clocks
  * Trace:
  * @param [in] portBaudRate - baud rate
  * @retval 	boolean, TRUE if the packet output is possible, FALSE if not
@@ -106,6 +111,8 @@ BOOL CheckPortBaudRate (uint16_t portBaudRate)
 
     if (portBaudRate >= NUM_BAUD_RATES) {
         valid = FALSE;
+    } else if (portBaudRate >= BAUD_921600) {
+        valid = uart_checkBaudRate(userSerialChan, _BaudRateFromEnum(portBaudRate));
     }
     return valid;
 }
@@ -121,17 +128,25 @@ BOOL CheckPortBaudRate (uint16_t portBaudRate)
  * @param [in] packetRateDivider - divider
  * @retval 	boolean, TRUE if the packet output is possible, FALSE if not
  ******************************************************************************/
-BOOL CheckContPacketRate (uint16_t      outputPacket,
-                          uint16_t      baudRate,
-                          uint16_t      packetRateDivider)
+static BOOL _CheckContPacketRate (uint16_t      outputPacket,
+                                  uint16_t      baudRate,
+                                  uint16_t      packetRateDivider,
+                                  BOOL          trailer)
 {
     BOOL     valid = TRUE;
     uint16_t bytesPerPacket;
     uint16_t bytesPerSecond;
+    int      ticksPerPacket;
 
     if (packetRateDivider == 0) {
         valid = TRUE;
     } else {
+        ticksPerPacket = platformConvertPacketRateDivider(packetRateDivider);
+        if (ticksPerPacket == 0) {
+            // faster than DACQ_ODR_HZ or not a whole number of dacq ticks
+            return FALSE;
+        }
+
         bytesPerPacket = UCB_SYNC_LENGTH +
                          UCB_PACKET_TYPE_LENGTH +
                          UCB_PAYLOAD_LENGTH_LENGTH +
@@ -165,6 +180,14 @@ BOOL CheckContPacketRate (uint16_t      outputPacket,
             case UCB_SCALED_1:
                 bytesPerPacket += UCB_SCALED_1_LENGTH;
                 break;
+            case UCB_COMPACT_1:
+                bytesPerPacket += UCB_COMPACT_1_LENGTH;
+                break;
+            case UCB_BATCH_1:
+                // one packet carries every sample since the previous one
+                bytesPerPacket += UCB_BATCH_1_HEADER_LENGTH +
+                                  UCB_BATCH_1_SAMPLE_LENGTH * ticksPerPacket;
+                break;
             default:
                 valid = FALSE;
         }
@@ -175,7 +198,11 @@ BOOL CheckContPacketRate (uint16_t      outputPacket,
         }
 #endif
 
-        bytesPerSecond = bytesPerPacket * (DACQ_200_HZ / platformConvertPacketRateDivider(packetRateDivider));
+        if (trailer) {
+            bytesPerPacket += UCB_STREAM_TRAILER_LENGTH;
+        }
+
+        bytesPerSecond = bytesPerPacket * (DACQ_ODR_HZ / ticksPerPacket);
 
         //   For a message with 10 bits/byte (data, start, and stop-bits) and a
         //   safety-factor of 80%, determine if the baud-rate can support the
@@ -206,14 +233,71 @@ BOOL CheckContPacketRate (uint16_t      outputPacket,
             case BAUD_460800:
                 valid = (BOOL)(bytesPerSecond < dutyCycle * 46080.0 );
                 break;
+            case BAUD_921600:
+                valid = (BOOL)(bytesPerSecond < dutyCycle * 92160.0 );
+                break;
+            case BAUD_1500000:
+                valid = (BOOL)(bytesPerSecond < dutyCycle * 150000.0 );
+                break;
+            case BAUD_2000000:
+                valid = (BOOL)(bytesPerSecond < dutyCycle * 200000.0 );
+                break;
+            case BAUD_3000000:
+                valid = (BOOL)(bytesPerSecond < dutyCycle * 300000.0 );
+                break;
             default:
                 valid = FALSE;
         }
+
+        if (outputPacket == UCB_BATCH_1 && ticksPerPacket > UCB_BATCH_MAX_DEPTH) {
+            valid = FALSE;
+        }
     }
     return valid;
+}
+
+BOOL CheckContPacketRate (uint16_t      outputPacket,
+                          uint16_t      baudRate,
+                          uint16_t      packetRateDivider)
+{
+    return _CheckContPacketRate(outputPacket, baudRate, packetRateDivider,
+                                platformStreamTrailerEnabled());
 } /* end CheckContPacketRate */
 
 
+/** ****************************************************************************
+ * @name _PacketRateDividerAtOdr
+ * @brief a stored divider that DACQ_ODR_HZ cannot pace (faster than the ODR
+ *        or not a whole number of dacq ticks) would leave the port quiet, so
+ *        step down to the next slower rate it can. 1 Hz always can
+ * @param [in] divider - packet_rate_div_t
+ * @retval packet_rate_div_t
+ ******************************************************************************/
+static uint16_t _PacketRateDividerAtOdr(uint16_t divider)
+{
+    // fastest first
+    static const uint16_t slower[] = {
+        PACKET_RATE_DIV_100HZ, PACKET_RATE_DIV_50HZ, PACKET_RATE_DIV_25HZ,
+        PACKET_RATE_DIV_20HZ,  PACKET_RATE_DIV_10HZ, PACKET_RATE_DIV_5HZ,
+        PACKET_RATE_DIV_2HZ,   PACKET_RATE_DIV_1HZ };
+    unsigned i;
+
+    if (divider == PACKET_RATE_DIV_QUIET ||
+        platformConvertPacketRateDivider(divider) != 0) {
+        return divider;
+    }
+    for (i = 0; i < sizeof(slower) / sizeof(slower[0]); i++) {
+        if (divider != PACKET_RATE_DIV_200HZ && slower[i] <= divider) {
+            continue;
+        }
+        if (platformConvertPacketRateDivider(slower[i]) != 0) {
+            return slower[i];
+        }
+    }
+    return PACKET_RATE_DIV_1HZ;
+}
+
+
 /** ****************************************************************************
  * @name ValidPortConfiguration
  * @brief Check output packet configuration members for sanity
@@ -244,10 +328,11 @@ BOOL ValidPortConfiguration (ConfigurationStruct *proposedConfiguration)
     /// check that a valid continuous output packet has been selected
     valid &= UcbPacketIsAnOutputPacket(continuousPacketType);
 
-    /// check continuous packet rate
-    valid &= CheckContPacketRate( continuousPacketType,
-                                  proposedConfiguration->baudRateUser,
-                                  proposedConfiguration->packetRateDivider );
+    /// check continuous packet rate, with the trailer if proposed
+    valid &= _CheckContPacketRate( continuousPacketType,
+                                   proposedConfiguration->baudRateUser,
+                                   proposedConfiguration->packetRateDivider,
+                                   (BOOL)(proposedConfiguration->streamTrailer == 1) );
     /// check port baud rates
     valid &= CheckPortBaudRate(proposedConfiguration->baudRateUser);
 
@@ -273,9 +358,10 @@ BOOL ValidPortConfiguration (ConfigurationStruct *proposedConfiguration)
  ******************************************************************************/
 void DefaultPortConfiguration (void)
 {
-  gConfiguration.packetRateDivider = PACKET_RATE_DIVIDER;
+  gConfiguration.packetRateDivider = _PacketRateDividerAtOdr(PACKET_RATE_DIVIDER);
   gConfiguration.packetCode        = PACKET_CODE;
   gConfiguration.baudRateUser      = BAUD_RATE_USER;
+  gConfiguration.streamTrailer     = 0;
 } /* end DefaultPortConfiguration */
 
 
@@ -329,6 +415,9 @@ void platformInitConfigureUnit(void)
     
     if (gConfiguration.CanTermResistorEnable != true)
       gConfiguration.CanTermResistorEnable = false;
+
+    if (gConfiguration.streamTrailer != 1)
+      gConfiguration.streamTrailer = 0;        // also an erased word
     
     if ((gConfiguration.ecuAddress < 128) || (gConfiguration.ecuAddress > 247))
       gConfiguration.ecuAddress = 128;
@@ -336,6 +425,9 @@ void platformInitConfigureUnit(void)
     if (gConfiguration.packetRateDivider > 200)
       gConfiguration.packetRateDivider = 10;     // 20 Hz at 200, will show 10 Hz     
 
+    /// CheckContPacketRate rejects it only when it is set
+    gConfiguration.packetRateDivider = _PacketRateDividerAtOdr(gConfiguration.packetRateDivider);
+
 
     /// check user orientation field for validity
     if (CheckOrientation(gConfiguration.orientation.all) == FALSE) {
@@ -350,7 +442,7 @@ void platformInitConfigureUnit(void)
 
     
     if(eepromLocked()){
-        gConfiguration.packetRateDivider = 10;
+        gConfiguration.packetRateDivider = _PacketRateDividerAtOdr(PACKET_RATE_DIV_10HZ);
 #ifdef CAN_BUS_COMM
         gConfiguration.packetRateDivider = 0;   // quiet mode
 #endif
@@ -571,13 +663,26 @@ BOOL platformSetPacketRate(int rate, BOOL fApply)
     return res;
 }
 
+/** ****************************************************************************
+ * @name platformConvertPacketRateDivider
+ * @brief dacq ticks per packet at DACQ_ODR_HZ for a packet rate divider
+ * @param [in] configParam - packet_rate_div_t, a divider of 100 Hz
+ * @retval ticks per packet, 0 in quiet mode or when the rate is not a whole
+ *         number of dacq ticks
+ ******************************************************************************/
 int platformConvertPacketRateDivider(int configParam)
 {
-    
-    if(configParam != PACKET_RATE_DIV_200HZ){
-        return configParam*2;
+    int ticks100;   // ticks per packet times 100
+
+    if(configParam == PACKET_RATE_DIV_200HZ){
+        ticks100 = DACQ_ODR_HZ / 2;
+    }else{
+        ticks100 = configParam * DACQ_ODR_HZ;
+    }
+    if(ticks100 % 100){
+        return 0;
     }
-    return 1;
+    return ticks100 / 100;
 }
 
 int platformGetPacketRateDivider()
@@ -606,6 +711,10 @@ BOOL platformSetBaudRate(int baudRate, BOOL fApply)
         case 115200:   baudRate = BAUD_115200; break;
         case 230400:   baudRate = BAUD_230400; break;
         case 460800:   baudRate = BAUD_460800; break;
+        case 921600:   baudRate = BAUD_921600; break;
+        case 1500000:  baudRate = BAUD_1500000; break;
+        case 2000000:  baudRate = BAUD_2000000; break;
+        case 3000000:  baudRate = BAUD_3000000; break;
         default:
             return FALSE;
     }
@@ -756,11 +865,11 @@ BOOL platformApplyOrientation(uint16_t input)
 
 //#pragma GCC pop_options
 
-int platformGetBaudRate()
+static int _BaudRateFromEnum(int baudEnum)
 {
     int baudRate = 0;
     
-    switch (gConfiguration.baudRateUser){
+    switch (baudEnum){
         case BAUD_9600:  baudRate = 9600;  break;
         case BAUD_19200: baudRate = 19200;  break;
         case BAUD_38400: baudRate = 38400;  break;
@@ -768,6 +877,10 @@ int platformGetBaudRate()
         case BAUD_115200: baudRate = 115200; break;
         case BAUD_230400: baudRate = 230400; break;
         case BAUD_460800: baudRate = 460800; break;
+        case BAUD_921600: baudRate = 921600; break;
+        case BAUD_1500000: baudRate = 1500000; break;
+        case BAUD_2000000: baudRate = 2000000; break;
+        case BAUD_3000000: baudRate = 3000000; break;
         case BAUD_57600:
         default:
             baudRate = 57600;
@@ -777,6 +890,11 @@ int platformGetBaudRate()
     return baudRate;
 }
 
+int platformGetBaudRate()
+{
+    return _BaudRateFromEnum(gConfiguration.baudRateUser);
+}
+
 int platformGetPacketRate()
 {
 
@@ -892,6 +1010,19 @@ void platformEnableGpsPps(BOOL enable)
     _useGpsPps = enable;
 }
 
+/// continuous packets carry a sequence number and dacq tick (see serial_port.h),
+/// configuration field STREAM_TRAILER_FIELD_ID
+BOOL platformStreamTrailerEnabled(void)
+{
+    return (BOOL)(gConfiguration.streamTrailer == 1);
+}
+
+/// RAM configuration only, as if set with SF
+void platformEnableStreamTrailer(BOOL enable)
+{
+    gConfiguration.streamTrailer = enable ? 1 : 0;
+}
+
 
 int platformGetGpsBaudRate()
 {
@@ -1159,6 +1290,22 @@ int  platformGetFilterType(int sensor, BOOL fSpi)
     }
     
     if(fSpi){
+#if DACQ_ODR_HZ != 200
+        // the Bartlett taps are fixed for 200 Hz, use the Butterworth filter
+        // of the same cutoff, which FilterInit() designs for DACQ_ODR_HZ
+        switch(counts){
+            case FIR_40HZ_LPF:
+                return IIR_40HZ_LPF;
+            case FIR_20HZ_LPF:
+                return IIR_20HZ_LPF;
+            case FIR_10HZ_LPF:
+                return IIR_10HZ_LPF;
+            case FIR_05HZ_LPF:
+                return IIR_05HZ_LPF;
+            default:
+                break;
+        }
+#endif
         return counts;
     }
 
@@ -1291,6 +1438,108 @@ BOOL platformForcePortTypeToSerialChannel(int portType, int channel)
 }
 
 
+/// user port baud negotiation, see platformStartBaudTrial()
+#define BAUD_TRIAL_TICKS    DACQ_ODR_HZ     // 1 s of user command ticks
+#define BAUD_TRIAL_DRAIN_TICKS  (DACQ_ODR_HZ / 4)   // 250 ms for the reply to leave
+
+typedef enum {
+    BAUD_TRIAL_IDLE,
+    BAUD_TRIAL_PENDING,             // waiting for the reply to leave at the old rate
+    BAUD_TRIAL_RUNNING,             // new rate active, waiting for a good packet
+} baud_trial_state_t;
+
+static struct {
+    baud_trial_state_t state;
+    uint16_t           newBaud;     // BAUD_* setting
+    uint16_t           oldBaud;
+    int                ticks;
+} _baudTrial = {BAUD_TRIAL_IDLE, 0, 0, 0};
+
+
+/** ****************************************************************************
+ * @name platformStartBaudTrial
+ * @brief auto-baud negotiation on the user port ("BD" command). The reply
+ *        goes out at the current rate, then the port switches to the new
+ *        rate. If a packet with a good CRC (e.g. an echo of a test pattern)
+ *        arrives within BAUD_TRIAL_TICKS the new rate stays in RAM, otherwise
+ *        the port falls back. The host walks down from the fastest rate until
+ *        one sticks, then stores it with WF if wanted. Continuous output
+ *        pauses until the switch; if the tx ring still has not drained after
+ *        BAUD_TRIAL_DRAIN_TICKS the trial is dropped at the old rate.
+ * @param [in] baudRate - BAUD_* setting to try
+ * @retval FALSE if the rate is not supported or the output packet won't fit
+ ******************************************************************************/
+BOOL platformStartBaudTrial(int baudRate)
+{
+    BOOL     valid;
+    uint16_t tmp = gConfiguration.baudRateUser;
+
+    if (_baudTrial.state != BAUD_TRIAL_IDLE || baudRate < 0 || baudRate >= NUM_BAUD_RATES) {
+        return FALSE;
+    }
+
+    gConfiguration.baudRateUser = (uint16_t)baudRate;
+    valid = ValidPortConfiguration(&gConfiguration);
+    gConfiguration.baudRateUser = tmp;
+
+    if (valid) {
+        _baudTrial.newBaud = (uint16_t)baudRate;
+        _baudTrial.oldBaud = tmp;
+        _baudTrial.ticks   = BAUD_TRIAL_DRAIN_TICKS;
+        _baudTrial.state   = BAUD_TRIAL_PENDING;
+    }
+    return valid;
+}
+
+/** ****************************************************************************
+ * @name platformBaudTrialTick
+ * @brief advances the negotiation, called with the user command processing
+ * @retval FALSE when a trial was dropped before the switch, the caller NAKs
+ *         the "BD" command at the unchanged rate
+ ******************************************************************************/
+BOOL platformBaudTrialTick(void)
+{
+    switch (_baudTrial.state) {
+        case BAUD_TRIAL_PENDING:
+            if (uart_txIdle(userSerialChan)) {
+                gConfiguration.baudRateUser = _baudTrial.newBaud;
+                uart_setBaudRate(userSerialChan, _BaudRateFromEnum(_baudTrial.newBaud));
+                _baudTrial.ticks = BAUD_TRIAL_TICKS;
+                _baudTrial.state = BAUD_TRIAL_RUNNING;
+            } else if (--_baudTrial.ticks <= 0) {
+                _baudTrial.state = BAUD_TRIAL_IDLE;
+                return FALSE;
+            }
+            break;
+        case BAUD_TRIAL_RUNNING:
+            if (--_baudTrial.ticks <= 0) {
+                gConfiguration.baudRateUser = _baudTrial.oldBaud;
+                uart_setBaudRate(userSerialChan, _BaudRateFromEnum(_baudTrial.oldBaud));
+                uart_flushRecBuffer(userSerialChan);
+                _baudTrial.state = BAUD_TRIAL_IDLE;
+            }
+            break;
+        default:
+            break;
+    }
+    return TRUE;
+}
+
+/// continuous output holds off while the "BD" reply drains at the old rate
+BOOL platformBaudTrialPending(void)
+{
+    return (BOOL)(_baudTrial.state == BAUD_TRIAL_PENDING);
+}
+
+/// a packet passed its CRC on the user port - keeps a running trial rate
+void platformBaudTrialConfirm(void)
+{
+    if (_baudTrial.state == BAUD_TRIAL_RUNNING) {
+        _baudTrial.state = BAUD_TRIAL_IDLE;
+    }
+}
+
+
 void platformDetectUserSerialCmd(uint8_t input)
 {
     static uint64_t inputSequence = 0LL;
@@ -0,0 +1,243 @@
+/** ***************************************************************************
+ * @file   sample_history.c
+ * @brief  timestamped sample history ring
+ *
+ * Single writer (dacq task), any number of readers. Every slot carries the
+ * sequence number of the sample in it; the writer clears it before touching
+ * the data and sets it afterwards, so a reader that sees the same sequence
+ * before and after copying has a consistent sample.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <string.h>
+#include "stm32f4xx.h"
+#include "sample_history.h"
+
+#if (SAMPLE_HISTORY_DEPTH & (SAMPLE_HISTORY_DEPTH - 1))
+#error "SAMPLE_HISTORY_DEPTH must be a power of two"
+#endif
+
+#define SAMPLE_HISTORY_MASK     (SAMPLE_HISTORY_DEPTH - 1)
+#define SAMPLE_HISTORY_MAX_DT   0xFFFF      // usec, data ready further from the tick is not kept
+
+static sample_history_entry_t history[SAMPLE_HISTORY_DEPTH];
+static volatile uint32_t      latestSeq = 0;     // 0 - nothing pushed yet
+
+
+/** ***************************************************************************
+ * @name SampleHistoryPush
+ * @brief store the current sample; overwrites the oldest one when full
+ * @param [in] data - sensor data of this dacq tick
+ * @param [in] tstamp - dacq timestamp of the sample
+ * @retval N/A
+ ******************************************************************************/
+void SampleHistoryPush(const sensors_data_t *data, uint64_t tstamp)
+{
+    uint32_t seq = latestSeq + 1;
+    volatile sample_history_entry_t *slot;
+    int64_t  dt;
+    int      g;
+
+    if (seq == 0) {
+        seq = 1;        // skip the "empty" marker on wrap
+    }
+    slot = &history[seq & SAMPLE_HISTORY_MASK];
+
+    slot->seq = 0;
+    __DMB();
+    slot->tstamp = tstamp;
+    memcpy((void *)slot->q27, &data->scaledSensors_q27[XACCEL], sizeof(slot->q27));
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        dt = data->sensorTstamp[g] ? (int64_t)(data->sensorTstamp[g] - tstamp) : 0;
+        if (dt > SAMPLE_HISTORY_MAX_DT || dt < -SAMPLE_HISTORY_MAX_DT) {
+            dt = 0;
+        }
+        slot->groupDtUs[g] = (int32_t)dt;
+    }
+    __DMB();
+    slot->seq = seq;
+    latestSeq = seq;
+}
+
+uint32_t SampleHistoryLatestSeq(void)
+{
+    return latestSeq;
+}
+
+uint32_t SampleHistoryOldestSeq(void)
+{
+    uint32_t latest = latestSeq;
+
+    if (latest < SAMPLE_HISTORY_DEPTH) {
+        return latest ? 1 : 0;
+    }
+    // the slot the writer fills next may be torn, leave it out
+    return latest - SAMPLE_HISTORY_DEPTH + 2;
+}
+
+
+/** ***************************************************************************
+ * @name SampleHistoryGet
+ * @brief copy out one sample by sequence number
+ * @param [in] seq - sequence number, SampleHistoryOldestSeq()..LatestSeq()
+ * @param [out] entry - sample copy
+ * @retval FALSE if the sample is not (or no longer) in the ring
+ ******************************************************************************/
+BOOL SampleHistoryGet(uint32_t seq, sample_history_entry_t *entry)
+{
+    volatile sample_history_entry_t *slot = &history[seq & SAMPLE_HISTORY_MASK];
+
+    if (seq == 0 || slot->seq != seq) {
+        return FALSE;
+    }
+    __DMB();
+    memcpy(entry, (const void *)slot, sizeof(sample_history_entry_t));
+    __DMB();
+
+    return (BOOL)(slot->seq == seq && entry->seq == seq);
+}
+
+// timestamp of one sample, FALSE if it is not (or no longer) in the ring
+static BOOL _GetTstamp(uint32_t seq, uint64_t *tstamp)
+{
+    volatile sample_history_entry_t *slot = &history[seq & SAMPLE_HISTORY_MASK];
+
+    if (seq == 0 || slot->seq != seq) {
+        return FALSE;
+    }
+    __DMB();
+    *tstamp = slot->tstamp;
+    __DMB();
+    return (BOOL)(slot->seq == seq);
+}
+
+
+/** ***************************************************************************
+ * @name SampleHistoryFind
+ * @brief latest sample taken at or before a time. Binary search, at most
+ *        log2(SAMPLE_HISTORY_DEPTH) + 2 probes; gives up rather than waits
+ *        when the writer overtakes it
+ * @param [in] tstamp - time, usec, dacq timebase
+ * @retval sequence number, 0 if tstamp is before the oldest sample or the
+ *         search was overrun
+ ******************************************************************************/
+uint32_t SampleHistoryFind(uint64_t tstamp)
+{
+    uint32_t lo = SampleHistoryOldestSeq();
+    uint32_t hi = SampleHistoryLatestSeq();
+    uint32_t mid;
+    uint64_t t;
+
+    if (lo == 0 || !_GetTstamp(lo, &t) || t > tstamp) {
+        return 0;
+    }
+    if (!_GetTstamp(hi, &t)) {
+        return 0;
+    }
+    if (t <= tstamp) {
+        return hi;
+    }
+
+    // tstamp(lo) <= tstamp < tstamp(hi)
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (!_GetTstamp(mid, &t)) {
+            return 0;
+        }
+        if (t <= tstamp) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+// a group of one sample moved by frac (0.15 fixed point, signed through neg)
+// towards the same group of the next sample
+static void _Interpolate(int32_t *q27, const int32_t *next, uint32_t frac, BOOL neg)
+{
+    int32_t d;
+    int     i;
+
+    for (i = 0; i < SENSOR_GROUP_AXES; i++) {
+        d      = (int32_t)((((int64_t)next[i] - q27[i]) * frac) >> 15);
+        q27[i] = neg ? q27[i] - d : q27[i] + d;
+    }
+}
+
+
+/** ***************************************************************************
+ * @name SampleHistoryAt
+ * @brief sample at a time, linearly interpolated between the two samples
+ *        around it. Each sensor group is interpolated along its own data
+ *        ready times, so the result is aligned across sensors even when the
+ *        samples were not (see sensor_tstamp.h). The interpolation weights
+ *        are 0.15 fixed point, so there is no 64-bit division
+ * @param [in] tstamp - time, usec, dacq timebase
+ * @param [out] entry - interpolated sample; seq is the sample before tstamp,
+ *                      tstamp the requested time and groupDtUs 0 for
+ *                      every group interpolated
+ * @retval FALSE if tstamp is outside the ring, the samples around it are more
+ *         than 65 ms apart (missed ticks) or were overwritten while read
+ ******************************************************************************/
+BOOL SampleHistoryAt(uint64_t tstamp, sample_history_entry_t *entry)
+{
+    sample_history_entry_t next;
+    uint32_t seq = SampleHistoryFind(tstamp);
+    uint32_t span, frac;
+    int32_t  shift, off;
+    BOOL     aligned = TRUE;
+    int      g;
+
+    if (seq == 0 || !SampleHistoryGet(seq, entry)) {
+        return FALSE;
+    }
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        aligned = aligned && entry->groupDtUs[g] == 0;
+    }
+    if (entry->tstamp == tstamp && aligned) {
+        return TRUE;
+    }
+    if (!SampleHistoryGet(seq + 1, &next) || next.tstamp - entry->tstamp > 0xFFFF) {
+        if (entry->tstamp != tstamp) {
+            return FALSE;
+        }
+        // the latest sample, as it was taken
+        memset(entry->groupDtUs, 0, sizeof(entry->groupDtUs));
+        return TRUE;
+    }
+
+    shift = (int32_t)(tstamp - entry->tstamp);
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        // data ready times of the group in both samples, relative to entry
+        off  = shift - entry->groupDtUs[g];
+        span = (uint32_t)((int32_t)(next.tstamp - entry->tstamp) + next.groupDtUs[g] - entry->groupDtUs[g]);
+        frac = (uint32_t)(off < 0 ? -off : off);
+        if ((int32_t)span <= 0 || span > 0xFFFF || frac > 2 * span) {
+            entry->groupDtUs[g] -= shift;   // keep the reading before
+            continue;
+        }
+        frac = (frac << 15) / span;
+        _Interpolate(&entry->q27[g * SENSOR_GROUP_AXES], &next.q27[g * SENSOR_GROUP_AXES], frac, (BOOL)(off < 0));
+        entry->groupDtUs[g] = 0;
+    }
+    entry->tstamp = tstamp;
+    return TRUE;
+}
@@ -25,6 +25,7 @@ See the License for the specific language governing permissions and
 limitations under the License.
 *******************************************************************************/
 
+#include <string.h>
 #include "boardAPI.h"
 #include "platformAPI.h"
 #include "algorithmAPI.h"
@@ -35,8 +36,19 @@ limitations under the License.
 #include "BITStatus.h"
 #include "uart.h"
 #include "ucb_packet.h"
+#include "compact_stream.h"
+#include "sample_history.h"
+#include "latency_probe.h"
+#include "dacq_monitor.h"
+#include "low_power_idle.h"
+#include "dacq_rate.h"
+#include "scaling.h"
+#include "qmath.h"
 
 #include "MagAlign.h"
+#ifdef SAE_J1939
+#include "sae_j1939_telemetry.h"
+#endif
 
 // placholders for Nav_view compatibility
 
@@ -59,10 +71,19 @@ void _UcbMagCal3Complete(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket)
 void _UcbNav0(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
 void _UcbNav1(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
 void _UcbNav2(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
+void _UcbCompact1(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
+void _UcbBatch1(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
+void _UcbCanTelemetry(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
+void _UcbLatency(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
+void _UcbDacqMonitor(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
+void _UcbLowPowerIdle(ExternPortTypeEnum port, UcbPacketStruct *ptrUcbPacket);
 
 uint8_t divideCount = 10; /// continuous packet rate divider - set initial delay
 
 static  UcbPacketStruct continuousUcbPacket; 
+static  compact_stream_t compactStream;
+static  uint32_t batchNextSeq = 0;    ///< next history sample to go out in B1
+static  uint32_t batchLost    = 0;    ///< samples overwritten before they were sent
 
 
 /** ****************************************************************************
@@ -553,6 +574,307 @@ void _UcbScaled0 (ExternPortTypeEnum port,
     }
 }
 
+/** ****************************************************************************
+ * @name _UcbCompact1 send C1 packet
+ * @brief A2 attitude, corrected rates and accels plus timer and BIT status,
+ *        sent as deltas from the previous sample with periodic key-frames
+ *        (see compact_stream.c). 45 % fewer bytes than A2 on the trajectory
+ *        of tools/compact_bench. UART only: the deltas assume the host gets
+ *        every frame, so on SPI the encoder state is left untouched
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+void _UcbCompact1 (ExternPortTypeEnum port,
+                   UcbPacketStruct    *ptrUcbPacket)
+{
+    uint8_t          scaled[2 * COMPACT_STREAM_NUM_CHANNELS];
+    uint16_t         index = 0;
+    compact_sample_t sample;
+    int              i;
+
+    if( platformGetUnitCommunicationType() == SPI_COMM ) {
+        ptrUcbPacket->payloadLength = 0;
+        return;
+    }
+
+    if (compactStream.keyFramePeriod == 0) {
+        CompactStreamInit(&compactStream, COMPACT_STREAM_KEYFRAME_PERIOD);
+    }
+
+    /// same scaling as A2
+    index = appendAttitudeTrue(scaled, index);
+    index = appendCorrectedRates(scaled, index);
+    index = appendAccels(scaled, index);
+
+    for (i = 0; i < COMPACT_STREAM_NUM_CHANNELS; i++) {
+        sample.channel[i] = (int16_t)((scaled[2*i] << 8) | scaled[2*i + 1]);
+    }
+    sample.timer     = getAlgorithmTimer();
+    sample.bitStatus = gBitStatus.BITStatus.all;
+
+    ptrUcbPacket->payloadLength = CompactStreamEncode(&compactStream,
+                                                      &sample,
+                                                      ptrUcbPacket->payload);
+
+    HandleUcbTx(port, ptrUcbPacket); /// send Compact 1 packet
+}
+
+/** ****************************************************************************
+ * @name _UcbBatch1 send B1 packet
+ * @brief every sample taken since the previous B1 packet, read from the sample
+ *        history, so the packet rate divider sets the batch depth (N samples at
+ *        200/N Hz). Payload: sample count, seq of the first sample, then per
+ *        sample the low 32 bits of the dacq timestamp [usec], X/Y/Z rate and
+ *        X/Y/Z accel in S1 scaling. Encoded straight into the uart tx ring; if
+ *        the ring is full the samples stay queued for the next packet.
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - not used, the packet is built in the tx ring
+ * @retval N/A
+ ******************************************************************************/
+void _UcbBatch1 (ExternPortTypeEnum port,
+                 UcbPacketStruct    *ptrUcbPacket)
+{
+    sample_history_entry_t entry;
+    ucb_tx_stream_t        tx;
+    uint32_t latest = SampleHistoryLatestSeq();
+    uint32_t oldest = SampleHistoryOldestSeq();
+    uint32_t depth  = platformConvertPacketRateDivider(gConfiguration.packetRateDivider);
+    uint32_t count;
+    uint32_t seq;
+    int      i;
+
+    if (platformGetUnitCommunicationType() == SPI_COMM || latest == 0) {
+        return;
+    }
+
+    if (batchNextSeq == 0 || batchNextSeq > latest + 1) {
+        /// first packet (or history restarted) - start one batch back
+        batchNextSeq = (latest >= depth) ? latest - depth + 1 : 1;
+    }
+    if (batchNextSeq < oldest) {
+        batchLost   += oldest - batchNextSeq;
+        batchNextSeq = oldest;
+    }
+
+    count = latest - batchNextSeq + 1;
+    if (count == 0) {
+        return;
+    }
+    if (count > UCB_BATCH_MAX_DEPTH) {
+        count = UCB_BATCH_MAX_DEPTH;    // catch up over the next packets
+    }
+
+    if (!HandleUcbTxBegin(&tx, UCB_BATCH_1,
+                          UCB_BATCH_1_HEADER_LENGTH + count * UCB_BATCH_1_SAMPLE_LENGTH)) {
+        return;
+    }
+
+    HandleUcbTxPut(&tx, (uint8_t)count);
+    HandleUcbTxPut32(&tx, batchNextSeq);
+
+    for (seq = batchNextSeq; seq < batchNextSeq + count; seq++) {
+        if (!SampleHistoryGet(seq, &entry)) {
+            memset(&entry, 0, sizeof(entry));
+            batchLost++;
+        }
+        HandleUcbTxPut32(&tx, (uint32_t)entry.tstamp);
+        for (i = XRATE; i <= ZRATE; i++) {
+            HandleUcbTxPut16(&tx, (uint16_t)(_qmul(TWO_POW16_OVER_7PI_q19, entry.q27[i], 19, 27, 16) >> 16));
+        }
+        for (i = XACCEL; i <= ZACCEL; i++) {
+            HandleUcbTxPut16(&tx, (uint16_t)(_qmul(TWO_POW16_OVER_20_q19, entry.q27[i], 19, 27, 16) >> 16));
+        }
+    }
+
+    HandleUcbTxEnd(&tx);
+    batchNextSeq += count;
+}
+
+#ifdef SAE_J1939
+/** ****************************************************************************
+ * @name _UcbCanTelemetry send CT packet
+ * @brief last closed window of the CAN telemetry (sae_j1939_telemetry.c), same
+ *        content as the telemetry PGN at full resolution. Payload: window [ms],
+ *        load [0.1 %], TEC, REC, max TEC, max REC, error state, last error
+ *        code, bus-off count, rx and tx frames, rx ring and controller FIFO
+ *        losses, mailbox-full refills, descriptor shortages, rx ring high
+ *        water, PGN count, then per PGN: PGN, frames, queueing and mailbox
+ *        period jitter [usec], max mailbox wait [usec]. Empty before the
+ *        first window closes. Polled only, not a continuous packet.
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+void _UcbCanTelemetry (ExternPortTypeEnum port,
+                       UcbPacketStruct    *ptrUcbPacket)
+{
+    SAE_J1939_TELEMETRY telemetry;
+    uint8_t  *payload = ptrUcbPacket->payload;
+    uint16_t index    = 0;
+    int      i;
+
+    if (j1939_telemetry_get(&telemetry)) {
+        /// SAE_J1939_TELEMETRY_MAX_PGNS can be raised past what fits
+        if (telemetry.pgns > (UCB_MAX_PAYLOAD_LENGTH - UCB_CAN_TELEMETRY_HEADER_LENGTH) / UCB_CAN_TELEMETRY_PGN_LENGTH) {
+            telemetry.pgns = (UCB_MAX_PAYLOAD_LENGTH - UCB_CAN_TELEMETRY_HEADER_LENGTH) / UCB_CAN_TELEMETRY_PGN_LENGTH;
+        }
+        index = uint16ToBuffer(payload, index, (uint16_t)telemetry.window_ms);
+        index = uint16ToBuffer(payload, index, telemetry.load_permille);
+        payload[index++] = telemetry.tec;
+        payload[index++] = telemetry.rec;
+        payload[index++] = telemetry.tec_max;
+        payload[index++] = telemetry.rec_max;
+        payload[index++] = telemetry.state;
+        payload[index++] = telemetry.lec;
+        index = uint16ToBuffer(payload, index, telemetry.bus_off);
+        index = uint32ToBuffer(payload, index, telemetry.rx_frames);
+        index = uint32ToBuffer(payload, index, telemetry.tx_frames);
+        index = uint32ToBuffer(payload, index, telemetry.rx_lost);
+        index = uint32ToBuffer(payload, index, telemetry.rx_hw_lost);
+        index = uint32ToBuffer(payload, index, telemetry.mailbox_full);
+        index = uint32ToBuffer(payload, index, telemetry.tx_no_desc);
+        index = uint16ToBuffer(payload, index, telemetry.rx_high_water);
+        payload[index++] = telemetry.pgns;
+
+        for (i = 0; i < telemetry.pgns; i++) {
+            index = uint32ToBuffer(payload, index, telemetry.pgn[i].pgn);
+            index = uint16ToBuffer(payload, index, telemetry.pgn[i].sent);
+            index = uint32ToBuffer(payload, index, telemetry.pgn[i].queue_jitter_us);
+            index = uint32ToBuffer(payload, index, telemetry.pgn[i].tx_jitter_us);
+            index = uint32ToBuffer(payload, index, telemetry.pgn[i].max_wait_us);
+        }
+    }
+    ptrUcbPacket->payloadLength = index;
+
+    if( platformGetUnitCommunicationType() != SPI_COMM ) {
+        HandleUcbTx(port, ptrUcbPacket); /// send CAN telemetry packet
+    }
+}
+#endif
+
+#ifdef DACQ_LATENCY_PROBES
+/** ****************************************************************************
+ * @name _UcbLatency send LT packet
+ * @brief sample to wire latency histograms (latency_probe.c) since the last
+ *        LT packet, which clears them. Payload: dacq ticks, stage count, bin
+ *        count, then per latency_stage_t: max [usec], and the bins, bin n
+ *        counting latencies below 16 usec << n, the last one the rest. Max
+ *        and counts saturate at 0xFFFF. Polled only, not a continuous packet.
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+void _UcbLatency (ExternPortTypeEnum port,
+                  UcbPacketStruct    *ptrUcbPacket)
+{
+    latency_stats_t stats;
+    uint8_t  *payload = ptrUcbPacket->payload;
+    uint16_t index    = 0;
+    int      i, j;
+
+    LatencyGetStats(&stats);
+    LatencyReset();
+
+    index = uint32ToBuffer(payload, index, stats.ticks);
+    payload[index++] = LATENCY_STAGES;
+    payload[index++] = LATENCY_BINS;
+    for (i = 0; i < LATENCY_STAGES; i++) {
+        index = uint16ToBuffer(payload, index, stats.maxUs[i] > 0xFFFF ? 0xFFFF : (uint16_t)stats.maxUs[i]);
+        for (j = 0; j < LATENCY_BINS; j++) {
+            index = uint16ToBuffer(payload, index, stats.hist[i][j] > 0xFFFF ? 0xFFFF : (uint16_t)stats.hist[i][j]);
+        }
+    }
+    ptrUcbPacket->payloadLength = index;
+
+    if( platformGetUnitCommunicationType() != SPI_COMM ) {
+        HandleUcbTx(port, ptrUcbPacket); /// send latency packet
+    }
+}
+#endif
+
+/** ****************************************************************************
+ * @name _UcbDacqMonitor send DM packet
+ * @brief dacq tick deadline monitor (dacq_monitor.c). Payload: tick period
+ *        [usec], ticks released, completed, overrun and missed, the
+ *        dacq_event_t counters, stage count, then the worst case time [usec]
+ *        per dacq_stage_t since the last DM packet, which restarts them.
+ *        Counters run from power up. Polled only, not a continuous packet.
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+void _UcbDacqMonitor (ExternPortTypeEnum port,
+                      UcbPacketStruct    *ptrUcbPacket)
+{
+    dacq_monitor_stats_t stats;
+    uint8_t  *payload = ptrUcbPacket->payload;
+    uint16_t index    = 0;
+    int      i;
+
+    DacqMonitorGetStats(&stats);
+
+    index = uint16ToBuffer(payload, index, DACQ_TICK_US);
+    index = uint32ToBuffer(payload, index, stats.released);
+    index = uint32ToBuffer(payload, index, stats.completed);
+    index = uint32ToBuffer(payload, index, stats.overruns);
+    index = uint32ToBuffer(payload, index, stats.missed);
+    for (i = 0; i < DACQ_EVENTS; i++) {
+        index = uint32ToBuffer(payload, index, stats.events[i]);
+    }
+    payload[index++] = DACQ_STAGES;
+    for (i = 0; i < DACQ_STAGES; i++) {
+        index = uint32ToBuffer(payload, index, stats.wcetUs[i]);
+    }
+    ptrUcbPacket->payloadLength = index;
+
+    if( platformGetUnitCommunicationType() != SPI_COMM ) {
+        HandleUcbTx(port, ptrUcbPacket); /// send deadline monitor packet
+    }
+}
+
+/** ****************************************************************************
+ * @name _UcbLowPowerIdle send LP packet
+ * @brief tickless idle (low_power_idle.c) since the last LP packet, which
+ *        starts a new window; the window of the first one is 0. Payload:
+ *        window [usec], time asleep [usec], sleep ratio [0.1 %], sleeps,
+ *        idle passes that did not sleep, too close to a dacq tick, dacq interrupts,
+ *        then their latency from the timer event to interrupt entry [nsec]:
+ *        min, max, mean. Max - min is the wake jitter. Polled only, not a
+ *        continuous packet.
+ * @param [in] port - number request came in on, the reply will go out this port
+ * @param [out] packetPtr - data part of packet
+ * @retval N/A
+ ******************************************************************************/
+void _UcbLowPowerIdle (ExternPortTypeEnum port,
+                       UcbPacketStruct    *ptrUcbPacket)
+{
+    low_power_idle_stats_t stats;
+    uint8_t  *payload = ptrUcbPacket->payload;
+    uint16_t index    = 0;
+    uint32_t ratio    = 0;
+
+    LowPowerIdleGetStats(&stats);
+    if (stats.windowUs) {
+        ratio = (uint32_t)((uint64_t)stats.sleptUs * 1000 / stats.windowUs);
+    }
+
+    index = uint32ToBuffer(payload, index, stats.windowUs);
+    index = uint32ToBuffer(payload, index, stats.sleptUs);
+    index = uint16ToBuffer(payload, index, ratio > 1000 ? 1000 : (uint16_t)ratio);
+    index = uint32ToBuffer(payload, index, stats.sleeps);
+    index = uint32ToBuffer(payload, index, stats.skipped);
+    index = uint32ToBuffer(payload, index, stats.wakes);
+    index = uint32ToBuffer(payload, index, stats.wakeMinNs);
+    index = uint32ToBuffer(payload, index, stats.wakeMaxNs);
+    index = uint32ToBuffer(payload, index, stats.wakeMeanNs);
+    ptrUcbPacket->payloadLength = index;
+
+    if( platformGetUnitCommunicationType() != SPI_COMM ) {
+        HandleUcbTx(port, ptrUcbPacket); /// send low power idle packet
+    }
+}
+
 /** ****************************************************************************
  * @name _UcbScaled1 send S1 packet
  * @brief Sclaed sensor 1 load (SPI / UART) send (UART) filtered and scaled data
@@ -1123,6 +1445,28 @@ void SendUcbPacket (UcbPacketStruct    *ptrUcbPacket)
             case UCB_ANGLE_2:          // A2 0x4132
                 _UcbAngle2(port, ptrUcbPacket);
                 break;
+            case UCB_COMPACT_1:        // C1 0x4331
+                _UcbCompact1(port, ptrUcbPacket);
+                break;
+            case UCB_BATCH_1:          // B1 0x4231
+                _UcbBatch1(port, ptrUcbPacket);
+                break;
+#ifdef SAE_J1939
+            case UCB_CAN_TELEMETRY:    // CT 0x4354
+                _UcbCanTelemetry(port, ptrUcbPacket);
+                break;
+#endif
+#ifdef DACQ_LATENCY_PROBES
+            case UCB_LATENCY:          // LT 0x4C54
+                _UcbLatency(port, ptrUcbPacket);
+                break;
+#endif
+            case UCB_DACQ_MONITOR:     // DM 0x444D
+                _UcbDacqMonitor(port, ptrUcbPacket);
+                break;
+            case UCB_LOW_POWER_IDLE:   // LP 0x4C50
+                _UcbLowPowerIdle(port, ptrUcbPacket);
+                break;
 #ifndef USER_PACKETS_NOT_SUPPORTED
             case UCB_USER_OUT:
                 result = HandleUserOutputPacket(ptrUcbPacket->payload, &ptrUcbPacket->payloadLength);
@@ -1156,6 +1500,7 @@ void SendUcbPacket (UcbPacketStruct    *ptrUcbPacket)
 void SendContinuousPacket (int dacqRate)
 {
     static  BOOL synced = FALSE;
+    static  UcbPacketType lastType = UCB_PKT_NONE;
     uint8_t type [UCB_PACKET_TYPE_LENGTH];
     uint16_t divider = platformConvertPacketRateDivider(gConfiguration.packetRateDivider);
     
@@ -1164,6 +1509,10 @@ void SendContinuousPacket (int dacqRate)
         divideCount = 1;
     }
 
+    if (platformBaudTrialPending()) {
+        return;     ///< let the "BD" reply drain before the rate switch
+    }
+
     if (divider != 0) { ///< check for quiet mode
         if (divideCount == 1) {
             /// get enum for requested continuous packet type
@@ -1172,7 +1521,18 @@ void SendContinuousPacket (int dacqRate)
 
             /// set continuous output packet type based on configuration
             continuousUcbPacket.packetType = UcbPacketBytesToPacketType(type);
+
+            if (platformStreamTrailerEnabled()) {
+                if (continuousUcbPacket.packetType != lastType) {
+                    UcbStreamTrailerReset();    // new stream
+                    lastType = continuousUcbPacket.packetType;
+                }
+                UcbStreamTrailerArm(platformGetDacqTick());
+            }
+            LATENCY_ARM(LATENCY_PATH_UART);
             SendUcbPacket(&continuousUcbPacket);
+            LATENCY_PROBE(LATENCY_UART_ENCODED);
+            UcbStreamTrailerDisarm();
             divideCount = divider;
         } else {
             --divideCount;
@@ -0,0 +1,229 @@
+/** ***************************************************************************
+ * @file   sensor_tstamp.c
+ * @brief  data ready timestamps of the sensors
+ *
+ * The sample timestamp is the dacq tick, while the accelerometer and the
+ * magnetometer latch on their own data ready and the rate sensor when its SPI
+ * read starts, all staggered by the bus traffic of the tick. Each group keeps
+ * the TIM5 value of its latest data ready:
+ *  - with DACQ_DRDY_CAPTURE the data ready pins are also routed to
+ *    DATA_READY_CAPTURE_TIM, which counts at the TIM5 rate. The interrupt
+ *    turns the captured edge into TIM5 with both counters read back to back,
+ *    so its own latency drops out;
+ *  - otherwise, and when no capture is pending, TIM5 at interrupt entry.
+ * The rate sensor has no data ready line: platformBeginRateSensorRead()
+ * stamps it when its SPI read starts. A group never stamped stays 0 in the
+ * sample.
+ *
+ * SensorTstampAlign() moves each group to the sample timestamp along the
+ * line through its previous and current reading, which is an interpolation
+ * for sensors that latched after the tick event. It runs from
+ * platformAlignSensorData(), between the sensor reads and the algorithm.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <string.h>
+#include "stm32f4xx_conf.h"
+#include "boardDefinition.h"
+#include "platformAPI.h"
+#include "sensor_tstamp.h"
+
+#define ALIGN_MAX_SPAN_US       0xFFFF      // readings further apart are not interpolated
+
+// written by the data ready interrupts, one group each
+static volatile uint32_t drdyTicks[SENSOR_GROUPS];
+static volatile uint32_t drdyCount[SENSOR_GROUPS];
+
+// previous reading of each group, dacq task
+static struct {
+    uint64_t tstamp;
+    int32_t  q27   [SENSOR_GROUP_AXES];
+    double   scaled[SENSOR_GROUP_AXES];
+} prev[SENSOR_GROUPS];
+
+
+/** ***************************************************************************
+ * @name SensorTstampInit
+ * @brief routes the data ready pins to the capture timer, after the sensor
+ *        driver has set them up for their EXTI lines. Nothing to do without
+ *        DACQ_DRDY_CAPTURE
+ * @retval N/A
+ ******************************************************************************/
+void SensorTstampInit(void)
+{
+    memset(prev, 0, sizeof(prev));
+
+#ifdef DACQ_DRDY_CAPTURE
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure;
+    TIM_ICInitTypeDef       TIM_ICInitStruct;
+
+    RCC_APB1PeriphClockCmd( DATA_READY_CAPTURE_TIM_CLK, ENABLE );
+    TIM_Cmd( DATA_READY_CAPTURE_TIM, DISABLE );
+
+    TIM_TimeBaseStructInit( &TIM_TimeBaseStructure );  // free running, no prescaler
+    TIM_TimeBaseInit( DATA_READY_CAPTURE_TIM, &TIM_TimeBaseStructure );
+
+    TIM_ICStructInit( &TIM_ICInitStruct );              // rising edge, direct input
+    TIM_ICInitStruct.TIM_Channel = ACCEL_DATA_READY_TIM_CHANNEL;
+    TIM_ICInit( DATA_READY_CAPTURE_TIM, &TIM_ICInitStruct );
+    TIM_ICInitStruct.TIM_Channel = MAG_DATA_READY_TIM_CHANNEL;
+    TIM_ICInit( DATA_READY_CAPTURE_TIM, &TIM_ICInitStruct );
+
+    // alternate function keeps the input path to the EXTI line, and the pull
+    // configuration of the sensor driver stays as it is
+    GPIO_PinAFConfig( ACCEL_DATA_READY_GPIO_PORT, ACCEL_DATA_READY_PIN_SOURCE, ACCEL_DATA_READY_GPIO_AF );
+    ACCEL_DATA_READY_GPIO_PORT->MODER = (ACCEL_DATA_READY_GPIO_PORT->MODER & ~(GPIO_MODER_MODER0 << (ACCEL_DATA_READY_PIN_SOURCE * 2))) |
+                                        ((uint32_t)GPIO_Mode_AF << (ACCEL_DATA_READY_PIN_SOURCE * 2));
+    GPIO_PinAFConfig( MAG_DATA_READY_GPIO_PORT, MAG_DATA_READY_PIN_SOURCE, MAG_DATA_READY_GPIO_AF );
+    MAG_DATA_READY_GPIO_PORT->MODER = (MAG_DATA_READY_GPIO_PORT->MODER & ~(GPIO_MODER_MODER0 << (MAG_DATA_READY_PIN_SOURCE * 2))) |
+                                      ((uint32_t)GPIO_Mode_AF << (MAG_DATA_READY_PIN_SOURCE * 2));
+
+    DATA_READY_CAPTURE_TIM->SR = 0;
+    TIM_Cmd( DATA_READY_CAPTURE_TIM, ENABLE );
+#endif
+}
+
+
+#ifdef DACQ_DRDY_CAPTURE
+// TIM5 at the captured edge, isrEnter when there is none
+static uint32_t _Captured(sensor_group_t group, uint32_t isrEnter)
+{
+    uint16_t flag, ccr, cnt;
+    uint32_t now;
+
+    if (group == SENSOR_GROUP_ACCEL) {
+        flag = TIM_SR_CC3IF;
+    } else if (group == SENSOR_GROUP_MAG) {
+        flag = TIM_SR_CC2IF;
+    } else {
+        return isrEnter;
+    }
+    if (!(DATA_READY_CAPTURE_TIM->SR & flag)) {
+        return isrEnter;
+    }
+    // reading the capture clears its flag
+    ccr = (uint16_t)(group == SENSOR_GROUP_ACCEL ? DATA_READY_CAPTURE_TIM->CCR3 : DATA_READY_CAPTURE_TIM->CCR2);
+    cnt = (uint16_t)DATA_READY_CAPTURE_TIM->CNT;
+    now = TIM5->CNT;
+    DATA_READY_CAPTURE_TIM->SR = (uint16_t)~(TIM_SR_CC2OF | TIM_SR_CC3OF);
+
+    return now - (uint16_t)(cnt - ccr);
+}
+#endif
+
+
+/** ***************************************************************************
+ * @name SensorTstampDataReady
+ * @brief data ready of a group, from its interrupt or its read start
+ * @param [in] group - sensor_group_t
+ * @param [in] isrEnter - TIM5 at interrupt entry, or now
+ * @retval N/A
+ ******************************************************************************/
+void SensorTstampDataReady(sensor_group_t group, uint32_t isrEnter)
+{
+    if (group >= SENSOR_GROUPS) {
+        return;
+    }
+#ifdef DACQ_DRDY_CAPTURE
+    drdyTicks[group] = _Captured(group, isrEnter);
+#else
+    drdyTicks[group] = isrEnter;
+#endif
+    __DMB();
+    drdyCount[group]++;
+}
+
+
+/** ***************************************************************************
+ * @name SensorTstampLatch
+ * @brief copies the data ready times into the sample, in the timebase of
+ *        platformGetCurrTimeStamp(). The dacq task calls it once per tick,
+ *        after the sensor reads
+ * @param [out] data - sample record
+ * @retval N/A
+ ******************************************************************************/
+void SensorTstampLatch(sensors_data_t *data)
+{
+    uint32_t count, ticks;
+    int      g;
+
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        do {
+            count = drdyCount[g];
+            __DMB();
+            ticks = drdyTicks[g];
+            __DMB();
+        } while (count != drdyCount[g]);
+
+        data->sensorTstamp[g] = count ? platformTicksToTimeStamp(ticks) : 0;
+    }
+}
+
+
+/** ***************************************************************************
+ * @name SensorTstampAlign
+ * @brief moves each group of the sample to tstamp. A group is left as it is
+ *        when it has no timestamp, did not update since the previous call or
+ *        its last two readings are more than 65 ms apart; aligned groups get
+ *        tstamp as their timestamp, so a second call changes nothing
+ * @param [in/out] data - sample record, after SensorTstampLatch()
+ * @param [in] tstamp - usec, the time to align to
+ * @retval N/A
+ ******************************************************************************/
+void SensorTstampAlign(sensors_data_t *data, uint64_t tstamp)
+{
+    uint64_t ts;
+    uint32_t span, dist, frac;
+    int32_t  q27;
+    double   scaled;
+    BOOL     valid, after;
+    int      g, i, axis;
+
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        ts = data->sensorTstamp[g];
+        if (ts == 0 || ts == tstamp || ts == prev[g].tstamp) {
+            continue;
+        }
+
+        valid = prev[g].tstamp != 0 && ts - prev[g].tstamp <= ALIGN_MAX_SPAN_US;
+        span  = (uint32_t)(ts - prev[g].tstamp);
+        after = tstamp > ts;
+        dist  = (uint32_t)(after ? tstamp - ts : ts - tstamp);
+        if (dist > span) {
+            valid = FALSE;          // further than one reading away
+        }
+        frac  = valid ? (dist << 16) / span : 0;
+
+        for (i = 0; i < SENSOR_GROUP_AXES; i++) {
+            axis   = g * SENSOR_GROUP_AXES + i;
+            q27    = data->scaledSensors_q27[axis];
+            scaled = data->scaledSensors[axis];
+            if (valid) {
+                int32_t dq = (int32_t)((((int64_t)q27 - prev[g].q27[i]) * frac) >> 16);
+                double  ds = (scaled - prev[g].scaled[i]) * (frac * (1.0 / 65536.0));
+
+                data->scaledSensors_q27[axis] = after ? q27 + dq : q27 - dq;
+                data->scaledSensors[axis]     = after ? scaled + ds : scaled - ds;
+            }
+            prev[g].q27[i]    = q27;
+            prev[g].scaled[i] = scaled;
+        }
+        prev[g].tstamp        = ts;
+        data->sensorTstamp[g] = valid ? tstamp : ts;
+    }
+}
@@ -31,9 +31,104 @@ limitations under the License.
 #include "sensors_data.h"
 #include "sensorsAPI.h"
 #include "qmath.h"
+#include "stm32f4xx.h"
 
 sensors_data_t gSensorsData;
 
+/* Published samples. SensorsDataPublish() copies gSensorsData into the buffer
+ * readers are not pointed at and then bumps publishSeq, whose low bit selects
+ * the front buffer, so the dacq task never waits. A reader copies the front
+ * buffer and retries if a publish completed meanwhile: the next one writes
+ * the buffer being read and only bumps publishSeq once it is done.
+ *
+ * The Get...Data getters read the working copy, for the algorithm within the
+ * dacq tick; the GetPublished...Data ones are for the output and CAN tasks.
+ */
+static sensors_data_t    published[2];
+static volatile uint32_t publishSeq = 0;
+
+
+/** ***************************************************************************
+ * @name SensorsDataPublish
+ * @brief makes the sample of this dacq tick visible to readers, once at the
+ *        end of the tick's sensor processing
+ * @retval N/A
+ ******************************************************************************/
+void SensorsDataPublish(void)
+{
+    uint32_t seq = publishSeq;
+
+    published[(seq + 1) & 1] = gSensorsData;
+    __DMB();
+    publishSeq = seq + 1;
+}
+
+
+/** ***************************************************************************
+ * @name SensorsDataGetPublished
+ * @brief copy of the last published sample, never torn; zeroes before the
+ *        first publish
+ * @param [out] out - sample copy
+ * @retval N/A
+ ******************************************************************************/
+void SensorsDataGetPublished(sensors_data_t *out)
+{
+    uint32_t seq;
+
+    do{
+        seq  = publishSeq;
+        __DMB();
+        *out = published[seq & 1];
+        __DMB();
+    }while(publishSeq != seq);
+}
+
+
+// scaled channels of the published sample, first..first+n-1
+static void _GetPublishedScaled(int first, int n, double scale, double *data)
+{
+    uint32_t seq;
+
+    do{
+        seq = publishSeq;
+        __DMB();
+        for(int i = 0; i < n; i++){
+            data[i] = published[seq & 1].scaledSensors[first + i] * scale;
+        }
+        __DMB();
+    }while(publishSeq != seq);
+}
+
+void GetPublishedAccelData_g(double *data)
+{
+    _GetPublishedScaled(XACCEL, 3, 1.0, data);
+}
+
+void GetPublishedAccelData_mPerSecSq(double *data)
+{
+    _GetPublishedScaled(XACCEL, 3, g_TO_M_SEC_SQ, data);
+}
+
+void GetPublishedRateData_radPerSec(double *data)
+{
+    _GetPublishedScaled(XRATE, 3, 1.0, data);
+}
+
+void GetPublishedRateData_degPerSec(double *data)
+{
+    _GetPublishedScaled(XRATE, 3, RAD_TO_DEG, data);
+}
+
+void GetPublishedMagData_G(double *data)
+{
+    _GetPublishedScaled(XMAG, 3, 1.0, data);
+}
+
+void GetPublishedBoardTempData(double *data)
+{
+    _GetPublishedScaled(15, 1, 1.0, data);
+}
+
 
 
 void GetAccelData_g(double *data)
@@ -34,6 +34,12 @@ limitations under the License.
 
 int userSerialChan = UART_CHANNEL_0;
 
+static struct {
+    BOOL     armed;       // next packet sent is a continuous one
+    uint16_t sequence;    // consumed only when a trailer is actually sent
+    uint32_t dacqTick;
+} streamTrailer;
+
 
 /// packet-type receive working buffer sizes
 #define UCB_RX_WORKING_BUFFER_SIZE	128
@@ -70,6 +76,9 @@ ucbInputSyncTableEntry_t ucbInputSyncTable[] = {		//
     {UCB_WRITE_CAL,          0x5743},   //  "WC" 
     {UCB_JUMP2_IAP,          0x4A49},   //  "JI" 
     {UCB_READ_APP,           0x5241},   //  "RA" 
+    {UCB_READ_CONFIG_BLOCK,  0x4252},   //  "BR" 
+    {UCB_WRITE_CONFIG_BLOCK, 0x4257},   //  "BW" 
+    {UCB_SET_BAUD_TRIAL,     0x4244},   //  "BD" 
     {UCB_INPUT_PACKET_MAX,   0x00000000},    //  "  "
 };
 
@@ -188,6 +197,7 @@ BOOL HandleUcbRx (UcbPacketStruct  *ucbPacket)
             }else {
                 // process message here
                HandleUcbPacket (ucbPacket);
+               platformBaudTrialConfirm();
                platformUpdateDebugPortAssignment();
                return 0;   // will come back later
             }
@@ -200,6 +210,41 @@ BOOL HandleUcbRx (UcbPacketStruct  *ucbPacket)
 }
 /* end HandleUcbRx */
 
+/** ****************************************************************************
+ * @name UcbStreamTrailerArm / Disarm / Reset
+ * @brief SendContinuousPacket arms the trailer around each continuous packet;
+ *        HandleUcbTx / HandleUcbTxEnd append it and advance the sequence, so a
+ *        packet that is never sent does not show up as a gap on the host.
+ ******************************************************************************/
+void UcbStreamTrailerArm (uint32_t dacqTick)
+{
+    streamTrailer.dacqTick = dacqTick;
+    streamTrailer.armed    = TRUE;
+}
+
+void UcbStreamTrailerDisarm (void)
+{
+    streamTrailer.armed = FALSE;
+}
+
+void UcbStreamTrailerReset (void)
+{
+    streamTrailer.sequence = 0;
+}
+
+static void _PutStreamTrailer (uint8_t *buf)
+{
+    buf[0] = (uint8_t)(streamTrailer.sequence >> 8);
+    buf[1] = (uint8_t) streamTrailer.sequence;
+    buf[2] = (uint8_t)(streamTrailer.dacqTick >> 24);
+    buf[3] = (uint8_t)(streamTrailer.dacqTick >> 16);
+    buf[4] = (uint8_t)(streamTrailer.dacqTick >> 8);
+    buf[5] = (uint8_t) streamTrailer.dacqTick;
+
+    streamTrailer.sequence++;
+    streamTrailer.armed = FALSE;
+}
+
 /** ****************************************************************************
  * @name HandleUcbTx
  * @brief builds a UCB packet and then triggers transmission of it. Packet:
@@ -220,6 +265,12 @@ void HandleUcbTx (int port, UcbPacketStruct *ptrUcbPacket)
 	UcbPacketCrcType crc;
 	uint8_t          data[2];
 
+    if (streamTrailer.armed &&
+        ptrUcbPacket->payloadLength + UCB_STREAM_TRAILER_LENGTH <= UCB_MAX_PAYLOAD_LENGTH) {
+        _PutStreamTrailer(ptrUcbPacket->payload + ptrUcbPacket->payloadLength);
+        ptrUcbPacket->payloadLength += UCB_STREAM_TRAILER_LENGTH;
+    }
+
 	/// get byte representation of packet type, index adjust required since sync
     /// isn't placed in data array
 	UcbPacketPacketTypeToBytes(ptrUcbPacket->packetType, data);
@@ -237,3 +288,84 @@ void HandleUcbTx (int port, UcbPacketStruct *ptrUcbPacket)
 
 }
 /* end HandleUcbTx */
+
+/** ****************************************************************************
+ * @name HandleUcbTxBegin
+ * @brief starts a UCB packet directly in the user port tx ring. Sync, code and
+ *        length are written here; the caller then adds exactly payloadLength
+ *        bytes with HandleUcbTxPut*() and finishes with HandleUcbTxEnd().
+ * @param [in] tx - stream state
+ * @param [in] packetType - UCB packet type enum
+ * @param [in] payloadLength - payload bytes that will follow, not counting
+ *        an armed stream trailer (added by HandleUcbTxEnd)
+ * @retval FALSE if the tx ring has no room for the whole packet
+ ******************************************************************************/
+BOOL HandleUcbTxBegin (ucb_tx_stream_t *tx, int packetType, uint8_t payloadLength)
+{
+	uint8_t data[2];
+
+    tx->trailer = (BOOL)(streamTrailer.armed &&
+                         payloadLength + UCB_STREAM_TRAILER_LENGTH <= UCB_MAX_PAYLOAD_LENGTH);
+    if (tx->trailer) {
+        payloadLength += UCB_STREAM_TRAILER_LENGTH;
+    }
+
+    if (!uart_txReserve(userSerialChan, payloadLength + 7)) {
+        return FALSE;
+    }
+
+	UcbPacketPacketTypeToBytes((UcbPacketType)packetType, data);
+
+    tx->channel = userSerialChan;
+    tx->offset  = 0;
+    uart_txPutAt(tx->channel, tx->offset++, 0x55);
+    uart_txPutAt(tx->channel, tx->offset++, 0x55);
+
+    tx->crc = CRC16_SEED;
+    HandleUcbTxPut(tx, data[0]);
+    HandleUcbTxPut(tx, data[1]);
+    HandleUcbTxPut(tx, payloadLength);
+
+    return TRUE;
+}
+
+void HandleUcbTxPut (ucb_tx_stream_t *tx, uint8_t byte)
+{
+    tx->crc = UpdateCRC(tx->crc, byte);
+    uart_txPutAt(tx->channel, tx->offset++, byte);
+}
+
+void HandleUcbTxPut16 (ucb_tx_stream_t *tx, uint16_t value)
+{
+    HandleUcbTxPut(tx, (uint8_t)(value >> 8));
+    HandleUcbTxPut(tx, (uint8_t)value);
+}
+
+void HandleUcbTxPut32 (ucb_tx_stream_t *tx, uint32_t value)
+{
+    HandleUcbTxPut16(tx, (uint16_t)(value >> 16));
+    HandleUcbTxPut16(tx, (uint16_t)value);
+}
+
+/** ****************************************************************************
+ * @name HandleUcbTxEnd
+ * @brief appends the CRC and hands the packet to the uart in one commit
+ * @param [in] tx - stream state
+ * @retval N/A
+ ******************************************************************************/
+void HandleUcbTxEnd (ucb_tx_stream_t *tx)
+{
+    uint8_t trailer[UCB_STREAM_TRAILER_LENGTH];
+    int     i;
+
+    if (tx->trailer) {
+        _PutStreamTrailer(trailer);
+        for (i = 0; i < UCB_STREAM_TRAILER_LENGTH; i++) {
+            HandleUcbTxPut(tx, trailer[i]);
+        }
+    }
+    uart_txPutAt(tx->channel, tx->offset++, (uint8_t)(tx->crc >> 8));
+    uart_txPutAt(tx->channel, tx->offset++, (uint8_t)tx->crc);
+    uart_txCommit(tx->channel, tx->offset);
+}
+/* end HandleUcbTxEnd */
@@ -63,7 +63,16 @@ ucb_packet_t ucbPackets[] = {		//
     {UCB_LOCK_EEPROM,        0x4C45},   //  "LE" 
     {UCB_USER_OUT,           0x5550},   //  "UP" 
     {UCB_READ_APP,           0x5241},   //  "RA" 
+    {UCB_READ_CONFIG_BLOCK,  0x4252},   //  "BR" 
+    {UCB_WRITE_CONFIG_BLOCK, 0x4257},   //  "BW" 
+    {UCB_SET_BAUD_TRIAL,     0x4244},   //  "BD" 
     {UCB_ANGLE_2,            0x4132},   //  "A2" 
+    {UCB_COMPACT_1,          0x4331},   //  "C1" 
+    {UCB_BATCH_1,            0x4231},   //  "B1" 
+    {UCB_CAN_TELEMETRY,      0x4354},   //  "CT" 
+    {UCB_LATENCY,            0x4C54},   //  "LT" 
+    {UCB_DACQ_MONITOR,       0x444D},   //  "DM" 
+    {UCB_LOW_POWER_IDLE,     0x4C50},   //  "LP" 
     {UCB_PKT_NONE,           0x0000}   //  "  "     should be last in the table as a end marker 
 };
 
@@ -257,6 +266,9 @@ BOOL UcbPacketIsAnInputPacket (UcbPacketType type)
         case UCB_WRITE_CAL:
         case UCB_JUMP2_IAP:
         case UCB_READ_APP:
+        case UCB_READ_CONFIG_BLOCK:
+        case UCB_WRITE_CONFIG_BLOCK:
+        case UCB_SET_BAUD_TRIAL:
             isAnInputPacket = TRUE;
             break;
 		default:
@@ -293,6 +305,16 @@ BOOL UcbPacketIsAnOutputPacket (UcbPacketType type)
         case UCB_FACTORY_1:
         case UCB_FACTORY_2:
         case UCB_ANGLE_2:
+        case UCB_COMPACT_1:
+        case UCB_BATCH_1:
+#ifdef SAE_J1939
+        case UCB_CAN_TELEMETRY:
+#endif
+#ifdef DACQ_LATENCY_PROBES
+        case UCB_LATENCY:
+#endif
+        case UCB_DACQ_MONITOR:
+        case UCB_LOW_POWER_IDLE:
             break;
 		default:
           isAnOutputPacket = FALSE;
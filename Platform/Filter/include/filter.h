@@ -124,6 +124,10 @@ uint32_t Apply_Bartlett_Q27_Filter( bartlett_fixed *coefficients,
                                     uint32_t       *x );
 
 void FilterInit(void); // Fixed point init
+// Q27 second order Butterworth low-pass for a sampling rate, init time only
+#define FILTER_IIR_MAX_CUTOFF   0.4     // of the sampling rate, higher cutoffs are lowered
+void FilterDesignButterworth(butterworth_fixed *filter, int32_t *b,
+                             double cutoff, double sampling);
 
 
 /** @brief Rolling avereage "boxcar" filter
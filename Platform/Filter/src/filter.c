@@ -27,38 +27,29 @@ limitations under the License.
 #include <stdint.h>
 #include <string.h> // For memset()
 #include <stdlib.h> // malloc
-#include <math.h>   // fabs()
+#include <math.h>   // fabs(), tan()
 #include "sensors_data.h"
 #include "filter.h"
+#include "latency_probe.h"
+#include "dacq_rate.h"
 
-// Butterworth (IIR) low-pass filter coefficients Q27
-// 200 Hz Sampling
-static int32_t b_2_Hz_iir_200HzSamp[] = {134217728, -256516528,  122805978};
-static int32_t g_2_Hz_iir_200HzSamp   =     126794;
+// Butterworth (IIR) low-pass filter denominators Q27, designed for
+// DACQ_ODR_HZ by FilterInit(); at 200 Hz they are the former fixed tables
+static int32_t b_2_Hz_iir[3];
+static int32_t b_5_Hz_iir[3];
+static int32_t b_10_Hz_iir[3];
+static int32_t b_20_Hz_iir[3];
+static int32_t b_25_Hz_iir[3];
+static int32_t b_40_Hz_iir[3];
+static int32_t b_50_Hz_iir[3];
 
-static int32_t b_5_Hz_iir_200HzSamp[] = {134217728,  -238723916, 107481912};
-static int32_t g_5_Hz_iir_200HzSamp   =     743931;
-
-static int32_t b_10_Hz_iir_200HzSamp[] = {134217728, -209516300,  86080746};
-static int32_t g_10_Hz_iir_200HzSamp   =    2695544;
-
-static int32_t b_20_Hz_iir_200HzSamp[] = {134217728, -153408246,  55405293};
-static int32_t g_20_Hz_iir_200HzSamp   =    9053694;
-
-// 25 Hz Filter (200 Hz sampling)
-static int32_t b_25_Hz_iir_200HzSamp[] = {134217728, -126541687,   44739243};
-static int32_t g_25_Hz_iir_200HzSamp   =    13103821;
-
-// 40 Hz filter (200 Hz sampling)
-static int32_t b_40_Hz_iir_200HzSamp[] = {134217728,  -49597125,   26281940};
-static int32_t g_40_Hz_iir_200HzSamp   =    27725636;
-
-static int32_t b_50_Hz_iir_200HzSamp[] = {134217728,          0,  23028122};
-static int32_t g_50_Hz_iir_200HzSamp   =   39311462;
+#define IIR_PI              3.14159265358979323846
+#define IIR_SQRT2           1.41421356237309504880
 
 
 // Bartlett fir Q27 taps (coefficients)
-// 200 Hz Sampling
+// 200 Hz Sampling. The callers size the delay lines from these, so they are
+// not redesigned: at other rates platformGetFilterType() never selects them
 static int32_t b_5Hz_fir_200HzSamp[]  = { 856611, 1714775, 2574283, 3434922, 4296482, 5158750, 6021514, 6884562, 7747681, 8610659, 9473284, 10335341 };
 static int32_t b_10Hz_fir_200HzSamp[] = { 3119269, 6303690, 9534154, 12791165, 16054959, 19305626 };
 static int32_t b_20Hz_fir_200HzSamp[] = { 9407719, 22044088, 35657057 };
@@ -78,6 +69,37 @@ static int32_t b_40Hz_fir_200HzSamp[] = { 30038942, 74139843 };
 	bartlett_fixed firTaps_20_Hz;
 	bartlett_fixed firTaps_40_Hz;
 
+/** ****************************************************************************
+ * @name FilterDesignButterworth
+ * @brief second order Butterworth low-pass by the bilinear transform with
+ *        prewarping, Q27. Double math, for init only. Cutoffs above
+ *        FILTER_IIR_MAX_CUTOFF of the sampling rate are lowered to it
+ * @param [out] filter - gain set, b pointed at the denominator
+ * @param [out] b - 3 denominator coefficients
+ * @param [in] cutoff - Hz
+ * @param [in] sampling - Hz
+ * @retval N/A
+ ******************************************************************************/
+void FilterDesignButterworth(butterworth_fixed *filter,
+                             int32_t           *b,
+                             double            cutoff,
+                             double            sampling)
+{
+    double k, norm;
+
+    if (cutoff > FILTER_IIR_MAX_CUTOFF * sampling) {
+        cutoff = FILTER_IIR_MAX_CUTOFF * sampling;
+    }
+    k    = tan(IIR_PI * cutoff / sampling);
+    norm = 134217728.0 / (1.0 + IIR_SQRT2 * k + k * k);
+
+    b[0]      = 134217728;
+    b[1]      = (int32_t)lround(2.0 * (k * k - 1.0) * norm);
+    b[2]      = (int32_t)lround((1.0 - IIR_SQRT2 * k + k * k) * norm);
+    filter->b = b;
+    filter->g = (int32_t)lround(k * k * norm);
+}
+
 void FilterInit()
 {
     // load the coefficients for the iir butterworth filters
@@ -89,27 +111,13 @@ void FilterInit()
     memset(&iirTaps_40_Hz, 0, sizeof(iirTaps_40_Hz));
     memset(&iirTaps_50_Hz, 0, sizeof(iirTaps_50_Hz));
 
-    // 200 Hz sampling
-        iirTaps_2_Hz.b = (int32_t*)b_2_Hz_iir_200HzSamp;
-        iirTaps_2_Hz.g = g_2_Hz_iir_200HzSamp;
-
-        iirTaps_5_Hz.b = (int32_t*)b_5_Hz_iir_200HzSamp;
-        iirTaps_5_Hz.g = g_5_Hz_iir_200HzSamp;
-
-        iirTaps_10_Hz.b = (int32_t*)b_10_Hz_iir_200HzSamp;
-        iirTaps_10_Hz.g = g_10_Hz_iir_200HzSamp;
-
-        iirTaps_20_Hz.b = (int32_t*)b_20_Hz_iir_200HzSamp;
-        iirTaps_20_Hz.g = g_20_Hz_iir_200HzSamp;
-
-        iirTaps_25_Hz.b = (int32_t*)b_25_Hz_iir_200HzSamp;
-        iirTaps_25_Hz.g = g_25_Hz_iir_200HzSamp;
-
-        iirTaps_40_Hz.b = (int32_t*)b_40_Hz_iir_200HzSamp;
-        iirTaps_40_Hz.g = g_40_Hz_iir_200HzSamp;
-
-        iirTaps_50_Hz.b = (int32_t*)b_50_Hz_iir_200HzSamp;
-        iirTaps_50_Hz.g = g_50_Hz_iir_200HzSamp;
+        FilterDesignButterworth(&iirTaps_2_Hz,  b_2_Hz_iir,  2.0,  DACQ_ODR_HZ);
+        FilterDesignButterworth(&iirTaps_5_Hz,  b_5_Hz_iir,  5.0,  DACQ_ODR_HZ);
+        FilterDesignButterworth(&iirTaps_10_Hz, b_10_Hz_iir, 10.0, DACQ_ODR_HZ);
+        FilterDesignButterworth(&iirTaps_20_Hz, b_20_Hz_iir, 20.0, DACQ_ODR_HZ);
+        FilterDesignButterworth(&iirTaps_25_Hz, b_25_Hz_iir, 25.0, DACQ_ODR_HZ);
+        FilterDesignButterworth(&iirTaps_40_Hz, b_40_Hz_iir, 40.0, DACQ_ODR_HZ);
+        FilterDesignButterworth(&iirTaps_50_Hz, b_50_Hz_iir, 50.0, DACQ_ODR_HZ);
 
         // load the coefficients for the fir bartlett filters
         firTaps_5_Hz.taps = b_5Hz_fir_200HzSamp;
@@ -213,6 +221,7 @@ Apply_Butterworth_Q27_Filter(butterworth_fixed *coefficients,
                            (int32_t*)iir_x[sensor],
                            (int32_t*)iir_y[sensor]);
     gSensorsData.rawSensors[sensor] = iir_y[sensor][0];
+    LATENCY_PROBE(LATENCY_FILTER_DONE);
 
 	return 0; // force fcn to finish before returning
 }
@@ -318,6 +327,7 @@ Apply_Bartlett_Q27_Filter( bartlett_fixed *coefficients,
 
     // Update the output value with the filtered value
     gSensorsData.rawSensors[sensor] = (uint32_t)filteredValue; //x[0];
+    LATENCY_PROBE(LATENCY_FILTER_DONE);
 
     return 0; // finish before returning
 }
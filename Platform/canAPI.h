@@ -27,11 +27,21 @@ limitations under the License.
 #ifndef __CAN_API_H
 #define __CAN_API_H
 #include <stdint.h>
+#include "GlobalConstants.h"
 
 void InitCommunication_UserCAN(int baudRate);
 void InitCANBoardConfiguration_GPIO();
 void ConfigureCANMessageFilters(void);
 void ConfigureCANMessageFilter(uint32_t baseID, uint32_t baseMask);
+BOOL SubscribeCANMessage(uint32_t baseID, uint32_t baseMask, uint8_t fifo);
 void ProcessDataPackets(void *dsc);
 
+// CAN task wakeup events
+#define CAN_EVENT_TICK      0x01    // acquisition tick, periodic data
+#define CAN_EVENT_RX        0x02    // frame published to an empty rx ring
+#define CAN_EVENT_TX_FREE   0x04    // tx queues drained, a TP window is open
+#define CAN_EVENT_ALL       (CAN_EVENT_TICK | CAN_EVENT_RX | CAN_EVENT_TX_FREE)
+
+void CANTaskSignal(int32_t events);
+
 #endif
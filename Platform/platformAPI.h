@@ -93,9 +93,11 @@ int  platformGetSensToPpsDelay();
 int  platformGetPpsToDrdyDelay();
 uint64_t   platformGetCurrTimeStamp();
 uint64_t   platformGetCurrTimeStampFromIsr();
+uint64_t   platformTicksToTimeStamp(uint32_t ticks);
 uint64_t   platformGetDacqTimeStamp();
 void       platformSetDacqTimeStamp(uint64_t time);
 BOOL       platformGetPpsFlag(BOOL fClear);
+uint8_t    platformGetPpsLockState(int32_t *phaseErrNs, uint32_t *phaseRmsNs);
 void       platformSetPpsFlag( uint8_t gotPpsFlag );
 uint64_t   platformGetPpsTimeStamp();
 void       platformForceMagUsage();
@@ -108,9 +110,19 @@ int        platformGetPreFilterType();
 int        platformGetFilterCounts(uint32_t type);
 int        platformGetFilterType(int sensor, BOOL fSpi);
 uint32_t   platformGetIMUCounter();
+uint32_t   platformGetDacqTick();
+uint32_t   platformTicksToDacqEvent();
+void       platformBeginRateSensorRead(void);
+void       platformAlignSensorData(void);
+void       platformEnableStreamTrailer(BOOL enable);
+BOOL       platformStreamTrailerEnabled(void);
 void       platformUpdateITOW(uint32_t itow);
 uint64_t   platformGetEstimatedITOW();
 void       platformDetectUserSerialCmd(uint8_t input);
+BOOL       platformStartBaudTrial(int baudRate);
+BOOL       platformBaudTrialTick(void);
+BOOL       platformBaudTrialPending(void);
+void       platformBaudTrialConfirm(void);
 uint64_t   platformGetSolutionTstamp();
 double     platformGetSolutionTstampAsDouble();
 uint32_t   platformGetItow(BOOL *detected, BOOL *updated);
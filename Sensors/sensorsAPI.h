@@ -77,6 +77,22 @@ void  GetMagData_G(double *data);
  ******************************************************************************/
 void  GetBoardTempData(double *temp); 
 
+/** ****************************************************************************
+ * @name GetPublished...Data
+ * @brief Same units as the getters above, from the sample published at the
+ *        end of the last dacq tick instead of the one being processed; never
+ *        torn. For the output and CAN tasks, the getters above are for the
+ *        algorithm within the dacq task
+ * @param [in] data - pointer to external data structure
+ * @retval N/A
+ ******************************************************************************/
+void  GetPublishedAccelData_g(double *data);
+void  GetPublishedAccelData_mPerSecSq(double *data);
+void  GetPublishedRateData_radPerSec(double *data);
+void  GetPublishedRateData_degPerSec(double *data);
+void  GetPublishedMagData_G(double *data);
+void  GetPublishedBoardTempData(double *temp);
+
 
 void AccelerometerDataReadyIRQ(void);
 void MagnetomterDataReadyIRQ(void);
@@ -0,0 +1,166 @@
+/** ***************************************************************************
+ * @file   compact_bench.c
+ * @brief  host tool: replays a synthetic trajectory through the C1 encoder and
+ *         decoder of Platform/Core/src/compact_stream.c, checks every decoded
+ *         sample against the one encoded and reports the wire bytes of C1
+ *         against A2 for the same samples.
+ *
+ * Build (Linux / macOS), from this directory:
+ *     cc -O2 -I../j1939_vbus/host -I../../Platform/Core/include \
+ *        -o compact_bench compact_bench.c ../../Platform/Core/src/compact_stream.c -lm
+ *
+ * Usage:
+ *     compact_bench [-n samples] [-k key-frame period] [-r noise lsb]
+ *                   [-l loss %] [-s seed]
+ *
+ * The trajectory is a vehicle at 200 Hz: a slow turn, a roll and pitch
+ * oscillation and a 2 Hz vibration, scaled as A2 (attitude 2^16 / 2pi,
+ * rates 2^16 / 7pi, accels 2^16 / 20 g), with uniform noise of +-r lsb on
+ * every channel. Bytes include the UCB framing of both packets. With -l,
+ * packets are dropped at random: the decoder must report the gaps and must
+ * not output a wrong sample before the next key-frame.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "compact_stream.h"
+
+#define RATE_HZ     200.0
+#define TWO_PI      6.28318530717958647692
+
+static struct {
+    int      samples;
+    int      keyFrame;
+    int      noise;
+    double   loss;
+    unsigned seed;
+} opt = { 2000, COMPACT_STREAM_KEYFRAME_PERIOD, 3, 0.0, 1 };
+
+static int16_t _scale(double v, double fullScale)
+{
+    double s = v * 65536.0 / fullScale + (rand() % (2 * opt.noise + 1)) - opt.noise;
+
+    if (s > 32767.0) {
+        s = 32767.0;
+    } else if (s < -32768.0) {
+        s = -32768.0;
+    }
+    return (int16_t)lrint(s);
+}
+
+static double _wrap(double a)
+{
+    return a - TWO_PI * floor((a + TWO_PI / 2) / TWO_PI);
+}
+
+static void _sample(int i, compact_sample_t *s)
+{
+    double t     = i / RATE_HZ;
+    double yawR  = 0.15;                                    // rad/s, slow turn
+    double roll  = 0.05 * sin(TWO_PI * 0.3 * t);
+    double pitch = 0.03 * sin(TWO_PI * 0.2 * t + 1.0);
+    double yaw   = _wrap(yawR * t);
+    double vib   = 0.02 * sin(TWO_PI * 2.0 * t);
+
+    s->channel[0] = _scale(roll,  TWO_PI);
+    s->channel[1] = _scale(pitch, TWO_PI);
+    s->channel[2] = _scale(yaw,   TWO_PI);
+    s->channel[3] = _scale(0.05 * TWO_PI * 0.3 * cos(TWO_PI * 0.3 * t) + vib, 7 * TWO_PI / 2);
+    s->channel[4] = _scale(0.03 * TWO_PI * 0.2 * cos(TWO_PI * 0.2 * t + 1.0), 7 * TWO_PI / 2);
+    s->channel[5] = _scale(yawR + vib, 7 * TWO_PI / 2);
+    s->channel[6] = _scale(-sin(pitch) + vib, 20.0);
+    s->channel[7] = _scale(sin(roll), 20.0);
+    s->channel[8] = _scale(-1.0 + 10 * vib, 20.0);
+    s->timer      = (uint32_t)(i * 5000);                   // usec
+    s->bitStatus  = (i / 700) & 1 ? 0x0010 : 0x0000;        // an occasional BIT change
+}
+
+// field by field, the struct has padding
+static int _same(const compact_sample_t *a, const compact_sample_t *b)
+{
+    return !memcmp(a->channel, b->channel, sizeof(a->channel)) &&
+           a->timer == b->timer && a->bitStatus == b->bitStatus;
+}
+
+int main(int argc, char **argv)
+{
+    compact_stream_t enc, dec;
+    compact_sample_t in, out;
+    uint8_t  payload[COMPACT_STREAM_MAX_LENGTH];
+    uint8_t  length;
+    int      i, dropped = 0, decoded = 0, mismatches = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            opt.samples = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+            opt.keyFrame = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            opt.noise = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+            opt.loss = atof(argv[++i]) / 100.0;
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            opt.seed = (unsigned)atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-n samples] [-k key-frame period] [-r noise lsb] [-l loss %%] [-s seed]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (opt.samples <= 0 || opt.keyFrame <= 0 || opt.noise < 0) {
+        fprintf(stderr, "samples and key-frame period must be positive, noise not negative\n");
+        return 1;
+    }
+
+    srand(opt.seed);
+    CompactStreamInit(&enc, (uint16_t)opt.keyFrame);
+    CompactStreamInit(&dec, (uint16_t)opt.keyFrame);
+
+    for (i = 0; i < opt.samples; i++) {
+        _sample(i, &in);
+        length = CompactStreamEncode(&enc, &in, payload);
+        if (length > COMPACT_STREAM_MAX_LENGTH) {
+            fprintf(stderr, "sample %d: %u bytes, above COMPACT_STREAM_MAX_LENGTH\n", i, length);
+            return 2;
+        }
+        if (opt.loss > 0.0 && rand() < opt.loss * RAND_MAX) {
+            dropped++;
+            continue;
+        }
+        if (CompactStreamDecode(&dec, payload, length, &out)) {
+            decoded++;
+            if (!_same(&in, &out)) {
+                mismatches++;
+            }
+        }
+    }
+
+    printf("samples %d, key-frame every %d, noise +-%d lsb, dropped %d\n",
+           opt.samples, opt.keyFrame, opt.noise, dropped);
+    printf("A2 bytes %u, C1 bytes %u, %.1f %% less\n",
+           (unsigned)enc.fullBytes, (unsigned)enc.compactBytes,
+           100.0 - 100.0 * enc.compactBytes / enc.fullBytes);
+    printf("decoded %d, gaps %u, discarded waiting for key-frame %u, mismatches %d\n",
+           decoded, (unsigned)dec.lost, (unsigned)dec.discarded, mismatches);
+
+    return mismatches ? 3 : 0;
+}
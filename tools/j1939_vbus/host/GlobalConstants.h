@@ -0,0 +1,15 @@
+/** ***************************************************************************
+ * @file   GlobalConstants.h
+ * @brief  j1939_vbus host stand-in for the application's global constants
+ ******************************************************************************/
+#ifndef GLOBALCONSTANTS_H
+#define GLOBALCONSTANTS_H
+#include <stdint.h>
+
+typedef int     BOOL;
+typedef double  real;
+
+#define TRUE    1
+#define FALSE   0
+
+#endif
@@ -0,0 +1 @@
+/** j1939_vbus host stand-in, nothing needed from the user configuration */
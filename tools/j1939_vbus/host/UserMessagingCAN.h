@@ -0,0 +1,15 @@
+/** ***************************************************************************
+ * @file   UserMessagingCAN.h
+ * @brief  j1939_vbus host stand-in for the application's CAN messaging, the
+ *         bench provides these
+ ******************************************************************************/
+#ifndef _USER_MESSAGING_CAN_H
+#define _USER_MESSAGING_CAN_H
+#include <stdint.h>
+
+struct sae_j1939_rx_desc;
+
+extern void ProcessRequest(struct sae_j1939_rx_desc *desc);
+extern void ProcessEcuCommands(uint8_t *command, uint8_t ps, uint8_t addr);
+
+#endif
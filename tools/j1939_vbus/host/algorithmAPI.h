@@ -0,0 +1,11 @@
+/** j1939_vbus host stand-in for the algorithm API */
+#ifndef _ALGORITHM_API_H
+#define _ALGORITHM_API_H
+#include <stdint.h>
+
+#define FREQ_200_HZ     200
+
+extern void    InitializeAlgorithmStruct(uint8_t callingFreq);
+extern uint8_t getAlgorithmFrequency(void);
+
+#endif
@@ -0,0 +1 @@
+/** j1939_vbus host stand-in, no board pins on the host */
@@ -0,0 +1,18 @@
+/** ***************************************************************************
+ * @file   osapi.h
+ * @brief  j1939_vbus host stand-in for the RTOS wrapper: the system tick is
+ *         simulated bus time in ms and interrupts never nest.
+ ******************************************************************************/
+#ifndef _OS_API_H
+#define _OS_API_H
+#include <stdint.h>
+
+extern uint32_t vbus_now_ms(void);
+
+#define OSEnterISR()
+#define OSExitISR()
+
+#define getSystemTime()          vbus_now_ms()
+#define timeElapsed(since)       (vbus_now_ms() - (since))
+
+#endif
@@ -0,0 +1,55 @@
+/** ***************************************************************************
+ * @file   stm32f4xx.h
+ * @brief  j1939_vbus host stand-in for the device header: only the registers
+ *         and core intrinsics the J1939 stack touches.
+ ******************************************************************************/
+#ifndef __STM32F4xx_H
+#define __STM32F4xx_H
+#include <stdint.h>
+
+typedef struct {
+  volatile uint32_t CNT;
+} TIM_TypeDef;
+
+typedef struct {
+  volatile uint32_t ESR;
+} CAN_TypeDef;
+
+#define CAN_ESR_EWGF      ((uint32_t)0x00000001)
+#define CAN_ESR_EPVF      ((uint32_t)0x00000002)
+#define CAN_ESR_BOFF      ((uint32_t)0x00000004)
+#define CAN_ESR_LEC       ((uint32_t)0x00000070)
+#define CAN_ESR_TEC       ((uint32_t)0x00FF0000)
+#define CAN_ESR_REC       ((uint32_t)0xFF000000)
+
+// TIM5 counts simulated time at 60 MHz, see vbus_now_ns(); CAN1 ESR
+// follows the error counters of the stack's node
+extern TIM_TypeDef vbusTim5;
+extern CAN_TypeDef vbusCan1;
+#define TIM5              (&vbusTim5)
+#define CAN1              (&vbusCan1)
+
+typedef enum { RESET = 0, SET = !RESET } FlagStatus, ITStatus;
+typedef enum { DISABLE = 0, ENABLE = !DISABLE } FunctionalState;
+
+static inline void __DMB(void)
+{
+  __sync_synchronize();
+}
+
+static inline uint32_t __RBIT(uint32_t value)
+{
+  uint32_t result = 0;
+  int      i;
+
+  for (i = 0; i < 32; i++, value >>= 1)
+    result = (result << 1) | (value & 1);
+  return result;
+}
+
+static inline uint32_t __CLZ(uint32_t value)
+{
+  return value ? (uint32_t)__builtin_clz(value) : 32;
+}
+
+#endif
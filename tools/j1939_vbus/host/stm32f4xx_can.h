@@ -0,0 +1,48 @@
+/** ***************************************************************************
+ * @file   stm32f4xx_can.h
+ * @brief  j1939_vbus host stand-in for the bxCAN driver header. CAN_Transmit()
+ *         is implemented by the virtual bus (vbus.c).
+ ******************************************************************************/
+#ifndef __STM32F4xx_CAN_H
+#define __STM32F4xx_CAN_H
+#include "stm32f4xx.h"
+
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint8_t  IDE;
+  uint8_t  RTR;
+  uint8_t  DLC;
+  uint8_t  Data[8];
+} CanTxMsg;
+
+typedef struct {
+  uint32_t StdId;
+  uint32_t ExtId;
+  uint8_t  IDE;
+  uint8_t  RTR;
+  uint8_t  DLC;
+  uint8_t  Data[8];
+  uint8_t  FMI;
+} CanRxMsg;
+
+#define CAN_Id_Standard             ((uint32_t)0x00000000)
+#define CAN_Id_Extended             ((uint32_t)0x00000004)
+#define CAN_ID_STD                  CAN_Id_Standard
+#define CAN_ID_EXT                  CAN_Id_Extended
+#define CAN_RTR_Data                ((uint32_t)0x00000000)
+#define CAN_RTR_Remote              ((uint32_t)0x00000002)
+
+#define CAN_TxStatus_Failed         ((uint8_t)0x00)
+#define CAN_TxStatus_Ok             ((uint8_t)0x01)
+#define CAN_TxStatus_Pending        ((uint8_t)0x02)
+#define CAN_TxStatus_NoMailBox      ((uint8_t)0x04)
+
+#define CAN_Filter_FIFO0            ((uint8_t)0x00)
+#define CAN_Filter_FIFO1            ((uint8_t)0x01)
+#define CAN_FIFO0                   ((uint8_t)0x00)
+#define CAN_FIFO1                   ((uint8_t)0x01)
+
+extern uint8_t CAN_Transmit(CAN_TypeDef* CANx, CanTxMsg* TxMessage);
+
+#endif
@@ -0,0 +1,2 @@
+/** j1939_vbus host stand-in, see stm32f4xx_can.h */
+#include "stm32f4xx_can.h"
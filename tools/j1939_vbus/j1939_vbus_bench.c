@@ -0,0 +1,977 @@
+/** ***************************************************************************
+ * @file   j1939_vbus_bench.c
+ * @brief  host tool: runs the J1939 stack (Platform/CAN/src/sae_j1939*.c)
+ *         against the virtual CAN bus and reports throughput and latency.
+ *
+ * Build (Linux / macOS), from this directory:
+ *     cc -O2 -DSAE_J1939 -DSAE_J1939_TP_MAX_SIZE=1785 -Ihost -I../../Platform/CAN/include -I../../Platform \
+ *        -I../../Platform/Core/include \
+ *        -o j1939_vbus_bench j1939_vbus_bench.c vbus.c \
+ *        ../../Platform/CAN/src/sae_j1939.c ../../Platform/CAN/src/sae_j1939_slave.c \
+ *        ../../Platform/CAN/src/sae_j1939_tp.c ../../Platform/CAN/src/sae_j1939_telemetry.c \
+ *        ../../Platform/CAN/src/sae_j1939_sched.c
+ *
+ * Usage:
+ *     j1939_vbus_bench [rx|storm|latency|tp|all] [-b kbit/s] [-t seconds]
+ *                      [-l background load %] [-e error rate] [-n peers]
+ *                      [-p periodic rate Hz]
+ *
+ * rx       one peer floods the bus with a mix of data, requests, commands
+ *          and address claims; wall clock time spent in ecu_process() gives
+ *          the frames/s the stack can take
+ * storm    -n peers claim addresses at once and keep re-claiming on loss,
+ *          reports the cost of each claim and how long the bus takes to settle
+ * latency  the periodic data of the CAN task plus a tester requesting a PGN
+ *          every 20 ms, with optional background traffic of higher priority;
+ *          reports acquisition tick to end of frame and request queued on
+ *          the tester to end of the response, in simulated bus time, and
+ *          the last CAN telemetry window next to the simulated bus load
+ * tp       a tester requests the component identification (PGN 65259),
+ *          once to its own address over RTS/CTS and once globally over BAM,
+ *          reassembles both and checks them against the expected text; then
+ *          1785 byte (255 packet) messages both ways over RTS/CTS and BAM.
+ *          The receiving cases need -DSAE_J1939_TP_MAX_SIZE=1785
+ *
+ * Without -b every test runs at 250, 500 and 1000 kbit/s. The exit status
+ * is the number of failed checks; every test fails on a tx wakeup that sent
+ * nothing and raised itself again, which on the unit keeps the CAN task
+ * from ever blocking. The task loop
+ * mirrors TaskCANCommunicationJ1939(): a DACQ_ODR_HZ tick plus the rx/tx wakeups
+ * of CANTaskSignal(), taken right after the frame that raised them.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "GlobalConstants.h"
+#include "can.h"
+#include "canAPI.h"
+#include "sae_j1939.h"
+#include "sae_j1939_tp.h"
+#include "sae_j1939_telemetry.h"
+#include "sae_j1939_sched.h"
+#include "vbus.h"
+
+#define TICK_NS             (1000000000ull / SAE_J1939_SCHED_TICK_HZ)  // CAN task tick
+#define DUT_ADDRESS         128
+#define TESTER_ADDRESS      0xF9
+#define REQUESTED_PS        0xDA                // PGN 65242, software identification
+#define REQUEST_PERIOD_NS   20000000ull
+#define MODEL_STRING        "OpenIMU300ZI 5020-3021-01"
+#define SERIAL_NUMBER       1234567
+#define BACKGROUND_ID       ((3u << 26) | (0xF0u << 16) | (0x04u << 8) | 0x00)  // EEC1-like, priority 3
+#define MAX_SAMPLES         (1 << 20)
+
+typedef struct {
+    uint32_t *us;
+    uint32_t  count;
+} samples_t;
+
+extern ECU_ADDRESS_ENTRY addrMappingTable[];
+
+BOOL canStarted = TRUE;
+
+static int32_t   taskEvents;
+static BOOL      inTask;
+static double    processSeconds;                // wall clock in ecu_process()
+static uint64_t  processedFrames;
+static uint64_t  requests, commands, dataPackets;
+static samples_t periodicLatency, responseLatency;
+static uint64_t  requestSentNs;
+static int       tester = -1;
+static int       failures;
+static uint64_t  txWakeups, idleTxWakeups;      // CAN_EVENT_TX_FREE, and those that spun
+
+static struct {
+    int    rate;                                // kbit/s, 0 all
+    double seconds;
+    double load;
+    double errorRate;
+    int    peers;
+    int    periodicHz;
+} opt = { 0, 5.0, 0.0, 0.0, 200, 100 };
+
+
+static double _wallSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void _sample(samples_t *s, uint64_t ns)
+{
+    if (s->us == NULL) {
+        s->us = malloc(MAX_SAMPLES * sizeof(uint32_t));
+    }
+    if (s->us != NULL && s->count < MAX_SAMPLES) {
+        s->us[s->count++] = (uint32_t)(ns / 1000);
+    }
+}
+
+static int _compare(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void _report(const char *name, samples_t *s)
+{
+    uint64_t sum = 0;
+    uint32_t i;
+
+    if (s->count == 0) {
+        printf("  %-22s no samples\n", name);
+        return;
+    }
+    qsort(s->us, s->count, sizeof(uint32_t), _compare);
+    for (i = 0; i < s->count; i++) {
+        sum += s->us[i];
+    }
+    printf("  %-22s n %-7u min %5u  avg %7.1f  p99 %5u  max %5u us\n", name, s->count,
+           s->us[0], (double)sum / s->count, s->us[(s->count * 99) / 100], s->us[s->count - 1]);
+    s->count = 0;
+}
+
+static uint32_t _id(uint8_t priority, uint8_t pf, uint8_t ps, uint8_t source)
+{
+    return ((uint32_t)priority << 26) | ((uint32_t)pf << 16) | ((uint32_t)ps << 8) | source;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * application side the stack calls into
+ * ------------------------------------------------------------------------- */
+
+void CANTaskSignal(int32_t events)
+{
+    taskEvents |= events;
+}
+
+void InitializeAlgorithmStruct(uint8_t callingFreq)
+{
+    (void)callingFreq;
+}
+
+uint8_t getAlgorithmFrequency(void)
+{
+    return 200;
+}
+
+void ProcessDataPackets(void *desc)
+{
+    (void)desc;
+    dataPackets++;
+}
+
+void ProcessEcuCommands(uint8_t *command, uint8_t ps, uint8_t addr)
+{
+    (void)command; (void)ps; (void)addr;
+    commands++;
+}
+
+// answers every request with one frame of the requested PGN
+void ProcessRequest(struct sae_j1939_rx_desc *desc)
+{
+    msg_params_t params;
+    uint8_t      payload[8];
+
+    requests++;
+    memset(&params, 0, sizeof(params));
+    params.pkt_type = ACEINNA_J1939_SOFTWARE_VERSION;
+    params.priority = SAE_J1939_CONTROL_PRIORITY;
+    params.PF       = desc->rx_buffer.Data[1];
+    params.PS       = desc->rx_buffer.Data[0];
+    params.len      = 8;
+    memset(payload, 0, sizeof(payload));
+    aceinna_j1939_build_msg(payload, &params);
+}
+
+void SaveEcuAddress(uint16_t address)
+{
+    (void)address;
+}
+
+ACEINNA_J1939_PACKET_TYPE is_valid_config_command(SAE_J1939_IDENTIFIER_FIELD *ident)
+{
+    return ident->pdu_format == SAE_J1939_PDU_FORMAT_GLOBAL ? ACEINNA_J1939_CONFIG : ACEINNA_J1939_IGNORE;
+}
+
+void platformGetVersionBytes(uint8_t *bytes)
+{
+    memset(bytes, 0, 4);
+}
+
+char *unitVersionString(void)
+{
+    return MODEL_STRING;
+}
+
+uint32_t unitSerialNumber(void)
+{
+    return SERIAL_NUMBER;
+}
+
+// what the application subscribes on the unit
+void ConfigureCANMessageFilters(void)
+{
+    ConfigureCANMessageFilter(_id(0, SAE_J1939_PDU_FORMAT_REQUEST, 0, 0), 0x00FF0000);
+    ConfigureCANMessageFilter(_id(0, SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM, 0xFF, 0), 0x03FFFF00);
+    ConfigureCANMessageFilter(_id(0, SAE_J1939_PDU_FORMAT_GLOBAL, 0, 0), 0x00FF0000);
+    ConfigureCANMessageFilter(_id(0, SAE_J1939_PDU_FORMAT_TP_CM, 0, 0), 0x00FF0000);
+    ConfigureCANMessageFilter(_id(0, SAE_J1939_PDU_FORMAT_TP_DT, 0, 0), 0x00FF0000);
+}
+
+
+/* ---------------------------------------------------------------------------
+ * CAN task of the stack under test
+ * ------------------------------------------------------------------------- */
+
+static void _process(void)
+{
+    double start = _wallSeconds();
+    uint16_t tail = ecu_rx_ring.tail;
+
+    ecu_process();
+    processSeconds  += _wallSeconds() - start;
+    processedFrames += (uint16_t)(ecu_rx_ring.tail - tail);
+}
+
+// frames ever handed to the tx queues
+static uint64_t _txQueued(void)
+{
+    uint64_t n = ecu_tx_pending(SAE_J1939_PRIORITY_LEVELS - 1);
+    int      prio;
+
+    for (prio = 0; prio < SAE_J1939_PRIORITY_LEVELS; prio++) {
+        n += ecu_tx_stats.sent[prio];
+    }
+    return n;
+}
+
+// rx and tx wakeups between ticks, see TaskCANCommunicationJ1939()
+static void _taskEvents(void)
+{
+    int32_t  events;
+    uint64_t queued;
+
+    if (inTask || !taskEvents) {
+        return;
+    }
+    inTask     = TRUE;
+    events     = taskEvents;
+    taskEvents = 0;
+    queued     = _txQueued();
+    _process();
+    if (events & CAN_EVENT_TX_FREE) {
+        j1939_tp_pump();
+    }
+    ecu_transmit();
+    if (events & CAN_EVENT_TX_FREE) {
+        txWakeups++;
+        if (_txQueued() == queued && (taskEvents & CAN_EVENT_TX_FREE)) {
+            idleTxWakeups++;
+        }
+    }
+    inTask = FALSE;
+}
+
+static uint32_t tickUs;                          // time of the tick being built
+
+// the application's per type callback, reached through j1939_sched_enqueue()
+void EnqueueScheduledDataPackets(int latency, uint16_t types)
+{
+    static const uint16_t type[3] = { ACEINNA_SAE_J1939_PACKET_SLOPE_SENSOR,
+                                      ACEINNA_SAE_J1939_PACKET_ANGULAR_RATE,
+                                      ACEINNA_SAE_J1939_PACKET_ACCELERATION };
+    static const uint8_t ps[3] = { SAE_J1939_GROUP_EXTENSION_SLOPE_SENSOR,
+                                   SAE_J1939_GROUP_EXTENSION_ANGULAR_RATE,
+                                   SAE_J1939_GROUP_EXTENSION_ACCELERATION };
+    static const uint8_t prio[3] = { SAE_J1939_SLOPE_PRIORITY, SAE_J1939_CONTROL_PRIORITY,
+                                     SAE_J1939_ACCELERATION_PRIORITY };
+    msg_params_t params;
+    uint8_t      payload[8];
+    int          i;
+
+    (void)latency;
+    memset(payload, 0, sizeof(payload));
+    memcpy(payload, &tickUs, sizeof(tickUs));   // tick time rides in the frame
+    for (i = 0; i < 3; i++) {
+        if (!(types & type[i])) {
+            continue;
+        }
+        memset(&params, 0, sizeof(params));
+        params.pkt_type = SAE_J1939_DATA_PACKET;
+        params.priority = prio[i];
+        params.PF       = SAE_J1939_PDU_FORMAT_DATA;
+        params.PS       = ps[i];
+        params.len      = 8;
+        aceinna_j1939_build_msg(payload, &params);
+    }
+}
+
+static void _taskTick(int periodicHz)
+{
+    inTask     = TRUE;
+    taskEvents = 0;
+    tickUs     = (uint32_t)(vbus_now_ns() / 1000);
+    _process();
+
+    // the application's packet type and rate, as TaskCANCommunicationJ1939()
+    gEcuConfig.packet_type = periodicHz ? ACEINNA_SAE_J1939_PACKET_SLOPE_SENSOR |
+                                          ACEINNA_SAE_J1939_PACKET_ANGULAR_RATE |
+                                          ACEINNA_SAE_J1939_PACKET_ACCELERATION : 0;
+    gEcuConfig.packet_rate = periodicHz ? 100 / periodicHz : 0;
+    j1939_sched_enqueue(0, j1939_sched_tick());
+
+    j1939_telemetry_process();
+    j1939_tp_process();
+    ecu_transmit();
+    inTask = FALSE;
+}
+
+static void _startStack(uint32_t kbit)
+{
+    vbus_init(kbit * 1000);
+    vbus_set_error_rate(opt.errorRate);
+    vbus_set_idle_hook(_taskEvents);
+
+    memset(addrMappingTable, 0, SAE_J1939_MAX_TABLE_ENTRY * sizeof(ECU_ADDRESS_ENTRY));
+    memset(&gEcuConfig, 0, sizeof(gEcuConfig));
+    gEcuConfigPtr->ecu_name.bits.function         = ACEINNA_SAE_J1939_FUNCTION;
+    gEcuConfigPtr->ecu_name.bits.manufacture_code = ACEINNA_SAE_J1939_MANUFACTURER_CODE;
+    gEcuConfigPtr->ecu_name.bits.identity_number  = 0x1234;
+
+    sae_j1939_initialize(kbit == 500 ? _ECU_500K : kbit == 1000 ? _ECU_1000K :
+                         kbit == 125 ? _ECU_125K : _ECU_250K, DUT_ADDRESS);
+    ConfigureCANMessageFilters();
+    send_address_claim(&gEcuInst);
+    gEcuInst.state = _ECU_READY;
+
+    taskEvents      = 0;
+    txWakeups       = 0;
+    idleTxWakeups   = 0;
+    processSeconds  = 0;
+    processedFrames = 0;
+    requests = commands = dataPackets = 0;
+    tester = -1;
+}
+
+static void _run(double seconds, int periodicHz)
+{
+    uint64_t end = vbus_now_ns() + (uint64_t)(seconds * 1e9);
+    uint64_t t;
+
+    for (t = vbus_now_ns() + TICK_NS; t <= end; t += TICK_NS) {
+        vbus_run_until(t);
+        _taskTick(periodicHz);
+    }
+    vbus_run_until(end);
+}
+
+static void _busReport(double seconds)
+{
+    double busNs = seconds * 1e9;
+
+    printf("  bus: %llu frames, load %.1f %%, %llu error frames, %llu lost arbitration\n",
+           (unsigned long long)vbusStats.frames, 100.0 * vbusStats.busyNs / busNs,
+           (unsigned long long)vbusStats.errorFrames,
+           (unsigned long long)vbusStats.dutArbitrationLost);
+    printf("  stack: tx %llu, rx %llu, filtered %llu, dropped %llu (ring high water %u)\n",
+           (unsigned long long)vbusStats.dutTx, (unsigned long long)vbusStats.dutRx,
+           (unsigned long long)vbusStats.dutFiltered, (unsigned long long)vbusStats.dutDropped,
+           ecu_rx_ring.high_water);
+    printf("  tx wakeups %llu, with nothing sent and raised again %llu%s\n",
+           (unsigned long long)txWakeups, (unsigned long long)idleTxWakeups,
+           idleTxWakeups ? " FAILED" : "");
+    failures += idleTxWakeups != 0;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * rx throughput
+ * ------------------------------------------------------------------------- */
+
+static void _flood(int node)
+{
+    static uint32_t n;
+    vbus_frame_t    f;
+
+    memset(&f, 0, sizeof(f));
+    f.dlc = 8;
+    switch (n++ % 8) {
+    case 0:
+        f.id = _id(6, SAE_J1939_PDU_FORMAT_REQUEST, DUT_ADDRESS, 0x21);
+        f.data[0] = REQUESTED_PS;
+        f.data[1] = 0xFE;
+        f.dlc = 3;
+        break;
+    case 1:
+        f.id = _id(6, SAE_J1939_PDU_FORMAT_GLOBAL, 0x50, 0x21);
+        break;
+    case 2:
+        f.id = _id(6, SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM, 0xFF, 0x80 + (n & 0x3F));
+        f.data[0] = (uint8_t)n;
+        f.data[7] = 0x80;
+        break;
+    default:
+        f.id = _id(3, SAE_J1939_PDU_FORMAT_REQUEST, 0x20, 0x21);   // for another node
+        break;
+    }
+    vbus_send(node, &f);
+}
+
+static void _testRx(uint32_t kbit)
+{
+    uint64_t end = (uint64_t)(opt.seconds * 1e9), t;
+    int      node, i;
+
+    _startStack(kbit);
+    node = vbus_add_node(NULL);
+
+    // a full queue lasts longer than a tick even at 1 Mbit/s
+    for (t = TICK_NS; t <= end; t += TICK_NS) {
+        for (i = 0; i < VBUS_NODE_QUEUE; i++) {
+            _flood(node);
+        }
+        vbus_run_until(t);
+        _taskTick(0);
+    }
+
+    printf("rx %u kbit/s, %.1f s\n", kbit, opt.seconds);
+    _busReport(opt.seconds);
+    printf("  ecu_process: %llu frames in %.3f s wall, %.0f frames/s (bus delivers %.0f frames/s)\n",
+           (unsigned long long)processedFrames, processSeconds,
+           processSeconds > 0 ? processedFrames / processSeconds : 0.0,
+           vbusStats.frames / opt.seconds);
+    printf("  handled: %llu requests, %llu commands\n",
+           (unsigned long long)requests, (unsigned long long)commands);
+}
+
+
+/* ---------------------------------------------------------------------------
+ * address claim storm
+ * ------------------------------------------------------------------------- */
+
+typedef struct {
+    uint64_t name;
+    uint8_t  address;
+} peer_t;
+
+static peer_t   peer[VBUS_MAX_NODES];
+static uint64_t stormLastClaimNs;
+static uint64_t stormClaims;
+
+static void _claim(int node)
+{
+    vbus_frame_t f;
+
+    f.id  = _id(6, SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM, 0xFF, peer[node].address);
+    f.dlc = 8;
+    memcpy(f.data, &peer[node].name, 8);
+    vbus_send(node, &f);
+    stormLastClaimNs = vbus_now_ns();
+    stormClaims++;
+}
+
+// J1939-81: the lower NAME keeps a contested address, the other moves on
+static void _stormRx(int node, const vbus_frame_t *frame)
+{
+    uint8_t  pf = (frame->id >> 16) & 0xFF;
+    uint8_t  sa = frame->id & 0xFF;
+    uint64_t name;
+
+    if (pf == SAE_J1939_PDU_FORMAT_REQUEST && frame->data[1] == SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM) {
+        _claim(node);
+        return;
+    }
+    if (pf != SAE_J1939_PDU_FORMAT_ADDRESS_CLAIM || sa != peer[node].address) {
+        return;
+    }
+    memcpy(&name, frame->data, 8);
+    if (name < peer[node].name) {
+        peer[node].address = (uint8_t)(128 + rand() % 120);
+        _claim(node);
+    } else if (name > peer[node].name) {
+        _claim(node);
+    }
+}
+
+static void _testStorm(uint32_t kbit)
+{
+    int    i, node, entries = 0;
+    double seconds = opt.seconds;
+
+    _startStack(kbit);
+    srand(1);
+    stormClaims = 0;
+    for (i = 0; i < opt.peers && i < VBUS_MAX_NODES - 1; i++) {
+        node = vbus_add_node(_stormRx);
+        peer[node].name    = ((uint64_t)rand() << 32) | (uint64_t)rand() | (1ull << 63);
+        peer[node].address = (uint8_t)(128 + rand() % 120);
+        _claim(node);
+    }
+    _run(seconds, 0);
+
+    for (i = 0; i < SAE_J1939_MAX_TABLE_ENTRY; i++) {
+        entries += addrMappingTable[i].status != _ECU_IDLE;
+    }
+    printf("storm %u kbit/s, %d peers, %.1f s\n", kbit, opt.peers, seconds);
+    _busReport(seconds);
+    printf("  %llu claims, last at %.1f ms, table %d entries, own address %u\n",
+           (unsigned long long)stormClaims, stormLastClaimNs / 1e6, entries, *gEcuInst.addr);
+    printf("  ecu_process: %llu frames in %.3f s wall, %.2f us per frame\n",
+           (unsigned long long)processedFrames, processSeconds,
+           processedFrames ? processSeconds * 1e6 / processedFrames : 0.0);
+}
+
+
+/* ---------------------------------------------------------------------------
+ * tx latency
+ * ------------------------------------------------------------------------- */
+
+static void _latencyTxDone(const vbus_frame_t *frame, uint64_t loaded, uint64_t done)
+{
+    uint32_t tickUs;
+
+    (void)loaded;
+    if (((frame->id >> 16) & 0xFF) == SAE_J1939_PDU_FORMAT_DATA) {
+        memcpy(&tickUs, frame->data, sizeof(tickUs));
+        _sample(&periodicLatency, (uint64_t)((uint32_t)(done / 1000) - tickUs) * 1000);
+    }
+}
+
+static uint32_t telemetryFrames;
+
+static void _testerRx(int node, const vbus_frame_t *frame)
+{
+    (void)node;
+    if (((frame->id >> 16) & 0xFF) == SAE_J1939_PDU_FORMAT_GLOBAL &&
+        ((frame->id >> 8) & 0xFF) == gEcuConfig.telemetry_ps && (frame->id & 0xFF) == DUT_ADDRESS) {
+        telemetryFrames++;
+    }
+    if (((frame->id >> 8) & 0xFF) == REQUESTED_PS && (frame->id & 0xFF) == DUT_ADDRESS && requestSentNs) {
+        _sample(&responseLatency, vbus_now_ns() - requestSentNs);
+        requestSentNs = 0;
+    }
+}
+
+// last window of sae_j1939_telemetry.c; its load only counts the frames
+// the stack sent or accepted, the background traffic is filtered out
+static void _telemetryReport(void)
+{
+    SAE_J1939_TELEMETRY t;
+    int i;
+
+    if (!j1939_telemetry_get(&t)) {
+        printf("  telemetry: no window closed\n");
+        return;
+    }
+    printf("  telemetry PGN frames seen by the tester %u\n", telemetryFrames);
+    printf("  telemetry %u ms: load %.1f %%, tx %u, rx %u, tec %u (max %u), rec %u (max %u), "
+           "state %u, mailbox full %u, lost %u\n",
+           t.window_ms, t.load_permille / 10.0, t.tx_frames, t.rx_frames, t.tec, t.tec_max,
+           t.rec, t.rec_max, t.state, t.mailbox_full, t.rx_lost + t.rx_hw_lost);
+    for (i = 0; i < t.pgns; i++) {
+        printf("    pgn %5u: %4u sent, queue jitter %5u us, tx jitter %5u us, max wait %5u us\n",
+               t.pgn[i].pgn, t.pgn[i].sent, t.pgn[i].queue_jitter_us, t.pgn[i].tx_jitter_us,
+               t.pgn[i].max_wait_us);
+    }
+}
+
+// the pgn_rate SET of _testLatency() halved the acceleration rate
+static void _rateCheck(void)
+{
+    uint32_t accel = 0, slope = 0;
+    double   ratio;
+    BOOL     ok;
+    int      i;
+
+    for (i = 0; i < ACEINNA_SAE_J1939_PACKET_TYPES; i++) {
+        if (ecu_sched.slot[i].type == ACEINNA_SAE_J1939_PACKET_ACCELERATION) {
+            accel = ecu_sched.slot[i].sent;
+        } else if (ecu_sched.slot[i].type == ACEINNA_SAE_J1939_PACKET_SLOPE_SENSOR) {
+            slope = ecu_sched.slot[i].sent;
+        }
+    }
+    if (!opt.periodicHz) {
+        return;
+    }
+    ratio = slope ? (double)accel / slope : 0.0;
+    ok    = ratio > 0.45 && ratio < 0.55;
+    printf("  pgn_rate %s: acceleration %u, slope %u sent\n", ok ? "ok" : "FAILED", accel, slope);
+    failures += !ok;
+}
+
+static void _testLatency(uint32_t kbit)
+{
+    vbus_frame_t req;
+    uint64_t     end, next;
+    uint32_t     tick = 0, prio;
+
+    _startStack(kbit);
+    vbus_set_tx_done(_latencyTxDone);
+    vbus_set_background_load(opt.load / 100.0, BACKGROUND_ID);
+    tester = vbus_add_node(_testerRx);
+
+    // telemetry PGN on, every second
+    memset(&req, 0, sizeof(req));
+    req.id      = _id(6, SAE_J1939_PDU_FORMAT_GLOBAL, SAE_J1939_GROUP_EXTENSION_CAN_TELEMETRY_CFG, TESTER_ADDRESS);
+    req.dlc     = 3;
+    req.data[0] = DUT_ADDRESS;
+    req.data[2] = SAE_J1939_TELEMETRY_PERIOD_DEFAULT;
+    vbus_send(tester, &req);
+    telemetryFrames = 0;
+
+    // acceleration at half the rate of the other types, pgn_rate SET
+    memset(&req, 0, sizeof(req));
+    req.id      = _id(6, SAE_J1939_PDU_FORMAT_GLOBAL, SAE_J1939_GROUP_EXTENSION_PGN_RATE, TESTER_ADDRESS);
+    req.dlc     = 4;
+    req.data[0] = DUT_ADDRESS;
+    req.data[1] = (uint8_t)ACEINNA_SAE_J1939_PACKET_ACCELERATION;
+    req.data[2] = (uint8_t)(ACEINNA_SAE_J1939_PACKET_ACCELERATION >> 8);
+    req.data[3] = (uint8_t)(2 * (opt.periodicHz ? 100 / opt.periodicHz : 1));
+    vbus_send(tester, &req);
+
+    memset(&req, 0, sizeof(req));
+    req.id      = _id(6, SAE_J1939_PDU_FORMAT_REQUEST, DUT_ADDRESS, TESTER_ADDRESS);
+    req.dlc     = 3;
+    req.data[0] = REQUESTED_PS;
+    req.data[1] = 0xFE;
+
+    // ticks and requests are not aligned, requests land anywhere in a tick
+    end  = (uint64_t)(opt.seconds * 1e9);
+    next = REQUEST_PERIOD_NS + 1234567;
+    while (vbus_now_ns() < end) {
+        uint64_t tickAt = (uint64_t)(tick + 1) * TICK_NS;
+
+        if (next < tickAt) {
+            vbus_run_until(next);
+            requestSentNs = vbus_now_ns();
+            vbus_send(tester, &req);
+            next += REQUEST_PERIOD_NS;
+            continue;
+        }
+        vbus_run_until(tickAt);
+        _taskTick(opt.periodicHz);
+        tick++;
+    }
+
+    printf("latency %u kbit/s, %.1f s, periodic %d Hz, background %.0f %%, error rate %g\n",
+           kbit, opt.seconds, opt.periodicHz, opt.load, opt.errorRate);
+    _busReport(opt.seconds);
+    _report("tick to end of frame", &periodicLatency);
+    _report("request to response", &responseLatency);
+    printf("  queue to mailbox (ecu_tx_stats):");
+    for (prio = 0; prio < SAE_J1939_PRIORITY_LEVELS; prio++) {
+        if (ecu_tx_stats.sent[prio]) {
+            printf("  p%u max %u us", prio, ecu_tx_stats.max_latency_us[prio]);
+        }
+    }
+    printf("\n");
+    printf("  scheduler: budget %u frames/tick, plan peak %u, max admitted %u",
+           ecu_sched.budget, ecu_sched.peak, ecu_sched.max_admitted);
+    for (prio = 0; prio < ACEINNA_SAE_J1939_PACKET_TYPES; prio++) {
+        SAE_J1939_SCHED_SLOT *s = &ecu_sched.slot[prio];
+
+        if (s->period) {
+            printf(", type %x phase %u deferred %u skipped %u", s->type, s->phase, s->deferred,
+                   s->skipped);
+        }
+    }
+    printf("\n");
+    _rateCheck();
+    _telemetryReport();
+    vbus_set_background_load(0, 0);
+    vbus_set_tx_done(NULL);
+}
+
+
+/* ---------------------------------------------------------------------------
+ * transport protocol
+ * ------------------------------------------------------------------------- */
+
+#define TP_LONG_PGN         0xFF5A              // proprietary B, 1785 byte messages
+#define TP_LONG_SIZE        (255 * 7)
+
+// the tester's side of a message, either direction
+typedef struct {
+    uint8_t  data[TP_LONG_SIZE];
+    uint32_t pgn;
+    uint16_t size;
+    uint8_t  packets;
+    uint8_t  received;
+    BOOL     bam;
+    BOOL     done;
+} tp_message_t;
+
+static tp_message_t tpRx;                       // from the stack
+static tp_message_t tpTx;                       // to the stack, done on EOM ACK
+static tp_message_t tpDut;                      // what the stack reassembled
+static uint8_t      tpLong[TP_LONG_SIZE];
+
+static void _tpSendCm(uint8_t dest, uint32_t pgn, uint8_t control, uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4)
+{
+    vbus_frame_t f;
+
+    f.id      = _id(7, SAE_J1939_PDU_FORMAT_TP_CM, dest, TESTER_ADDRESS);
+    f.dlc     = 8;
+    f.data[0] = control;
+    f.data[1] = b1;
+    f.data[2] = b2;
+    f.data[3] = b3;
+    f.data[4] = b4;
+    f.data[5] = (uint8_t)pgn;
+    f.data[6] = (uint8_t)(pgn >> 8);
+    f.data[7] = (uint8_t)(pgn >> 16);
+    vbus_send(tester, &f);
+}
+
+static void _tpSendDt(uint8_t dest, uint8_t seq)
+{
+    vbus_frame_t f;
+    uint16_t     offset = (uint16_t)(seq - 1) * 7;
+    uint16_t     len    = tpTx.size - offset < 7 ? tpTx.size - offset : 7;
+
+    f.id  = _id(7, SAE_J1939_PDU_FORMAT_TP_DT, dest, TESTER_ADDRESS);
+    f.dlc = 8;
+    memset(f.data, 0xFF, sizeof(f.data));
+    f.data[0] = seq;
+    memcpy(&f.data[1], &tpTx.data[offset], len);
+    vbus_send(tester, &f);
+}
+
+// the receiving side of J1939-21, one window for the whole message, and the
+// sending side of a connection, the windows the stack grants
+static void _tpTesterRx(int node, const vbus_frame_t *frame)
+{
+    uint8_t pf = (frame->id >> 16) & 0xFF;
+    uint8_t ps = (frame->id >> 8) & 0xFF;
+    int     seq;
+
+    (void)node;
+    if ((frame->id & 0xFF) != DUT_ADDRESS || (ps != TESTER_ADDRESS && ps != 0xFF)) {
+        return;
+    }
+    if (pf == SAE_J1939_PDU_FORMAT_TP_CM &&
+        (frame->data[0] == SAE_J1939_TP_CM_RTS || frame->data[0] == SAE_J1939_TP_CM_BAM)) {
+        memset(&tpRx, 0, sizeof(tpRx));
+        tpRx.size    = frame->data[1] | (frame->data[2] << 8);
+        tpRx.packets = frame->data[3];
+        tpRx.pgn     = frame->data[5] | (frame->data[6] << 8) | ((uint32_t)frame->data[7] << 16);
+        tpRx.bam     = frame->data[0] == SAE_J1939_TP_CM_BAM;
+        if (!tpRx.bam) {
+            _tpSendCm(DUT_ADDRESS, tpRx.pgn, SAE_J1939_TP_CM_CTS, tpRx.packets, 1, 0xFF, 0xFF);
+        }
+    } else if (pf == SAE_J1939_PDU_FORMAT_TP_CM && frame->data[0] == SAE_J1939_TP_CM_CTS) {
+        for (seq = frame->data[2]; seq < frame->data[2] + frame->data[1] && seq <= tpTx.packets; seq++) {
+            _tpSendDt(DUT_ADDRESS, (uint8_t)seq);
+        }
+    } else if (pf == SAE_J1939_PDU_FORMAT_TP_CM && frame->data[0] == SAE_J1939_TP_CM_EOM_ACK) {
+        tpTx.done = TRUE;
+    } else if (pf == SAE_J1939_PDU_FORMAT_TP_DT && tpRx.packets && !tpRx.done) {
+        if (frame->data[0] != tpRx.received + 1) {
+            return;
+        }
+        memcpy(&tpRx.data[tpRx.received * 7], &frame->data[1], 7);
+        if (++tpRx.received == tpRx.packets) {
+            tpRx.done = TRUE;
+            if (!tpRx.bam) {
+                _tpSendCm(DUT_ADDRESS, tpRx.pgn, SAE_J1939_TP_CM_EOM_ACK, tpRx.size, tpRx.size >> 8,
+                          tpRx.packets, 0xFF);
+            }
+        }
+    }
+}
+
+// j1939_tp_set_rx_handler() of the stack
+static void _tpDutRx(uint32_t pgn, uint8_t source, const uint8_t *data, uint16_t len)
+{
+    if (source != TESTER_ADDRESS || len > sizeof(tpDut.data)) {
+        return;
+    }
+    memcpy(tpDut.data, data, len);
+    tpDut.pgn  = pgn;
+    tpDut.size = len;
+    tpDut.done = TRUE;
+}
+
+static void _tpResult(const char *name, const tp_message_t *m, const uint8_t *expected, uint16_t size)
+{
+    BOOL ok = m->done && m->size == size && !memcmp(m->data, expected, size);
+
+    printf("  %-6s %s: %u of %u packets, %u bytes", name, ok ? "ok" : "FAILED",
+           m->received, m->packets, m->size);
+    if (size < 64) {
+        printf(" \"%.*s\"", m->size, m->data);
+    }
+    printf("\n");
+    failures += !ok;
+}
+
+static void _tpCheck(const char *name, uint8_t dest, const char *expected)
+{
+    vbus_frame_t req;
+
+    memset(&tpRx, 0, sizeof(tpRx));
+    memset(&req, 0, sizeof(req));
+    req.id      = _id(6, SAE_J1939_PDU_FORMAT_REQUEST, dest, TESTER_ADDRESS);
+    req.dlc     = 3;
+    req.data[0] = SAE_J1939_GROUP_EXTENSION_COMPONENT_ID;
+    req.data[1] = SAE_J1939_PDU_FORMAT_254;
+    vbus_send(tester, &req);
+    _run(1.0, 0);
+
+    _tpResult(name, &tpRx, (const uint8_t *)expected, (uint16_t)strlen(expected));
+}
+
+// 255 packets from the stack, the sequence number wraps its byte on the last
+static void _tpCheckLongTx(const char *name, uint8_t dest)
+{
+    memset(&tpRx, 0, sizeof(tpRx));
+    if (!j1939_tp_send(TP_LONG_PGN, 6, dest, tpLong, sizeof(tpLong))) {
+        printf("  %-6s FAILED: j1939_tp_send refused %u bytes\n", name, (unsigned)sizeof(tpLong));
+        failures++;
+        return;
+    }
+    // BAM paces a packet per SAE_J1939_TP_BAM_INTERVAL_MS
+    _run(dest == 0xFF ? 255 * SAE_J1939_TP_BAM_INTERVAL_MS / 1000.0 + 1.0 : 2.0, 0);
+    _tpResult(name, &tpRx, tpLong, sizeof(tpLong));
+    if (j1939_tp_tx_pending(tpLong)) {
+        printf("  %-6s FAILED: session still open\n", name);
+        failures++;
+    }
+}
+
+// 255 packets to the stack, needs SAE_J1939_TP_MAX_SIZE 1785 in the build
+static void _tpCheckLongRx(const char *name, uint8_t dest)
+{
+    int seq;
+
+    if (SAE_J1939_TP_MAX_SIZE < TP_LONG_SIZE) {
+        printf("  %-6s skipped, build with -DSAE_J1939_TP_MAX_SIZE=%u\n", name, TP_LONG_SIZE);
+        return;
+    }
+    memset(&tpDut, 0, sizeof(tpDut));
+    memset(&tpTx, 0, sizeof(tpTx));
+    memcpy(tpTx.data, tpLong, sizeof(tpLong));
+    tpTx.size    = TP_LONG_SIZE;
+    tpTx.packets = 255;
+    tpTx.pgn     = TP_LONG_PGN;
+    j1939_tp_set_rx_handler(_tpDutRx);
+
+    if (dest == 0xFF) {
+        _tpSendCm(0xFF, TP_LONG_PGN, SAE_J1939_TP_CM_BAM, TP_LONG_SIZE & 0xFF, TP_LONG_SIZE >> 8, 255, 0xFF);
+        for (seq = 1; seq <= 255; seq++) {
+            _run(SAE_J1939_TP_BAM_INTERVAL_MS / 1000.0, 0);
+            _tpSendDt(0xFF, (uint8_t)seq);
+        }
+        _run(0.1, 0);
+        tpTx.done = TRUE;                       // no EOM ACK for a broadcast
+    } else {
+        _tpSendCm(dest, TP_LONG_PGN, SAE_J1939_TP_CM_RTS, TP_LONG_SIZE & 0xFF, TP_LONG_SIZE >> 8, 255, 0xFF);
+        _run(2.0, 0);
+    }
+    j1939_tp_set_rx_handler(NULL);
+
+    tpDut.received = tpDut.packets = tpDut.done ? 255 : 0;
+    tpDut.done     = tpDut.done && tpTx.done && tpDut.pgn == TP_LONG_PGN;
+    _tpResult(name, &tpDut, tpLong, sizeof(tpLong));
+}
+
+static void _testTp(uint32_t kbit)
+{
+    char expected[64];
+    int  i;
+
+    _startStack(kbit);
+    tester = vbus_add_node(_tpTesterRx);
+    snprintf(expected, sizeof(expected), "ACEINNA*%.*s*%u**",
+             (int)strcspn(MODEL_STRING, " "), MODEL_STRING, SERIAL_NUMBER);
+    for (i = 0; i < TP_LONG_SIZE; i++) {
+        tpLong[i] = (uint8_t)(i * 7 + i / 251);
+    }
+
+    printf("tp %u kbit/s, component identification and %u byte messages\n", kbit, TP_LONG_SIZE);
+    _tpCheck("rts", DUT_ADDRESS, expected);
+    _tpCheck("bam", 0xFF, expected);
+    _tpCheckLongTx("rts tx", TESTER_ADDRESS);
+    _tpCheckLongTx("bam tx", 0xFF);
+    _tpCheckLongRx("rts rx", DUT_ADDRESS);
+    _tpCheckLongRx("bam rx", 0xFF);
+    _busReport(vbus_now_ns() / 1e9);
+    printf("  tp: tx done %u, rx done %u, aborts %u, timeouts %u\n",
+           j1939TpStats.tx_done, j1939TpStats.rx_done, j1939TpStats.aborts, j1939TpStats.timeouts);
+}
+
+
+int main(int argc, char **argv)
+{
+    static const uint32_t rates[3] = { 250, 500, 1000 };
+    const char *test = "all";
+    int i, r;
+
+    for (i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            test = argv[i];
+        } else if (i + 1 < argc) {
+            switch (argv[i][1]) {
+            case 'b': opt.rate       = atoi(argv[++i]); break;
+            case 't': opt.seconds    = atof(argv[++i]); break;
+            case 'l': opt.load       = atof(argv[++i]); break;
+            case 'e': opt.errorRate  = atof(argv[++i]); break;
+            case 'n': opt.peers      = atoi(argv[++i]); break;
+            case 'p': opt.periodicHz = atoi(argv[++i]); break;
+            default:
+                fprintf(stderr, "unknown option %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "missing value for %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (opt.periodicHz < 0 || opt.periodicHz > 100 || (opt.periodicHz && 100 % opt.periodicHz)) {
+        fprintf(stderr, "periodic rate must divide 100 Hz\n");
+        return 1;
+    }
+
+    for (r = 0; r < 3; r++) {
+        uint32_t kbit = opt.rate ? (uint32_t)opt.rate : rates[r];
+
+        if (!strcmp(test, "rx") || !strcmp(test, "all")) {
+            _testRx(kbit);
+        }
+        if (!strcmp(test, "storm") || !strcmp(test, "all")) {
+            _testStorm(kbit);
+        }
+        if (!strcmp(test, "latency") || !strcmp(test, "all")) {
+            _testLatency(kbit);
+        }
+        if (!strcmp(test, "tp") || !strcmp(test, "all")) {
+            _testTp(kbit);
+        }
+        if (opt.rate) {
+            break;
+        }
+    }
+    return failures;
+}
@@ -0,0 +1,524 @@
+/** ***************************************************************************
+ * @file   vbus.c
+ * @brief  host tool: virtual CAN bus and the host side of the CAN driver
+ *         (CAN_Transmit, CAN_Tx_Request, _CAN_Configure and the acceptance
+ *         filters) for the J1939 stack, see vbus.h.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32f4xx_can.h"
+#include "can.h"
+#include "canAPI.h"
+#include "sae_j1939.h"
+#include "vbus.h"
+
+#define TIM5_TICKS_PER_US       60
+
+typedef struct {
+    vbus_frame_t frame;
+    uint64_t     ready;                 // ns, earliest start of frame
+} vbus_slot_t;
+
+typedef struct {
+    vbus_rx_handler_t rx;
+    vbus_slot_t       queue[VBUS_NODE_QUEUE];
+    uint16_t          head;
+    uint16_t          tail;
+} vbus_node_t;
+
+typedef struct {
+    BOOL         used;
+    uint32_t     order;                 // request order, TXFP
+    vbus_frame_t frame;
+    uint64_t     loaded;
+} vbus_mailbox_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t mask;
+    uint8_t  fifo;
+} vbus_filter_t;
+
+TIM_TypeDef  vbusTim5;
+CAN_TypeDef  vbusCan1;
+vbus_stats_t vbusStats;
+
+static vbus_node_t    nodes[VBUS_MAX_NODES];
+static int            numNodes;
+static vbus_mailbox_t mailbox[VBUS_DUT_MAILBOXES];
+static uint32_t       mailboxOrder;
+static vbus_filter_t  filters[CAN_FILTER_MAX_SUBSCRIPTIONS];
+static int            numFilters;
+
+static uint64_t now;                    // ns
+static uint64_t busIdle;                // ns, end of the last frame or error
+static uint32_t bitNs;
+static double   errorRate;
+static uint32_t rngState = 0x2545F491;
+
+// background traffic, one frame pending at a time
+static BOOL         bgEnabled;
+static vbus_frame_t bgFrame;
+static uint64_t     bgReady;
+static uint64_t     bgPeriod;
+
+static void (*txCallback)(void);
+static void (*rxCallback)(void);
+static void (*idleHook)(void);
+static vbus_tx_done_t txDone;
+static uint32_t       dutTec, dutRec;   // error counters of the stack's node
+
+
+static uint32_t _rand(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static void _setTime(uint64_t ns)
+{
+    now          = ns;
+    vbusTim5.CNT = (uint32_t)(ns * TIM5_TICKS_PER_US / 1000);
+}
+
+// fault confinement of the stack's node, CAN 2.0 rules without bus-off
+static void _dutErrorCounters(BOOL transmitter, BOOL error)
+{
+    uint32_t *counter = transmitter ? &dutTec : &dutRec;
+    uint32_t  lec     = error ? 1 : 0;  // stuff error, cleared by a good frame
+
+    if (error) {
+        *counter += transmitter ? 8 : 1;
+        if (*counter > 255) {
+            *counter = 255;
+        }
+    } else if (*counter) {
+        (*counter)--;
+    }
+    vbusCan1.ESR = (dutRec << 24) | (dutTec << 16) | (lec << 4) |
+                   ((dutTec > 127 || dutRec > 127) ? CAN_ESR_EPVF : 0) |
+                   ((dutTec >= 96 || dutRec >= 96) ? CAN_ESR_EWGF : 0);
+}
+
+uint64_t vbus_now_ns(void)
+{
+    return now;
+}
+
+uint32_t vbus_now_ms(void)
+{
+    return (uint32_t)(now / 1000000);
+}
+
+uint32_t vbus_bit_ns(void)
+{
+    return bitNs;
+}
+
+
+/** ***************************************************************************
+ * @name vbus_frame_bits
+ * @brief length of an extended data frame on the wire: SOF through CRC with
+ *        the actual stuff bits, then CRC delimiter, ACK, EOF and intermission
+ ******************************************************************************/
+uint32_t vbus_frame_bits(const vbus_frame_t *frame)
+{
+    uint8_t  bits[1 + 32 + 6 + 64 + 15];
+    uint16_t crc = 0;
+    int      n = 0, i, run, stuff;
+    uint8_t  last;
+    uint32_t id = frame->id & CAN_EXT_ID_MASK;
+    uint8_t  dlc = frame->dlc > 8 ? 8 : frame->dlc;
+
+    bits[n++] = 0;                                          // SOF
+    for (i = 28; i >= 18; i--) bits[n++] = (id >> i) & 1;  // base id
+    bits[n++] = 1;                                          // SRR
+    bits[n++] = 1;                                          // IDE
+    for (i = 17; i >= 0; i--) bits[n++] = (id >> i) & 1;    // id extension
+    bits[n++] = 0;                                          // RTR
+    bits[n++] = 0;                                          // r1
+    bits[n++] = 0;                                          // r0
+    for (i = 3; i >= 0; i--) bits[n++] = (dlc >> i) & 1;
+    for (i = 0; i < dlc * 8; i++) bits[n++] = (frame->data[i >> 3] >> (7 - (i & 7))) & 1;
+
+    for (i = 0; i < n; i++) {
+        uint16_t next = bits[i] ^ ((crc >> 14) & 1);
+        crc = (uint16_t)((crc << 1) & 0x7FFF);
+        if (next) {
+            crc ^= 0x4599;
+        }
+    }
+    for (i = 14; i >= 0; i--) bits[n++] = (crc >> i) & 1;
+
+    // a stuff bit after five equal bits, and it starts the next run
+    stuff = 0;
+    run   = 1;
+    last  = bits[0];
+    for (i = 1; i < n; i++) {
+        if (bits[i] == last) {
+            if (++run == 5) {
+                stuff++;
+                last = !last;
+                run  = 1;
+            }
+        } else {
+            last = bits[i];
+            run  = 1;
+        }
+    }
+
+    return n + stuff + 1 + 2 + 7 + 3;
+}
+
+
+void vbus_init(uint32_t bitrate)
+{
+    memset(nodes, 0, sizeof(nodes));
+    memset(mailbox, 0, sizeof(mailbox));
+    memset(&vbusStats, 0, sizeof(vbusStats));
+    numNodes     = 1;                   // VBUS_DUT
+    numFilters   = 0;
+    mailboxOrder = 0;
+    busIdle      = 0;
+    bitNs        = 1000000000u / bitrate;
+    errorRate    = 0;
+    bgEnabled    = FALSE;
+    txDone       = NULL;
+    idleHook     = NULL;
+    dutTec       = 0;
+    dutRec       = 0;
+    vbusCan1.ESR = 0;
+    _setTime(0);
+}
+
+void vbus_set_error_rate(double perFrame)
+{
+    errorRate = perFrame;
+}
+
+/** ***************************************************************************
+ * @name vbus_set_background_load
+ * @brief 8-byte frames with the given identifier taking about load (0..1) of
+ *        the bus, sent with +-25 % jitter so they don't lock to the stack's tick
+ ******************************************************************************/
+void vbus_set_background_load(double load, uint32_t id)
+{
+    bgEnabled = load > 0;
+    if (!bgEnabled) {
+        return;
+    }
+    bgFrame.id  = id & CAN_EXT_ID_MASK;
+    bgFrame.dlc = 8;
+    memset(bgFrame.data, 0xA5, sizeof(bgFrame.data));
+    bgPeriod = (uint64_t)(vbus_frame_bits(&bgFrame) * bitNs / load);
+    bgReady  = now;
+}
+
+void vbus_set_tx_done(vbus_tx_done_t handler)
+{
+    txDone = handler;
+}
+
+void vbus_set_idle_hook(void (*hook)(void))
+{
+    idleHook = hook;
+}
+
+int vbus_add_node(vbus_rx_handler_t handler)
+{
+    if (numNodes == VBUS_MAX_NODES) {
+        return -1;
+    }
+    nodes[numNodes].rx = handler;
+    return numNodes++;
+}
+
+BOOL vbus_send(int node, const vbus_frame_t *frame)
+{
+    vbus_node_t *n = &nodes[node];
+
+    if (node <= VBUS_DUT || node >= numNodes) {
+        return FALSE;
+    }
+    if ((uint16_t)(n->head - n->tail) >= VBUS_NODE_QUEUE) {
+        vbusStats.peerDropped++;
+        return FALSE;
+    }
+    n->queue[n->head % VBUS_NODE_QUEUE].frame = *frame;
+    n->queue[n->head % VBUS_NODE_QUEUE].ready = now;
+    n->head++;
+    return TRUE;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * driver side of the stack under test
+ * ------------------------------------------------------------------------- */
+
+uint8_t CAN_Transmit(CAN_TypeDef* CANx, CanTxMsg* TxMessage)
+{
+    int i;
+
+    (void)CANx;
+    for (i = 0; i < VBUS_DUT_MAILBOXES; i++) {
+        if (!mailbox[i].used) {
+            mailbox[i].used      = TRUE;
+            mailbox[i].order     = mailboxOrder++;
+            mailbox[i].loaded    = now;
+            mailbox[i].frame.id  = TxMessage->ExtId & CAN_EXT_ID_MASK;
+            mailbox[i].frame.dlc = TxMessage->DLC;
+            memcpy(mailbox[i].frame.data, TxMessage->Data, sizeof(TxMessage->Data));
+            return (uint8_t)i;
+        }
+    }
+    return CAN_TxStatus_NoMailBox;
+}
+
+// the tx interrupt runs right away, interrupts never nest on the host
+void CAN_Tx_Request(void)
+{
+    if (txCallback != NULL) {
+        txCallback();
+    }
+}
+
+void _CAN_Configure(void (*callback1)(void), void(*callback2)(void))
+{
+    txCallback = callback1;
+    rxCallback = callback2;
+}
+
+BOOL SubscribeCANMessage(uint32_t baseID, uint32_t baseMask, uint8_t fifo)
+{
+    vbus_filter_t *f;
+
+    if (numFilters >= CAN_FILTER_MAX_SUBSCRIPTIONS) {
+        return FALSE;
+    }
+    f       = &filters[numFilters++];
+    f->mask = baseMask & CAN_EXT_ID_MASK;
+    f->id   = baseID & f->mask;
+    f->fifo = (fifo == CAN_Filter_FIFO1) ? CAN_Filter_FIFO1 : CAN_Filter_FIFO0;
+    return TRUE;
+}
+
+void ConfigureCANMessageFilter(uint32_t baseID, uint32_t baseMask)
+{
+    uint8_t fifo = CAN_Filter_FIFO0;
+
+    if (!aceinna_j1939_filter_route(baseID, baseMask, &fifo)) {
+        return;
+    }
+    SubscribeCANMessage(baseID, baseMask, fifo);
+}
+
+/** ***************************************************************************
+ * @name _dutReceive
+ * @brief acceptance filters, FIFO1 subscriptions first like the bank layout,
+ *        then the rx interrupt path of _CAN_ReceiveFifo(). No subscriptions
+ *        at all accepts everything into FIFO0.
+ ******************************************************************************/
+static void _dutReceive(const vbus_frame_t *frame)
+{
+    struct sae_j1939_rx_desc *desc;
+    uint8_t fifo = CAN_FIFO0, fmi = 0xFF;
+    int     pass, i;
+
+    if (numFilters) {
+        for (pass = CAN_FIFO1; pass >= CAN_FIFO0 && fmi == 0xFF; pass--) {
+            for (i = 0; i < numFilters; i++) {
+                if (filters[i].fifo == pass && (frame->id & filters[i].mask) == filters[i].id) {
+                    fifo = (uint8_t)pass;
+                    fmi  = (uint8_t)i;
+                    break;
+                }
+            }
+        }
+        if (fmi == 0xFF) {
+            vbusStats.dutFiltered++;
+            return;
+        }
+    }
+
+    desc = aceinna_j1939_rx_reserve(fifo);
+    if (desc == NULL) {
+        vbusStats.dutDropped++;
+        return;
+    }
+    memset(&desc->rx_buffer, 0, sizeof(desc->rx_buffer));
+    desc->rx_buffer.ExtId = frame->id;
+    desc->rx_buffer.IDE   = CAN_ID_EXT;
+    desc->rx_buffer.RTR   = CAN_RTR_Data;
+    desc->rx_buffer.DLC   = frame->dlc;
+    desc->rx_buffer.FMI   = fmi;
+    memcpy(desc->rx_buffer.Data, frame->data, 8);
+    vbusStats.dutRx++;
+    if (rxCallback != NULL) {
+        rxCallback();
+    }
+}
+
+
+/* ---------------------------------------------------------------------------
+ * bus
+ * ------------------------------------------------------------------------- */
+
+// node -1 is the background traffic, node VBUS_DUT picks its oldest mailbox
+static const vbus_frame_t *_candidate(int node, uint64_t *ready, int *box)
+{
+    vbus_node_t *n;
+    int i, oldest = -1;
+
+    if (node < 0) {
+        *ready = bgReady;
+        return bgEnabled ? &bgFrame : NULL;
+    }
+    if (node == VBUS_DUT) {
+        for (i = 0; i < VBUS_DUT_MAILBOXES; i++) {
+            if (mailbox[i].used && (oldest < 0 || mailbox[i].order < mailbox[oldest].order)) {
+                oldest = i;
+            }
+        }
+        if (oldest < 0) {
+            return NULL;
+        }
+        *box   = oldest;
+        *ready = mailbox[oldest].loaded;
+        return &mailbox[oldest].frame;
+    }
+    n = &nodes[node];
+    if (n->head == n->tail) {
+        return NULL;
+    }
+    *ready = n->queue[n->tail % VBUS_NODE_QUEUE].ready;
+    return &n->queue[n->tail % VBUS_NODE_QUEUE].frame;
+}
+
+/** ***************************************************************************
+ * @name vbus_run_until
+ * @brief advance the simulated clock, one start of frame at a time: every
+ *        node with a frame ready at that instant contends, the lowest
+ *        identifier wins, the others retry at the next start of frame
+ ******************************************************************************/
+void vbus_run_until(uint64_t ns)
+{
+    const vbus_frame_t *f, *win;
+    vbus_frame_t frame;
+    uint64_t ready, start, end;
+    int      node, winner, box = 0, winBox = 0;
+    BOOL     dutContends;
+    uint32_t bits;
+
+    while (1) {
+        // earliest instant any frame can start
+        start = UINT64_MAX;
+        for (node = -1; node < numNodes; node++) {
+            if ((f = _candidate(node, &ready, &box)) != NULL && ready < start) {
+                start = ready;
+            }
+        }
+        if (start < busIdle) {
+            start = busIdle;
+        }
+        if (start == UINT64_MAX || start > ns) {
+            break;
+        }
+        _setTime(start);
+
+        win         = NULL;
+        winner      = 0;
+        dutContends = FALSE;
+        for (node = -1; node < numNodes; node++) {
+            f = _candidate(node, &ready, &box);
+            if (f == NULL || ready > start) {
+                continue;
+            }
+            if (node == VBUS_DUT) {
+                dutContends = TRUE;
+            }
+            if (win == NULL || f->id < win->id) {
+                win    = f;
+                winner = node;
+                winBox = box;
+            }
+        }
+        if (dutContends && winner != VBUS_DUT) {
+            vbusStats.dutArbitrationLost++;
+        }
+
+        bits = vbus_frame_bits(win);
+        if (errorRate > 0 && _rand() < (uint32_t)(errorRate * 4294967295.0)) {
+            // error somewhere before the CRC delimiter, then retransmission
+            end = start + (uint64_t)(_rand() % (bits - 13) + VBUS_ERROR_FRAME_BITS) * bitNs;
+            vbusStats.errorFrames++;
+            _dutErrorCounters(winner == VBUS_DUT, TRUE);
+            vbusStats.busyNs += end - start;
+            busIdle = end;
+            _setTime(end);
+            continue;
+        }
+
+        end     = start + (uint64_t)bits * bitNs;
+        frame   = *win;
+        busIdle = end;
+        vbusStats.frames++;
+        _dutErrorCounters(winner == VBUS_DUT, FALSE);
+        vbusStats.busyNs += end - start;
+        _setTime(end);
+
+        // the frame leaves its transmitter before anyone reacts to it
+        if (winner < 0) {
+            bgReady = start + bgPeriod * 3 / 4 + _rand() % (bgPeriod / 2 + 1);
+        } else if (winner == VBUS_DUT) {
+            ready = mailbox[winBox].loaded;
+            mailbox[winBox].used = FALSE;
+            vbusStats.dutTx++;
+            if (txDone != NULL) {
+                txDone(&frame, ready, end);
+            }
+        } else {
+            nodes[winner].tail++;
+        }
+
+        if (winner != VBUS_DUT) {
+            _dutReceive(&frame);
+        }
+        for (node = 1; node < numNodes; node++) {
+            if (node != winner && nodes[node].rx != NULL) {
+                nodes[node].rx(node, &frame);
+            }
+        }
+
+        // mailbox empty interrupt
+        if (winner == VBUS_DUT && txCallback != NULL) {
+            txCallback();
+        }
+        if (idleHook != NULL) {
+            idleHook();
+        }
+    }
+
+    if (ns > now) {
+        _setTime(ns);
+    }
+}
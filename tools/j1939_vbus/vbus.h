@@ -0,0 +1,84 @@
+/** ***************************************************************************
+ * @file   vbus.h
+ * @brief  host tool: in-process virtual CAN bus the J1939 stack runs against
+ *         instead of bxCAN.
+ *
+ * The stack under test is node VBUS_DUT. It reaches the bus through the same
+ * driver entry points it uses on the unit (CAN_Transmit behind gEcuInst.xmit,
+ * the tx/rx callbacks registered with _CAN_Configure, the PGN subscriptions),
+ * so sae_j1939*.c build unchanged. Other nodes are simulated peers.
+ *
+ * Timing is simulated, not wall clock: frames take their exact bit time
+ * (stuff bits, CRC, ACK, EOF and intermission) at the configured bit rate,
+ * nodes arbitrate by identifier at each start of frame, and injected errors
+ * cost an error frame followed by automatic retransmission. TIM5 and the
+ * system tick of the stack follow the simulated clock.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#ifndef _VBUS_H
+#define _VBUS_H
+#include <stdint.h>
+#include "GlobalConstants.h"
+
+#define VBUS_MAX_NODES          256
+#define VBUS_NODE_QUEUE         64      // frames a simulated peer can queue
+#define VBUS_DUT                0       // node of the stack under test
+#define VBUS_DUT_MAILBOXES      3       // bxCAN tx mailboxes, sent in request order (TXFP)
+#define VBUS_ERROR_FRAME_BITS   23      // flag, echo flag, delimiter and intermission
+
+typedef struct {
+    uint32_t id;                        // 29-bit extended identifier
+    uint8_t  dlc;
+    uint8_t  data[8];
+} vbus_frame_t;
+
+// a frame seen by a simulated peer, at the end of the frame
+typedef void (*vbus_rx_handler_t)(int node, const vbus_frame_t *frame);
+
+// a frame of the stack under test left the bus, times in ns
+typedef void (*vbus_tx_done_t)(const vbus_frame_t *frame, uint64_t loaded, uint64_t done);
+
+typedef struct {
+    uint64_t frames;                    // completed frames
+    uint64_t errorFrames;
+    uint64_t busyNs;                    // bus not idle
+    uint64_t dutTx;
+    uint64_t dutArbitrationLost;        // start of frames the stack took part in and lost
+    uint64_t dutRx;                     // handed to the rx ring
+    uint64_t dutFiltered;               // rejected by the acceptance filters
+    uint64_t dutDropped;                // rx ring full
+    uint64_t peerDropped;               // peer queue full
+} vbus_stats_t;
+
+extern vbus_stats_t vbusStats;
+
+extern void     vbus_init(uint32_t bitrate);
+extern void     vbus_set_error_rate(double perFrame);
+extern void     vbus_set_background_load(double load, uint32_t id);
+extern void     vbus_set_tx_done(vbus_tx_done_t handler);
+extern void     vbus_set_idle_hook(void (*hook)(void));
+extern int      vbus_add_node(vbus_rx_handler_t handler);
+extern BOOL     vbus_send(int node, const vbus_frame_t *frame);
+extern void     vbus_run_until(uint64_t ns);
+extern uint64_t vbus_now_ns(void);
+extern uint32_t vbus_now_ms(void);
+extern uint32_t vbus_frame_bits(const vbus_frame_t *frame);
+extern uint32_t vbus_bit_ns(void);
+
+#endif
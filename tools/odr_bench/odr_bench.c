@@ -0,0 +1,162 @@
+/** ***************************************************************************
+ * @file   odr_bench.c
+ * @brief  host tool: cost on the host of the hosted part of the acquisition
+ *         tick at each output data rate (DACQ_ODR_HZ), with the IIR filters
+ *         designed for that rate by Platform/Filter/src/filter.c.
+ *
+ * Build (Linux / macOS), from this directory:
+ *     cc -O2 -I../j1939_vbus/host -I../../Platform/Core/include \
+ *        -I../../Platform/Filter/include -o odr_bench odr_bench.c \
+ *        ../../Platform/Filter/src/filter.c ../../Platform/Core/src/clock_discipline.c -lm
+ *
+ * Usage:
+ *     odr_bench [-r rate Hz] [-f cutoff Hz] [-n ticks]
+ *
+ * Without -r every rate from 50 to 1000 Hz is reported. Each tick runs the
+ * hosted part of the dacq tick: the Butterworth filter on the six inertial
+ * channels and the dacq timer period of clock_discipline.c, with a PPS once
+ * a second.
+ *
+ * The filter check prints the response of the Q27 coefficients at DC and at
+ * the cutoff, lowered to FILTER_IIR_MAX_CUTOFF of slow rates: 0 and -3 dB.
+ *
+ * "host ns" is x86 time, it is NOT the headroom of the tick and no headroom
+ * figure can be derived from it. On the Cortex-M4 the sensor reads,
+ * calibration and algorithm dominate the tick. Headroom comes only from the
+ * target, built for the rate of interest: the "DM" packet (dacq_monitor.h)
+ * gives the worst case of each stage against the tick, and with
+ * DACQ_LATENCY_PROBES the "LT" packet gives the tick from TIM2 entry to the
+ * encoded packet.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "sensors_data.h"
+#include "filter.h"
+#include "clock_discipline.h"
+
+#define TICKS_PER_SECOND    60000000u       // TIM5, SystemCoreClock / 2
+#define CHANNELS            6               // XACCEL..ZRATE
+
+sensors_data_t gSensorsData;
+
+// keeps the loop from being optimised away
+static volatile uint32_t sink;
+
+static const uint32_t rates[] = { 50, 100, 200, 250, 400, 500, 1000 };
+
+static struct {
+    uint32_t rate;
+    double   cutoff;
+    int      ticks;
+} opt = { 0, 25.0, 2000000 };
+
+static double _nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// |H| in dB of the Q27 filter at f, numerator 1 2 1
+static double _responseDb(butterworth_fixed *f, double hz, double rate)
+{
+    double w  = 2.0 * 3.14159265358979323846 * hz / rate;
+    double g  = f->g / 134217728.0;
+    double b1 = f->b[1] / 134217728.0, b2 = f->b[2] / 134217728.0;
+    double nr = g * (1.0 + 2.0 * cos(w) + cos(2 * w)), ni = -g * (2.0 * sin(w) + sin(2 * w));
+    double dr = 1.0 + b1 * cos(w) + b2 * cos(2 * w),   di = -(b1 * sin(w) + b2 * sin(2 * w));
+
+    return 10.0 * log10((nr * nr + ni * ni) / (dr * dr + di * di));
+}
+
+static void _run(uint32_t rate)
+{
+    butterworth_fixed iir;
+    int32_t  b[3];
+    uint32_t period, sum = 0;
+    double   t0, hostNs, tickUs, fc;
+    int      i, ch;
+
+    FilterDesignButterworth(&iir, b, opt.cutoff, rate);
+    fc = opt.cutoff < FILTER_IIR_MAX_CUTOFF * rate ? opt.cutoff : FILTER_IIR_MAX_CUTOFF * rate;
+    ClockDisciplineInit(TICKS_PER_SECOND, rate);
+    memset(&gSensorsData, 0, sizeof(gSensorsData));
+
+    t0 = _nowNs();
+    for (i = 0; i < opt.ticks; i++) {
+        for (ch = 0; ch < CHANNELS; ch++) {
+            gSensorsData.rawSensors[ch] = (int32_t)((i * 2654435761u + ch) >> 12);
+            Apply_Butterworth_Q27_Filter(&iir, (uint8_t)ch);
+        }
+        if (i % rate == 0) {
+            ClockDisciplinePps(2400 + (i & 63), TICKS_PER_SECOND);
+        }
+        period = ClockDisciplineNextPeriod();
+        sum   += period + gSensorsData.rawSensors[0];
+    }
+    sink     = sum;
+    hostNs   = (_nowNs() - t0) / opt.ticks;
+    tickUs   = 1e6 / rate;
+
+    printf("  %4u %8.1f %6.1f %7.2f %7.2f %8.1f\n",
+           rate, tickUs, fc, _responseDb(&iir, 0.0, rate), _responseDb(&iir, fc, rate),
+           hostNs);
+}
+
+int main(int argc, char **argv)
+{
+    size_t r;
+    int    i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            opt.rate = (uint32_t)atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+            opt.cutoff = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            opt.ticks = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-r rate Hz] [-f cutoff Hz] [-n ticks]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (opt.rate && (opt.rate < 50 || opt.rate > 1000 || 1000000 % opt.rate)) {
+        fprintf(stderr, "rate must be 50..1000 Hz and divide 1000000\n");
+        return 1;
+    }
+
+    printf("dacq tick, %d ticks per rate, iir %.1f Hz, host only\n", opt.ticks, opt.cutoff);
+    printf("host ns is x86 time, not target headroom: read that from the DM / LT packets\n");
+    printf("    Hz  tick us  fc Hz dB at 0 dB at fc  host ns\n");
+    if (opt.rate) {
+        _run(opt.rate);
+    } else {
+        for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+            _run(rates[r]);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,360 @@
+/** ***************************************************************************
+ * @file   pps_sim.c
+ * @brief  host tool: simulates the PPS discipline of the dacq timer
+ *         (Platform/Core/src/clock_discipline.c) against a jittered PPS and
+ *         an oscillator with offset and drift, and reports how long the
+ *         sampling phase takes to converge and how much it wanders after.
+ *
+ * Build (Linux / macOS), from this directory:
+ *     cc -O2 -I../../Platform/Core/include -o pps_sim pps_sim.c \
+ *        ../../Platform/Core/src/clock_discipline.c -lm
+ *
+ * Usage:
+ *     pps_sim [-t seconds] [-p ppm] [-d ppm/s] [-j pps jitter ns rms]
+ *             [-l isr latency us] [-g start,seconds] [-s seed] [-L] [-v]
+ *
+ * -p   oscillator offset, -d its drift (temperature), -j PPS edge jitter
+ * -l   TIM2 interrupt entry latency, uniform up to this value
+ * -g   PPS missing for a while, to exercise holdover
+ * -L   run the previous lock1/lock2/lock3 ladder with the TIM2 autoreload
+ *      toggling and the 8 sample boxcar instead, for comparison
+ * -v   one line per second
+ *
+ * Time is kept in TIM5 ticks of the simulated oscillator. The phase reported
+ * is the true time of the first dacq tick after each true PPS edge, minus the
+ * 40 us target, wrapped to +-half a sample period. Converged is the first
+ * second from which it stays within 1 us to the end of the run; steady state
+ * statistics are taken over the second half of the run.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "clock_discipline.h"
+
+#define NOMINAL_HZ          60000000.0
+#define SAMPLES             200
+#define CONVERGED_NS        1000.0
+
+static struct {
+    int    seconds;
+    double ppm;
+    double driftPpmPerS;
+    double jitterNs;
+    double latencyUs;
+    int    gapStart, gapLen;
+    int    legacy;
+    int    verbose;
+    unsigned seed;
+} opt = { 600, 20.0, 0.0, 20.0, 2.0, 0, 0, 0, 0, 1 };
+
+static uint64_t rngState;
+
+static double _uniform(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return ((rngState >> 11) + 0.5) / 9007199254740992.0;
+}
+
+static double _gauss(void)
+{
+    return sqrt(-2.0 * log(_uniform())) * cos(2.0 * M_PI * _uniform());
+}
+
+// oscillator ticks at a true time, offset plus linear drift
+static double _ticksAt(double t)
+{
+    return NOMINAL_HZ * (t + 1e-6 * (opt.ppm * t + 0.5 * opt.driftPpmPerS * t * t));
+}
+
+// true time of a tick count, Newton on _ticksAt()
+static double _timeAt(double ticks)
+{
+    double t = ticks / NOMINAL_HZ;
+    int    i;
+
+    for (i = 0; i < 3; i++) {
+        double f = NOMINAL_HZ * (1 + 1e-6 * (opt.ppm + opt.driftPpmPerS * t));
+        t -= (_ticksAt(t) - ticks) / f;
+    }
+    return t;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * the loop before clock_discipline.c, from DataAcquisitionSupport.c
+ * ------------------------------------------------------------------------- */
+
+static int     syncP, resync, rem = 17, divv = 299739, divva, ratioP, ratioM, adjStep, adj1, dir;
+static int     numDacqCycles;
+static int64_t legacyDelta;
+static uint32_t ppsFiltr[8], syncAvg, syncCnt;
+static int     syncFltIdx;
+
+static uint32_t _legacyNextArr(uint32_t arr)
+{
+    if (!syncP) {
+        return arr;
+    }
+    if (resync) {
+        resync  = 0;
+        ratioP  = rem;
+        ratioM  = 200 - ratioP;
+        dir     = 1;
+        divva   = divv;
+        adj1    = adjStep;
+        adjStep = 0;
+    }
+    if (ratioP && dir) {
+        arr = divva + adj1;
+        if (ratioM) {
+            dir ^= 1;
+        }
+        ratioP -= 1;
+    }
+    if (!dir && ratioM) {
+        if (ratioP) {
+            dir ^= 1;
+        }
+        ratioM -= 1;
+        arr = divva - 1;
+    }
+    return arr;
+}
+
+static void _legacyPhase(void)
+{
+    static int lock1, lock2, lock3;
+    int64_t    delta = legacyDelta;
+
+    if (!lock1) {
+        if (delta < 10000) {
+            adjStep = 50;
+        } else {
+            lock1   = 1;
+            adjStep = -20;
+        }
+    } else if (!lock2) {
+        if (delta > 6000) {
+            adjStep = -20;
+        } else {
+            lock2   = 1;
+            adjStep = -10;
+        }
+    } else if (!lock3) {
+        if (delta > 3000) {
+            adjStep = -5;
+        } else {
+            lock3   = 1;
+            adjStep = 0;
+        }
+    } else {
+        if (delta > 2400) {
+            rem -= 3;
+        } else {
+            rem += 3;
+        }
+    }
+}
+
+static void _legacyPps(uint32_t period)
+{
+    uint32_t syncPeriod;
+
+    syncAvg             -= ppsFiltr[syncFltIdx];
+    ppsFiltr[syncFltIdx] = period;
+    syncFltIdx           = (syncFltIdx + 1) & 7;
+    syncAvg             += period;
+    if (syncCnt < 8) {
+        syncCnt++;
+        syncPeriod = period;
+    } else {
+        syncPeriod = syncAvg >> 3;
+    }
+    divv   = syncPeriod / 200;
+    rem    = syncPeriod % 200;
+    syncP  = 1;
+    resync = 1;
+}
+
+
+/* ---------------------------------------------------------------------------
+ * simulation
+ * ------------------------------------------------------------------------- */
+
+typedef struct {
+    int    n;
+    double sum, sumSq, max;
+} stat_t;
+
+static void _add(stat_t *s, double v)
+{
+    s->n++;
+    s->sum   += v;
+    s->sumSq += v * v;
+    if (fabs(v) > s->max) {
+        s->max = fabs(v);
+    }
+}
+
+static const char *stateName[] = { "unlocked", "acquiring", "locked", "holdover" };
+
+int main(int argc, char **argv)
+{
+    double   *phaseNs;
+    double   nextPpsTrue = 1.0, ppsCapture, periodNs = 1e9 / SAMPLES;
+    int64_t  tickEvent = 0, lastCapture = 0;
+    uint32_t arr = 300000 - 1, nextArr = arr, ppsPeriod = 0;
+    int      ppsPending = 0, k = 0, converged = -1, i;
+    stat_t   steady = { 0 };
+    clock_discipline_status_t st;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-L")) {
+            opt.legacy = 1;
+        } else if (!strcmp(argv[i], "-v")) {
+            opt.verbose = 1;
+        } else if (i + 1 < argc && argv[i][0] == '-') {
+            switch (argv[i][1]) {
+            case 't': opt.seconds      = atoi(argv[++i]); break;
+            case 'p': opt.ppm          = atof(argv[++i]); break;
+            case 'd': opt.driftPpmPerS = atof(argv[++i]); break;
+            case 'j': opt.jitterNs     = atof(argv[++i]); break;
+            case 'l': opt.latencyUs    = atof(argv[++i]); break;
+            case 's': opt.seed         = (unsigned)atoi(argv[++i]); break;
+            case 'g':
+                if (sscanf(argv[++i], "%d,%d", &opt.gapStart, &opt.gapLen) != 2) {
+                    fprintf(stderr, "-g start,seconds\n");
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "unknown option %s\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "usage: %s [-t s] [-p ppm] [-d ppm/s] [-j ns] [-l us] [-g start,len] "
+                    "[-s seed] [-L] [-v]\n", argv[0]);
+            return 1;
+        }
+    }
+    rngState = 0x9E3779B97F4A7C15ull ^ opt.seed;
+    phaseNs  = calloc(opt.seconds + 2, sizeof(double));
+
+    ClockDisciplineInit((uint32_t)NOMINAL_HZ, SAMPLES);
+    ppsCapture = floor(_ticksAt(nextPpsTrue + 1e-9 * opt.jitterNs * _gauss()));
+
+    // dacq ticks; a PPS captured before the TIM2 interrupt is entered is seen by it
+    while (k < opt.seconds) {
+        int64_t entry = tickEvent + (int64_t)(_uniform() * opt.latencyUs * 60);
+
+        while (ppsCapture <= entry && k < opt.seconds) {
+            int    lost = nextPpsTrue >= opt.gapStart && nextPpsTrue < opt.gapStart + opt.gapLen;
+            double edge = _ticksAt(nextPpsTrue), ev = (double)tickEvent, t;
+
+            // truth: phase of the first dacq tick after the true edge
+            while (ev < edge) {
+                ev += (double)arr + 1;
+            }
+            t = (_timeAt(ev) - nextPpsTrue) * 1e9 - CLOCK_PHASE_TARGET * 1e9 / NOMINAL_HZ;
+            phaseNs[k++] = fmod(t + periodNs * 1.5, periodNs) - periodNs / 2;
+
+            if (!lost) {
+                // TIM5 capture interrupt: period only from two consecutive edges
+                ppsPeriod   = lastCapture ? (uint32_t)((int64_t)ppsCapture - lastCapture) : 0;
+                lastCapture = (int64_t)ppsCapture;
+                if (opt.legacy && ppsPeriod) {
+                    _legacyPps(ppsPeriod);
+                }
+                ppsPending = 1;
+            } else {
+                lastCapture = 0;
+            }
+            nextPpsTrue += 1.0;
+            ppsCapture   = floor(_ticksAt(nextPpsTrue + 1e-9 * opt.jitterNs * _gauss()));
+        }
+
+        // TIM2 interrupt of this dacq tick
+        if (opt.legacy) {
+            if (syncP) {
+                if (ppsPending) {
+                    legacyDelta = entry - lastCapture;
+                    _legacyPhase();
+                    resync        = 1;
+                    numDacqCycles = 0;
+                } else if (++numDacqCycles % 200 == 0) {
+                    numDacqCycles = 0;
+                    resync        = 1;
+                }
+                nextArr = _legacyNextArr(nextArr);
+            }
+        } else {
+            if (ppsPending) {
+                ClockDisciplinePps((int32_t)(tickEvent - lastCapture), ppsPeriod);
+            }
+            nextArr = ClockDisciplineNextPeriod() - 1;
+        }
+        ppsPending = 0;
+
+        // preloaded ARR: the value written now times the period after this one
+        tickEvent += (int64_t)arr + 1;
+        arr        = nextArr;
+    }
+
+    for (i = 0; i < opt.seconds; i++) {
+        if (opt.verbose) {
+            printf("%5d %10.1f ns\n", i + 1, phaseNs[i]);
+        }
+        if (fabs(phaseNs[i]) >= CONVERGED_NS) {
+            converged = -1;
+        } else if (converged < 0) {
+            converged = i + 1;
+        }
+        if (i >= opt.seconds / 2) {
+            _add(&steady, phaseNs[i]);
+        }
+    }
+
+    printf("%s: %d s, oscillator %+.1f ppm %+.3f ppm/s, pps jitter %.0f ns, isr latency %.1f us",
+           opt.legacy ? "legacy ladder" : "clock discipline", opt.seconds, opt.ppm,
+           opt.driftPpmPerS, opt.jitterNs, opt.latencyUs);
+    if (opt.gapLen) {
+        printf(", pps lost %d..%d s", opt.gapStart, opt.gapStart + opt.gapLen);
+    }
+    printf("\n");
+    if (converged > 0) {
+        printf("  converged within 1 us after %d s\n", converged);
+    } else {
+        printf("  not converged within 1 us\n");
+    }
+    printf("  steady state phase: mean %.1f ns, rms %.1f ns, max %.1f ns\n",
+           steady.sum / steady.n, sqrt(steady.sumSq / steady.n), steady.max);
+    if (!opt.legacy) {
+        ClockDisciplineGetStatus(&st);
+        printf("  loop: %s, phase error %d ticks, rms %u ticks, %u ticks/s, %u pps, %u locks\n",
+               stateName[st.state], st.phaseErr, st.phaseRms, st.ticksPerSecond, st.ppsCount,
+               st.lockCount);
+    }
+    free(phaseNs);
+    return 0;
+}
@@ -0,0 +1,203 @@
+/** ***************************************************************************
+ * @file   sample_history_check.c
+ * @brief  host tool: checks the time lookups of the sample history ring,
+ *         SampleHistoryFind() and SampleHistoryAt() of
+ *         Platform/Core/src/sample_history.c.
+ *
+ * Build (Linux / macOS), from this directory:
+ *     cc -O2 -I../j1939_vbus/host -I../../Platform/Core/include \
+ *        -o sample_history_check sample_history_check.c \
+ *        ../../Platform/Core/src/sample_history.c
+ *
+ * Usage:
+ *     sample_history_check
+ *
+ * Samples are pushed at DACQ_TICK_US. Every channel is linear in the data
+ * ready time of its group, so an interpolated sample is known exactly, up to
+ * the resolution of the 0.15 weights. In order, the checks cover:
+ * - an empty ring;
+ * - times exactly on a sample, between two samples, and before or after the
+ *   ring;
+ * - a gap of more than 65 ms (missed ticks) between two samples;
+ * - the ring wrapped, with the oldest slot the writer fills next left out;
+ * - groups whose data ready times are off the tick.
+ * Add -DSAMPLE_HISTORY_DEPTH=16 to the build for a short ring.
+ * Exit status is the number of failed checks.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "sample_history.h"
+
+#define T0          1000000ull      // usec, time of sample 1
+#define GAP_US      70000           // above the 65 ms SampleHistoryAt accepts
+// q27 lsb: a 0.15 weight is off by up to 2^-15 of the step between two
+// samples, plus rounding
+#define TOLERANCE(ch)   ((ch + 1) * DACQ_TICK_US / 32768 + 2)
+
+static uint64_t  pushed[4 * SAMPLE_HISTORY_DEPTH + 64];  // tstamp by seq
+static int32_t   groupDt[SENSOR_GROUPS];                 // data ready - tstamp of the next push
+static uint32_t  seq;
+static int       failures;
+
+// channel ch read at t: linear in time, steeper for each channel
+static int32_t _value(int ch, uint64_t t)
+{
+    return (int32_t)((ch + 1) * (int64_t)(t - T0));
+}
+
+static void _push(uint64_t tstamp)
+{
+    sensors_data_t data;
+    uint64_t       t;
+    int            g, i;
+
+    memset(&data, 0, sizeof(data));
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        t = tstamp + groupDt[g];
+        data.sensorTstamp[g] = groupDt[g] ? t : 0;
+        for (i = 0; i < SENSOR_GROUP_AXES; i++) {
+            data.scaledSensors_q27[XACCEL + g * SENSOR_GROUP_AXES + i] =
+                _value(g * SENSOR_GROUP_AXES + i, t);
+        }
+    }
+    SampleHistoryPush(&data, tstamp);
+    pushed[++seq] = tstamp;
+}
+
+static void _pushTicks(int n)
+{
+    while (n-- > 0) {
+        _push(pushed[seq] + DACQ_TICK_US);
+    }
+}
+
+static void _check(int ok, const char *what, uint64_t t)
+{
+    if (!ok) {
+        printf("  FAILED: %s at T0%+lld us\n", what, (long long)(t - T0));
+        failures++;
+    }
+}
+
+static void _find(uint64_t t, uint32_t expected, const char *what)
+{
+    uint32_t found = SampleHistoryFind(t);
+
+    if (found != expected) {
+        printf("  FAILED: %s, find at T0%+lld us gave %u, not %u\n",
+               what, (long long)(t - T0), found, expected);
+        failures++;
+    }
+}
+
+// SampleHistoryAt(t) must succeed and give every channel as read at t
+static void _at(uint64_t t, const char *what)
+{
+    sample_history_entry_t e;
+    int32_t  err;
+    int      ch, g, ok;
+
+    if (!SampleHistoryAt(t, &e)) {
+        _check(0, what, t);
+        return;
+    }
+    ok = e.tstamp == t && e.seq == SampleHistoryFind(t);
+    for (g = 0; g < SENSOR_GROUPS; g++) {
+        ok = ok && e.groupDtUs[g] == 0;
+    }
+    for (ch = 0; ch < NUM_SENSOR_IN_AXIS; ch++) {
+        err = e.q27[ch] - _value(ch, t);
+        ok  = ok && err <= TOLERANCE(ch) && err >= -TOLERANCE(ch);
+    }
+    _check(ok, what, t);
+}
+
+static void _notAt(uint64_t t, const char *what)
+{
+    sample_history_entry_t e;
+
+    _check(!SampleHistoryAt(t, &e), what, t);
+}
+
+int main(void)
+{
+    uint32_t k, gapSeq, oldest;
+
+    printf("sample history %d deep, tick %d us\n", SAMPLE_HISTORY_DEPTH, DACQ_TICK_US);
+
+    // empty
+    _find(T0, 0, "empty ring");
+    _notAt(T0, "empty ring");
+
+    // a few aligned samples, no wrap yet
+    pushed[0] = T0 - DACQ_TICK_US;
+    _pushTicks(8);
+    for (k = 1; k <= seq; k++) {
+        _find(pushed[k], k, "exact");
+        _at(pushed[k], "exact");
+    }
+    for (k = 1; k < seq; k++) {
+        _find(pushed[k] + DACQ_TICK_US / 2, k, "between");
+        _find(pushed[k + 1] - 1, k, "just before the next");
+        _at(pushed[k] + DACQ_TICK_US / 3, "between");
+    }
+    _find(pushed[1] - 1, 0, "before the ring");
+    _notAt(pushed[1] - 1, "before the ring");
+    _find(pushed[seq] + 1, seq, "after the latest");
+    _notAt(pushed[seq] + 1, "after the latest");
+
+    // missed ticks: nothing to interpolate across the gap
+    gapSeq = seq;
+    _push(pushed[seq] + GAP_US);
+    _pushTicks(2);
+    _find(pushed[gapSeq] + GAP_US / 2, gapSeq, "inside the gap");
+    _notAt(pushed[gapSeq] + GAP_US / 2, "inside the gap");
+    _at(pushed[gapSeq], "on the sample before the gap");
+    _at(pushed[gapSeq + 1], "on the sample after the gap");
+    _at(pushed[gapSeq + 1] + DACQ_TICK_US / 2, "after the gap");
+
+    // wrap the ring twice
+    _pushTicks(2 * SAMPLE_HISTORY_DEPTH);
+    oldest = SampleHistoryOldestSeq();
+    _check(oldest == seq - SAMPLE_HISTORY_DEPTH + 2, "oldest after wrap", pushed[oldest]);
+    _find(pushed[oldest], oldest, "oldest after wrap");
+    _find(pushed[oldest] - 1, 0, "overwritten");
+    _notAt(pushed[oldest] - 1, "overwritten");
+    _notAt(pushed[oldest - 1] + DACQ_TICK_US / 2, "overwritten");
+    for (k = oldest; k < seq; k++) {
+        _find(pushed[k] + 1, k, "between after wrap");
+        _at(pushed[k] + DACQ_TICK_US / 4, "between after wrap");
+    }
+    _at(pushed[seq], "latest after wrap");
+
+    // rates read early, mags late: each group interpolated along its own times
+    groupDt[SENSOR_GROUP_RATE] = -1200;
+    groupDt[SENSOR_GROUP_MAG]  = 800;
+    _pushTicks(SAMPLE_HISTORY_DEPTH);
+    for (k = seq - SAMPLE_HISTORY_DEPTH + 2; k < seq; k++) {
+        _at(pushed[k], "exact, groups off the tick");
+        _at(pushed[k] + DACQ_TICK_US / 2, "between, groups off the tick");
+    }
+
+    printf("%u samples pushed, %d failed\n", seq, failures);
+    return failures;
+}
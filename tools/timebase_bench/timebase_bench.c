@@ -0,0 +1,208 @@
+/** ***************************************************************************
+ * @file   timebase_bench.c
+ * @brief  host tool: checks and times the TIM5 conversions of
+ *         Platform/Core/include/timebase.h against the division and double
+ *         code they replace in DataAcquisitionSupport.c.
+ *
+ * Build (Linux / macOS), from this directory:
+ *     cc -O2 -I../../Platform/Core/include -o timebase_bench timebase_bench.c -lm
+ *
+ * Usage:
+ *     timebase_bench [-n conversions] [-x]
+ *
+ * -x checks timebaseDiv60() for every 32-bit value (a few seconds).
+ *
+ * A 64-bit host divides by a constant with a multiply, so "ticks / 60" is
+ * timed twice: as the host compiles it, and through a shift-subtract 64-bit
+ * division like the library routine the Cortex-M4 calls (__aeabi_uldivmod).
+ * The double path runs on the host FPU; the M4 FPU is single precision and
+ * does it in software, so the host understates that gap too.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "timebase.h"
+
+static uint64_t rngState = 0x9E3779B97F4A7C15ull;
+
+static uint64_t _rand64(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static double _nowNs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// restoring division, one bit per step from the top set bit of n
+static __attribute__((noinline)) uint64_t _softDiv64(uint64_t n, uint64_t d)
+{
+    uint64_t q = 0, r = 0;
+    int      i;
+
+    for (i = n ? 63 - __builtin_clzll(n) : -1; i >= 0; i--) {
+        r = (r << 1) | ((n >> i) & 1);
+        if (r >= d) {
+            r -= d;
+            q |= 1ull << i;
+        }
+    }
+    return q;
+}
+
+static int _checkTicksToUs(int exhaustive)
+{
+    uint64_t ticks;
+    uint32_t n = 0;
+    int      i, bad = 0;
+
+    if (exhaustive) {
+        do {
+            if (timebaseDiv60(n) != n / 60) {
+                printf("  div60(%u) = %u, expected %u\n", n, timebaseDiv60(n), n / 60);
+                bad++;
+            }
+        } while (++n && bad < 10);
+        printf("  div60: all 2^32 inputs checked\n");
+    }
+
+    for (i = 0; i < 10000000 && bad < 10; i++) {
+        ticks = _rand64() >> (i & 1 ? 37 : 20 + (i & 15));    // high word below 2^27
+        if (timebaseTicksToUs(ticks) != ticks / 60) {
+            printf("  ticksToUs(%llu) = %llu, expected %llu\n", (unsigned long long)ticks,
+                   (unsigned long long)timebaseTicksToUs(ticks), (unsigned long long)(ticks / 60));
+            bad++;
+        }
+    }
+    ticks = ((uint64_t)1 << 59) - 1;
+    if (timebaseTicksToUs(ticks) != ticks / 60) {
+        bad++;
+    }
+    printf("  ticksToUs: 10M random tick counts up to 2^59 %s\n", bad ? "FAILED" : "match ticks / 60");
+    return bad;
+}
+
+static void _checkPpsScale(void)
+{
+    double   maxErr = 0, err, exact;
+    uint32_t tps, ticks, recip;
+    int      i;
+
+    for (i = 0; i < 1000000; i++) {
+        tps   = 59900000 + (uint32_t)(_rand64() % 200000);
+        ticks = (uint32_t)(_rand64() % (tps + tps / 10));         // up to 1.1 s after the PPS
+        recip = timebaseUsPerTickQ32(tps);
+        exact = (double)ticks / ((double)tps / 1000000);
+        err   = fabs((double)timebaseScaleQ32(ticks, recip) / 4294967296.0 - exact);
+        if (err > maxErr) {
+            maxErr = err;
+        }
+    }
+    printf("  pps scale: max error %.4f us over 1.1 s, 1M random rates and offsets\n", maxErr);
+}
+
+static void _time(int n)
+{
+    uint64_t *ticks = malloc(n * sizeof(uint64_t));
+    uint64_t sum = 0;
+    double   dsum = 0, t0, tHost, tSoft, tNew, tDouble, tQ32;
+    uint32_t tps = 59947833, recip = timebaseUsPerTickQ32(tps);
+    int      i;
+
+    for (i = 0; i < n; i++) {
+        ticks[i] = _rand64() >> 24;
+    }
+
+    t0 = _nowNs();
+    for (i = 0; i < n; i++) {
+        sum += ticks[i] / 60;
+    }
+    tHost = (_nowNs() - t0) / n;
+
+    t0 = _nowNs();
+    for (i = 0; i < n; i++) {
+        sum += _softDiv64(ticks[i], 60);
+    }
+    tSoft = (_nowNs() - t0) / n;
+
+    t0 = _nowNs();
+    for (i = 0; i < n; i++) {
+        sum += timebaseTicksToUs(ticks[i]);
+    }
+    tNew = (_nowNs() - t0) / n;
+
+    // platformGetSolutionTstampAsDouble() before and after
+    t0 = _nowNs();
+    for (i = 0; i < n; i++) {
+        double numTicksPerUs = (double)tps / 1000000;
+        dsum += (double)(int64_t)(ticks[i] & 0x3FFFFFF) / numTicksPerUs;
+    }
+    tDouble = (_nowNs() - t0) / n;
+
+    t0 = _nowNs();
+    for (i = 0; i < n; i++) {
+        sum += timebaseScaleQ32((uint32_t)(ticks[i] & 0x3FFFFFF), recip);
+    }
+    tQ32 = (_nowNs() - t0) / n;
+
+    printf("  ticks / 60, host        %6.2f ns\n", tHost);
+    printf("  ticks / 60, soft divide %6.2f ns\n", tSoft);
+    printf("  timebaseTicksToUs       %6.2f ns\n", tNew);
+    printf("  pps offset, double      %6.2f ns\n", tDouble);
+    printf("  pps offset, 32.32       %6.2f ns\n", tQ32);
+    printf("  (checksum %llx %g)\n", (unsigned long long)sum, dsum);
+    free(ticks);
+}
+
+int main(int argc, char **argv)
+{
+    int n = 10000000, exhaustive = 0, i;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-x")) {
+            exhaustive = 1;
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            n = atoi(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [-n conversions] [-x]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    printf("correctness\n");
+    if (_checkTicksToUs(exhaustive)) {
+        return 1;
+    }
+    _checkPpsScale();
+
+    printf("time per conversion, %d conversions\n", n);
+    _time(n);
+    return 0;
+}
@@ -0,0 +1,386 @@
+/** ***************************************************************************
+ * @file   ucb_config_bench.c
+ * @brief  host tool: provisioning benchmark, field-by-field configuration
+ *         access (RF / WF) against the bulk "BR" / "BW" commands.
+ *
+ * Build (Linux / macOS):
+ *     cc -O2 -o ucb_config_bench ucb_config_bench.c
+ *
+ * Usage:
+ *     ucb_config_bench <serial device> [-b baud] [-n repeats] [-w]
+ *
+ * Reads the EEPROM configuration with one RF per field, with RF packed with
+ * as many fields as fit, and with BR. With -w the image just read is written
+ * back unchanged with WF and with BW (EEPROM must be unlocked); the unit ends
+ * up with the configuration it started with.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#define LOWER_FIELD         0x0001      // LOWER_CONFIG_ADDR_BOUND
+#define UPPER_FIELD         0x0040      // UPPER_CONFIG_ADDR_BOUND
+#define MAX_PAYLOAD         255
+#define BLOCK_HEADER        8           // UCB_CONFIG_BLOCK_HEADER_LENGTH
+#define BLOCK_MAX_WORDS     ((MAX_PAYLOAD - BLOCK_HEADER - 2) / 2)
+#define BLOCK_RAM           0x01
+#define BLOCK_EEPROM        0x02
+#define BLOCK_BEGIN         0x40
+#define BLOCK_COMMIT        0x80
+#define REPLY_TIMEOUT_MS    1000
+
+static int      fd;
+static unsigned roundTrips;
+
+
+static uint16_t _crc16(const uint8_t *buf, int length)
+{
+    uint16_t crc = 0x1D0F;
+    int      i, j;
+
+    for (i = 0; i < length; i++) {
+        crc ^= (uint16_t)(buf[i] << 8);
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static double _nowMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void _send(const char *code, const uint8_t *payload, int length)
+{
+    uint8_t  frame[2 + 2 + 1 + MAX_PAYLOAD + 2];
+    uint16_t crc;
+
+    frame[0] = frame[1] = 0x55;
+    frame[2] = (uint8_t)code[0];
+    frame[3] = (uint8_t)code[1];
+    frame[4] = (uint8_t)length;
+    memcpy(&frame[5], payload, length);
+    crc = _crc16(&frame[2], length + 3);
+    frame[5 + length] = (uint8_t)(crc >> 8);
+    frame[6 + length] = (uint8_t)crc;
+    if (write(fd, frame, length + 7) != length + 7) {
+        perror("write");
+        exit(1);
+    }
+}
+
+/** ***************************************************************************
+ * @name _receive
+ * @brief wait for the reply with the given code, skipping continuous packets
+ * @retval payload length, -1 on NAK or timeout
+ ******************************************************************************/
+static int _receive(const char *code, uint8_t *payload)
+{
+    uint8_t frame[2 + 2 + 1 + MAX_PAYLOAD + 2];
+    int     index = 0, length = 0;
+    double  deadline = _nowMs() + REPLY_TIMEOUT_MS;
+
+    while (_nowMs() < deadline) {
+        struct timeval tv = {0, 10000};
+        fd_set         set;
+        uint8_t        byte;
+
+        FD_ZERO(&set);
+        FD_SET(fd, &set);
+        if (select(fd + 1, &set, NULL, NULL, &tv) <= 0 || read(fd, &byte, 1) != 1) {
+            continue;
+        }
+
+        if (index < 2) {
+            index = (byte == 0x55) ? index + 1 : 0;
+            continue;
+        }
+        if (index == 2 && byte == 0x55) {
+            continue;
+        }
+        frame[index++] = byte;
+        if (index < 5) {
+            continue;
+        }
+        length = frame[4];
+        if (index < 5 + length + 2) {
+            continue;
+        }
+        index = 0;
+
+        uint16_t crc = _crc16(&frame[2], length + 3);
+        if (frame[5 + length] != (uint8_t)(crc >> 8) || frame[6 + length] != (uint8_t)crc) {
+            continue;
+        }
+        if ((frame[2] == 0x15 && frame[3] == 0x15) || (frame[2] == 0 && frame[3] == 0)) {
+            return -1;                  // NAK
+        }
+        if (frame[2] == (uint8_t)code[0] && frame[3] == (uint8_t)code[1]) {
+            memcpy(payload, &frame[5], length);
+            return length;
+        }
+    }
+    return -1;
+}
+
+static int _transact(const char *code, uint8_t *payload, int length)
+{
+    roundTrips++;
+    _send(code, payload, length);
+    return _receive(code, payload);
+}
+
+
+/// RF with up to maxPerPacket fields per request
+static int _readFields(uint16_t *image, int maxPerPacket)
+{
+    uint8_t  payload[MAX_PAYLOAD];
+    uint16_t id = LOWER_FIELD;
+    int      n, i, len;
+
+    while (id <= UPPER_FIELD) {
+        n = UPPER_FIELD - id + 1;
+        if (n > maxPerPacket) {
+            n = maxPerPacket;
+        }
+        payload[0] = (uint8_t)n;
+        for (i = 0; i < n; i++) {
+            payload[1 + 2 * i] = (uint8_t)((id + i) >> 8);
+            payload[2 + 2 * i] = (uint8_t)(id + i);
+        }
+        len = _transact("RF", payload, 1 + 2 * n);
+        if (len < 1) {
+            return -1;
+        }
+        for (i = 0; i < payload[0] && 4 * i + 4 < len; i++) {
+            uint16_t f = (uint16_t)((payload[1 + 4 * i] << 8) | payload[2 + 4 * i]);
+            if (f <= UPPER_FIELD) {
+                image[f] = (uint16_t)((payload[3 + 4 * i] << 8) | payload[4 + 4 * i]);
+            }
+        }
+        id += n;
+    }
+    return 0;
+}
+
+/// BR of the whole image, returns the image size in words
+static int _readBlock(uint16_t *image, int maxWords, uint16_t *tag)
+{
+    uint8_t  payload[MAX_PAYLOAD];
+    uint16_t start = 0, words = 1, count, i;
+    int      len;
+
+    while (start < words) {
+        payload[0] = BLOCK_EEPROM;
+        payload[1] = (uint8_t)(start >> 8);
+        payload[2] = (uint8_t)start;
+        payload[3] = 0;
+        len = _transact("BR", payload, 4);
+        if (len < BLOCK_HEADER + 2) {
+            return -1;
+        }
+        *tag  = (uint16_t)((payload[1] << 8) | payload[2]);
+        words = (uint16_t)((payload[3] << 8) | payload[4]);
+        count = payload[7];
+        if (len != BLOCK_HEADER + 2 * count + 2 || words > maxWords ||
+            _crc16(&payload[BLOCK_HEADER], 2 * count) !=
+            (uint16_t)((payload[len - 2] << 8) | payload[len - 1])) {
+            return -1;
+        }
+        for (i = 0; i < count; i++) {
+            image[start + i] = (uint16_t)((payload[BLOCK_HEADER + 2 * i] << 8) |
+                                          payload[BLOCK_HEADER + 2 * i + 1]);
+        }
+        start += count;
+    }
+    return words;
+}
+
+/// WF with up to maxPerPacket fields per request
+static int _writeFields(const uint16_t *image, int maxPerPacket)
+{
+    uint8_t  payload[MAX_PAYLOAD];
+    uint16_t id = LOWER_FIELD;
+    int      n, i;
+
+    while (id <= UPPER_FIELD) {
+        n = UPPER_FIELD - id + 1;
+        if (n > maxPerPacket) {
+            n = maxPerPacket;
+        }
+        payload[0] = (uint8_t)n;
+        for (i = 0; i < n; i++) {
+            payload[1 + 4 * i] = (uint8_t)((id + i) >> 8);
+            payload[2 + 4 * i] = (uint8_t)(id + i);
+            payload[3 + 4 * i] = (uint8_t)(image[id + i] >> 8);
+            payload[4 + 4 * i] = (uint8_t)image[id + i];
+        }
+        _transact("WF", payload, 1 + 4 * n);   // partial NAKs are expected
+        id += n;
+    }
+    return 0;
+}
+
+/// BW of the field words, staged and committed to EEPROM once
+static int _writeBlock(const uint16_t *image, int words, uint16_t tag)
+{
+    uint8_t  payload[MAX_PAYLOAD];
+    uint16_t start = LOWER_FIELD, count, crc, i;
+    uint16_t end   = (uint16_t)(words < UPPER_FIELD + 1 ? words : UPPER_FIELD + 1);
+
+    while (start < end) {
+        count = (uint16_t)(end - start);
+        if (count > BLOCK_MAX_WORDS) {
+            count = BLOCK_MAX_WORDS;
+        }
+        payload[0] = BLOCK_EEPROM;
+        if (start == LOWER_FIELD) {
+            payload[0] |= BLOCK_BEGIN;
+        }
+        if (start + count == end) {
+            payload[0] |= BLOCK_COMMIT;
+        }
+        payload[1] = (uint8_t)(tag >> 8);
+        payload[2] = (uint8_t)tag;
+        payload[3] = (uint8_t)(words >> 8);
+        payload[4] = (uint8_t)words;
+        payload[5] = (uint8_t)(start >> 8);
+        payload[6] = (uint8_t)start;
+        payload[7] = (uint8_t)count;
+        for (i = 0; i < count; i++) {
+            payload[BLOCK_HEADER + 2 * i]     = (uint8_t)(image[start + i] >> 8);
+            payload[BLOCK_HEADER + 2 * i + 1] = (uint8_t)image[start + i];
+        }
+        crc = _crc16(&payload[BLOCK_HEADER], 2 * count);
+        payload[BLOCK_HEADER + 2 * count]     = (uint8_t)(crc >> 8);
+        payload[BLOCK_HEADER + 2 * count + 1] = (uint8_t)crc;
+        if (_transact("BW", payload, BLOCK_HEADER + 2 * count + 2) != BLOCK_HEADER + 2) {
+            return -1;
+        }
+        start += count;
+    }
+    return 0;
+}
+
+static void _result(const char *name, double ms, unsigned trips, int repeats)
+{
+    printf("%-28s %8.1f ms  %4u round trips\n", name, ms / repeats, trips / repeats);
+}
+
+int main(int argc, char **argv)
+{
+    static uint16_t fieldImage[UPPER_FIELD + 1];
+    static uint16_t blockImage[1024];
+    const char *path    = NULL;
+    long        baud    = 115200;
+    int         repeats = 5;
+    int         doWrite = 0;
+    int         words   = 0;
+    uint16_t    tag     = 0;
+    struct termios tio;
+    double      t0;
+    int         i, r;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            baud = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-w")) {
+            doWrite = 1;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL || repeats < 1) {
+        fprintf(stderr, "usage: %s <device> [-b baud] [-n repeats] [-w]\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0 || tcgetattr(fd, &tio) != 0) {
+        perror(path);
+        return 1;
+    }
+    cfmakeraw(&tio);
+    cfsetispeed(&tio, baud == 57600 ? B57600 : baud == 38400 ? B38400 : baud == 230400 ? B230400 : B115200);
+    cfsetospeed(&tio, cfgetispeed(&tio));
+    tcsetattr(fd, TCSANOW, &tio);
+    tcflush(fd, TCIOFLUSH);
+
+    roundTrips = 0;
+    t0 = _nowMs();
+    for (r = 0; r < repeats; r++) {
+        if (_readFields(fieldImage, 1) < 0) {
+            fprintf(stderr, "RF failed\n");
+            return 1;
+        }
+    }
+    _result("RF, 1 field per packet", _nowMs() - t0, roundTrips, repeats);
+
+    roundTrips = 0;
+    t0 = _nowMs();
+    for (r = 0; r < repeats; r++) {
+        _readFields(fieldImage, (MAX_PAYLOAD - 1) / 4);
+    }
+    _result("RF, packed", _nowMs() - t0, roundTrips, repeats);
+
+    roundTrips = 0;
+    t0 = _nowMs();
+    for (r = 0; r < repeats; r++) {
+        words = _readBlock(blockImage, 1024, &tag);
+        if (words < 0) {
+            fprintf(stderr, "BR failed (firmware without bulk configuration?)\n");
+            return 1;
+        }
+    }
+    _result("BR, whole image", _nowMs() - t0, roundTrips, repeats);
+    printf("image %d words, tag 0x%04x, fields %s\n", words, tag,
+           memcmp(&fieldImage[LOWER_FIELD], &blockImage[LOWER_FIELD],
+                  (UPPER_FIELD < words ? UPPER_FIELD : words - 1) * 2) ? "DIFFER" : "match");
+
+    if (doWrite) {
+        roundTrips = 0;
+        t0 = _nowMs();
+        _writeFields(fieldImage, 1);
+        _result("WF, 1 field per packet", _nowMs() - t0, roundTrips, 1);
+
+        roundTrips = 0;
+        t0 = _nowMs();
+        if (_writeBlock(blockImage, words, tag) < 0) {
+            fprintf(stderr, "BW failed (EEPROM locked?)\n");
+            return 1;
+        }
+        _result("BW, fields, 1 commit", _nowMs() - t0, roundTrips, 1);
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,359 @@
+/** ***************************************************************************
+ * @file   ucb_stream_stats.c
+ * @brief  host tool: loss, latency and jitter statistics for continuous UCB
+ *         packets sent with the stream trailer enabled
+ *         (configuration field 0x000D set to 1, see serial_port.h).
+ *
+ * Build (Linux / macOS):
+ *     cc -O2 -o ucb_stream_stats ucb_stream_stats.c -lm
+ *
+ * Usage:
+ *     ucb_stream_stats <capture file | serial device> [-b baud] [-s seconds]
+ *                      [-r dacq rate Hz]
+ *
+ * A capture file (raw bytes) gives loss and on-unit tick statistics. A serial
+ * device is read live and every packet is time stamped on arrival, which adds
+ * latency and jitter. Latency is relative: the smallest observed
+ * arrival - tick * period is taken as zero, so it shows queueing on top of the
+ * fixed transport delay.
+ ******************************************************************************/
+
+/*******************************************************************************
+Copyright 2018 ACEINNA, INC
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#define TRAILER_LENGTH  6       // UCB_STREAM_TRAILER_LENGTH
+#define MAX_STREAMS     16
+
+typedef struct {
+    uint16_t code;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t lost;              // sequence gaps
+    uint64_t duplicates;
+    uint64_t tickSkips;         // dacq ticks missing between packets
+    uint16_t lastSeq;
+    uint32_t lastTick;
+    uint32_t tickStep;          // expected ticks per packet (smallest seen)
+    double   lastArrival;       // usec, live only
+    double   minOffset;
+    double   sumOffset;
+    double   maxOffset;
+    double   sumJitter;
+    double   sumJitter2;
+    double   maxJitter;
+    uint64_t jitterCount;
+} stream_stats_t;
+
+static stream_stats_t streams[MAX_STREAMS];
+static int            numStreams;
+static uint64_t       crcErrors;
+static uint64_t       totalBytes;
+static double         tickPeriodUs = 5000.0;     // 200 Hz
+
+
+static uint16_t _crc16(const uint8_t *buf, int length)
+{
+    uint16_t crc = 0x1D0F;
+    int      i, j;
+
+    for (i = 0; i < length; i++) {
+        crc ^= (uint16_t)(buf[i] << 8);
+        for (j = 0; j < 8; j++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static double _nowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static stream_stats_t *_stream(uint16_t code)
+{
+    int i;
+
+    for (i = 0; i < numStreams; i++) {
+        if (streams[i].code == code) {
+            return &streams[i];
+        }
+    }
+    if (numStreams == MAX_STREAMS) {
+        return NULL;
+    }
+    memset(&streams[numStreams], 0, sizeof(stream_stats_t));
+    streams[numStreams].code      = code;
+    streams[numStreams].minOffset = INFINITY;
+    return &streams[numStreams++];
+}
+
+
+/** ***************************************************************************
+ * @name _account
+ * @brief update the statistics of one stream with a CRC-checked packet
+ * @param [in] code, payload, length - packet
+ * @param [in] arrival - host receive time [usec], < 0 when not live
+ ******************************************************************************/
+static void _account(uint16_t code, const uint8_t *payload, int length, double arrival)
+{
+    stream_stats_t *s = _stream(code);
+    const uint8_t  *t;
+    uint16_t seq;
+    uint32_t tick;
+    double   offset;
+
+    if (s == NULL || length < TRAILER_LENGTH) {
+        return;
+    }
+
+    t    = payload + length - TRAILER_LENGTH;
+    seq  = (uint16_t)((t[0] << 8) | t[1]);
+    tick = ((uint32_t)t[2] << 24) | ((uint32_t)t[3] << 16) | ((uint32_t)t[4] << 8) | t[5];
+
+    s->bytes += length + 7;
+
+    if (s->packets) {
+        uint16_t seqStep  = (uint16_t)(seq - s->lastSeq);
+        uint32_t tickStep = tick - s->lastTick;
+
+        if (seqStep == 0) {
+            s->duplicates++;
+            return;
+        }
+        if (seq == 0 && s->lastSeq > 1) {
+            // unit restarted the stream (packet type or rate changed)
+            seqStep  = 1;
+        }
+        s->lost += seqStep - 1;
+
+        if (tickStep && (s->tickStep == 0 || tickStep < s->tickStep)) {
+            s->tickStep = tickStep;
+        }
+        if (s->tickStep && tickStep > s->tickStep * seqStep) {
+            s->tickSkips += tickStep - s->tickStep * seqStep;
+        }
+
+        if (arrival >= 0 && seqStep == 1) {
+            double jitter = fabs((arrival - s->lastArrival) - tickStep * tickPeriodUs);
+            s->sumJitter  += jitter;
+            s->sumJitter2 += jitter * jitter;
+            if (jitter > s->maxJitter) {
+                s->maxJitter = jitter;
+            }
+            s->jitterCount++;
+        }
+    }
+
+    if (arrival >= 0) {
+        offset = arrival - tick * tickPeriodUs;
+        if (offset < s->minOffset) {
+            s->minOffset = offset;
+        }
+        s->sumOffset += offset;
+        if (s->packets == 0 || offset > s->maxOffset) {
+            s->maxOffset = offset;
+        }
+        s->lastArrival = arrival;
+    }
+
+    s->packets++;
+    s->lastSeq  = seq;
+    s->lastTick = tick;
+}
+
+
+/** ***************************************************************************
+ * @name _parse
+ * @brief byte-wise UCB framer: 0x5555, code, length, payload, CRC. A frame
+ *        that fails its CRC was found on a false sync (a longer preamble, or
+ *        0x5555 inside a payload): its bytes after the first are framed again,
+ *        so "UP" (0x5550) and other codes starting with 'U' are not lost
+ ******************************************************************************/
+static void _parse(uint8_t byte, double arrival)
+{
+    static uint8_t frame[2 + 2 + 1 + 255 + 2];
+    static int     index = 0;
+    uint8_t        queue[2 * sizeof(frame)];   // replayed frame + rest of a replay
+    int            head = 0, tail = 0;
+    uint16_t       crc;
+    int            length;
+
+    totalBytes++;
+    queue[tail++] = byte;
+
+    while (head < tail) {
+        byte = queue[head++];
+
+        if (index < 2) {
+            index = (byte == 0x55) ? index + 1 : 0;
+            frame[0] = frame[1] = 0x55;
+            continue;
+        }
+
+        frame[index++] = byte;
+        if (index < 5) {
+            continue;
+        }
+        length = frame[4];
+        if (index < 5 + length + 2) {
+            continue;
+        }
+
+        crc = _crc16(&frame[2], length + 3);
+        if (frame[5 + length] == (uint8_t)(crc >> 8) && frame[6 + length] == (uint8_t)crc) {
+            _account((uint16_t)((frame[2] << 8) | frame[3]), &frame[5], length, arrival);
+        } else {
+            crcErrors++;
+            memmove(&queue[index - 1], &queue[head], (size_t)(tail - head));
+            memcpy(queue, &frame[1], (size_t)(index - 1));
+            tail = index - 1 + tail - head;
+            head = 0;
+        }
+        index = 0;
+    }
+}
+
+static speed_t _speed(long baud)
+{
+    switch (baud) {
+        case 9600:    return B9600;
+        case 19200:   return B19200;
+        case 38400:   return B38400;
+        case 57600:   return B57600;
+        case 115200:  return B115200;
+        case 230400:  return B230400;
+#ifdef B460800
+        case 460800:  return B460800;
+#endif
+#ifdef B921600
+        case 921600:  return B921600;
+#endif
+        default:      return B0;
+    }
+}
+
+static void _report(double seconds)
+{
+    int i;
+
+    printf("bytes %llu, CRC errors %llu", (unsigned long long)totalBytes,
+           (unsigned long long)crcErrors);
+    if (seconds > 0) {
+        printf(", %.0f bytes/s", totalBytes / seconds);
+    }
+    printf("\n\n");
+
+    for (i = 0; i < numStreams; i++) {
+        stream_stats_t *s = &streams[i];
+        double expected = (double)s->packets + s->lost;
+
+        printf("%c%c  packets %llu  lost %llu (%.3f%%)  dup %llu  ticks/pkt %u  skipped ticks %llu\n",
+               s->code >> 8, s->code & 0xff,
+               (unsigned long long)s->packets, (unsigned long long)s->lost,
+               expected > 0 ? 100.0 * s->lost / expected : 0.0,
+               (unsigned long long)s->duplicates, s->tickStep,
+               (unsigned long long)s->tickSkips);
+
+        if (s->jitterCount) {
+            double mean = s->sumJitter / s->jitterCount;
+            double var  = s->sumJitter2 / s->jitterCount - mean * mean;
+
+            printf("    latency (relative) mean %.0f us  max %.0f us\n",
+                   s->sumOffset / s->packets - s->minOffset, s->maxOffset - s->minOffset);
+            printf("    jitter mean %.0f us  std %.0f us  max %.0f us\n",
+                   mean, var > 0 ? sqrt(var) : 0.0, s->maxJitter);
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *path    = NULL;
+    long        baud    = 115200;
+    double      seconds = 10.0;
+    double      start, now;
+    uint8_t     buf[512];
+    int         fd, i, n, live;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+            baud = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            tickPeriodUs = 1e6 / atof(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == NULL) {
+        fprintf(stderr, "usage: %s <capture | device> [-b baud] [-s seconds] [-r dacq Hz]\n", argv[0]);
+        return 1;
+    }
+
+    fd = open(path, O_RDONLY | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+
+    live = isatty(fd);
+    if (live) {
+        struct termios tio;
+
+        if (_speed(baud) == B0 || tcgetattr(fd, &tio) != 0) {
+            fprintf(stderr, "%s: can not set %ld baud\n", path, baud);
+            return 1;
+        }
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, _speed(baud));
+        cfsetospeed(&tio, _speed(baud));
+        tio.c_cc[VMIN]  = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIFLUSH);
+    }
+
+    start = _nowUs();
+    now   = start;
+    while ((n = (int)read(fd, buf, sizeof(buf))) > 0) {
+        now = _nowUs();
+        for (i = 0; i < n; i++) {
+            _parse(buf[i], live ? now : -1.0);
+        }
+        if (live && now - start > seconds * 1e6) {
+            break;
+        }
+    }
+    close(fd);
+
+    _report(live ? (now - start) / 1e6 : 0.0);
+    return 0;
+}